@@ -62,6 +62,12 @@ const char* AgoraServer::getName(void) const
 	return protocolName;
 	}
 
+bool AgoraServer::canShareSpectatorUpdates(void) const
+	{
+	/* Server updates only depend on the source clients' locked audio and video packets: */
+	return true;
+	}
+
 ProtocolServer::ClientState* AgoraServer::receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe)
 	{
 	size_t readMessageLength=0;
@@ -120,125 +126,100 @@ ProtocolServer::ClientState* AgoraServer::receiveConnectRequest(unsigned int pro
 	return newClientState;
 	}
 
-void AgoraServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe)
+void AgoraServer::receiveClientUpdate(AgoraServer::ClientState* cs,Comm::NetPipe& pipe)
 	{
-	/* Get a handle on the Agora state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("AgoraServer::receiveClientUpdate: Client state object has mismatching type");
-	
-	if(myCs->speexFrameSize>0)
+	if(cs->speexFrameSize>0)
 		{
 		/* Read all SPEEX frames sent by the client: */
 		size_t numSpeexFrames=pipe.read<Misc::UInt16>();
 		for(size_t i=0;i<numSpeexFrames;++i)
 			{
-			Byte* speexPacket=myCs->speexPacketBuffer.getWriteSegment();
-			pipe.read(speexPacket,myCs->speexPacketSize);
-			myCs->speexPacketBuffer.pushSegment();
+			Byte* speexPacket=cs->speexPacketBuffer.getWriteSegment();
+			pipe.read(speexPacket,cs->speexPacketSize);
+			cs->speexPacketBuffer.pushSegment();
 			}
 		}
 	
-	if(myCs->hasTheora)
+	if(cs->hasTheora)
 		{
 		/* Check if the client sent a new video packet: */
 		if(pipe.read<Byte>()!=0)
 			{
 			/* Read a Theora packet from the client: */
-			VideoPacket& theoraPacket=myCs->theoraPacketBuffer.startNewValue();
+			VideoPacket& theoraPacket=cs->theoraPacketBuffer.startNewValue();
 			theoraPacket.read(pipe);
-			myCs->theoraPacketBuffer.postNewValue();
+			cs->theoraPacketBuffer.postNewValue();
 			}
 		}
 	}
 
-void AgoraServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+void AgoraServer::sendClientConnect(AgoraServer::ClientState* sourceCs,AgoraServer::ClientState* destCs,Comm::NetPipe& pipe)
 	{
-	/* Get a handle on the Agora state object: */
-	ClientState* mySourceCs=dynamic_cast<ClientState*>(sourceCs);
-	if(mySourceCs==0)
-		Misc::throwStdErr("AgoraServer::sendClientConnect: Client state object has mismatching type");
-	
 	/* Send the client's mouth position: */
-	write(mySourceCs->mouthPosition,pipe);
+	write(sourceCs->mouthPosition,pipe);
 	
 	/* Send the client's SPEEX frame size and packet size: */
-	pipe.write<Card>(mySourceCs->speexFrameSize);
-	pipe.write<Card>(mySourceCs->speexPacketSize);
+	pipe.write<Card>(sourceCs->speexFrameSize);
+	pipe.write<Card>(sourceCs->speexPacketSize);
 	
-	if(mySourceCs->hasTheora)
+	if(sourceCs->hasTheora)
 		{
 		pipe.write<Byte>(1);
 		
 		/* Write the client's virtual video transformation: */
-		write(mySourceCs->videoTransform,pipe);
-		pipe.write(mySourceCs->videoSize,2);
+		write(sourceCs->videoTransform,pipe);
+		pipe.write(sourceCs->videoSize,2);
 		
 		/* Write the source client's Theora stream headers: */
-		pipe.write<Card>(mySourceCs->theoraHeadersSize);
-		pipe.write(mySourceCs->theoraHeaders,mySourceCs->theoraHeadersSize);
+		pipe.write<Card>(sourceCs->theoraHeadersSize);
+		pipe.write(sourceCs->theoraHeaders,sourceCs->theoraHeadersSize);
 		}
 	else
 		pipe.write<Byte>(0);
 	}
 
-void AgoraServer::sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+void AgoraServer::sendServerUpdate(AgoraServer::ClientState* sourceCs,AgoraServer::ClientState* destCs,Comm::NetPipe& pipe)
 	{
-	/* Get a handle on the Agora state object: */
-	ClientState* mySourceCs=dynamic_cast<ClientState*>(sourceCs);
-	if(mySourceCs==0)
-		Misc::throwStdErr("AgoraServer::sendServerUpdate: Client state object has mismatching type");
-	
-	if(mySourceCs->speexFrameSize>0)
+	if(sourceCs->speexFrameSize>0)
 		{
 		/* Send all SPEEX packets from the source client's packet buffer to the destination client: */
-		pipe.write<Misc::UInt16>(mySourceCs->numSpeexPackets);
-		for(size_t i=0;i<mySourceCs->numSpeexPackets;++i)
+		pipe.write<Misc::UInt16>(sourceCs->numSpeexPackets);
+		for(size_t i=0;i<sourceCs->numSpeexPackets;++i)
 			{
-			const Byte* speexPacket=mySourceCs->speexPacketBuffer.getLockedSegment(i);
-			pipe.write(speexPacket,mySourceCs->speexPacketSize);
+			const Byte* speexPacket=sourceCs->speexPacketBuffer.getLockedSegment(i);
+			pipe.write(speexPacket,sourceCs->speexPacketSize);
 			}
 		}
 	
 	/* Check if the destination client expects streaming video from the source client: */
-	if(mySourceCs->hasTheora)
+	if(sourceCs->hasTheora)
 		{
 		/* Check if there is a new video packet for the client: */
-		if(mySourceCs->hasTheoraPacket)
+		if(sourceCs->hasTheoraPacket)
 			{
 			/* Write the Theora packet to the client: */
 			pipe.write<Byte>(1);
-			mySourceCs->theoraPacketBuffer.getLockedValue().write(pipe);
+			sourceCs->theoraPacketBuffer.getLockedValue().write(pipe);
 			}
 		else
 			pipe.write<Byte>(0);
 		}
 	}
 
-void AgoraServer::beforeServerUpdate(ProtocolServer::ClientState* cs)
+void AgoraServer::beforeServerUpdate(AgoraServer::ClientState* cs)
 	{
-	/* Get a handle on the Agora state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("AgoraServer::beforeServerUpdate: Client state object has mismatching type");
-	
 	/* Lock the available SPEEX packets: */
-	myCs->numSpeexPackets=myCs->speexFrameSize>0?myCs->speexPacketBuffer.lockQueue():0;
+	cs->numSpeexPackets=cs->speexFrameSize>0?cs->speexPacketBuffer.lockQueue():0;
 	
 	/* Check if there is a new Theora packet in the receiving buffer: */
-	myCs->hasTheoraPacket=myCs->hasTheora&&myCs->theoraPacketBuffer.lockNewValue();
+	cs->hasTheoraPacket=cs->hasTheora&&cs->theoraPacketBuffer.lockNewValue();
 	}
 
-void AgoraServer::afterServerUpdate(ProtocolServer::ClientState* cs)
+void AgoraServer::afterServerUpdate(AgoraServer::ClientState* cs)
 	{
-	/* Get a handle on the Agora state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("AgoraServer::afterServerUpdate: Client state object has mismatching type");
-	
 	/* Unlock the SPEEX packet buffer: */
-	if(myCs->speexFrameSize>0)
-		myCs->speexPacketBuffer.unlockQueue();
+	if(cs->speexFrameSize>0)
+		cs->speexPacketBuffer.unlockQueue();
 	}
 
 }
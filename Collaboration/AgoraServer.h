@@ -25,13 +25,15 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <Threads/TripleBuffer.h>
 #include <Threads/DropoutBuffer.h>
-#include <Collaboration/ProtocolServer.h>
+#include <Collaboration/ProtocolServerT.h>
 #include <Collaboration/AgoraProtocol.h>
 
 namespace Collaboration {
 
-class AgoraServer:public ProtocolServer,private AgoraProtocol
+class AgoraServer:public ProtocolServerT<AgoraServer>,private AgoraProtocol
 	{
+	friend class ProtocolServerT<AgoraServer>;
+	
 	/* Embedded classes: */
 	protected:
 	class ClientState:public ProtocolServer::ClientState
@@ -68,12 +70,15 @@ class AgoraServer:public ProtocolServer,private AgoraProtocol
 	
 	/* Methods from ProtocolServer: */
 	virtual const char* getName(void) const;
+	virtual bool canShareSpectatorUpdates(void) const;
 	virtual ProtocolServer::ClientState* receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe);
-	virtual void receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe);
-	virtual void sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
-	virtual void sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
-	virtual void beforeServerUpdate(ProtocolServer::ClientState* cs);
-	virtual void afterServerUpdate(ProtocolServer::ClientState* cs);
+	
+	/* Statically dispatched hooks from ProtocolServerT: */
+	void receiveClientUpdate(ClientState* cs,Comm::NetPipe& pipe);
+	void sendClientConnect(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe);
+	void sendServerUpdate(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe);
+	void beforeServerUpdate(ClientState* cs);
+	void afterServerUpdate(ClientState* cs);
 	};
 
 }
@@ -0,0 +1,117 @@
+/***********************************************************************
+Arena - Class for memory arenas allocating small blocks from large
+chunks, recycling freed blocks in per-size free lists, and releasing all
+chunks at once when the arena is destroyed.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/Arena.h>
+
+namespace Collaboration {
+
+/**********************
+Methods of class Arena:
+**********************/
+
+void* Arena::allocateFromChunk(size_t blockSize)
+	{
+	if(size_t(chunkEnd-chunkPtr)<blockSize)
+		{
+		/* Allocate a new chunk, reserving one granule for the chunk header to keep blocks aligned: */
+		size_t newChunkSize=granularity+(blockSize>chunkSize?blockSize:chunkSize);
+		char* newChunk=static_cast<char*>(::operator new(newChunkSize));
+		Chunk* header=reinterpret_cast<Chunk*>(newChunk);
+		header->succ=chunks;
+		chunks=header;
+		chunkPtr=newChunk+granularity;
+		chunkEnd=newChunk+newChunkSize;
+		numChunkBytes+=newChunkSize;
+		}
+	
+	/* Carve the block off the front of the current chunk: */
+	void* result=chunkPtr;
+	chunkPtr+=blockSize;
+	return result;
+	}
+
+Arena::Arena(size_t sChunkSize)
+	:chunkSize(roundSize(sChunkSize)),
+	 chunks(0),chunkPtr(0),chunkEnd(0),
+	 numChunkBytes(0),numLiveBytes(0)
+	{
+	for(unsigned int i=0;i<numSizeClasses;++i)
+		freeLists[i]=0;
+	}
+
+Arena::~Arena(void)
+	{
+	/* Release all chunks: */
+	while(chunks!=0)
+		{
+		Chunk* succ=chunks->succ;
+		::operator delete(chunks);
+		chunks=succ;
+		}
+	}
+
+void* Arena::allocate(size_t size)
+	{
+	size_t blockSize=roundSize(size);
+	numLiveBytes+=blockSize;
+	
+	/* Pass large blocks through to the heap: */
+	if(blockSize>maxBlockSize)
+		return ::operator new(blockSize);
+	
+	/* Recycle a free block of the same size class if there is one: */
+	FreeBlock*& freeList=freeLists[blockSize/granularity-1];
+	if(freeList!=0)
+		{
+		FreeBlock* result=freeList;
+		freeList=result->succ;
+		return result;
+		}
+	
+	return allocateFromChunk(blockSize);
+	}
+
+void Arena::deallocate(void* block,size_t size)
+	{
+	if(block==0)
+		return;
+	
+	size_t blockSize=roundSize(size);
+	numLiveBytes-=blockSize;
+	
+	/* Return large blocks to the heap: */
+	if(blockSize>maxBlockSize)
+		{
+		::operator delete(block);
+		return;
+		}
+	
+	/* Put the block into its size class's free list: */
+	FreeBlock* freeBlock=static_cast<FreeBlock*>(block);
+	FreeBlock*& freeList=freeLists[blockSize/granularity-1];
+	freeBlock->succ=freeList;
+	freeList=freeBlock;
+	}
+
+}
@@ -0,0 +1,155 @@
+/***********************************************************************
+Arena - Class for memory arenas allocating small blocks from large
+chunks, recycling freed blocks in per-size free lists, and releasing all
+chunks at once when the arena is destroyed.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Usage: Objects are created inside an arena using placement new, as in
+new(arena) Type(args), and must be destroyed via arena.destroy(object),
+which runs the object's destructor and recycles its memory block. The
+object's static type must be its dynamic type. Arrays are created and
+destroyed via the static newArray and deleteArray methods, which fall
+back to the heap if no arena is given. Blocks larger than maxBlockSize
+are passed through to the heap. An arena is not thread-safe.
+***********************************************************************/
+
+#ifndef COLLABORATION_ARENA_INCLUDED
+#define COLLABORATION_ARENA_INCLUDED
+
+#include <stddef.h>
+#include <new>
+
+namespace Collaboration {
+
+class Arena
+	{
+	/* Embedded classes: */
+	private:
+	struct Chunk // Header of a memory chunk
+		{
+		/* Elements: */
+		public:
+		Chunk* succ; // Pointer to the next chunk in the arena's chunk list
+		};
+	
+	struct FreeBlock // Header of a recycled memory block
+		{
+		/* Elements: */
+		public:
+		FreeBlock* succ; // Pointer to the next free block of the same size class
+		};
+	
+	/* Elements: */
+	public:
+	static const size_t granularity=16; // Alignment and size granularity of allocated blocks
+	static const size_t maxBlockSize=1024; // Size of the largest block allocated from the arena's chunks
+	private:
+	static const unsigned int numSizeClasses=maxBlockSize/granularity; // Number of block size classes
+	size_t chunkSize; // Default size of newly allocated chunks
+	Chunk* chunks; // List of all chunks allocated by the arena
+	char* chunkPtr; // Pointer to the unused part of the most recently allocated chunk
+	char* chunkEnd; // Pointer to the end of the most recently allocated chunk
+	FreeBlock* freeLists[numSizeClasses]; // Lists of recycled blocks for each size class
+	size_t numChunkBytes; // Total size of all chunks allocated by the arena
+	size_t numLiveBytes; // Total size of all blocks currently handed out by the arena, including heap pass-through blocks
+	
+	/* Private methods: */
+	static size_t roundSize(size_t size) // Rounds a block size up to the arena's granularity
+		{
+		return size>granularity?(size+granularity-1)&~(granularity-1):granularity;
+		}
+	void* allocateFromChunk(size_t blockSize); // Allocates a block of the given rounded size from the current chunk, allocating a new chunk if necessary
+	
+	/* Constructors and destructors: */
+	public:
+	Arena(size_t sChunkSize =16384); // Creates an empty arena allocating chunks of the given size
+	private:
+	Arena(const Arena& source); // Prohibit copy constructor
+	Arena& operator=(const Arena& source); // Prohibit assignment operator
+	public:
+	~Arena(void); // Releases all chunks; objects still living in the arena are not destroyed
+	
+	/* Methods: */
+	size_t getNumChunkBytes(void) const // Returns the total size of all chunks allocated by the arena
+		{
+		return numChunkBytes;
+		}
+	size_t getNumLiveBytes(void) const // Returns the total size of all blocks currently handed out by the arena
+		{
+		return numLiveBytes;
+		}
+	void* allocate(size_t size); // Allocates a block of the given size
+	void deallocate(void* block,size_t size); // Returns a block of the given size to the arena
+	template <class ObjectParam>
+	void destroy(ObjectParam* object) // Destroys an object created inside the arena via placement new
+		{
+		if(object!=0)
+			{
+			object->~ObjectParam();
+			deallocate(object,sizeof(ObjectParam));
+			}
+		}
+	template <class ValueParam>
+	static ValueParam* newArray(Arena* arena,size_t numElements) // Creates a default-constructed array inside the given arena, or on the heap if the arena is null; returns null for empty arrays
+		{
+		if(numElements==0)
+			return 0;
+		if(arena==0)
+			return new ValueParam[numElements];
+		ValueParam* result=static_cast<ValueParam*>(arena->allocate(numElements*sizeof(ValueParam)));
+		for(size_t i=0;i<numElements;++i)
+			new(result+i) ValueParam;
+		return result;
+		}
+	template <class ValueParam>
+	static void deleteArray(Arena* arena,ValueParam* array,size_t numElements) // Destroys an array created by newArray with the same arena and size
+		{
+		if(array==0)
+			return;
+		if(arena==0)
+			{
+			delete[] array;
+			return;
+			}
+		for(size_t i=0;i<numElements;++i)
+			array[i].~ValueParam();
+		arena->deallocate(array,numElements*sizeof(ValueParam));
+		}
+	};
+
+}
+
+/****************************************
+Placement allocation of objects in arenas:
+****************************************/
+
+inline void* operator new(size_t size,Collaboration::Arena& arena)
+	{
+	return arena.allocate(size);
+	}
+
+inline void operator delete(void* block,Collaboration::Arena& arena)
+	{
+	/* Only called if a constructor throws; the object's size is unknown, so the block is reclaimed when the arena is destroyed: */
+	}
+
+#endif
@@ -0,0 +1,182 @@
+/***********************************************************************
+BufferedPipe - Class for network pipes that collect all data written to
+them in memory, to be sent through an underlying network pipe later.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/BufferedPipe.h>
+
+#include <string.h>
+#include <algorithm>
+#include <Misc/ThrowStdErr.h>
+
+namespace Collaboration {
+
+/*****************************
+Methods of class BufferedPipe:
+*****************************/
+
+size_t BufferedPipe::readData(IO::File::Byte* buffer,size_t bufferSize)
+	{
+	Misc::throwStdErr("BufferedPipe::readData: Buffered pipes are write-only");
+	
+	/* Never reached; just to make compiler happy: */
+	return 0;
+	}
+
+void BufferedPipe::writeData(const IO::File::Byte* buffer,size_t bufferSize)
+	{
+	dataSize+=bufferSize;
+	while(bufferSize>0)
+		{
+		/* Start a new chunk if the last one is full: */
+		if(lastChunkSize==chunkSize)
+			{
+			chunks.push_back(new Byte[chunkSize]);
+			lastChunkSize=0;
+			}
+		
+		/* Copy as much data as fits into the last chunk: */
+		size_t copySize=chunkSize-lastChunkSize;
+		if(copySize>bufferSize)
+			copySize=bufferSize;
+		memcpy(chunks.back()+lastChunkSize,buffer,copySize);
+		lastChunkSize+=copySize;
+		buffer+=copySize;
+		bufferSize-=copySize;
+		}
+	}
+
+BufferedPipe::BufferedPipe(Comm::NetPipePtr sPipe)
+	:Comm::NetPipe(WriteOnly),
+	 pipe(sPipe),
+	 lastChunkSize(chunkSize),dataSize(0)
+	{
+	/* Inherit the underlying pipe's endianness setting; the underlying pipe only sees raw data: */
+	setSwapOnWrite(pipe->mustSwapOnWrite());
+	}
+
+BufferedPipe::~BufferedPipe(void)
+	{
+	discardData();
+	}
+
+int BufferedPipe::getFd(void) const
+	{
+	return pipe->getFd();
+	}
+
+bool BufferedPipe::waitForData(void) const
+	{
+	return false;
+	}
+
+bool BufferedPipe::waitForData(const Misc::Time& timeout) const
+	{
+	return false;
+	}
+
+void BufferedPipe::shutdown(bool read,bool write)
+	{
+	/* Collected data is sent explicitly; leave the underlying pipe alone */
+	}
+
+int BufferedPipe::getPortId(void) const
+	{
+	return pipe->getPortId();
+	}
+
+std::string BufferedPipe::getAddress(void) const
+	{
+	return pipe->getAddress();
+	}
+
+std::string BufferedPipe::getHostName(void) const
+	{
+	return pipe->getHostName();
+	}
+
+int BufferedPipe::getPeerPortId(void) const
+	{
+	return pipe->getPeerPortId();
+	}
+
+std::string BufferedPipe::getPeerAddress(void) const
+	{
+	return pipe->getPeerAddress();
+	}
+
+std::string BufferedPipe::getPeerHostName(void) const
+	{
+	return pipe->getPeerHostName();
+	}
+
+void BufferedPipe::swapData(BufferedPipe& other)
+	{
+	/* Move pending data from both pipes' write buffers into their chunk lists: */
+	flush();
+	other.flush();
+	
+	std::swap(chunks,other.chunks);
+	std::swap(lastChunkSize,other.lastChunkSize);
+	std::swap(dataSize,other.dataSize);
+	}
+
+void BufferedPipe::writeToSink(IO::File& sink)
+	{
+	/* Move pending data from the write buffer into the chunk list: */
+	flush();
+	
+	/* Write all chunks to the sink: */
+	size_t numChunks=chunks.size();
+	for(size_t i=0;i<numChunks;++i)
+		sink.writeRaw(chunks[i],i+1<numChunks?chunkSize:lastChunkSize);
+	}
+
+void BufferedPipe::sendData(void)
+	{
+	/* Move pending data from the write buffer into the chunk list: */
+	flush();
+	
+	/* Send all chunks to the underlying pipe, releasing each chunk as soon as it was sent: */
+	size_t numChunks=chunks.size();
+	for(size_t i=0;i<numChunks;++i)
+		{
+		pipe->writeRaw(chunks[i],i+1<numChunks?chunkSize:lastChunkSize);
+		delete[] chunks[i];
+		chunks[i]=0;
+		}
+	chunks.clear();
+	lastChunkSize=chunkSize;
+	dataSize=0;
+	
+	pipe->flush();
+	}
+
+void BufferedPipe::discardData(void)
+	{
+	for(std::vector<Byte*>::iterator cIt=chunks.begin();cIt!=chunks.end();++cIt)
+		delete[] *cIt;
+	chunks.clear();
+	lastChunkSize=chunkSize;
+	dataSize=0;
+	}
+
+}
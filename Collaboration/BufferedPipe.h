@@ -0,0 +1,95 @@
+/***********************************************************************
+BufferedPipe - Class for network pipes that collect all data written to
+them in memory, to be sent through an underlying network pipe later.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+A buffered pipe is write-only; it takes on the underlying pipe's
+endianness settings, so that its collected data can be sent verbatim.
+Data is collected in fixed-size chunks, and sent to the underlying pipe
+chunk by chunk. A buffered pipe is not thread-safe; it has to be
+protected by the same mutex as the underlying pipe.
+***********************************************************************/
+
+#ifndef COLLABORATION_BUFFEREDPIPE_INCLUDED
+#define COLLABORATION_BUFFEREDPIPE_INCLUDED
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <Comm/NetPipe.h>
+
+namespace Collaboration {
+
+class BufferedPipe:public Comm::NetPipe
+	{
+	/* Elements: */
+	private:
+	static const size_t chunkSize=65536; // Size of the chunks in which collected data is stored
+	Comm::NetPipePtr pipe; // The underlying network pipe
+	std::vector<Byte*> chunks; // List of chunks holding collected data
+	size_t lastChunkSize; // Amount of data in the last chunk
+	size_t dataSize; // Total amount of collected data
+	
+	/* Protected methods from IO::File: */
+	protected:
+	virtual size_t readData(Byte* buffer,size_t bufferSize);
+	virtual void writeData(const Byte* buffer,size_t bufferSize);
+	
+	/* Constructors and destructors: */
+	public:
+	BufferedPipe(Comm::NetPipePtr sPipe); // Creates a buffered pipe for the given network pipe, which must have negotiated endianness already
+	private:
+	BufferedPipe(const BufferedPipe& source); // Prohibit copy constructor
+	BufferedPipe& operator=(const BufferedPipe& source); // Prohibit assignment operator
+	public:
+	virtual ~BufferedPipe(void); // Discards all collected data that has not been sent
+	
+	/* Methods from IO::File: */
+	virtual int getFd(void) const;
+	
+	/* Methods from Comm::Pipe: */
+	virtual bool waitForData(void) const;
+	virtual bool waitForData(const Misc::Time& timeout) const;
+	virtual void shutdown(bool read,bool write);
+	
+	/* Methods from Comm::NetPipe: */
+	virtual int getPortId(void) const;
+	virtual std::string getAddress(void) const;
+	virtual std::string getHostName(void) const;
+	virtual int getPeerPortId(void) const;
+	virtual std::string getPeerAddress(void) const;
+	virtual std::string getPeerHostName(void) const;
+	
+	/* New methods: */
+	size_t getDataSize(void) const // Returns the amount of collected data, not counting data still in the pipe's write buffer
+		{
+		return dataSize;
+		}
+	void swapData(BufferedPipe& other); // Exchanges the collected data of this pipe and the given pipe
+	void writeToSink(IO::File& sink); // Writes a copy of all collected data to the given sink, which must have the same endianness as the underlying pipe
+	void sendData(void); // Sends all collected data to the underlying pipe and flushes it
+	void discardData(void); // Discards all collected data
+	};
+
+}
+
+#endif
@@ -30,8 +30,12 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <iostream>
 #endif
 #include <Misc/ThrowStdErr.h>
-#include <IO/FixedMemoryFile.h>
+#include <Misc/StandardValueCoders.h>
+#include <Math/Math.h>
 #include <Comm/NetPipe.h>
+#include <Cluster/MulticastPipe.h>
+#include <GL/gl.h>
+#include <GL/GLTransformationWrappers.h>
 #include <Vrui/Vrui.h>
 #include <Vrui/InputDevice.h>
 #include <Vrui/InputGraphManager.h>
@@ -40,22 +44,162 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 namespace Collaboration {
 
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+CheriaProtocol::ONTransform interpolate(const CheriaProtocol::ONTransform& t0,const CheriaProtocol::ONTransform& t1,CheriaProtocol::Scalar w) // Interpolates between two device transformations
+	{
+	typedef CheriaProtocol::Scalar Scalar;
+	
+	/* Linearly interpolate the translations: */
+	CheriaProtocol::Vector translation=t0.getTranslation()*(Scalar(1)-w)+t1.getTranslation()*w;
+	
+	/* Linearly interpolate the rotation quaternions along the shorter arc and renormalize the result: */
+	const Scalar* q0=t0.getRotation().getQuaternion();
+	const Scalar* q1=t1.getRotation().getQuaternion();
+	Scalar dot=q0[0]*q1[0]+q0[1]*q1[1]+q0[2]*q1[2]+q0[3]*q1[3];
+	Scalar w1=dot>=Scalar(0)?w:-w;
+	Scalar q[4];
+	Scalar sqrLen(0);
+	for(int i=0;i<4;++i)
+		{
+		q[i]=q0[i]*(Scalar(1)-w)+q1[i]*w1;
+		sqrLen+=q[i]*q[i];
+		}
+	Scalar invLen=Scalar(1)/Math::sqrt(sqrLen);
+	for(int i=0;i<4;++i)
+		q[i]*=invLen;
+	
+	return CheriaProtocol::ONTransform(translation,CheriaProtocol::Rotation(q));
+	}
+
+}
+
 /*******************************************************************
 Methods of class CheriaClient::RemoteClientState::RemoteDeviceState:
 *******************************************************************/
 
 CheriaClient::RemoteClientState::RemoteDeviceState::RemoteDeviceState(IO::File& source)
 	:DeviceState(source),
-	 device(Vrui::getInputDeviceManager()->createInputDevice("CheriaRemoteDevice",trackType,numButtons,numValuators))
+	 device(0),proxyTransform(Vrui::TrackerState::identity),
+	 previousTransform(ONTransform::identity),previousTime(-1.0)
 	{
-	/* Permanently grab the device: */
-	Vrui::getInputGraphManager()->grabInputDevice(device,0);
 	}
 
 CheriaClient::RemoteClientState::RemoteDeviceState::~RemoteDeviceState(void)
 	{
-	Vrui::getInputGraphManager()->releaseInputDevice(device,0);
-	Vrui::getInputDeviceManager()->destroyInputDevice(device);
+	if(device!=0)
+		{
+		Vrui::getInputGraphManager()->releaseInputDevice(device,0);
+		Vrui::getInputDeviceManager()->destroyInputDevice(device);
+		}
+	}
+
+Vrui::InputDevice* CheriaClient::RemoteClientState::RemoteDeviceState::getDevice(CheriaClient& client)
+	{
+	if(device==0)
+		{
+		/* Create the local proxy device and permanently grab it: */
+		client.remoteClientCreatingDevice=true;
+		device=Vrui::getInputDeviceManager()->createInputDevice("CheriaRemoteDevice",trackType,numButtons,numValuators);
+		client.remoteClientCreatingDevice=false;
+		Vrui::getInputGraphManager()->grabInputDevice(device,0);
+		
+		/* Set the new device's glyph: */
+		Vrui::Glyph& deviceGlyph=Vrui::getInputGraphManager()->getInputDeviceGlyph(device);
+		deviceGlyph=client.inputDeviceGlyph;
+		
+		/* Initialize the new device's state: */
+		device->setTransformation(proxyTransform);
+		updateDevice(FULL_UPDATE);
+		}
+	
+	return device;
+	}
+
+void CheriaClient::RemoteClientState::RemoteDeviceState::updateDevice(unsigned int deviceUpdateMask)
+	{
+	/* Update the device ray direction: */
+	if(deviceUpdateMask&RAYDIRECTION)
+		device->setDeviceRay(rayDirection,rayStart);
+	
+	/* Update all button states: */
+	if(deviceUpdateMask&BUTTON)
+		{
+		unsigned int index=0;
+		unsigned int mask=0x1U;
+		for(unsigned int buttonIndex=0;buttonIndex<numButtons;++buttonIndex)
+			{
+			device->setButtonState(buttonIndex,(buttonStates[index]&mask)!=0x0U);
+			mask<<=1;
+			if(mask==0x100U)
+				{
+				++index;
+				mask=0x1U;
+				}
+			}
+		}
+	
+	/* Update all valuator states: */
+	if(deviceUpdateMask&VALUATOR)
+		{
+		for(unsigned int valuatorIndex=0;valuatorIndex<numValuators;++valuatorIndex)
+			device->setValuator(valuatorIndex,valuatorStates[valuatorIndex]);
+		}
+	}
+
+void CheriaClient::RemoteClientState::RemoteDeviceState::deriveVelocities(double time)
+	{
+	if(previousTime>=0.0&&time>previousTime)
+		{
+		/* Divide the changes in position and orientation since the previous time by the elapsed time: */
+		Scalar invDt=Scalar(1.0/(time-previousTime));
+		linearVelocity=(transform.getTranslation()-previousTransform.getTranslation())*invDt;
+		angularVelocity=(transform.getRotation()*Geometry::invert(previousTransform.getRotation())).getScaledAxis()*invDt;
+		}
+	
+	/* Remember the current transformation: */
+	previousTransform=transform;
+	previousTime=time;
+	}
+
+void CheriaClient::RemoteClientState::RemoteDeviceState::scheduleSamples(double time)
+	{
+	/* Convert the received samples' ages to application times, keeping the replay in order: */
+	for(TransformSampleList::iterator sIt=receivedSamples.begin();sIt!=receivedSamples.end();++sIt)
+		{
+		double sampleTime=time-sIt->time;
+		if(!replaySamples.empty()&&sampleTime<replaySamples.back().time)
+			sampleTime=replaySamples.back().time;
+		replaySamples.push_back(TransformSample(sampleTime,sIt->transform));
+		}
+	receivedSamples.clear();
+	}
+
+CheriaClient::ONTransform CheriaClient::RemoteClientState::RemoteDeviceState::getReplayTransform(double time)
+	{
+	/* Drop all samples that were passed by the replay: */
+	while(replaySamples.size()>=2&&replaySamples[1].time<=time)
+		replaySamples.pop_front();
+	
+	/* Interpolate between the two samples bracketing the given time: */
+	if(replaySamples.size()>=2)
+		{
+		const TransformSample& s0=replaySamples[0];
+		const TransformSample& s1=replaySamples[1];
+		if(time<=s0.time)
+			return s0.transform;
+		return interpolate(s0.transform,s1.transform,Scalar((time-s0.time)/(s1.time-s0.time)));
+		}
+	
+	/* Stop replaying once the last sample has been reached: */
+	ONTransform result=replaySamples.empty()?transform:replaySamples.front().transform;
+	if(!replaySamples.empty()&&replaySamples.front().time<=time)
+		replaySamples.clear();
+	return result;
 	}
 
 /************************************************
@@ -64,7 +208,10 @@ Methods of class CheriaClient::RemoteClientState:
 
 CheriaClient::RemoteClientState::RemoteClientState(CheriaClient& sClient)
 	:client(sClient),
-	 remoteDevices(17),remoteTools(17)
+	 remoteDevices(17),remoteTools(17),
+	 messageBufferPool(sClient.client->getMessageBufferPool()),
+	 pendingDevices(17),haveUpdates(false),
+	 lastUpdateTime(-1.0),updateInterval(0.0)
 	{
 	}
 
@@ -76,26 +223,175 @@ CheriaClient::RemoteClientState::~RemoteClientState(void)
 		delete rdIt->getDest();
 	client.remoteClientDestroyingDevice=false;
 	
-	/* Delete any leftover message buffers: */
+	/* Delete any leftover message buffers and pending device states: */
 	{
 	Threads::Mutex::Lock messageBufferLock(messageBufferMutex);
 	for(std::vector<IncomingMessage*>::iterator mIt=messages.begin();mIt!=messages.end();++mIt)
-		delete *mIt;
+		messageBufferPool.release(*mIt);
+	for(PendingDeviceMap::Iterator pdIt=pendingDevices.begin();!pdIt.isFinished();++pdIt)
+		delete pdIt->getDest();
 	}
 	}
 
-void CheriaClient::RemoteClientState::processMessages(void)
+void CheriaClient::RemoteClientState::queueMessage(CheriaClient::IncomingMessage* msg)
 	{
 	Threads::Mutex::Lock messageBufferLock(messageBufferMutex);
 	
-	/* Handle all state tracking and device state update messages: */
-	for(std::vector<IncomingMessage*>::iterator mIt=messages.begin();mIt!=messages.end();++mIt)
+	try
 		{
-		/* Process all messages in this buffer: */
-		IO::File& msg=**mIt;
-		while(!msg.eof())
+		/* Scan all messages in the buffer: */
+		bool haveTrackingMessages=false;
+		while(!msg->eom())
 			{
 			/* Read the next message: */
+			switch(CheriaProtocol::readMessage(*msg))
+				{
+				case CREATE_DEVICE:
+					{
+					/* Read the new device's ID: */
+					unsigned int newDeviceId=msg->read<Card>();
+					
+					/* Create a pending state for the new device unless the device already exists: */
+					if(pendingDevices.isEntry(newDeviceId))
+						DeviceState::skipLayout(*msg);
+					else
+						pendingDevices[newDeviceId]=new PendingDeviceState(*msg);
+					
+					haveTrackingMessages=true;
+					break;
+					}
+				
+				case DESTROY_DEVICE:
+					{
+					/* Discard the device's pending state: */
+					PendingDeviceMap::Iterator pdIt=pendingDevices.findEntry(msg->read<Card>());
+					if(!pdIt.isFinished())
+						{
+						delete pdIt->getDest();
+						pendingDevices.removeEntry(pdIt);
+						}
+					
+					haveTrackingMessages=true;
+					break;
+					}
+				
+				case CREATE_TOOL:
+					{
+					/* Skip the new tool's ID, class name, and input assignment: */
+					msg->skip<Card>(1);
+					ToolState::skip(*msg);
+					
+					haveTrackingMessages=true;
+					break;
+					}
+				
+				case DESTROY_TOOL:
+					{
+					/* Skip the tool's ID: */
+					msg->skip<Card>(1);
+					
+					haveTrackingMessages=true;
+					break;
+					}
+				
+				case DEVICE_SAMPLES:
+					{
+					/* Skip the size of the sample batch: */
+					msg->skip<Card>(1);
+					
+					/* Read all contained sample lists: */
+					unsigned int deviceId;
+					while((deviceId=readVarCard(*msg))!=0)
+						{
+						TransformSampleList& samples=pendingDevices.getEntry(deviceId).getDest()->samples;
+						size_t firstNew=samples.size();
+						
+						/* Read the device's samples, timestamped by their age in microseconds relative to the device's next transformation: */
+						unsigned int numSamples=readVarCard(*msg);
+						for(unsigned int i=0;i<numSamples;++i)
+							{
+							double age=double(readVarCard(*msg))*1.0e-6;
+							ONTransform sampleTransform=encoding.readTransform(*msg);
+							if(client.replayDeviceSamples)
+								samples.push_back(TransformSample(age,sampleTransform));
+							}
+						
+						/* Age samples received earlier since the last frame by the age of the oldest new sample: */
+						if(firstNew>0&&samples.size()>firstNew)
+							{
+							double shift=samples[firstNew].time;
+							for(size_t i=0;i<firstNew;++i)
+								samples[i].time+=shift;
+							}
+						}
+					
+					break;
+					}
+				
+				case DEVICE_STATES:
+					{
+					/* Fold all contained status messages into the pending device states: */
+					unsigned int deviceId;
+					while((deviceId=readVarCard(*msg))!=0)
+						{
+						/* Update the device's pending state, which accumulates the update masks of all updates since the last frame: */
+						PendingDeviceState* pds=pendingDevices.getEntry(deviceId).getDest();
+						unsigned int readMask=pds->read(*msg,encoding);
+						
+						/* Append the new transformation to the received samples if the device is being replayed: */
+						if((readMask&DeviceState::TRANSFORM)&&(!pds->samples.empty()||pds->replaying))
+							pds->samples.push_back(TransformSample(0.0,pds->transform));
+						}
+					
+					break;
+					}
+				}
+			}
+		
+		/* Queue the buffer for the next frame if it contains state tracking messages, or return it to the pool: */
+		if(haveTrackingMessages)
+			{
+			msg->setReadPosAbs(0);
+			messages.push_back(msg);
+			}
+		else
+			messageBufferPool.release(msg);
+		}
+	catch(...)
+		{
+		/* Return the buffer to the pool and re-throw the exception: */
+		messageBufferPool.release(msg);
+		throw;
+		}
+	
+	haveUpdates=true;
+	}
+
+bool CheriaClient::RemoteClientState::processMessages(void)
+	{
+	Threads::Mutex::Lock messageBufferLock(messageBufferMutex);
+	
+	/* Slave nodes handle as many state tracking messages as the master node, whose wall clock decides how much work is deferred: */
+	size_t maxNumMessages=~size_t(0);
+	if(!Vrui::isMaster())
+		maxNumMessages=Vrui::getMainPipe()->read<Card>();
+	
+	/* Handle queued state tracking messages until the frame's work budget runs out, but handle at least one message per frame: */
+	size_t numMessages=0;
+	std::vector<IncomingMessage*>::iterator mIt;
+	for(mIt=messages.begin();mIt!=messages.end();++mIt)
+		{
+		/* Process all state tracking messages in this buffer: */
+		IncomingMessage& msg=**mIt;
+		bool goOn=true;
+		while(goOn&&!msg.eom())
+			{
+			/* Defer the rest of the buffer to the next frame if the work budget ran out: */
+			if(Vrui::isMaster()?numMessages>0&&!client.client->haveFrameWorkTime():numMessages>=maxNumMessages)
+				break;
+			
+			/* Read the next message: */
+			++numMessages;
 			switch(CheriaProtocol::readMessage(msg))
 				{
 				case CREATE_DEVICE:
@@ -111,17 +407,11 @@ void CheriaClient::RemoteClientState::processMessages(void)
 						}
 					else
 						{
-						/* Create a new remote device structure: */
-						client.remoteClientCreatingDevice=true;
+						/* Create a new remote device structure; its local proxy device is only created once a remote tool uses it: */
 						RemoteDeviceState* newRemoteDevice=new RemoteDeviceState(msg);
-						client.remoteClientCreatingDevice=false;
-						
-						/* Set the new device's glyph: */
-						Vrui::Glyph& deviceGlyph=Vrui::getInputGraphManager()->getInputDeviceGlyph(newRemoteDevice->device);
-						deviceGlyph=client.inputDeviceGlyph;
 						
 						#if DEBUGGING
-						std::cout<<"Creating remote device "<<newRemoteDevice->device<<" with remote ID "<<newDeviceId<<std::endl;
+						std::cout<<"Creating remote device with remote ID "<<newDeviceId<<std::endl;
 						#endif
 						
 						/* Add the new device to the remote device map: */
@@ -189,7 +479,7 @@ void CheriaClient::RemoteClientState::processMessages(void)
 								for(unsigned int buttonSlotIndex=0;buttonSlotIndex<ts.numButtonSlots;++buttonSlotIndex)
 									{
 									/* Assign the slot: */
-									Vrui::InputDevice* slotDevice=remoteDevices.getEntry(ts.buttonSlots[buttonSlotIndex].deviceId).getDest()->device;
+									Vrui::InputDevice* slotDevice=remoteDevices.getEntry(ts.buttonSlots[buttonSlotIndex].deviceId).getDest()->getDevice(client);
 									if(int(buttonSlotIndex)<til.getNumButtons())
 										tia.setButtonSlot(buttonSlotIndex,slotDevice,ts.buttonSlots[buttonSlotIndex].index);
 									else
@@ -200,7 +490,7 @@ void CheriaClient::RemoteClientState::processMessages(void)
 								for(unsigned int valuatorSlotIndex=0;valuatorSlotIndex<ts.numValuatorSlots;++valuatorSlotIndex)
 									{
 									/* Assign the slot: */
-									Vrui::InputDevice* slotDevice=remoteDevices.getEntry(ts.valuatorSlots[valuatorSlotIndex].deviceId).getDest()->device;
+									Vrui::InputDevice* slotDevice=remoteDevices.getEntry(ts.valuatorSlots[valuatorSlotIndex].deviceId).getDest()->getDevice(client);
 									if(int(valuatorSlotIndex)<til.getNumValuators())
 										tia.setValuatorSlot(valuatorSlotIndex,slotDevice,ts.valuatorSlots[valuatorSlotIndex].index);
 									else
@@ -265,27 +555,71 @@ void CheriaClient::RemoteClientState::processMessages(void)
 					break;
 					}
 				
-				case DEVICE_STATES:
+				case DEVICE_SAMPLES:
 					{
-					/* Read all contained status messages: */
-					unsigned int deviceId;
-					while((deviceId=msg.read<Card>())!=0)
-						{
-						/* Update the device state: */
-						remoteDevices.getEntry(deviceId).getDest()->read(msg);
-						}
+					/* Skip the sample batch, which was already folded into the pending device states: */
+					size_t batchSize=msg.read<Card>();
+					msg.skip<Byte>(batchSize);
 					
 					break;
 					}
+				
+				case DEVICE_STATES:
+					/* Device states were already folded into the pending device states, and this is the last message: */
+					goOn=false;
+					break;
 				}
 			}
 		
-		/* Destroy the just-read message buffer: */
-		delete *mIt;
+		/* Stop if the buffer was not processed completely: */
+		if(goOn&&!msg.eom())
+			break;
+		
+		/* Return the just-read message buffer to the pool: */
+		messageBufferPool.release(*mIt);
+		}
+	
+	/* Send the number of handled messages to the slave nodes: */
+	if(Vrui::isMaster()&&Vrui::getMainPipe()!=0)
+		{
+		Vrui::getMainPipe()->write<Card>(numMessages);
+		Vrui::getMainPipe()->flush();
+		}
+	
+	/* Remove the completely processed buffers from the message buffer list, and come back for the deferred ones during the next frame: */
+	messages.erase(messages.begin(),mIt);
+	if(!messages.empty())
+		Vrui::requestUpdate();
+	
+	/* Apply the device state updates folded since the last frame: */
+	for(PendingDeviceMap::Iterator pdIt=pendingDevices.begin();!pdIt.isFinished();++pdIt)
+		{
+		PendingDeviceState* pds=pdIt->getDest();
+		RemoteDeviceMap::Iterator rdIt=remoteDevices.findEntry(pdIt->getSource());
+		if(!rdIt.isFinished())
+			{
+			RemoteDeviceState* rds=rdIt->getDest();
+			
+			/* Copy the updated components of the device's state: */
+			if(pds->updateMask!=DeviceState::NO_CHANGE)
+				{
+				rds->copy(pds->updateMask,*pds);
+				pds->updateMask=DeviceState::NO_CHANGE;
+				}
+			
+			/* Hand over the received transformation samples: */
+			if(!pds->samples.empty())
+				{
+				rds->receivedSamples.insert(rds->receivedSamples.end(),pds->samples.begin(),pds->samples.end());
+				pds->samples.clear();
+				}
+			pds->replaying=!rds->replaySamples.empty();
+			}
 		}
 	
-	/* Clear the message buffer list: */
-	messages.clear();
+	bool result=haveUpdates;
+	haveUpdates=false;
+	return result;
 	}
 
 /***********************************************
@@ -294,20 +628,21 @@ Methods of class CheriaClient::LocalDeviceState:
 
 CheriaClient::LocalDeviceState::LocalDeviceState(unsigned int sDeviceId,const Vrui::InputDevice* device)
 	:DeviceState(device->getTrackType(),device->getNumButtons(),device->getNumValuators()),
-	 deviceId(sDeviceId),
-	 buttonMasks(numButtons>0?new Byte[(numButtons+7)/8]:0),valuatorMasks(numValuators>0?new Byte[(numValuators+7)/8]:0)
+	 deviceId(sDeviceId),batchIndex(0),
+	 buttonMasks(numButtons>0?new Byte[(numButtons+7)/8]:0),valuatorGains(numValuators>0?new Scalar[numValuators]:0),
+	 updateTime(0.0)
 	{
-	/* Initialize the mask arrays to false: */
+	/* Initialize the mask and gain arrays to disabled: */
 	for(unsigned int i=0;i<(numButtons+7)/8;++i)
 		buttonMasks[i]=0x0U;
-	for(unsigned int i=0;i<(numValuators+7)/8;++i)
-		valuatorMasks[i]=0x0U;
+	for(unsigned int i=0;i<numValuators;++i)
+		valuatorGains[i]=Scalar(0);
 	}
 
 CheriaClient::LocalDeviceState::~LocalDeviceState(void)
 	{
 	delete[] buttonMasks;
-	delete[] valuatorMasks;
+	delete[] valuatorGains;
 	}
 
 /*****************************
@@ -322,9 +657,12 @@ void CheriaClient::createInputDevice(Vrui::InputDevice* device)
 	
 	/* Create a local device state structure for the new device: */
 	LocalDeviceState* lds=new LocalDeviceState(nextLocalDeviceId,device);
+	lds->samples.reserve(maxDeviceSamples);
 	
-	/* Add the new input device to the local device map: */
+	/* Add the new input device to the local device map and the local device batch: */
 	localDevices[device]=lds;
+	lds->batchIndex=localDeviceBatch.addDevice(lds->transform,lds->linearVelocity,lds->angularVelocity);
+	batchedLocalDevices.push_back(lds);
 	
 	/**************************************************************
 	Write an input device creation message into the message buffer:
@@ -389,7 +727,7 @@ void CheriaClient::createTool(Vrui::PointingTool* tool)
 		ts.valuatorSlots[valuatorSlotIndex].index=index;
 		
 		/* Enable the slot's valuator on the device for further updates: */
-		lds->valuatorMasks[index/8]|=0x1U<<(index%8);
+		lds->valuatorGains[index]=Scalar(1);
 		}
 	
 	/* Write the tool state structure into the message buffer: */
@@ -426,6 +764,13 @@ void CheriaClient::inputDeviceDestructionCallback(Vrui::InputDeviceManager::Inpu
 			writeMessage(DESTROY_DEVICE,message);
 			message.write<Card>(ldIt->getDest()->deviceId);
 			
+			/* Remove the device from the local device batch by moving the last batched device into its place: */
+			size_t batchIndex=ldIt->getDest()->batchIndex;
+			size_t movedIndex=localDeviceBatch.removeDevice(batchIndex);
+			batchedLocalDevices[batchIndex]=batchedLocalDevices[movedIndex];
+			batchedLocalDevices[batchIndex]->batchIndex=batchIndex;
+			batchedLocalDevices.pop_back();
+			
 			/* Destroy the device's local device state and remove the device: */
 			delete ldIt->getDest();
 			localDevices.removeEntry(ldIt);
@@ -488,8 +833,7 @@ void CheriaClient::toolDestructionCallback(Vrui::ToolManager::ToolDestructionCal
 					LocalDeviceState* lds=localDevices.getEntry(tia.getValuatorSlot(valuatorSlotIndex).device).getDest();
 					
 					/* Disable the slot's valuator on the device: */
-					unsigned int index=tia.getValuatorSlot(valuatorSlotIndex).index;
-					lds->valuatorMasks[index/8]&=~(0x1U<<(index%8));
+					lds->valuatorGains[tia.getValuatorSlot(valuatorSlotIndex).index]=Scalar(0);
 					}
 				
 				/* Send a tool destruction message: */
@@ -507,7 +851,8 @@ CheriaClient::CheriaClient(void)
 	:nextLocalDeviceId(1),localDevices(17),
 	 nextLocalToolId(1),localTools(17),
 	 remoteClientCreatingDevice(false),remoteClientDestroyingDevice(false),
-	 remoteClientCreatingTool(false),remoteClientDestroyingTool(false)
+	 remoteClientCreatingTool(false),remoteClientDestroyingTool(false),
+	 maxDeviceSamples(0),replayDeviceSamples(true),sampleReplayDelay(0.0)
 	{
 	}
 
@@ -542,21 +887,58 @@ void CheriaClient::initialize(CollaborationClient* sClient,Misc::ConfigurationFi
 	/* Initialize and configure the remote input device glyph: */
 	inputDeviceGlyph.enable(Vrui::Glyph::CONE,GLMaterial(GLMaterial::Color(0.5f,0.5f,0.5f),GLMaterial::Color(0.5f,0.5f,0.5f),25.0f));
 	inputDeviceGlyph.configure(configFileSection,"remoteInputDeviceGlyphType","remoteInputDeviceGlyphMaterial");
+	
+	/* Configure the encoding of local device states: */
+	if(configFileSection.retrieveValue<bool>("./quantizePositions",false))
+		{
+		/* Quantize positions inside a box around the display center that scales with the display size: */
+		encoding.flags|=DeviceEncoding::QUANTIZE_POSITIONS;
+		encoding.boxCenter=Point(Vrui::getDisplayCenter());
+		encoding.boxSize=Scalar(Vrui::getDisplaySize())*configFileSection.retrieveValue<Scalar>("./positionBoxScale",Scalar(4));
+		}
+	if(configFileSection.retrieveValue<bool>("./quantizeRotations",false))
+		encoding.flags|=DeviceEncoding::QUANTIZE_ROTATIONS;
+	if(!configFileSection.retrieveValue<bool>("./sendVelocities",true))
+		encoding.flags|=DeviceEncoding::DERIVE_VELOCITIES;
+	int valuatorBits=configFileSection.retrieveValue<int>("./valuatorBits",32);
+	if(valuatorBits==8)
+		encoding.flags|=DeviceEncoding::VALUATORS_8BIT;
+	else if(valuatorBits==16)
+		encoding.flags|=DeviceEncoding::VALUATORS_16BIT;
+	else if(valuatorBits!=32)
+		Misc::throwStdErr("CheriaClient::initialize: Invalid number of valuator bits %d",valuatorBits);
+	if(!encoding.isValid())
+		Misc::throwStdErr("CheriaClient::initialize: Invalid device state encoding");
+	
+	/* Configure recording and replay of device transformation samples between client updates: */
+	maxDeviceSamples=configFileSection.retrieveValue<unsigned int>("./maxDeviceSamples",(unsigned int)(maxDeviceSamples));
+	if(maxDeviceSamples<2)
+		maxDeviceSamples=0;
+	replayDeviceSamples=configFileSection.retrieveValue<bool>("./replayDeviceSamples",replayDeviceSamples);
+	sampleReplayDelay=configFileSection.retrieveValue<double>("./sampleReplayDelay",sampleReplayDelay);
+	
+	/* Start from the collaboration client's dead band and apply protocol-specific overrides: */
+	deadBand=sClient->getDeadBand();
+	deadBand.configure(configFileSection,Scalar(Vrui::getInchFactor()));
 	}
 
 void CheriaClient::sendConnectRequest(Comm::NetPipe& pipe)
 	{
 	/* Send the length of the following message: */
-	pipe.write<Card>(sizeof(Card));
+	pipe.write<Card>(sizeof(Card)+DeviceEncoding::getSize());
 	
 	/* Send the client's protocol version: */
 	pipe.write<Card>(protocolVersion);
+	
+	/* Send the encoding the client will use for its device states: */
+	encoding.write(pipe);
 	}
 
 void CheriaClient::receiveConnectReply(Comm::NetPipe& pipe)
 	{
-	/* Set the message buffer's endianness swapping behavior to that of the pipe: */
+	/* Set the message buffers' endianness swapping behavior to that of the pipe: */
 	message.setSwapOnWrite(pipe.mustSwapOnWrite());
+	sampleMessage.setSwapOnWrite(pipe.mustSwapOnWrite());
 	
 	Vrui::InputDeviceManager* idm=Vrui::getInputDeviceManager();
 	Vrui::ToolManager* tm=Vrui::getToolManager();
@@ -606,6 +988,9 @@ ProtocolClient::RemoteClientState* CheriaClient::receiveClientConnect(Comm::NetP
 	/* Create a new remote client state object: */
 	RemoteClientState* newClientState=new RemoteClientState(*this);
 	
+	/* Read the encoding the remote client uses for its device states: */
+	newClientState->encoding.read(pipe);
+	
 	/* Read the size of the following message: */
 	unsigned int messageSize=pipe.read<Card>();
 	
@@ -613,13 +998,11 @@ ProtocolClient::RemoteClientState* CheriaClient::receiveClientConnect(Comm::NetP
 	std::cout<<"Received client connect message of size "<<messageSize<<std::endl;
 	#endif
 	
-	/* Read the entire message into a new read buffer that has the same endianness as the pipe's read end: */
-	IncomingMessage* msg=new IncomingMessage(messageSize);
-	msg->setSwapOnRead(pipe.mustSwapOnRead());
-	pipe.readRaw(msg->getMemory(),messageSize);
+	/* Read the entire message into a pooled read buffer that has the same endianness as the pipe's read end: */
+	IncomingMessage* msg=newClientState->messageBufferPool.acquire(pipe,messageSize);
 	
-	/* Store the new buffer in the client's message list: */
-	newClientState->messages.push_back(msg);
+	/* Fold the initial device states into the new client's pending device states and store the buffer in its message list: */
+	newClientState->queueMessage(msg);
 	
 	return newClientState;
 	}
@@ -636,19 +1019,15 @@ bool CheriaClient::receiveServerUpdate(ProtocolClient::RemoteClientState* rcs,Co
 	
 	if(messageSize>0)
 		{
-		/* Read the entire message into a new read buffer that has the same endianness as the pipe's read end: */
-		IncomingMessage* msg=new IncomingMessage(messageSize);
-		msg->setSwapOnRead(pipe.mustSwapOnRead());
-		pipe.readRaw(msg->getMemory(),messageSize);
+		/* Read the entire message into a pooled read buffer that has the same endianness as the pipe's read end: */
+		IncomingMessage* msg=myRcs->messageBufferPool.acquire(pipe,messageSize);
 		
-		/* Store the new buffer in the client's message list: */
-		{
-		Threads::Mutex::Lock messageBufferLock(myRcs->messageBufferMutex);
-		myRcs->messages.push_back(msg);
-		}
+		/* Fold the buffer's device states into the client's pending device states, and queue its state tracking messages: */
+		myRcs->queueMessage(msg);
 		}
 	
-	return messageSize>sizeof(MessageIdType)+sizeof(Card);
+	/* Check if the message contains more than an empty device state message: */
+	return messageSize>sizeof(MessageIdType)+1;
 	}
 
 void CheriaClient::sendClientUpdate(Comm::NetPipe& pipe)
@@ -659,6 +1038,41 @@ void CheriaClient::sendClientUpdate(Comm::NetPipe& pipe)
 	message.writeToSink(pipe);
 	message.clear();
 	
+	if(maxDeviceSamples>0)
+		{
+		/* Assemble the transformation samples recorded for all local input devices since the last update: */
+		for(LocalDeviceMap::Iterator ldIt=localDevices.begin();!ldIt.isFinished();++ldIt)
+			{
+			LocalDeviceState* lds=ldIt->getDest();
+			if(lds->samples.size()>=2)
+				{
+				/* Write the device's local ID and the number of samples, leaving out the most recent one which is sent as the device's state: */
+				writeVarCard(lds->deviceId,sampleMessage);
+				size_t numSamples=lds->samples.size()-1;
+				writeVarCard(Card(numSamples),sampleMessage);
+				
+				/* Write the samples with their ages in microseconds relative to the most recent one: */
+				double stateTime=lds->samples.back().time;
+				for(size_t i=0;i<numSamples;++i)
+					{
+					writeVarCard(Card(Math::floor((stateTime-lds->samples[i].time)*1.0e6+0.5)),sampleMessage);
+					encoding.writeTransform(lds->samples[i].transform,sampleMessage);
+					}
+				}
+			lds->samples.clear();
+			}
+		
+		/* Send the sample batch if it is not empty: */
+		if(sampleMessage.getDataSize()>0)
+			{
+			writeVarCard(0,sampleMessage);
+			writeMessage(DEVICE_SAMPLES,pipe);
+			pipe.write<Card>(Card(sampleMessage.getDataSize()));
+			sampleMessage.writeToSink(pipe);
+			}
+		sampleMessage.clear();
+		}
+	
 	/* Send the current state of all local input devices: */
 	writeMessage(DEVICE_STATES,pipe);
 	for(LocalDeviceMap::Iterator ldIt=localDevices.begin();!ldIt.isFinished();++ldIt)
@@ -670,10 +1084,10 @@ void CheriaClient::sendClientUpdate(Comm::NetPipe& pipe)
 		if(lds->updateMask!=DeviceState::NO_CHANGE)
 			{
 			/* Write the device's local ID: */
-			pipe.write<Card>(lds->deviceId);
+			writeVarCard(lds->deviceId,pipe);
 			
 			/* Write the device's state update: */
-			lds->write(lds->updateMask,pipe);
+			lds->write(lds->updateMask,encoding,pipe);
 			
 			/* Reset the device's update mask: */
 			lds->updateMask=DeviceState::NO_CHANGE;
@@ -681,23 +1095,40 @@ void CheriaClient::sendClientUpdate(Comm::NetPipe& pipe)
 		}
 	
 	/* Terminate the update packet with a zero device ID: */
-	pipe.write<Card>(0);
+	writeVarCard(0,pipe);
 	}
 
 void CheriaClient::frame(void)
 	{
 	Threads::Mutex::Lock localDevicesLock(localDevicesMutex);
 	
+	double now=Vrui::getApplicationTime();
+	
+	/* Sample the positions, orientations, and velocities of all local input devices into the local device batch: */
+	for(LocalDeviceMap::Iterator ldIt=localDevices.begin();!ldIt.isFinished();++ldIt)
+		{
+		Vrui::InputDevice* device=ldIt->getSource();
+		const LocalDeviceState& lds=*(ldIt->getDest());
+		localDeviceBatch.setCurrent(lds.batchIndex,ONTransform(device->getTransformation()),Vector(device->getLinearVelocity()),Vector(device->getAngularVelocity()),deadBand.isStale(lds.updateTime,now)); // Conversion to lower precision
+		}
+	
+	/* Detect perceptible changes in all sampled positions, orientations, and velocities in one pass: */
+	localDeviceBatch.detectChanges(deadBand);
+	
 	/* Update the states of all local input devices: */
 	for(LocalDeviceMap::Iterator ldIt=localDevices.begin();!ldIt.isFinished();++ldIt)
 		{
 		Vrui::InputDevice* device=ldIt->getSource();
 		LocalDeviceState& lds=*(ldIt->getDest());
+		unsigned int batchChanges=localDeviceBatch.getChanges(lds.batchIndex);
+		
+		/* Report any change at all if the device's last exact update is stale: */
+		bool stale=deadBand.isStale(lds.updateTime,now);
 		
 		/* Update the device's ray direction: */
 		Vector rayDirection(device->getDeviceRayDirection()); // Conversion to lower precision
 		Scalar rayStart=Scalar(device->getDeviceRayStart()); // Conversion to lower precision
-		if(lds.rayDirection!=rayDirection||lds.rayStart!=rayStart)
+		if(lds.rayStart!=rayStart||deadBand.changedDirection(lds.rayDirection,rayDirection,stale))
 			{
 			lds.updateMask|=DeviceState::RAYDIRECTION;
 			lds.rayDirection=rayDirection;
@@ -705,72 +1136,63 @@ void CheriaClient::frame(void)
 			}
 		
 		/* Update the device's position and orientation: */
-		ONTransform transform(device->getTransformation()); // Conversion to lower precision
-		if(lds.transform!=transform)
+		if(batchChanges&DeviceState::TRANSFORM)
+			{
 			lds.updateMask|=DeviceState::TRANSFORM;
-		lds.transform=transform;
+			lds.transform=localDeviceBatch.getTransform(lds.batchIndex);
+			
+			if(maxDeviceSamples>0)
+				{
+				/* Thin out the recorded samples by dropping every other one if the sample list is full: */
+				if(lds.samples.size()>=maxDeviceSamples)
+					{
+					size_t numKept=0;
+					for(size_t i=0;i<lds.samples.size();i+=2,++numKept)
+						lds.samples[numKept]=lds.samples[i];
+					lds.samples.erase(lds.samples.begin()+numKept,lds.samples.end());
+					}
+				
+				/* Record the new transformation as a sample for the next client update: */
+				lds.samples.push_back(TransformSample(now,lds.transform));
+				}
+			}
 		
 		/* Update the device's velocities: */
-		Vector linearVelocity(device->getLinearVelocity()); // Conversion to lower precision
-		Vector angularVelocity(device->getAngularVelocity()); // Conversion to lower precision
-		if(lds.linearVelocity!=linearVelocity||lds.angularVelocity!=angularVelocity)
+		if(batchChanges&DeviceState::VELOCITY)
 			{
 			lds.updateMask|=DeviceState::VELOCITY;
-			lds.linearVelocity=linearVelocity;
-			lds.angularVelocity=angularVelocity;
+			lds.linearVelocity=localDeviceBatch.getLinearVelocity(lds.batchIndex);
+			lds.angularVelocity=localDeviceBatch.getAngularVelocity(lds.batchIndex);
 			}
 		
-		/* Update the device's button states: */
-		bool buttonChanged=false;
-		unsigned int index=0;
-		unsigned int mask=0x1U;
-		for(unsigned int buttonIndex=0;buttonIndex<lds.numButtons;++buttonIndex)
+		/* Gather the device's button states into a packed bit array and update the masked states in one go: */
+		if(lds.numButtons>0)
 			{
-			/* Update the button state: */
-			unsigned int oldButtonState=lds.buttonStates[index]&mask;
-			unsigned int newButtonState=lds.buttonMasks[index]&mask;
-			if(!device->getButtonState(buttonIndex))
-				newButtonState=0x0U;
-			buttonChanged=buttonChanged||newButtonState!=oldButtonState;
-			if(newButtonState)
-				lds.buttonStates[index]|=mask;
-			else
-				lds.buttonStates[index]&=~mask;
-			
-			/* Go to the next button and button mask bit: */
-			mask<<=1;
-			if(mask==0x100U)
-				{
-				++index;
-				mask=0x1U;
-				}
+			unsigned int numButtonBytes=(lds.numButtons+7)/8;
+			if(newButtonStates.size()<numButtonBytes)
+				newButtonStates.resize(numButtonBytes);
+			for(unsigned int i=0;i<numButtonBytes;++i)
+				newButtonStates[i]=0x0U;
+			for(unsigned int buttonIndex=0;buttonIndex<lds.numButtons;++buttonIndex)
+				newButtonStates[buttonIndex/8]|=Byte(device->getButtonState(buttonIndex))<<(buttonIndex%8);
+			if(CheriaDeviceKernels::updateBits(lds.buttonStates,&newButtonStates[0],lds.buttonMasks,numButtonBytes))
+				lds.updateMask|=DeviceState::BUTTON;
 			}
-		if(buttonChanged)
-			lds.updateMask|=DeviceState::BUTTON;
 		
-		/* Update the device's valuator states: */
-		bool valuatorChanged=false;
-		index=0;
-		mask=0x1U;
-		for(unsigned int valuatorIndex=0;valuatorIndex<lds.numValuators;++valuatorIndex)
+		/* Gather the device's valuator states and update the masked states in one go: */
+		if(lds.numValuators>0)
 			{
-			/* Update the valuator state: */
-			Scalar newValue(device->getValuator(valuatorIndex)); // Conversion to lower precision
-			if((lds.valuatorMasks[index]&mask)==0)
-				newValue=Scalar(0);
-			valuatorChanged=valuatorChanged||lds.valuatorStates[valuatorIndex]!=newValue;
-			lds.valuatorStates[valuatorIndex]=newValue;
-			
-			/* Go to the next valuator mask bit: */
-			mask<<=1;
-			if(mask==0x100U)
-				{
-				++index;
-				mask=0x1U;
-				}
+			if(newValuatorStates.size()<lds.numValuators)
+				newValuatorStates.resize(lds.numValuators);
+			for(unsigned int valuatorIndex=0;valuatorIndex<lds.numValuators;++valuatorIndex)
+				newValuatorStates[valuatorIndex]=Scalar(device->getValuator(valuatorIndex)); // Conversion to lower precision
+			if(CheriaDeviceKernels::updateValues(lds.valuatorStates,&newValuatorStates[0],lds.valuatorGains,lds.numValuators,stale?Scalar(0):deadBand.getValueTolerance()))
+				lds.updateMask|=DeviceState::VALUATOR;
 			}
-		if(valuatorChanged)
-			lds.updateMask|=DeviceState::VALUATOR;
+		
+		/* Restart the device's staleness interval if its sent state is now exact: */
+		if(stale)
+			lds.updateTime=now;
 		}
 	}
 
@@ -781,55 +1203,74 @@ void CheriaClient::frame(ProtocolClient::RemoteClientState* rcs)
 	if(myRcs==0)
 		Misc::throwStdErr("CheriaClient::frame: Mismatching remote client state object type");
 	
-	/* Process the remote client's queued server update messages: */
-	myRcs->processMessages();
+	/* Process the remote client's queued server update messages and keep track of the interval between server updates: */
+	double now=Vrui::getApplicationTime();
+	if(myRcs->processMessages())
+		{
+		if(myRcs->lastUpdateTime>=0.0)
+			{
+			double interval=now-myRcs->lastUpdateTime;
+			myRcs->updateInterval=myRcs->updateInterval>0.0?myRcs->updateInterval*0.9+interval*0.1:interval;
+			}
+		myRcs->lastUpdateTime=now;
+		}
 	
 	/* Calculate the transformation from the remote client's physical space into the local client's physical space: */
 	Vrui::NavTransform remoteNav=Vrui::NavTransform(client->getClientState(rcs).getLockedValue().navTransform);
 	remoteNav.doInvert();
 	remoteNav.leftMultiply(Vrui::getNavigationTransformation());
 	
-	/* Update the states of all remote input devices: */
-	for(RemoteClientState::RemoteDeviceMap::Iterator rdIt=myRcs->remoteDevices.begin();!rdIt.isFinished();++rdIt)
+	/* Check whether remote device velocities must be derived from successive transformations because the remote client does not send them: */
+	bool deriveVelocities=(myRcs->encoding.flags&DeviceEncoding::DERIVE_VELOCITIES)!=0x0U;
+	
+	/* Consider a remote device stopped if its transformation did not change for two intervals between server updates: */
+	double stopInterval=myRcs->updateInterval*2.0;
+	
+	/* Replay received transformation samples delayed by the configured delay or by the interval between server updates: */
+	double replayTime=now-(sampleReplayDelay>0.0?sampleReplayDelay:myRcs->updateInterval);
+	
+	/* Always transform all remote device positions, orientations, and velocities in one batch as either navigation transformation might have changed: */
+	remoteDeviceBatch.resize(myRcs->remoteDevices.getNumEntries());
+	size_t batchIndex=0;
+	for(RemoteClientState::RemoteDeviceMap::Iterator rdIt=myRcs->remoteDevices.begin();!rdIt.isFinished();++rdIt,++batchIndex)
 		{
 		RemoteClientState::RemoteDeviceState& rds=*(rdIt->getDest());
-		
-		/* Update the device ray direction: */
-		if(rds.updateMask&DeviceState::RAYDIRECTION)
-			rds.device->setDeviceRay(rds.rayDirection,rds.rayStart);
-		
-		/* Always update the device transformation as either navigation transformation might have changed: */
-		Vrui::NavTransform deviceTransform=Vrui::NavTransform(rds.transform);
-		deviceTransform.leftMultiply(remoteNav);
-		deviceTransform.renormalize();
-		rds.device->setTransformation(Vrui::TrackerState(deviceTransform.getTranslation(),deviceTransform.getRotation()));
-		
-		/* Always update the device velocities as either navigation transformation might have changed: */
-		rds.device->setLinearVelocity(remoteNav.transform(rds.linearVelocity));
-		rds.device->setAngularVelocity(remoteNav.transform(rds.angularVelocity));
-		
-		/* Update all button states: */
-		if(rds.updateMask&DeviceState::BUTTON)
+		if(deriveVelocities)
 			{
-			unsigned int index=0;
-			unsigned int mask=0x1U;
-			for(unsigned int buttonIndex=0;buttonIndex<rds.numButtons;++buttonIndex)
+			if(rds.updateMask&DeviceState::TRANSFORM)
+				rds.deriveVelocities(now);
+			else if(now-rds.previousTime>stopInterval)
 				{
-				rds.device->setButtonState(buttonIndex,(rds.buttonStates[index]&mask)!=0x0U);
-				mask<<=1;
-				if(mask==0x100U)
-					{
-					++index;
-					mask=0x1U;
-					}
+				/* The remote client stopped sending transformations because the device stopped moving: */
+				rds.linearVelocity=Vector::zero;
+				rds.angularVelocity=Vector::zero;
 				}
 			}
+		if(!rds.receivedSamples.empty())
+			rds.scheduleSamples(now);
+		if(!rds.replaySamples.empty())
+			remoteDeviceBatch.set(batchIndex,rds.getReplayTransform(replayTime),rds.linearVelocity,rds.angularVelocity);
+		else
+			remoteDeviceBatch.set(batchIndex,rds.transform,rds.linearVelocity,rds.angularVelocity);
+		}
+	remoteDeviceBatch.transform(remoteNav);
+	
+	/* Update the states of all remote devices: */
+	batchIndex=0;
+	for(RemoteClientState::RemoteDeviceMap::Iterator rdIt=myRcs->remoteDevices.begin();!rdIt.isFinished();++rdIt,++batchIndex)
+		{
+		RemoteClientState::RemoteDeviceState& rds=*(rdIt->getDest());
 		
-		/* Update all valuator states: */
-		if(rds.updateMask&DeviceState::VALUATOR)
+		/* Store the device transformation from the batch: */
+		rds.proxyTransform=remoteDeviceBatch.getTrackerState(batchIndex);
+		
+		/* Update the local proxy device if the device is used by a remote tool: */
+		if(rds.device!=0)
 			{
-			for(unsigned int valuatorIndex=0;valuatorIndex<rds.numValuators;++valuatorIndex)
-				rds.device->setValuator(valuatorIndex,rds.valuatorStates[valuatorIndex]);
+			rds.device->setTransformation(rds.proxyTransform);
+			rds.device->setLinearVelocity(remoteDeviceBatch.getLinearVelocity(batchIndex));
+			rds.device->setAngularVelocity(remoteDeviceBatch.getAngularVelocity(batchIndex));
+			rds.updateDevice(rds.updateMask);
 			}
 		
 		/* Reset the device's update mask: */
@@ -845,6 +1286,25 @@ void CheriaClient::frame(ProtocolClient::RemoteClientState* rcs)
 		}
 	}
 
+void CheriaClient::glRenderAction(const ProtocolClient::RemoteClientState* rcs,GLContextData& contextData) const
+	{
+	/* Get a handle on the remote client state object: */
+	const RemoteClientState* myRcs=dynamic_cast<const RemoteClientState*>(rcs);
+	if(myRcs==0)
+		Misc::throwStdErr("CheriaClient::glRenderAction: Mismatching remote client state object type");
+	
+	/* Go to local physical space: */
+	glPushMatrix();
+	glMultMatrix(Vrui::getInverseNavigationTransformation());
+	
+	/* Render glyphs for all remote devices that do not have local proxy devices, which are rendered by the input graph manager: */
+	for(RemoteClientState::RemoteDeviceMap::ConstIterator rdIt=myRcs->remoteDevices.begin();!rdIt.isFinished();++rdIt)
+		if(rdIt->getDest()->device==0)
+			Vrui::renderGlyph(inputDeviceGlyph,Vrui::OGTransform(rdIt->getDest()->proxyTransform),contextData);
+	
+	glPopMatrix();
+	}
+
 }
 
 /****************
@@ -24,19 +24,21 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #ifndef COLLABORATION_CHERIACLIENT_INCLUDED
 #define COLLABORATION_CHERIACLIENT_INCLUDED
 
-#include <Misc/HashTable.h>
+#include <vector>
+#include <deque>
 #include <IO/VariableMemoryFile.h>
 #include <Threads/Mutex.h>
 #include <Vrui/GlyphRenderer.h>
 #include <Vrui/InputDeviceManager.h>
 #include <Vrui/ToolManager.h>
+#include <Collaboration/FlatHashTable.h>
 #include <Collaboration/ProtocolClient.h>
 #include <Collaboration/CheriaProtocol.h>
+#include <Collaboration/CheriaDeviceBatch.h>
+#include <Collaboration/DeadBand.h>
+#include <Collaboration/MessageBufferPool.h>
 
 /* Forward declarations: */
-namespace IO {
-class FixedMemoryFile;
-}
 namespace Vrui {
 class PointingTool;
 }
@@ -47,9 +49,25 @@ class CheriaClient:public ProtocolClient,private CheriaProtocol
 	{
 	/* Embedded classes: */
 	private:
-	typedef IO::FixedMemoryFile IncomingMessage; // Type for buffers storing incoming messages
+	typedef MessageBufferPool::Buffer IncomingMessage; // Type for pooled buffers storing incoming messages
 	typedef IO::VariableMemoryFile OutgoingMessage; // Type for buffers storing outgoing messages
 	
+	struct TransformSample // Structure for timestamped device transformations
+		{
+		/* Elements: */
+		public:
+		double time; // Application time of the sample, or its age relative to a device state
+		ONTransform transform; // Device transformation at the time of the sample
+		
+		/* Constructors and destructors: */
+		TransformSample(double sTime,const ONTransform& sTransform)
+			:time(sTime),transform(sTransform)
+			{
+			}
+		};
+	
+	typedef std::vector<TransformSample> TransformSampleList; // Type for lists of transformation samples
+	
 	class RemoteClientState:public ProtocolClient::RemoteClientState
 		{
 		/* Embedded classes: */
@@ -58,29 +76,64 @@ class CheriaClient:public ProtocolClient,private CheriaProtocol
 			{
 			/* Elements: */
 			public:
-			Vrui::InputDevice* device; // Pointer to local input device representing the remote device
+			Vrui::InputDevice* device; // Pointer to local input device representing the remote device, or null until a remote tool uses the device
+			Vrui::TrackerState proxyTransform; // Device's current position and orientation in local physical space
+			ONTransform previousTransform; // Device transformation at the time velocities were last derived
+			double previousTime; // Application time at which velocities were last derived, or negative if never
+			TransformSampleList receivedSamples; // Samples received since the last frame, timestamped by their age relative to the device's most recent transformation
+			std::deque<TransformSample> replaySamples; // Samples scheduled for replay, timestamped in local application time
+			
+			/* Constructors and destructors: */
+			RemoteDeviceState(IO::File& source); // Reads device state layout from the given source
+			~RemoteDeviceState(void); // Destroys local proxy device if it was created
+			
+			/* Methods: */
+			Vrui::InputDevice* getDevice(CheriaClient& client); // Returns the local proxy device representing the remote device, creating it on first use
+			void updateDevice(unsigned int deviceUpdateMask); // Updates the local proxy device's ray, button, and valuator states selected by the given update mask
+			void deriveVelocities(double time); // Derives the device's velocities from its transformation at the given application time and the previous one
+			void scheduleSamples(double time); // Schedules all received samples for replay relative to the given application time
+			ONTransform getReplayTransform(double time); // Returns the device's transformation replayed at the given application time
+			};
+		
+		struct PendingDeviceState:public DeviceState // Structure to fold the state updates of a remote device received between frames
+			{
+			/* Elements: */
+			public:
+			TransformSampleList samples; // Samples received since the last frame, timestamped by their age relative to the device's most recent transformation
+			bool replaying; // Flag whether the remote device was replaying samples during the last frame
 			
 			/* Constructors and destructors: */
-			RemoteDeviceState(IO::File& source); // Reads device state layout from the given source and creates local proxy device
-			~RemoteDeviceState(void); // Destroys local proxy device
+			PendingDeviceState(IO::File& source) // Reads device state layout from the given source
+				:DeviceState(source),
+				 replaying(false)
+				{
+				}
 			};
 		
-		typedef Misc::HashTable<unsigned int,RemoteDeviceState*> RemoteDeviceMap; // Hash table to map remote device IDs to local input device pointers
-		typedef Misc::HashTable<unsigned int,Vrui::PointingTool*> RemoteToolMap; // Hash table to map remote device IDs to local pointing tool pointers
+		typedef FlatHashTable<unsigned int,RemoteDeviceState*> RemoteDeviceMap; // Hash table to map remote device IDs to local input device pointers
+		typedef FlatHashTable<unsigned int,PendingDeviceState*> PendingDeviceMap; // Hash table to map remote device IDs to folded device state updates
+		typedef FlatHashTable<unsigned int,Vrui::PointingTool*> RemoteToolMap; // Hash table to map remote device IDs to local pointing tool pointers
 		
 		/* Elements: */
 		CheriaClient& client; // Cheria client object to which the remote client state belongs
 		RemoteDeviceMap remoteDevices; // Map of remote client's device IDs to local input devices
 		RemoteToolMap remoteTools; // Map of remote client's tool IDs to local tools
+		DeviceEncoding encoding; // Encoding the remote client uses for its device states
+		MessageBufferPool& messageBufferPool; // Pool from which incoming message buffers are drawn and to which they are returned
 		Threads::Mutex messageBufferMutex; // Mutex serializing access to the message buffer list
-		std::vector<IncomingMessage*> messages; // List of buffers retaining server update messages between frame calls
+		std::vector<IncomingMessage*> messages; // List of buffers retaining server update messages containing state tracking messages between frame calls
+		PendingDeviceMap pendingDevices; // Map of remote client's device IDs to device state updates folded since the last frame call
+		bool haveUpdates; // Flag whether server update messages were received since the last frame call
+		double lastUpdateTime; // Application time at which server update messages were last processed, or negative if never
+		double updateInterval; // Running average of the interval between server update messages in seconds
 		
 		/* Constructors and destructors: */
 		RemoteClientState(CheriaClient& sClient);
 		virtual ~RemoteClientState(void);
 		
 		/* Methods: */
-		void processMessages(void); // Reads and processes all queued server update messages
+		void queueMessage(IncomingMessage* msg); // Folds the device states and samples in the given server update message into the pending device states, and queues the message if it contains state tracking messages; called from communication thread
+		bool processMessages(void); // Processes all queued state tracking messages and applies the pending device states; returns true if there were any server update messages
 		};
 	
 	struct LocalDeviceState:public DeviceState // Structure to associate button and valuator masks with represented local devices
@@ -88,30 +141,44 @@ class CheriaClient:public ProtocolClient,private CheriaProtocol
 		/* Elements: */
 		public:
 		unsigned int deviceId; // The device's local device ID
+		size_t batchIndex; // Index of the device in the batch of local device states
 		Byte* buttonMasks; // Array of mask flags for each of the device's buttons, to disable those not used by local pointing tools
-		Byte* valuatorMasks; // Array of mask flags for each of the device's valuators, to disable those not used by local pointing tools
+		Scalar* valuatorGains; // Array of gains of one or zero for each of the device's valuators, to disable those not used by local pointing tools
+		double updateTime; // Application time at which the device's ray, transformation, velocities, and valuators were last updated exactly
+		TransformSampleList samples; // Transformations recorded since the last client update
 		
 		/* Constructors and destructors: */
 		LocalDeviceState(unsigned int sDeviceId,const Vrui::InputDevice* device); // Initializes local device state from device's layout
 		~LocalDeviceState(void); // Destroys a local device state
 		};
 	
-	typedef Misc::HashTable<Vrui::InputDevice*,LocalDeviceState*> LocalDeviceMap; // Hash table to map input device pointers to local device states
-	typedef Misc::HashTable<Vrui::PointingTool*,unsigned int> LocalToolMap; // Hash table to map tool pointers to local tool IDs
+	typedef FlatHashTable<Vrui::InputDevice*,LocalDeviceState*> LocalDeviceMap; // Hash table to map input device pointers to local device states
+	typedef FlatHashTable<Vrui::PointingTool*,unsigned int> LocalToolMap; // Hash table to map tool pointers to local tool IDs
 	
 	/* Elements: */
 	private:
 	Vrui::Glyph inputDeviceGlyph; // Glyph to render remote input devices
+	DeadBand deadBand; // Dead band to suppress local device updates caused by tracking noise
 	Threads::Mutex localDevicesMutex; // Mutex serializing access to the local input device and tool maps
 	unsigned int nextLocalDeviceId; // Next ID to assign to a local input device
 	LocalDeviceMap localDevices; // Hash table of local devices represented by the Cheria client
+	LocalDeviceBatch localDeviceBatch; // Batch holding the sent positions, orientations, and velocities of all local devices to detect changes in one pass during frame processing
+	std::vector<LocalDeviceState*> batchedLocalDevices; // Local device states in order of their indices in the local device batch
 	unsigned int nextLocalToolId; // Next ID to assign to a local tool
 	LocalToolMap localTools; // Hash table of local tools represented by the Cheria client
+	DeviceEncoding encoding; // Encoding used to send the states of local devices
+	size_t maxDeviceSamples; // Maximum number of transformation samples recorded per local device between client updates; 0 disables sampling
+	bool replayDeviceSamples; // Flag whether to replay transformation samples received from remote clients
+	double sampleReplayDelay; // Delay in seconds at which received samples are replayed; 0 adapts to the interval between server updates
 	OutgoingMessage message; // Buffer to assemble client update messages as devices are created / destroyed
+	OutgoingMessage sampleMessage; // Buffer to assemble batches of local device samples
 	volatile bool remoteClientCreatingDevice; // Flag if a remote Cheria client is currently creating an input device
 	volatile bool remoteClientDestroyingDevice; // Flag if a remote Cheria client is currently destroying an input device
 	volatile bool remoteClientCreatingTool; // Flag if a remote Cheria client is currently creating a tool
 	volatile bool remoteClientDestroyingTool; // Flag if a remote Cheria client is currently destroying a tool
+	std::vector<Byte> newButtonStates; // Packed bit array receiving a local device's current button states during frame processing
+	std::vector<Scalar> newValuatorStates; // Array receiving a local device's current valuator states during frame processing
+	DeviceTransformBatch remoteDeviceBatch; // Batch to transform the states of a remote client's devices into local physical space during frame processing
 	
 	/* Private methods: */
 	void createInputDevice(Vrui::InputDevice* device); // Method to add a newly-created local input device to the local input device set
@@ -138,6 +205,7 @@ class CheriaClient:public ProtocolClient,private CheriaProtocol
 	virtual void sendClientUpdate(Comm::NetPipe& pipe);
 	virtual void frame(void);
 	virtual void frame(ProtocolClient::RemoteClientState* rcs);
+	virtual void glRenderAction(const ProtocolClient::RemoteClientState* rcs,GLContextData& contextData) const;
 	};
 
 }
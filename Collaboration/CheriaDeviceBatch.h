@@ -0,0 +1,369 @@
+/***********************************************************************
+CheriaDeviceBatch - Helper classes to process the states of many Cheria
+input devices at once, using packed structure-of-arrays data and simple
+loops that compilers can vectorize.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#ifndef COLLABORATION_CHERIADEVICEBATCH_INCLUDED
+#define COLLABORATION_CHERIADEVICEBATCH_INCLUDED
+
+#include <stddef.h>
+#include <math.h>
+#include <vector>
+#include <Math/Math.h>
+#include <Vrui/Geometry.h>
+#include <Collaboration/CheriaProtocol.h>
+#include <Collaboration/DeadBand.h>
+
+namespace Collaboration {
+
+class CheriaDeviceKernels // Class for kernels updating packed button and valuator state arrays
+	{
+	/* Embedded classes: */
+	public:
+	typedef CheriaProtocol::Byte Byte;
+	typedef CheriaProtocol::Scalar Scalar;
+	
+	/* Methods: */
+	static bool updateBits(Byte* states,const Byte* newStates,const Byte* masks,unsigned int numBytes) // Stores masked new bit states into a packed bit array; returns true if any bit changed
+		{
+		Byte changed=0x0U;
+		for(unsigned int i=0;i<numBytes;++i)
+			{
+			Byte newState=newStates[i]&masks[i];
+			changed|=states[i]^newState;
+			states[i]=newState;
+			}
+		return changed!=0x0U;
+		}
+	static bool updateValues(Scalar* states,Scalar* newStates,const Scalar* gains,unsigned int numValues,Scalar tolerance) // Multiplies new values by per-value gains of zero or one, and stores all of them if any differs from its state by more than the tolerance; returns true if the values were stored
+		{
+		int changed=0;
+		for(unsigned int i=0;i<numValues;++i)
+			{
+			newStates[i]*=gains[i];
+			Scalar delta=newStates[i]-states[i];
+			changed|=int(delta>tolerance)|int(-delta>tolerance);
+			}
+		if(changed!=0)
+			{
+			for(unsigned int i=0;i<numValues;++i)
+				states[i]=newStates[i];
+			}
+		return changed!=0;
+		}
+	};
+
+class LocalDeviceBatch // Class to detect perceptible changes in the positions, orientations, and velocities of many local devices in one pass
+	{
+	/* Embedded classes: */
+	public:
+	typedef CheriaProtocol::Byte Byte;
+	typedef CheriaProtocol::Scalar Scalar;
+	typedef CheriaProtocol::Vector Vector;
+	typedef CheriaProtocol::ONTransform ONTransform;
+	
+	enum Stream // Enumerated type for the batch's data streams
+		{
+		TX=0,TY,TZ, // Translation vector
+		QX,QY,QZ,QW, // Rotation quaternion
+		LX,LY,LZ, // Linear velocity
+		AX,AY,AZ, // Angular velocity
+		NUM_STREAMS
+		};
+	
+	/* Elements: */
+	private:
+	std::vector<Scalar> sent[NUM_STREAMS]; // Last sent states of all devices, one stream per state component
+	std::vector<Scalar> current[NUM_STREAMS]; // States of all devices sampled during the current frame
+	std::vector<Byte> stale; // Flags whether each device's last exact update is stale
+	std::vector<Byte> changes; // Masks of the state components of each device that changed perceptibly during the current frame
+	
+	/* Private methods: */
+	static void store(std::vector<Scalar>* streams,size_t index,const ONTransform& transform,const Vector& linearVelocity,const Vector& angularVelocity) // Stores a device's state in the given streams
+		{
+		const Vector& t=transform.getTranslation();
+		const Scalar* q=transform.getRotation().getQuaternion();
+		for(int i=0;i<3;++i)
+			{
+			streams[TX+i][index]=t[i];
+			streams[LX+i][index]=linearVelocity[i];
+			streams[AX+i][index]=angularVelocity[i];
+			}
+		for(int i=0;i<4;++i)
+			streams[QX+i][index]=q[i];
+		}
+	
+	/* Methods: */
+	public:
+	size_t getNumDevices(void) const // Returns the number of devices in the batch
+		{
+		return stale.size();
+		}
+	size_t addDevice(const ONTransform& transform,const Vector& linearVelocity,const Vector& angularVelocity) // Adds a device with the given sent state to the batch; returns the device's index
+		{
+		size_t index=stale.size();
+		for(int s=0;s<NUM_STREAMS;++s)
+			{
+			sent[s].push_back(Scalar(0));
+			current[s].push_back(Scalar(0));
+			}
+		stale.push_back(0x0U);
+		changes.push_back(0x0U);
+		store(sent,index,transform,linearVelocity,angularVelocity);
+		return index;
+		}
+	size_t removeDevice(size_t index) // Removes the device of the given index by moving the last device into its place; returns the former index of the moved device
+		{
+		size_t last=stale.size()-1;
+		for(int s=0;s<NUM_STREAMS;++s)
+			{
+			sent[s][index]=sent[s][last];
+			sent[s].pop_back();
+			current[s][index]=current[s][last];
+			current[s].pop_back();
+			}
+		stale[index]=stale[last];
+		stale.pop_back();
+		changes[index]=changes[last];
+		changes.pop_back();
+		return last;
+		}
+	void setCurrent(size_t index,const ONTransform& transform,const Vector& linearVelocity,const Vector& angularVelocity,bool newStale) // Stores a device's state sampled during the current frame, and whether its last exact update is stale
+		{
+		store(current,index,transform,linearVelocity,angularVelocity);
+		stale[index]=newStale?0x1U:0x0U;
+		}
+	void detectChanges(const DeadBand& deadBand) // Compares the current states of all devices against their sent states using the given dead band, and stores the changed components as the new sent states
+		{
+		size_t numDevices=stale.size();
+		if(numDevices==0)
+			return;
+		
+		/* Derive the squared and cosine tolerances compared by the kernel: */
+		Scalar positionTolerance2=Math::sqr(deadBand.getPositionTolerance());
+		Scalar rotationCosTolerance=Math::cos(deadBand.getAngleTolerance()*Scalar(0.5));
+		Scalar linearVelocityTolerance2=Math::sqr(deadBand.getLinearVelocityTolerance());
+		Scalar angularVelocityTolerance2=Math::sqr(deadBand.getAngularVelocityTolerance());
+		
+		Scalar* s[NUM_STREAMS];
+		const Scalar* c[NUM_STREAMS];
+		for(int i=0;i<NUM_STREAMS;++i)
+			{
+			s[i]=&sent[i][0];
+			c[i]=&current[i][0];
+			}
+		
+		/* Compare all devices' positions and orientations by the same rules as DeadBand::changed, and their velocities by the same rules as DeadBand::changedLinearVelocity and DeadBand::changedAngularVelocity: */
+		for(size_t i=0;i<numDevices;++i)
+			{
+			int isStale=int(stale[i]!=0x0U);
+			
+			Scalar dx=c[TX][i]-s[TX][i];
+			Scalar dy=c[TY][i]-s[TY][i];
+			Scalar dz=c[TZ][i]-s[TZ][i];
+			Scalar dot=s[QX][i]*c[QX][i]+s[QY][i]*c[QY][i]+s[QZ][i]*c[QZ][i]+s[QW][i]*c[QW][i];
+			int transformDiffers=int(dx!=Scalar(0))|int(dy!=Scalar(0))|int(dz!=Scalar(0))|int(s[QX][i]!=c[QX][i])|int(s[QY][i]!=c[QY][i])|int(s[QZ][i]!=c[QZ][i])|int(s[QW][i]!=c[QW][i]);
+			int transformChanged=transformDiffers&(isStale|int(dx*dx+dy*dy+dz*dz>positionTolerance2)|(int(dot<rotationCosTolerance)&int(-dot<rotationCosTolerance)));
+			
+			Scalar lx=c[LX][i]-s[LX][i];
+			Scalar ly=c[LY][i]-s[LY][i];
+			Scalar lz=c[LZ][i]-s[LZ][i];
+			int linearDiffers=int(lx!=Scalar(0))|int(ly!=Scalar(0))|int(lz!=Scalar(0));
+			Scalar ax=c[AX][i]-s[AX][i];
+			Scalar ay=c[AY][i]-s[AY][i];
+			Scalar az=c[AZ][i]-s[AZ][i];
+			int angularDiffers=int(ax!=Scalar(0))|int(ay!=Scalar(0))|int(az!=Scalar(0));
+			int velocityChanged=(linearDiffers&(isStale|int(lx*lx+ly*ly+lz*lz>linearVelocityTolerance2)))|(angularDiffers&(isStale|int(ax*ax+ay*ay+az*az>angularVelocityTolerance2)));
+			
+			changes[i]=Byte(transformChanged*CheriaProtocol::DeviceState::TRANSFORM+velocityChanged*CheriaProtocol::DeviceState::VELOCITY);
+			}
+		
+		/* Store the changed components as the new sent states: */
+		for(int stream=TX;stream<LX;++stream)
+			for(size_t i=0;i<numDevices;++i)
+				if(changes[i]&CheriaProtocol::DeviceState::TRANSFORM)
+					s[stream][i]=c[stream][i];
+		for(int stream=LX;stream<NUM_STREAMS;++stream)
+			for(size_t i=0;i<numDevices;++i)
+				if(changes[i]&CheriaProtocol::DeviceState::VELOCITY)
+					s[stream][i]=c[stream][i];
+		}
+	unsigned int getChanges(size_t index) const // Returns the mask of a device's state components that changed perceptibly during the current frame
+		{
+		return changes[index];
+		}
+	ONTransform getTransform(size_t index) const // Returns a device's sent position and orientation
+		{
+		Scalar q[4];
+		for(int i=0;i<4;++i)
+			q[i]=sent[QX+i][index];
+		return ONTransform(Vector(sent[TX][index],sent[TY][index],sent[TZ][index]),CheriaProtocol::Rotation(q));
+		}
+	Vector getLinearVelocity(size_t index) const // Returns a device's sent linear velocity
+		{
+		return Vector(sent[LX][index],sent[LY][index],sent[LZ][index]);
+		}
+	Vector getAngularVelocity(size_t index) const // Returns a device's sent angular velocity
+		{
+		return Vector(sent[AX][index],sent[AY][index],sent[AZ][index]);
+		}
+	};
+
+class DeviceTransformBatch // Class to transform the positions, orientations, and velocities of many devices by a common navigation transformation
+	{
+	/* Embedded classes: */
+	public:
+	enum Stream // Enumerated type for the batch's data streams
+		{
+		TX=0,TY,TZ, // Translation vector
+		QX,QY,QZ,QW, // Rotation quaternion
+		LX,LY,LZ, // Linear velocity
+		AX,AY,AZ, // Angular velocity
+		NUM_STREAMS
+		};
+	
+	/* Elements: */
+	private:
+	size_t numDevices; // Number of devices in the batch
+	std::vector<double> data; // Storage for all streams, each stream holding numDevices values
+	
+	/* Constructors and destructors: */
+	public:
+	DeviceTransformBatch(void)
+		:numDevices(0)
+		{
+		}
+	
+	/* Methods: */
+	size_t getNumDevices(void) const // Returns the number of devices in the batch
+		{
+		return numDevices;
+		}
+	void resize(size_t newNumDevices) // Sets the number of devices in the batch; retains allocated storage
+		{
+		numDevices=newNumDevices;
+		if(data.size()<numDevices*NUM_STREAMS)
+			data.resize(numDevices*NUM_STREAMS);
+		}
+	double* getStream(int stream) // Returns the given data stream
+		{
+		return &data[stream*numDevices];
+		}
+	const double* getStream(int stream) const // Ditto
+		{
+		return &data[stream*numDevices];
+		}
+	void set(size_t index,const CheriaProtocol::ONTransform& transform,const CheriaProtocol::Vector& linearVelocity,const CheriaProtocol::Vector& angularVelocity) // Stores a device's state in the batch
+		{
+		double* d=&data[index];
+		const CheriaProtocol::Vector& t=transform.getTranslation();
+		const CheriaProtocol::Scalar* q=transform.getRotation().getQuaternion();
+		for(int i=0;i<3;++i)
+			{
+			d[(TX+i)*numDevices]=t[i];
+			d[(LX+i)*numDevices]=linearVelocity[i];
+			d[(AX+i)*numDevices]=angularVelocity[i];
+			}
+		for(int i=0;i<4;++i)
+			d[(QX+i)*numDevices]=q[i];
+		}
+	void transform(const Vrui::NavTransform& nav) // Left-multiplies all device transformations by the given navigation transformation, and transforms all velocities by it
+		{
+		if(numDevices==0)
+			return;
+		
+		/* Convert the navigation transformation's rotation to a scaled rotation matrix: */
+		const Vrui::Scalar* nq=nav.getRotation().getQuaternion();
+		double x=nq[0],y=nq[1],z=nq[2],w=nq[3];
+		double s=nav.getScaling();
+		double m[3][3];
+		m[0][0]=s*(1.0-2.0*(y*y+z*z));
+		m[0][1]=s*2.0*(x*y-z*w);
+		m[0][2]=s*2.0*(x*z+y*w);
+		m[1][0]=s*2.0*(x*y+z*w);
+		m[1][1]=s*(1.0-2.0*(x*x+z*z));
+		m[1][2]=s*2.0*(y*z-x*w);
+		m[2][0]=s*2.0*(x*z-y*w);
+		m[2][1]=s*2.0*(y*z+x*w);
+		m[2][2]=s*(1.0-2.0*(x*x+y*y));
+		const Vrui::Vector& nt=nav.getTranslation();
+		
+		/* Transform the translations and velocities as vectors, and add the navigation translation to the former: */
+		static const int vectorStreams[3]={TX,LX,AX};
+		for(int v=0;v<3;++v)
+			{
+			double* vx=getStream(vectorStreams[v]);
+			double* vy=vx+numDevices;
+			double* vz=vy+numDevices;
+			double ox=v==0?nt[0]:0.0;
+			double oy=v==0?nt[1]:0.0;
+			double oz=v==0?nt[2]:0.0;
+			for(size_t i=0;i<numDevices;++i)
+				{
+				double ix=vx[i],iy=vy[i],iz=vz[i];
+				vx[i]=m[0][0]*ix+m[0][1]*iy+m[0][2]*iz+ox;
+				vy[i]=m[1][0]*ix+m[1][1]*iy+m[1][2]*iz+oy;
+				vz[i]=m[2][0]*ix+m[2][1]*iy+m[2][2]*iz+oz;
+				}
+			}
+		
+		/* Multiply the navigation rotation onto all device rotations and renormalize the results: */
+		double* qx=getStream(QX);
+		double* qy=getStream(QY);
+		double* qz=getStream(QZ);
+		double* qw=getStream(QW);
+		for(size_t i=0;i<numDevices;++i)
+			{
+			double rx=w*qx[i]+x*qw[i]+y*qz[i]-z*qy[i];
+			double ry=w*qy[i]-x*qz[i]+y*qw[i]+z*qx[i];
+			double rz=w*qz[i]+x*qy[i]-y*qx[i]+z*qw[i];
+			double rw=w*qw[i]-x*qx[i]-y*qy[i]-z*qz[i];
+			double scale=1.0/sqrt(rx*rx+ry*ry+rz*rz+rw*rw);
+			qx[i]=rx*scale;
+			qy[i]=ry*scale;
+			qz[i]=rz*scale;
+			qw[i]=rw*scale;
+			}
+		}
+	Vrui::TrackerState getTrackerState(size_t index) const // Returns a device's transformed position and orientation
+		{
+		const double* d=&data[index];
+		double q[4];
+		for(int i=0;i<4;++i)
+			q[i]=d[(QX+i)*numDevices];
+		return Vrui::TrackerState(Vrui::Vector(d[TX*numDevices],d[TY*numDevices],d[TZ*numDevices]),Vrui::Rotation(q));
+		}
+	Vrui::Vector getLinearVelocity(size_t index) const // Returns a device's transformed linear velocity
+		{
+		const double* d=&data[index];
+		return Vrui::Vector(d[LX*numDevices],d[LY*numDevices],d[LZ*numDevices]);
+		}
+	Vrui::Vector getAngularVelocity(size_t index) const // Returns a device's transformed angular velocity
+		{
+		const double* d=&data[index];
+		return Vrui::Vector(d[AX*numDevices],d[AY*numDevices],d[AZ*numDevices]);
+		}
+	};
+
+}
+
+#endif
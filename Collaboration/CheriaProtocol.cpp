@@ -23,10 +23,162 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <Collaboration/CheriaProtocol.h>
 
+#include <math.h>
+#include <Misc/SizedTypes.h>
 #include <IO/File.h>
+#include <Collaboration/Arena.h>
+#include <Collaboration/ProtocolSchema.h>
 
 namespace Collaboration {
 
+namespace {
+
+/**************************************************
+Wire schema of the variable parts of device states:
+**************************************************/
+
+typedef CheriaProtocol::DeviceState DS;
+typedef Schema<SchemaField<DS,CheriaProtocol::Vector,&DS::rayDirection,DS::RAYDIRECTION>,
+               SchemaField<DS,CheriaProtocol::Scalar,&DS::rayStart,DS::RAYDIRECTION>,
+               SchemaField<DS,CheriaProtocol::ONTransform,&DS::transform,DS::TRANSFORM>,
+               SchemaField<DS,CheriaProtocol::Vector,&DS::linearVelocity,DS::VELOCITY>,
+               SchemaField<DS,CheriaProtocol::Vector,&DS::angularVelocity,DS::VELOCITY>,
+               SchemaBitArrayField<DS,&DS::buttonStates,&DS::numButtons,DS::BUTTON>,
+               SchemaArrayField<DS,CheriaProtocol::Scalar,&DS::valuatorStates,&DS::numValuators,DS::VALUATOR> > DeviceStateSchema;
+
+/****************************************************
+Helper functions for compact device state encodings:
+****************************************************/
+
+typedef CheriaProtocol::DeviceEncoding DE;
+typedef CheriaProtocol::Scalar Scalar;
+
+inline Scalar clampUnit(Scalar value) // Clamps a value to the [-1, 1] interval
+	{
+	return value<Scalar(-1)?Scalar(-1):(value>Scalar(1)?Scalar(1):value);
+	}
+
+template <class WireParam>
+inline WireParam quantizeUnit(Scalar value,Scalar maxValue) // Quantizes a value from the [-1, 1] interval to a signed fixed-point number
+	{
+	return WireParam(floor(clampUnit(value)*maxValue+Scalar(0.5)));
+	}
+
+void writePosition(const CheriaProtocol::Vector& position,const DE& encoding,IO::File& sink)
+	{
+	if(encoding.flags&DE::QUANTIZE_POSITIONS)
+		{
+		/* Write the position as fixed-point offsets inside the position box: */
+		for(int i=0;i<3;++i)
+			sink.write<Misc::SInt16>(quantizeUnit<Misc::SInt16>((position[i]-encoding.boxCenter[i])/encoding.boxSize,Scalar(32767)));
+		}
+	else
+		CheriaProtocol::write(position,sink);
+	}
+
+CheriaProtocol::Vector readPosition(const DE& encoding,IO::File& source)
+	{
+	if(encoding.flags&DE::QUANTIZE_POSITIONS)
+		{
+		CheriaProtocol::Vector result;
+		for(int i=0;i<3;++i)
+			result[i]=encoding.boxCenter[i]+Scalar(source.read<Misc::SInt16>())*encoding.boxSize/Scalar(32767);
+		return result;
+		}
+	else
+		return CheriaProtocol::read<CheriaProtocol::Vector>(source);
+	}
+
+void writeRotation(const CheriaProtocol::Rotation& rotation,const DE& encoding,IO::File& sink)
+	{
+	if(encoding.flags&DE::QUANTIZE_ROTATIONS)
+		{
+		/* Find the quaternion's largest component: */
+		const Scalar* q=rotation.getQuaternion();
+		int largest=0;
+		for(int i=1;i<4;++i)
+			if(fabs(q[i])>fabs(q[largest]))
+				largest=i;
+		
+		/* Write the other three components, flipped to make the largest one positive, as 15-bit fixed-point numbers, and the largest one's index in the top bits of the first two: */
+		Scalar sign=q[largest]<Scalar(0)?Scalar(-1):Scalar(1);
+		Misc::UInt16 words[3];
+		for(int i=0,j=0;i<4;++i)
+			if(i!=largest)
+				{
+				/* The three smallest components are in [-1/sqrt(2), 1/sqrt(2)]: */
+				words[j]=Misc::UInt16(floor((clampUnit(q[i]*sign*Scalar(M_SQRT2))+Scalar(1))*Scalar(16383.5)+Scalar(0.5)));
+				++j;
+				}
+		words[0]|=Misc::UInt16((largest>>1)<<15);
+		words[1]|=Misc::UInt16((largest&0x1)<<15);
+		sink.write(words,3);
+		}
+	else
+		CheriaProtocol::write(rotation,sink);
+	}
+
+CheriaProtocol::Rotation readRotation(const DE& encoding,IO::File& source)
+	{
+	if(encoding.flags&DE::QUANTIZE_ROTATIONS)
+		{
+		/* Read the three smallest components and the largest component's index: */
+		Misc::UInt16 words[3];
+		source.read(words,3);
+		int largest=int((words[0]>>15)<<1)|int(words[1]>>15);
+		
+		/* Reconstruct the quaternion: */
+		Scalar q[4];
+		Scalar sqrSum(0);
+		for(int i=0,j=0;i<4;++i)
+			if(i!=largest)
+				{
+				q[i]=(Scalar(words[j]&0x7fffU)/Scalar(16383.5)-Scalar(1))/Scalar(M_SQRT2);
+				sqrSum+=q[i]*q[i];
+				++j;
+				}
+		q[largest]=sqrSum<Scalar(1)?Scalar(sqrt(Scalar(1)-sqrSum)):Scalar(0);
+		
+		return CheriaProtocol::Rotation(q);
+		}
+	else
+		return CheriaProtocol::read<CheriaProtocol::Rotation>(source);
+	}
+
+void writeValuators(const Scalar* valuators,unsigned int numValuators,const DE& encoding,IO::File& sink)
+	{
+	if(encoding.flags&DE::VALUATORS_8BIT)
+		{
+		for(unsigned int i=0;i<numValuators;++i)
+			sink.write<Misc::SInt8>(quantizeUnit<Misc::SInt8>(valuators[i],Scalar(127)));
+		}
+	else if(encoding.flags&DE::VALUATORS_16BIT)
+		{
+		for(unsigned int i=0;i<numValuators;++i)
+			sink.write<Misc::SInt16>(quantizeUnit<Misc::SInt16>(valuators[i],Scalar(32767)));
+		}
+	else
+		CheriaProtocol::writeArray(valuators,numValuators,sink);
+	}
+
+void readValuators(Scalar* valuators,unsigned int numValuators,const DE& encoding,IO::File& source)
+	{
+	if(encoding.flags&DE::VALUATORS_8BIT)
+		{
+		for(unsigned int i=0;i<numValuators;++i)
+			valuators[i]=Scalar(source.read<Misc::SInt8>())/Scalar(127);
+		}
+	else if(encoding.flags&DE::VALUATORS_16BIT)
+		{
+		for(unsigned int i=0;i<numValuators;++i)
+			valuators[i]=Scalar(source.read<Misc::SInt16>())/Scalar(32767);
+		}
+	else
+		CheriaProtocol::readArray(valuators,numValuators,source);
+	}
+
+}
+
 /********************************************
 Methods of class CheriaProtocol::DeviceState:
 ********************************************/
@@ -40,7 +192,8 @@ CheriaProtocol::DeviceState::DeviceState(int sTrackType,unsigned int sNumButtons
 	 transform(ONTransform::identity),
 	 linearVelocity(Vector::zero),angularVelocity(Vector::zero),
 	 buttonStates(numButtons>0?new Byte[(numButtons+7)/8]:0),
-	 valuatorStates(numValuators>0?new Scalar[numValuators]:0)
+	 valuatorStates(numValuators>0?new Scalar[numValuators]:0),
+	 arena(0)
 	{
 	/* Initialize button states: */
 	for(unsigned int i=0;i<(numButtons+7)/8;++i)
@@ -51,7 +204,7 @@ CheriaProtocol::DeviceState::DeviceState(int sTrackType,unsigned int sNumButtons
 		valuatorStates[i]=Scalar(0);
 	}
 
-CheriaProtocol::DeviceState::DeviceState(IO::File& source)
+CheriaProtocol::DeviceState::DeviceState(IO::File& source,Arena* sArena)
 	:trackType(source.read<Misc::SInt32>()),
 	 numButtons(source.read<Card>()),
 	 numValuators(source.read<Card>()),
@@ -59,8 +212,9 @@ CheriaProtocol::DeviceState::DeviceState(IO::File& source)
 	 rayDirection(0,1,0),rayStart(0),
 	 transform(ONTransform::identity),
 	 linearVelocity(Vector::zero),angularVelocity(Vector::zero),
-	 buttonStates(numButtons>0?new Byte[(numButtons+7)/8]:0),
-	 valuatorStates(numValuators>0?new Scalar[numValuators]:0)
+	 buttonStates(Arena::newArray<Byte>(sArena,(numButtons+7)/8)),
+	 valuatorStates(Arena::newArray<Scalar>(sArena,numValuators)),
+	 arena(sArena)
 	{
 	/* Initialize button states: */
 	for(unsigned int i=0;i<(numButtons+7)/8;++i)
@@ -73,8 +227,8 @@ CheriaProtocol::DeviceState::DeviceState(IO::File& source)
 
 CheriaProtocol::DeviceState::~DeviceState(void)
 	{
-	delete[] buttonStates;
-	delete[] valuatorStates;
+	Arena::deleteArray(arena,buttonStates,(numButtons+7)/8);
+	Arena::deleteArray(arena,valuatorStates,numValuators);
 	}
 
 void CheriaProtocol::DeviceState::skipLayout(IO::File& source)
@@ -90,71 +244,108 @@ void CheriaProtocol::DeviceState::writeLayout(IO::File& sink) const
 	sink.write<Card>(numValuators);
 	}
 
-void CheriaProtocol::DeviceState::read(IO::File& source)
+unsigned int CheriaProtocol::DeviceState::read(IO::File& source,const CheriaProtocol::DeviceEncoding& encoding)
 	{
 	/* Read the update mask: */
 	unsigned int newUpdateMask=source.read<Byte>();
 	
-	/* Read the device's ray direction: */
-	if(newUpdateMask&RAYDIRECTION)
+	if(encoding.flags==DeviceEncoding::NATIVE)
 		{
-		CheriaProtocol::read(rayDirection,source);
-		CheriaProtocol::read(rayStart,source);
+		/* Read all device state components selected by the update mask: */
+		DeviceStateSchema::read(newUpdateMask,*this,source);
 		}
-	
-	/* Read the device's position and orientation: */
-	if(newUpdateMask&TRANSFORM)
-		CheriaProtocol::read(transform,source);
-	
-	/* Read the device's linear and angular velocities: */
-	if(newUpdateMask&VELOCITY)
+	else
 		{
-		CheriaProtocol::read(linearVelocity,source);
-		CheriaProtocol::read(angularVelocity,source);
+		/* Read the natively encoded device state components selected by the update mask: */
+		DeviceStateSchema::read(newUpdateMask&(RAYDIRECTION|VELOCITY|BUTTON),*this,source);
+		
+		/* Read the compactly encoded device state components: */
+		if(newUpdateMask&TRANSFORM)
+			transform=encoding.readTransform(source);
+		if(newUpdateMask&VALUATOR)
+			readValuators(valuatorStates,numValuators,encoding,source);
 		}
 	
-	/* Read the device's button states: */
-	if(newUpdateMask&BUTTON)
-		source.read(buttonStates,(numButtons+7)/8);
-	
-	/* Read the device's valuator states: */
-	if(newUpdateMask&VALUATOR)
-		source.read(valuatorStates,numValuators);
-	
 	/* Update the cumulative update mask: */
 	updateMask|=newUpdateMask;
+	
+	return newUpdateMask;
 	}
 
-void CheriaProtocol::DeviceState::write(unsigned int writeUpdateMask,IO::File& sink) const
+void CheriaProtocol::DeviceState::write(unsigned int writeUpdateMask,const CheriaProtocol::DeviceEncoding& encoding,IO::File& sink) const
 	{
-	/* Write the update mask: */
+	/* Write the update mask, leaving out any groups not sent under the encoding: */
+	writeUpdateMask=encoding.getWriteMask(writeUpdateMask);
 	sink.write<Byte>(writeUpdateMask);
 	
-	/* Write the device's ray direction: */
-	if(writeUpdateMask&RAYDIRECTION)
+	if(encoding.flags==DeviceEncoding::NATIVE)
 		{
-		CheriaProtocol::write(rayDirection,sink);
-		CheriaProtocol::write(rayStart,sink);
+		/* Write all device state components selected by the update mask: */
+		DeviceStateSchema::write(writeUpdateMask,*this,sink);
 		}
-	
-	/* Write the device's position and orientation: */
-	if(writeUpdateMask&TRANSFORM)
-		CheriaProtocol::write(transform,sink);
-	
-	/* Write the device's linear and angular velocities: */
-	if(writeUpdateMask&VELOCITY)
+	else
 		{
-		CheriaProtocol::write(linearVelocity,sink);
-		CheriaProtocol::write(angularVelocity,sink);
+		/* Write the natively encoded device state components selected by the update mask: */
+		DeviceStateSchema::write(writeUpdateMask&(RAYDIRECTION|VELOCITY|BUTTON),*this,sink);
+		
+		/* Write the compactly encoded device state components: */
+		if(writeUpdateMask&TRANSFORM)
+			encoding.writeTransform(transform,sink);
+		if(writeUpdateMask&VALUATOR)
+			writeValuators(valuatorStates,numValuators,encoding,sink);
 		}
-	
-	/* Write the device's button states: */
-	if(writeUpdateMask&BUTTON)
-		sink.write(buttonStates,(numButtons+7)/8);
-	
-	/* Write the device's valuator states: */
-	if(writeUpdateMask&VALUATOR)
-		sink.write(valuatorStates,numValuators);
+	}
+
+void CheriaProtocol::DeviceState::copy(unsigned int copyUpdateMask,const CheriaProtocol::DeviceState& source)
+	{
+	DeviceStateSchema::copy(copyUpdateMask,*this,source);
+	updateMask|=copyUpdateMask;
+	}
+
+/***********************************************
+Methods of class CheriaProtocol::DeviceEncoding:
+***********************************************/
+
+CheriaProtocol::DeviceEncoding::DeviceEncoding(void)
+	:flags(NATIVE),
+	 boxCenter(Point::origin),boxSize(1)
+	{
+	}
+
+bool CheriaProtocol::DeviceEncoding::isValid(void) const
+	{
+	/* Check for unknown flags, conflicting valuator encodings, and a degenerate position box: */
+	if(flags&~ALL_FLAGS)
+		return false;
+	if((flags&VALUATORS_8BIT)&&(flags&VALUATORS_16BIT))
+		return false;
+	return (flags&QUANTIZE_POSITIONS)==0x0U||boxSize>Scalar(0);
+	}
+
+void CheriaProtocol::DeviceEncoding::read(IO::File& source)
+	{
+	flags=source.read<Card>();
+	CheriaProtocol::read(boxCenter,source);
+	boxSize=source.read<Scalar>();
+	}
+
+void CheriaProtocol::DeviceEncoding::write(IO::File& sink) const
+	{
+	sink.write<Card>(flags);
+	CheriaProtocol::write(boxCenter,sink);
+	sink.write<Scalar>(boxSize);
+	}
+
+CheriaProtocol::ONTransform CheriaProtocol::DeviceEncoding::readTransform(IO::File& source) const
+	{
+	Vector translation=readPosition(*this,source);
+	return ONTransform(translation,readRotation(*this,source));
+	}
+
+void CheriaProtocol::DeviceEncoding::writeTransform(const CheriaProtocol::ONTransform& transform,IO::File& sink) const
+	{
+	writePosition(transform.getTranslation(),*this,sink);
+	writeRotation(transform.getRotation(),*this,sink);
 	}
 
 /******************************************
@@ -164,20 +355,22 @@ Methods of class CheriaProtocol::ToolState:
 CheriaProtocol::ToolState::ToolState(const char* sClassName,unsigned int sNumButtonSlots,unsigned int sNumValuatorSlots)
 	:className(sClassName),
 	 numButtonSlots(sNumButtonSlots),buttonSlots(numButtonSlots>0?new Slot[numButtonSlots]:0),
-	 numValuatorSlots(sNumValuatorSlots),valuatorSlots(numValuatorSlots>0?new Slot[numValuatorSlots]:0)
+	 numValuatorSlots(sNumValuatorSlots),valuatorSlots(numValuatorSlots>0?new Slot[numValuatorSlots]:0),
+	 arena(0)
 	{
 	}	
 
-CheriaProtocol::ToolState::ToolState(IO::File& source)
+CheriaProtocol::ToolState::ToolState(IO::File& source,Arena* sArena)
 	:buttonSlots(0),
-	 valuatorSlots(0)
+	 valuatorSlots(0),
+	 arena(sArena)
 	{
 	/* Read the tool's class name: */
 	CheriaProtocol::read(className,source);
 	
 	/* Read the tool's button slots: */
 	numButtonSlots=source.read<Card>();
-	buttonSlots=new Slot[numButtonSlots];
+	buttonSlots=Arena::newArray<Slot>(arena,numButtonSlots);
 	for(unsigned int buttonSlotIndex=0;buttonSlotIndex<numButtonSlots;++buttonSlotIndex)
 		{
 		buttonSlots[buttonSlotIndex].deviceId=source.read<Card>();
@@ -186,7 +379,7 @@ CheriaProtocol::ToolState::ToolState(IO::File& source)
 	
 	/* Read the tool's valuator slots: */
 	numValuatorSlots=source.read<Card>();
-	valuatorSlots=new Slot[numValuatorSlots];
+	valuatorSlots=Arena::newArray<Slot>(arena,numValuatorSlots);
 	for(unsigned int valuatorSlotIndex=0;valuatorSlotIndex<numValuatorSlots;++valuatorSlotIndex)
 		{
 		valuatorSlots[valuatorSlotIndex].deviceId=source.read<Card>();
@@ -196,8 +389,8 @@ CheriaProtocol::ToolState::ToolState(IO::File& source)
 
 CheriaProtocol::ToolState::~ToolState(void)
 	{
-	delete[] buttonSlots;
-	delete[] valuatorSlots;
+	Arena::deleteArray(arena,buttonSlots,numButtonSlots);
+	Arena::deleteArray(arena,valuatorSlots,numValuatorSlots);
 	}
 
 void CheriaProtocol::ToolState::skip(IO::File& source)
@@ -241,6 +434,6 @@ Static elements of class CheriaProtocol:
 ***************************************/
 
 const char* CheriaProtocol::protocolName="Cheria"; // How inventive
-const unsigned int CheriaProtocol::protocolVersion=(3U<<16)+0U; // Version 3.0
+const unsigned int CheriaProtocol::protocolVersion=(4U<<16)+1U; // Version 4.1
 
 }
@@ -27,6 +27,11 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <string>
 #include <Collaboration/Protocol.h>
 
+/* Forward declarations: */
+namespace Collaboration {
+class Arena;
+}
+
 namespace Collaboration {
 
 class CheriaProtocol:public Protocol
@@ -40,9 +45,12 @@ class CheriaProtocol:public Protocol
 		CREATE_TOOL,
 		DESTROY_TOOL,
 		DEVICE_STATES,
+		DEVICE_SAMPLES, // Size-prefixed batch of timestamped device transformations recorded since the previous client update; relayed unchanged by the server
 		MESSAGES_END
 		};
 	
+	struct DeviceEncoding;
+	
 	struct DeviceState // Structure to exchange input device data between server and clients
 		{
 		/* Embedded classes: */
@@ -70,10 +78,11 @@ class CheriaProtocol:public Protocol
 		Vector linearVelocity,angularVelocity; // Device's linear and angular velocities in client's physical space
 		Byte* buttonStates; // Bit array of button flags
 		Scalar* valuatorStates; // Array of valuator values
+		Arena* arena; // Memory arena from which the button and valuator state arrays are allocated, or null to use the heap
 		
 		/* Constructors and destructors: */
 		DeviceState(int sTrackType,unsigned int sNumButtons,unsigned int sNumValuators); // Creates device state with given layout
-		DeviceState(IO::File& source); // Creates device state with layout read from file
+		DeviceState(IO::File& source,Arena* sArena =0); // Creates device state with layout read from file, allocating from the given memory arena
 		private:
 		DeviceState(const DeviceState& source); // Prohibit copy constructor
 		DeviceState& operator=(const DeviceState& source); // Prohibit assignment operator
@@ -83,8 +92,49 @@ class CheriaProtocol:public Protocol
 		/* Methods: */
 		static void skipLayout(IO::File& source); // Skips a device layout transmitted on the given source
 		void writeLayout(IO::File& sink) const; // Writes device's layout to the given sink
-		void read(IO::File& source); // Reads device's state from the given source
-		void write(unsigned int writeUpdateMask,IO::File& sink) const; // Writes device's state to the given sink
+		unsigned int read(IO::File& source,const DeviceEncoding& encoding); // Reads device's state from the given source using the given encoding; returns the update mask of the read components
+		void write(unsigned int writeUpdateMask,const DeviceEncoding& encoding,IO::File& sink) const; // Writes device's state to the given sink using the given encoding
+		void copy(unsigned int copyUpdateMask,const DeviceState& source); // Copies the components selected by the update mask from a device state of the same layout, and adds them to the cumulative update mask
+		};
+	
+	struct DeviceEncoding // Structure describing how a client encodes the states of its devices; negotiated during connection
+		{
+		/* Embedded classes: */
+		public:
+		enum Flags // Enumerated type for encoding flags
+			{
+			NATIVE=0x0,              // All components are sent at full precision
+			QUANTIZE_POSITIONS=0x1,  // Device positions are sent as 16-bit fixed-point offsets inside the client's position box
+			QUANTIZE_ROTATIONS=0x2,  // Device orientations are sent as 48-bit smallest-three quaternions
+			DERIVE_VELOCITIES=0x4,   // Device velocities are not sent, and receivers derive them from successive transformations
+			VALUATORS_8BIT=0x8,      // Valuator values are sent as 8-bit fixed-point numbers
+			VALUATORS_16BIT=0x10,    // Valuator values are sent as 16-bit fixed-point numbers
+			ALL_FLAGS=0x1f
+			};
+		
+		/* Elements: */
+		public:
+		unsigned int flags; // Bit mask of encoding flags
+		Point boxCenter; // Center of the box inside which positions are quantized, in client's physical space
+		Scalar boxSize; // Half side length of the box inside which positions are quantized
+		
+		/* Constructors and destructors: */
+		DeviceEncoding(void); // Creates the native encoding
+		
+		/* Methods: */
+		static size_t getSize(void) // Returns the size of an encoding description on the wire
+			{
+			return sizeof(Card)+4*sizeof(Scalar);
+			}
+		bool isValid(void) const; // Returns true if the encoding can be used
+		void read(IO::File& source); // Reads an encoding description from the given source
+		void write(IO::File& sink) const; // Writes an encoding description to the given sink
+		ONTransform readTransform(IO::File& source) const; // Reads a device transformation in this encoding from the given source
+		void writeTransform(const ONTransform& transform,IO::File& sink) const; // Writes a device transformation in this encoding to the given sink
+		unsigned int getWriteMask(unsigned int updateMask) const // Returns the update mask of the groups that are actually sent for the given update mask
+			{
+			return (flags&DERIVE_VELOCITIES)?updateMask&~DeviceState::VELOCITY:updateMask;
+			}
 		};
 	
 	struct ToolState // Structure to exchange tool data between server and clients
@@ -105,10 +155,11 @@ class CheriaProtocol:public Protocol
 		Slot* buttonSlots; // Array of button slot assignments
 		unsigned int numValuatorSlots; // Number of valuator slots in tool's input assignment
 		Slot* valuatorSlots; // Array of valuator slot assignments
+		Arena* arena; // Memory arena from which the slot arrays are allocated, or null to use the heap
 		
 		/* Constructors and destructors: */
 		ToolState(const char* sClassName,unsigned int sNumButtonSlots,unsigned int sNumValuatorSlots); // Creates tool state with given class and input layout
-		ToolState(IO::File& source); // Creates tool state by reading class name and input layout and assignment from the given source
+		ToolState(IO::File& source,Arena* sArena =0); // Creates tool state by reading class name and input layout and assignment from the given source, allocating from the given memory arena
 		private:
 		ToolState(const ToolState& source); // Prohibit copy constructor
 		ToolState& operator=(const ToolState& source); // Prohibit assignment operator
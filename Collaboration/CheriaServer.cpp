@@ -25,11 +25,13 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <Collaboration/CheriaServer.h>
 
+#include <stdexcept>
 #if DEBUGGING
 #include <iostream>
 #endif
 #include <Misc/ThrowStdErr.h>
 #include <Comm/NetPipe.h>
+#include <Collaboration/Arena.h>
 
 namespace Collaboration {
 
@@ -38,19 +40,47 @@ Methods of class CheriaServer::ClientState:
 ******************************************/
 
 CheriaServer::ClientState::ClientState(void)
-	:clientDevices(17),clientTools(17)
+	:clientDevices(17),clientTools(17),deviceUses(17)
 	{
 	}
 
 CheriaServer::ClientState::~ClientState(void)
 	{
-	/* Delete all device states: */
+	/* Destroy all device states: */
 	for(ClientDeviceMap::Iterator cdIt=clientDevices.begin();!cdIt.isFinished();++cdIt)
-		delete cdIt->getDest();
+		getArena().destroy(cdIt->getDest());
 	
-	/* Delete all tool states: */
+	/* Destroy all tool states: */
 	for(ClientToolMap::Iterator ctIt=clientTools.begin();!ctIt.isFinished();++ctIt)
-		delete ctIt->getDest();
+		getArena().destroy(ctIt->getDest());
+	}
+
+void CheriaServer::ClientState::useDevices(const CheriaProtocol::ToolState& tool)
+	{
+	for(unsigned int i=0;i<tool.numButtonSlots+tool.numValuatorSlots;++i)
+		{
+		unsigned int deviceId=i<tool.numButtonSlots?tool.buttonSlots[i].deviceId:tool.valuatorSlots[i-tool.numButtonSlots].deviceId;
+		unsigned int& numUses=deviceUses[deviceId];
+		if(numUses==0)
+			{
+			/* Forward the device's current button and valuator states with the next update, as they were withheld while the device was unused: */
+			ClientDeviceMap::Iterator cdIt=clientDevices.findEntry(deviceId);
+			if(!cdIt.isFinished())
+				cdIt->getDest()->updateMask|=DeviceState::BUTTON|DeviceState::VALUATOR;
+			}
+		++numUses;
+		}
+	}
+
+void CheriaServer::ClientState::releaseDevices(const CheriaProtocol::ToolState& tool)
+	{
+	for(unsigned int i=0;i<tool.numButtonSlots+tool.numValuatorSlots;++i)
+		{
+		unsigned int deviceId=i<tool.numButtonSlots?tool.buttonSlots[i].deviceId:tool.valuatorSlots[i-tool.numButtonSlots].deviceId;
+		DeviceUseMap::Iterator duIt=deviceUses.findEntry(deviceId);
+		if(!duIt.isFinished()&&--duIt->getDest()==0)
+			deviceUses.removeEntry(duIt);
+		}
 	}
 
 /*****************************
@@ -75,6 +105,12 @@ unsigned int CheriaServer::getNumMessages(void) const
 	return MESSAGES_END;
 	}
 
+bool CheriaServer::canShareSpectatorUpdates(void) const
+	{
+	/* Server updates only depend on the source clients' accumulated device states: */
+	return true;
+	}
+
 ProtocolServer::ClientState* CheriaServer::receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe)
 	{
 	#if DEBUGGING
@@ -82,35 +118,42 @@ ProtocolServer::ClientState* CheriaServer::receiveConnectRequest(unsigned int pr
 	#endif
 	
 	/* Check the protocol message length: */
-	if(protocolMessageLength!=sizeof(Card))
+	if(protocolMessageLength<sizeof(Card))
 		{
 		/* Fatal error; stop communicating with client entirely: */
-		Misc::throwStdErr("CheriaServer::receiveConnectRequest: Protocol error; received %u bytes instead of %u",protocolMessageLength,(unsigned int)sizeof(Card));
+		Misc::throwStdErr("CheriaServer::receiveConnectRequest: Protocol error; received %u bytes instead of at least %u",protocolMessageLength,(unsigned int)sizeof(Card));
 		}
 	
 	/* Read the client's protocol version: */
 	unsigned int clientProtocolVersion=pipe.read<Card>();
 	
-	/* Check for the correct version number: */
-	if(clientProtocolVersion==protocolVersion)
+	/* Check for the correct version number and message length: */
+	if(clientProtocolVersion==protocolVersion&&protocolMessageLength==sizeof(Card)+DeviceEncoding::getSize())
 		{
+		/* Read the client's requested device state encoding: */
+		DeviceEncoding encoding;
+		encoding.read(pipe);
+		if(!encoding.isValid())
+			return 0;
+		
 		/* Create the new client state object and set its message buffer's endianness: */
 		ClientState* result=new ClientState;
+		result->encoding=encoding;
 		result->messageBuffer.setSwapOnWrite(pipe.mustSwapOnWrite());
 		
 		return result;
 		}
 	else
+		{
+		/* Skip the rest of the message: */
+		pipe.skip<Byte>(protocolMessageLength-sizeof(Card));
+		
 		return 0;
+		}
 	}
 
-void CheriaServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe)
+void CheriaServer::receiveClientUpdate(CheriaServer::ClientState* cs,Comm::NetPipe& pipe)
 	{
-	/* Get a handle on the Cheria state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("CheriaServer::receiveClientUpdate: Client state object has mismatching type");
-	
 	/* Read all messages from the pipe: */
 	bool goOn=true;
 	while(goOn)
@@ -127,16 +170,16 @@ void CheriaServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::Net
 				std::cout<<"CREATE_DEVICE "<<newDeviceId<<"..."<<std::flush;
 				#endif
 				
-				/* Create the new device: */
-				DeviceState* newDevice=new DeviceState(pipe);
+				/* Create the new device in the client's memory arena: */
+				DeviceState* newDevice=new(cs->getArena()) DeviceState(pipe,&cs->getArena());
 				
 				/* Store the new device in the client's device map: */
-				myCs->clientDevices[newDeviceId]=newDevice;
+				cs->clientDevices[newDeviceId]=newDevice;
 				
 				/* Append a creation message to the client's outgoing buffer: */
-				writeMessage(CREATE_DEVICE,myCs->messageBuffer);
-				myCs->messageBuffer.write<Card>(newDeviceId);
-				newDevice->writeLayout(myCs->messageBuffer);
+				writeMessage(CREATE_DEVICE,cs->messageBuffer);
+				cs->messageBuffer.write<Card>(newDeviceId);
+				newDevice->writeLayout(cs->messageBuffer);
 				
 				#if DEBUGGING
 				std::cout<<" "<<newDevice->numButtons<<", "<<newDevice->numValuators<<std::endl<<std::flush;
@@ -155,17 +198,18 @@ void CheriaServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::Net
 				#endif
 				
 				/* Erase the device from the client's device map: */
-				ClientDeviceMap::Iterator cdIt=myCs->clientDevices.findEntry(deviceId);
+				ClientDeviceMap::Iterator cdIt=cs->clientDevices.findEntry(deviceId);
 				if(!cdIt.isFinished())
 					{
-					/* Delete the device: */
-					delete cdIt->getDest();
-					myCs->clientDevices.removeEntry(cdIt);
+					/* Destroy the device: */
+					cs->getArena().destroy(cdIt->getDest());
+					cs->clientDevices.removeEntry(cdIt);
 					}
+				cs->deviceUses.removeEntry(deviceId);
 				
 				/* Append the message to the client's outgoing buffer: */
-				writeMessage(DESTROY_DEVICE,myCs->messageBuffer);
-				myCs->messageBuffer.write<Card>(deviceId);
+				writeMessage(DESTROY_DEVICE,cs->messageBuffer);
+				cs->messageBuffer.write<Card>(deviceId);
 				
 				break;
 				}
@@ -179,16 +223,17 @@ void CheriaServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::Net
 				std::cout<<"CREATE_TOOL "<<newToolId<<"..."<<std::flush;
 				#endif
 				
-				/* Create the new tool: */
-				ToolState* newTool=new ToolState(pipe);
+				/* Create the new tool in the client's memory arena: */
+				ToolState* newTool=new(cs->getArena()) ToolState(pipe,&cs->getArena());
 				
-				/* Store the new tool in the client's tool map: */
-				myCs->clientTools[newToolId]=newTool;
+				/* Store the new tool in the client's tool map and mark the devices it uses: */
+				cs->clientTools[newToolId]=newTool;
+				cs->useDevices(*newTool);
 				
 				/* Append the message to the client's outgoing buffer: */
-				writeMessage(CREATE_TOOL,myCs->messageBuffer);
-				myCs->messageBuffer.write<Card>(newToolId);
-				newTool->write(myCs->messageBuffer);
+				writeMessage(CREATE_TOOL,cs->messageBuffer);
+				cs->messageBuffer.write<Card>(newToolId);
+				newTool->write(cs->messageBuffer);
 				
 				#if DEBUGGING
 				std::cout<<" "<<newTool->numButtonSlots<<", "<<newTool->numValuatorSlots<<std::endl<<std::flush;
@@ -207,17 +252,38 @@ void CheriaServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::Net
 				#endif
 				
 				/* Erase the tool from the client's tool map: */
-				ClientToolMap::Iterator ctIt=myCs->clientTools.findEntry(toolId);
+				ClientToolMap::Iterator ctIt=cs->clientTools.findEntry(toolId);
 				if(!ctIt.isFinished())
 					{
-					/* Delete the tool: */
-					delete ctIt->getDest();
-					myCs->clientTools.removeEntry(ctIt);
+					/* Destroy the tool and release the devices it used: */
+					cs->releaseDevices(*ctIt->getDest());
+					cs->getArena().destroy(ctIt->getDest());
+					cs->clientTools.removeEntry(ctIt);
 					}
 				
 				/* Append the message to the client's outgoing buffer: */
-				writeMessage(DESTROY_TOOL,myCs->messageBuffer);
-				myCs->messageBuffer.write<Card>(toolId);
+				writeMessage(DESTROY_TOOL,cs->messageBuffer);
+				cs->messageBuffer.write<Card>(toolId);
+				
+				break;
+				}
+			
+			case DEVICE_SAMPLES:
+				{
+				/* Read the size of the sample batch: */
+				size_t batchSize=pipe.read<Card>();
+				
+				/* Append the sample batch to the client's outgoing buffer without decoding it: */
+				writeMessage(DEVICE_SAMPLES,cs->messageBuffer);
+				cs->messageBuffer.write<Card>(Card(batchSize));
+				Byte chunk[256];
+				while(batchSize>0)
+					{
+					size_t chunkSize=batchSize<sizeof(chunk)?batchSize:sizeof(chunk);
+					pipe.readRaw(chunk,chunkSize);
+					cs->messageBuffer.writeRaw(chunk,chunkSize);
+					batchSize-=chunkSize;
+					}
 				
 				break;
 				}
@@ -226,10 +292,10 @@ void CheriaServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::Net
 				{
 				/* Read all contained status messages: */
 				unsigned int deviceId;
-				while((deviceId=pipe.read<Card>())!=0)
+				while((deviceId=readVarCard(pipe))!=0)
 					{
 					/* Update the device state: */
-					myCs->clientDevices.getEntry(deviceId).getDest()->read(pipe);
+					cs->clientDevices.getEntry(deviceId).getDest()->read(pipe,cs->encoding);
 					}
 				
 				/* This is the last message: */
@@ -243,28 +309,15 @@ void CheriaServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::Net
 		}
 	}
 
-void CheriaServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+void CheriaServer::assembleClientConnect(CheriaServer::ClientState* sourceCs,bool swapOnWrite)
 	{
-	/* Get handles on the Cheria state objects: */
-	ClientState* mySourceCs=dynamic_cast<ClientState*>(sourceCs);
-	ClientState* myDestCs=dynamic_cast<ClientState*>(destCs);
-	if(mySourceCs==0||myDestCs==0)
-		Misc::throwStdErr("CheriaServer::sendClientConnect: Client state object has mismatching type");
-	
-	#if DEBUGGING
-	std::cout<<"CheriaServer::sendClientConnect..."<<std::flush;
-	#endif
-	
-	/* Create a temporary message buffer with the same endianness as the pipe's write end: */
-	MessageBuffer buffer;
-	buffer.setSwapOnWrite(pipe.mustSwapOnWrite());
-	
-	/*********************************************************************
-	Assemble the update message in the temporary buffer:
-	*********************************************************************/
+	/* Prepare the reusable connect message buffer with the given endianness: */
+	MessageBuffer& buffer=connectMessageBuffer;
+	buffer.clear();
+	buffer.setSwapOnWrite(swapOnWrite);
 	
 	/* Send creation messages for the source client's devices to the destination client: */
-	for(ClientDeviceMap::Iterator cdIt=mySourceCs->clientDevices.begin();!cdIt.isFinished();++cdIt)
+	for(ClientDeviceMap::Iterator cdIt=sourceCs->clientDevices.begin();!cdIt.isFinished();++cdIt)
 		{
 		writeMessage(CREATE_DEVICE,buffer);
 		buffer.write<Card>(cdIt->getSource());
@@ -272,7 +325,7 @@ void CheriaServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,Proto
 		}
 	
 	/* Send creation messages for the source client's tools to the destination client: */
-	for(ClientToolMap::Iterator ctIt=mySourceCs->clientTools.begin();!ctIt.isFinished();++ctIt)
+	for(ClientToolMap::Iterator ctIt=sourceCs->clientTools.begin();!ctIt.isFinished();++ctIt)
 		{
 		writeMessage(CREATE_TOOL,buffer);
 		buffer.write<Card>(ctIt->getSource());
@@ -281,84 +334,113 @@ void CheriaServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,Proto
 	
 	/* Send the current states of the source client's devices: */
 	writeMessage(DEVICE_STATES,buffer);
-	for(ClientDeviceMap::Iterator cdIt=mySourceCs->clientDevices.begin();!cdIt.isFinished();++cdIt)
+	for(ClientDeviceMap::Iterator cdIt=sourceCs->clientDevices.begin();!cdIt.isFinished();++cdIt)
 		{
 		/* Send a device state message: */
-		buffer.write<Card>(cdIt->getSource());
-		cdIt->getDest()->write(DeviceState::FULL_UPDATE,buffer);
+		writeVarCard(cdIt->getSource(),buffer);
+		cdIt->getDest()->write(sourceCs->getForwardMask(cdIt->getSource(),DeviceState::FULL_UPDATE),sourceCs->encoding,buffer);
 		}
-	buffer.write<Card>(0);
-	
-	/*********************************************************************
-	Send the assembled message to the client in one go:
-	*********************************************************************/
+	writeVarCard(0,buffer);
 	
 	#if DEBUGGING
-	std::cout<<" message size "<<buffer.getDataSize()<<std::endl;
+	std::cout<<"CheriaServer: Assembled connect message of size "<<buffer.getDataSize()<<std::endl;
 	#endif
+	}
+
+void CheriaServer::writeClientConnect(const CheriaServer::ClientState* sourceCs,IO::File& sink)
+	{
+	/* Write the source client's device state encoding and the message's total size first: */
+	sourceCs->encoding.write(sink);
+	sink.write<Card>(connectMessageBuffer.getDataSize());
 	
-	/* Write the message's total size first: */
-	pipe.write<Card>(buffer.getDataSize());
+	/* Write the assembled message itself: */
+	connectMessageBuffer.writeToSink(sink);
+	}
+
+void CheriaServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::UpdateDestination* destinations,unsigned int numDestinations)
+	{
+	ClientState* mySourceCs=cast<ClientState>(sourceCs);
 	
-	/* Write the message itself: */
-	buffer.writeToSink(pipe);
+	/* Assemble the source client's connect message once for each byte order used by the destination clients, and send it to all destinations of that byte order: */
+	for(int swap=0;swap<2;++swap)
+		{
+		bool assembled=false;
+		for(UpdateDestination* dIt=destinations;dIt!=destinations+numDestinations;++dIt)
+			if(dIt->pipe->mustSwapOnWrite()==(swap!=0))
+				{
+				if(!assembled)
+					{
+					assembleClientConnect(mySourceCs,swap!=0);
+					assembled=true;
+					}
+				
+				try
+					{
+					writeClientConnect(mySourceCs,*dIt->pipe);
+					}
+				catch(std::runtime_error err)
+					{
+					/* Flag the destination as failed and carry on with the others: */
+					dIt->failed=true;
+					dIt->error=err.what();
+					}
+				}
+		}
+	
+	/* Reset the buffer for the next connecting client: */
+	connectMessageBuffer.clear();
 	}
 
-void CheriaServer::beforeServerUpdate(ProtocolServer::ClientState* cs)
+void CheriaServer::sendClientConnect(CheriaServer::ClientState* sourceCs,CheriaServer::ClientState* destCs,Comm::NetPipe& pipe)
 	{
-	/* Get a handle on the Cheria state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("CheriaServer::beforeServerUpdate: Client state object has mismatching type");
+	/* Assemble the connect message with the same endianness as the pipe's write end, and send it to the client in one go: */
+	assembleClientConnect(sourceCs,pipe.mustSwapOnWrite());
+	writeClientConnect(sourceCs,pipe);
 	
+	/* Reset the buffer for the next connecting client: */
+	connectMessageBuffer.clear();
+	}
+
+void CheriaServer::beforeServerUpdate(CheriaServer::ClientState* cs)
+	{
 	/* Send the current states of the source client's managed input devices: */
-	writeMessage(DEVICE_STATES,myCs->messageBuffer);
-	for(ClientDeviceMap::Iterator cdIt=myCs->clientDevices.begin();!cdIt.isFinished();++cdIt)
+	writeMessage(DEVICE_STATES,cs->messageBuffer);
+	for(ClientDeviceMap::Iterator cdIt=cs->clientDevices.begin();!cdIt.isFinished();++cdIt)
 		{
-		if(cdIt->getDest()->updateMask!=DeviceState::NO_CHANGE)
+		unsigned int forwardMask=cs->getForwardMask(cdIt->getSource(),cdIt->getDest()->updateMask);
+		if(forwardMask!=DeviceState::NO_CHANGE)
 			{
 			/* Send a device state message: */
-			myCs->messageBuffer.write<Card>(cdIt->getSource());
-			cdIt->getDest()->write(cdIt->getDest()->updateMask,myCs->messageBuffer);
-			
-			/* Reset the device's update mask: */
-			cdIt->getDest()->updateMask=DeviceState::NO_CHANGE;
+			writeVarCard(cdIt->getSource(),cs->messageBuffer);
+			cdIt->getDest()->write(forwardMask,cs->encoding,cs->messageBuffer);
 			}
+		
+		/* Reset the device's update mask: */
+		cdIt->getDest()->updateMask=DeviceState::NO_CHANGE;
 		}
 	
 	/* Terminate the device state update message: */
-	myCs->messageBuffer.write<Card>(0);
+	writeVarCard(0,cs->messageBuffer);
 	}
 
-void CheriaServer::sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+void CheriaServer::sendServerUpdate(CheriaServer::ClientState* sourceCs,CheriaServer::ClientState* destCs,Comm::NetPipe& pipe)
 	{
-	/* Get handles on the Cheria state objects: */
-	ClientState* mySourceCs=dynamic_cast<ClientState*>(sourceCs);
-	ClientState* myDestCs=dynamic_cast<ClientState*>(destCs);
-	if(mySourceCs==0||myDestCs==0)
-		Misc::throwStdErr("CheriaServer::sendServerUpdate: Client state object has mismatching type");
-	
 	/*********************************************************************
 	Send the source client's accumulated state tracking messages to the
 	destination client:
 	*********************************************************************/
 	
 	/* Send the total size of the message first: */
-	pipe.write<Card>(mySourceCs->messageBuffer.getDataSize());
+	pipe.write<Card>(sourceCs->messageBuffer.getDataSize());
 	
 	/* Write the message itself: */
-	mySourceCs->messageBuffer.writeToSink(pipe);
+	sourceCs->messageBuffer.writeToSink(pipe);
 	}
 
-void CheriaServer::afterServerUpdate(ProtocolServer::ClientState* cs)
+void CheriaServer::afterServerUpdate(CheriaServer::ClientState* cs)
 	{
-	/* Get a handle on the Cheria state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("CheriaServer::afterServerUpdate: Client state object has mismatching type");
-	
 	/* Clear the client's message buffer: */
-	myCs->messageBuffer.clear();
+	cs->messageBuffer.clear();
 	}
 
 }
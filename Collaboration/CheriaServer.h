@@ -24,19 +24,22 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #ifndef COLLABORATION_CHERIASERVER_INCLUDED
 #define COLLABORATION_CHERIASERVER_INCLUDED
 
-#include <Misc/HashTable.h>
 #include <IO/VariableMemoryFile.h>
-#include <Collaboration/ProtocolServer.h>
+#include <Collaboration/FlatHashTable.h>
+#include <Collaboration/ProtocolServerT.h>
 #include <Collaboration/CheriaProtocol.h>
 
 namespace Collaboration {
 
-class CheriaServer:public ProtocolServer,private CheriaProtocol
+class CheriaServer:public ProtocolServerT<CheriaServer>,private CheriaProtocol
 	{
+	friend class ProtocolServerT<CheriaServer>;
+	
 	/* Embedded classes: */
 	private:
-	typedef Misc::HashTable<unsigned int,DeviceState*> ClientDeviceMap; // Map from client device IDs to device states
-	typedef Misc::HashTable<unsigned int,ToolState*> ClientToolMap; // Map from client tool IDs to tool states
+	typedef FlatHashTable<unsigned int,DeviceState*> ClientDeviceMap; // Map from client device IDs to device states
+	typedef FlatHashTable<unsigned int,ToolState*> ClientToolMap; // Map from client tool IDs to tool states
+	typedef FlatHashTable<unsigned int,unsigned int> DeviceUseMap; // Map from client device IDs to the number of tool slots assigned to them
 	typedef IO::VariableMemoryFile MessageBuffer; // Buffer to hold outgoing messages from a client between two updates
 	
 	class ClientState:public ProtocolServer::ClientState
@@ -47,13 +50,31 @@ class CheriaServer:public ProtocolServer,private CheriaProtocol
 		private:
 		ClientDeviceMap clientDevices; // Map of devices managed by the client
 		ClientToolMap clientTools; // Map of tools managed by the client
+		DeviceUseMap deviceUses; // Map of devices managed by the client that are used by at least one of the client's tools
+		DeviceEncoding encoding; // Encoding the client uses for its device states, which is also used to forward them to other clients
 		MessageBuffer messageBuffer; // Buffer for outgoing messages from this client
 		
 		/* Constructors and destructors: */
 		ClientState(void);
 		virtual ~ClientState(void);
+		
+		/* Methods: */
+		void useDevices(const ToolState& tool); // Counts the slots of the given tool towards the devices assigned to them
+		void releaseDevices(const ToolState& tool); // Removes the slots of the given tool from the devices assigned to them
+		unsigned int getForwardMask(unsigned int deviceId,unsigned int updateMask) const // Returns the part of the given update mask of the given device that is forwarded to other clients
+			{
+			/* Don't forward button or valuator states of devices that are not used by any tools: */
+			return deviceUses.isEntry(deviceId)?updateMask:updateMask&~(DeviceState::BUTTON|DeviceState::VALUATOR);
+			}
 		};
 	
+	/* Elements: */
+	MessageBuffer connectMessageBuffer; // Buffer to assemble client connect messages, reused between connecting clients
+	
+	/* Private methods: */
+	void assembleClientConnect(ClientState* sourceCs,bool swapOnWrite); // Assembles the given client's connect message in the connect message buffer using the given endianness
+	void writeClientConnect(const ClientState* sourceCs,IO::File& sink); // Writes the connect message assembled for the given client to the given sink
+	
 	/* Constructors and destructors: */
 	public:
 	CheriaServer(void); // Creates a Cheria server object
@@ -62,12 +83,16 @@ class CheriaServer:public ProtocolServer,private CheriaProtocol
 	/* Methods from ProtocolServer: */
 	virtual const char* getName(void) const;
 	virtual unsigned int getNumMessages(void) const;
+	virtual bool canShareSpectatorUpdates(void) const;
 	virtual ProtocolServer::ClientState* receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe);
-	virtual void receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe);
-	virtual void sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
-	virtual void beforeServerUpdate(ProtocolServer::ClientState* cs);
-	virtual void sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
-	virtual void afterServerUpdate(ProtocolServer::ClientState* cs);
+	virtual void sendClientConnect(ProtocolServer::ClientState* sourceCs,UpdateDestination* destinations,unsigned int numDestinations);
+	
+	/* Statically dispatched hooks from ProtocolServerT: */
+	void receiveClientUpdate(ClientState* cs,Comm::NetPipe& pipe);
+	void sendClientConnect(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe);
+	void beforeServerUpdate(ClientState* cs);
+	void sendServerUpdate(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe);
+	void afterServerUpdate(ClientState* cs);
 	};
 
 }
@@ -33,6 +33,8 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <Misc/StandardValueCoders.h>
 #include <Misc/CompoundValueCoders.h>
 #include <Misc/StringMarshaller.h>
+#include <Misc/Time.h>
+#include <Math/Math.h>
 #include <Cluster/MulticastPipe.h>
 #include <Cluster/OpenPipe.h>
 #include <GL/gl.h>
@@ -49,6 +51,8 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <GLMotif/ToggleButton.h>
 #include <Vrui/Vrui.h>
 #include <Vrui/Viewer.h>
+#include <Collaboration/CompressedPipe.h>
+#include <Collaboration/BufferedPipe.h>
 
 namespace Collaboration {
 
@@ -580,9 +584,12 @@ void* CollaborationClient::communicationThreadMethod(void)
 					Send a client update packet in response to the server update:
 					*************************************************************/
 					
+					/* Spectators cannot change the shared state; their plug-ins' client update messages are written to a sink and discarded: */
+					Comm::NetPipe& updatePipe=spectatorSink!=0?static_cast<Comm::NetPipe&>(*spectatorSink):*pipe;
+					
 					/* Let protocol plug-ins insert their own messages before the main update message: */
 					for(ProtocolList::iterator pIt=protocols.begin();pIt!=protocols.end();++pIt)
-						(*pIt)->beforeClientUpdate(*pipe);
+						(*pIt)->beforeClientUpdate(updatePipe);
 					
 					/* Process higher-level protocols: */
 					beforeClientUpdate();
@@ -591,19 +598,24 @@ void* CollaborationClient::communicationThreadMethod(void)
 					Threads::Mutex::Lock pipeLock(pipeMutex);
 					writeMessage(CLIENT_UPDATE,*pipe);
 					
-					/* Send the local client state: */
+					/* Send the local client state, or an empty client update if the client is a spectator: */
 					{
 					Threads::Spinlock::Lock clientStateLock(clientStateMutex);
-					writeClientState(clientState.updateMask,clientState,*pipe);
+					writeClientState(spectatorSink!=0?ClientState::NO_CHANGE:clientState.updateMask,clientState,*pipe);
 					clientState.updateMask=ClientState::NO_CHANGE;
 					}
 					
 					/* Let protocol plug-ins send their own client update messages: */
 					for(ProtocolList::iterator pIt=protocols.begin();pIt!=protocols.end();++pIt)
-						(*pIt)->sendClientUpdate(*pipe);
+						(*pIt)->sendClientUpdate(updatePipe);
 					
-					/* Process higher-level protocols: */
-					sendClientUpdate();
+					if(spectatorSink!=0)
+						spectatorSink->discardData();
+					else
+						{
+						/* Process higher-level protocols: */
+						sendClientUpdate();
+						}
 					
 					/* Finish the message: */
 					pipe->flush();
@@ -656,55 +668,43 @@ void* CollaborationClient::communicationThreadMethod(void)
 
 void CollaborationClient::updateClientState(void)
 	{
-	/* Update the physical environment: */
-	bool environmentChanged=false;
-	Scalar inchFactor=Scalar(Vrui::getInchFactor());
-	environmentChanged=environmentChanged||clientState.inchFactor!=inchFactor;
-	clientState.inchFactor=inchFactor;
-	Point displayCenter=Point(Vrui::getDisplayCenter());
-	environmentChanged=environmentChanged||clientState.displayCenter!=displayCenter;
-	clientState.displayCenter=displayCenter;
-	Scalar displaySize=Scalar(Vrui::getDisplaySize());
-	environmentChanged=environmentChanged||clientState.displaySize!=displaySize;
-	clientState.displaySize=displaySize;
-	Vector forward=Vector(Vrui::getForwardDirection());
-	environmentChanged=environmentChanged||clientState.forward!=forward;
-	clientState.forward=forward;
-	Vector up=Vector(Vrui::getUpDirection());
-	environmentChanged=environmentChanged||clientState.up!=up;
-	clientState.up=up;
-	Plane floorPlane=Plane(Vrui::getFloorPlane());
-	environmentChanged=environmentChanged||clientState.floorPlane!=floorPlane;
-	clientState.floorPlane=floorPlane;
-	if(environmentChanged)
-		clientState.updateMask|=ClientState::ENVIRONMENT;
-	
-	/* Update the positions/orientations of all viewers: */
-	bool viewersChanged=clientState.resize(Vrui::getNumViewers());
-	for(unsigned int i=0;i<clientState.numViewers;++i)
-		{
-		ONTransform viewerState=ONTransform(Vrui::getViewer(i)->getHeadTransformation());
-		viewersChanged=viewersChanged||clientState.viewerStates[i]!=viewerState;
-		clientState.viewerStates[i]=viewerState;
-		}
-	if(viewersChanged)
-		clientState.updateMask|=ClientState::VIEWER;
-	
-	/* Update the navigation transformation: */
-	OGTransform navTransform=OGTransform(Vrui::getNavigationTransformation());
-	if(clientState.navTransform!=navTransform)
-		{
-		clientState.navTransform=navTransform;
-		clientState.updateMask|=ClientState::NAVTRANSFORM;
-		}
+	/* Sample the physical environment: */
+	sampledState.inchFactor=Scalar(Vrui::getInchFactor());
+	sampledState.displayCenter=Point(Vrui::getDisplayCenter());
+	sampledState.displaySize=Scalar(Vrui::getDisplaySize());
+	sampledState.forward=Vector(Vrui::getForwardDirection());
+	sampledState.up=Vector(Vrui::getUpDirection());
+	sampledState.floorPlane=Plane(Vrui::getFloorPlane());
+	
+	/* Sample the positions/orientations of all viewers: */
+	sampledState.resize(Vrui::getNumViewers());
+	for(unsigned int i=0;i<sampledState.numViewers;++i)
+		sampledState.viewerStates[i]=ONTransform(Vrui::getViewer(i)->getHeadTransformation());
+	
+	/* Sample the navigation transformation: */
+	sampledState.navTransform=OGTransform(Vrui::getNavigationTransformation());
+	
+	/* Find all sampled components that changed, where viewers must move perceptibly unless the viewer states are stale; the client name is set explicitly: */
+	double now=Vrui::getApplicationTime();
+	bool viewersStale=deadBand.isStale(viewerUpdateTime,now);
+	unsigned int changedMask=diffClientState(clientState,sampledState,deadBand,viewersStale)&~ClientState::CLIENTNAME;
+	
+	/* Update the changed components: */
+	copyClientState(changedMask,clientState,sampledState);
+	
+	/* Restart the staleness interval if the sent viewer states are now exact: */
+	if(viewersStale)
+		viewerUpdateTime=now;
 	}
 
 CollaborationClient::CollaborationClient(CollaborationClient::Configuration* sConfiguration)
 	:configuration(sConfiguration!=0?sConfiguration:new Configuration),
 	 protocolLoader(configuration->cfg.retrieveString("./pluginDsoNameTemplate",COLLABORATION_PLUGINDSONAMETEMPLATE)),
-	 disconnect(false),
+	 disconnect(false),spectatorSink(0),
 	 remoteClientMap(17),protocolClientMap(31),
+	 deadBand(Scalar(0.01*Vrui::getInchFactor()),Math::rad(Scalar(0.1)),Scalar(0.1*Vrui::getInchFactor()),Math::rad(Scalar(1.0)),Scalar(0.001),0.5),viewerUpdateTime(0.0),
 	 followClientID(0),faceClientID(0),
+	 frameWorkBudget(0.005),frameWorkDeadline(0.0),
 	 clientDialogPopup(0),showSettingsToggle(0),clientListRowColumn(0),
 	 settingsDialogPopup(0),
 	 fixGlyphScaling(false),renderRemoteEnvironments(false)
@@ -750,6 +750,8 @@ CollaborationClient::CollaborationClient(CollaborationClient::Configuration* sCo
 	viewerGlyph.configure(configuration->cfg,"remoteViewerGlyphType","remoteViewerGlyphMaterial");
 	fixGlyphScaling=configuration->cfg.retrieveValue<bool>("./fixRemoteGlyphScaling",fixGlyphScaling);
 	renderRemoteEnvironments=configuration->cfg.retrieveValue<bool>("./renderRemoteEnvironments",renderRemoteEnvironments);
+	deadBand.configure(configuration->cfg,Scalar(Vrui::getInchFactor()));
+	frameWorkBudget=configuration->cfg.retrieveValue<double>("./frameWorkBudget",frameWorkBudget);
 	
 	/* Initialize the protocol message table to have invalid entries for the collaboration pipe's own messages: */
 	for(unsigned int i=0;i<MESSAGES_END;++i)
@@ -815,9 +817,21 @@ CollaborationClient::~CollaborationClient(void)
 		/* Wait until the communication thread receives the disconnect reply and terminates: */
 		communicationThread.join();
 		
+		#ifdef VERBOSE
+		CompressedPipe* cPipe=dynamic_cast<CompressedPipe*>(pipe.getPointer());
+		if(cPipe!=0)
+			{
+			/* Print the connection's compression statistics: */
+			const CompressedPipe::Statistics& stats=cPipe->getStatistics();
+			std::cout<<"Node "<<Vrui::getNodeIndex()<<": "<<"Sent "<<stats.numRawBytesWritten<<" bytes as "<<stats.numCompressedBytesWritten<<" bytes in "<<stats.compressionTime*1000.0<<" ms CPU time"<<std::endl;
+			std::cout<<"Node "<<Vrui::getNodeIndex()<<": "<<"Received "<<stats.numCompressedBytesRead<<" bytes as "<<stats.numRawBytesRead<<" bytes in "<<stats.decompressionTime*1000.0<<" ms CPU time"<<std::endl;
+			}
+		#endif
+		
 		/* Close the pipe: */
 		pipe=0;
 		}
+	delete spectatorSink;
 	
 	/* Disconnect all remote clients: */
 	for(RemoteClientMap::Iterator cmIt=remoteClientMap.begin();!cmIt.isFinished();++cmIt)
@@ -870,6 +884,12 @@ CollaborationClient::~CollaborationClient(void)
 	
 	/* Delete the configuration object: */
 	delete configuration;
+	
+	#ifdef VERBOSE
+	/* Print the message buffer pool's statistics: */
+	MessageBufferPool::Statistics poolStats=messageBufferPool.getStatistics();
+	std::cout<<"Node "<<Vrui::getNodeIndex()<<": "<<"Handed out "<<poolStats.numAcquired<<" message buffers, allocated "<<poolStats.numAllocated<<", discarded "<<poolStats.numDiscarded<<", "<<poolStats.numPooled<<" ("<<poolStats.numPooledBytes<<" bytes) pooled"<<std::endl;
+	#endif
 	}
 
 void CollaborationClient::setClientName(std::string newClientName)
@@ -910,6 +930,23 @@ void CollaborationClient::connect(void)
 	/* Send the connection initiation message: */
 	writeMessage(CONNECT_REQUEST,*pipe);
 	
+	/* Write the base protocol version, which must match the server's: */
+	pipe->write<Card>(protocolVersion);
+	
+	/* Request to join the configured room: */
+	write(configuration->cfg.retrieveString("./room",""),*pipe);
+	
+	/* Request compression of all traffic after the connection reply: */
+	int compressionLevel=configuration->cfg.retrieveValue<int>("./compressionLevel",0);
+	if(compressionLevel<0)
+		compressionLevel=0;
+	if(compressionLevel>9)
+		compressionLevel=9;
+	pipe->write<Byte>(compressionLevel);
+	
+	/* Request to connect as a passive spectator if so configured: */
+	pipe->write<Byte>(configuration->cfg.retrieveValue<bool>("./spectator",false)?1:0);
+	
 	/* Write the initial client state: */
 	{
 	Threads::Spinlock::Lock clientStateLock(clientStateMutex);
@@ -971,8 +1008,13 @@ void CollaborationClient::connect(void)
 		/* Process higher-level protocols: */
 		receiveConnectReject();
 		
-		/* Bail out: */
+		/* Check whether the server rejected the connection due to a protocol version mismatch: */
+		unsigned int serverProtocolVersion=pipe->read<Card>();
 		pipe=0;
+		if(serverProtocolVersion!=protocolVersion)
+			Misc::throwStdErr("CollaborationClient::CollaborationClient: Collaboration server speaks protocol version %u.%u; this client speaks version %u.%u",serverProtocolVersion>>16,serverProtocolVersion&0xffffU,protocolVersion>>16,protocolVersion&0xffffU);
+		
+		/* Bail out: */
 		Misc::throwStdErr("CollaborationClient::CollaborationClient: Connection refused by collaboration server");
 		}
 	else if(message!=CONNECT_REPLY)
@@ -989,6 +1031,9 @@ void CollaborationClient::connect(void)
 	std::cout<<" accepted"<<std::endl;
 	#endif
 	
+	/* Read the pipe compression level granted by the server: */
+	int grantedCompressionLevel=pipe->read<Byte>();
+	
 	/* Read the list of negotiated protocols and their message payloads: */
 	unsigned int numNegotiatedProtocols=pipe->read<Card>();
 	ProtocolList negotiatedProtocols;
@@ -1035,6 +1080,19 @@ void CollaborationClient::connect(void)
 	/* Process higher-level protocols: */
 	receiveConnectReply();
 	
+	if(grantedCompressionLevel>0)
+		{
+		/* Compress everything following the connection reply: */
+		#ifdef VERBOSE
+		std::cout<<"Node "<<Vrui::getNodeIndex()<<": "<<"Compressing server communication at level "<<grantedCompressionLevel<<std::endl;
+		#endif
+		pipe=new CompressedPipe(pipe,grantedCompressionLevel);
+		}
+	
+	/* Collect the plug-in client update messages of a spectator client in a sink from which they are discarded: */
+	if(configuration->cfg.retrieveValue<bool>("./spectator",false))
+		spectatorSink=new BufferedPipe(pipe);
+	
 	/* Start server communication thread: */
 	communicationThread.start(this,&CollaborationClient::communicationThreadMethod);
 	
@@ -1091,6 +1149,16 @@ void CollaborationClient::hideDialog(void)
 	Vrui::popdownPrimaryWidget(clientDialogPopup);
 	}
 
+bool CollaborationClient::haveFrameWorkTime(void) const
+	{
+	if(frameWorkBudget<=0.0)
+		return true;
+	
+	/* Compare the current wall-clock time against the current frame's deadline: */
+	Misc::Time now=Misc::Time::now();
+	return double(now.tv_sec)+double(now.tv_nsec)/1.0e9<frameWorkDeadline;
+	}
+
 void CollaborationClient::frame(void)
 	{
 	/* Bail out if not connected to the server: */
@@ -1132,14 +1200,35 @@ void CollaborationClient::frame(void)
 		Vrui::showErrorMessage("CollaborationClient","Disconnected from collaboration server due to communication error");
 		}
 	
+	/* Start this frame's budget for deferrable work: */
+	Misc::Time frameStartTime=Misc::Time::now();
+	frameWorkDeadline=double(frameStartTime.tv_sec)+double(frameStartTime.tv_nsec)/1.0e9+frameWorkBudget;
+	
 	/* Lock the client map: */
 	Threads::Mutex::Lock clientMapLock(clientMapMutex);
 	
 	/* Process the action list: */
 	{
 	Threads::Mutex::Lock actionListLock(actionListMutex);
-	for(ActionList::iterator alIt=actionList.begin();alIt!=actionList.end();++alIt)
+	
+	/* Slave nodes process as many actions as the master node, whose wall clock decides how much work is deferred: */
+	size_t maxNumActions=actionList.size();
+	if(!Vrui::isMaster())
+		{
+		size_t numMasterActions=Vrui::getMainPipe()->read<Card>();
+		if(maxNumActions>numMasterActions)
+			maxNumActions=numMasterActions;
+		}
+	
+	ActionList::iterator alIt;
+	size_t numActions=0;
+	bool addedClient=false;
+	for(alIt=actionList.begin();numActions<maxNumActions;++alIt,++numActions)
 		{
+		/* Defer the remaining actions to later frames if the work budget ran out, but add at least one client per frame; process all actions after a disconnect: */
+		if(Vrui::isMaster()&&pipe!=0&&addedClient&&!haveFrameWorkTime())
+			break;
+		
 		switch(alIt->action)
 			{
 			case ClientListAction::ADD_CLIENT:
@@ -1181,6 +1270,7 @@ void CollaborationClient::frame(void)
 					pIt->protocol->connectClient(pIt->protocolClientState);
 					}
 				
+				addedClient=true;
 				break;
 				}
 			
@@ -1235,8 +1325,17 @@ void CollaborationClient::frame(void)
 			}
 		}
 	
-	/* Clear the action list: */
-	actionList.clear();
+	/* Send the number of processed actions to the slave nodes: */
+	if(Vrui::isMaster()&&Vrui::getMainPipe()!=0)
+		{
+		Vrui::getMainPipe()->write<Card>(numActions);
+		Vrui::getMainPipe()->flush();
+		}
+	
+	/* Remove the processed actions from the action list, and come back for the deferred ones during the next frame: */
+	actionList.erase(actionList.begin(),alIt);
+	if(!actionList.empty())
+		Vrui::requestUpdate();
 	}
 	
 	/* Update the local client state structure: */
@@ -27,7 +27,6 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <string>
 #include <vector>
-#include <Misc/HashTable.h>
 #include <Misc/ConfigurationFile.h>
 #include <Plugins/ObjectLoader.h>
 #include <Threads/Thread.h>
@@ -38,8 +37,11 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <GLMotif/ToggleButton.h>
 #include <Vrui/Geometry.h>
 #include <Vrui/GlyphRenderer.h>
+#include <Collaboration/FlatHashTable.h>
 #include <Collaboration/ProtocolClient.h>
 #include <Collaboration/CollaborationProtocol.h>
+#include <Collaboration/DeadBand.h>
+#include <Collaboration/MessageBufferPool.h>
 
 /* Forward declarations: */
 class GLContextData;
@@ -50,6 +52,10 @@ class TextField;
 }
 class ALContextData;
 
+namespace Collaboration {
+class BufferedPipe;
+}
+
 namespace Collaboration {
 
 class CollaborationClient:private CollaborationProtocol
@@ -136,17 +142,19 @@ class CollaborationClient:private CollaborationProtocol
 		};
 	
 	typedef std::vector<ClientListAction> ActionList; // Type for lists of client list actions
-	typedef Misc::HashTable<unsigned int,RemoteClientState*> RemoteClientMap; // Hash table to map from client IDs to client objects
-	typedef Misc::HashTable<ProtocolRemoteClientState*,RemoteClientState*> ProtocolClientMap; // Hash table to map from protocol client state objects to remote client state objects
+	typedef FlatHashTable<unsigned int,RemoteClientState*> RemoteClientMap; // Hash table to map from client IDs to client objects
+	typedef FlatHashTable<ProtocolRemoteClientState*,RemoteClientState*> ProtocolClientMap; // Hash table to map from protocol client state objects to remote client state objects
 	
 	/* Elements: */
 	private:
 	Configuration* configuration; // Pointer to the client's configuration object
+	MessageBufferPool messageBufferPool; // Pool of buffers holding incoming protocol plug-in messages; outlives all plug-ins
 	ProtocolClientLoader protocolLoader; // Object loader to dynamically load protocol plug-ins from DSOs
 	protected:
 	Threads::Mutex pipeMutex; // Mutex serializing access to the collaboration pipe
 	Comm::NetPipePtr pipe; // Pipe connected to the collaboration server
 	volatile bool disconnect; // Flag if the server communication thread encountered an error
+	BufferedPipe* spectatorSink; // Pipe collecting and discarding the plug-in client update messages of a spectator client, or 0 if the client is not a spectator
 	private:
 	Threads::Thread communicationThread; // Thread handling communication with the collaboration server
 	ProtocolList protocols; // List of protocols currently registered with the server
@@ -162,8 +170,13 @@ class CollaborationClient:private CollaborationProtocol
 	/* Local client state: */
 	Threads::Spinlock clientStateMutex; // Mutex protecting the local client state
 	ClientState clientState; // Transient state of local client
+	ClientState sampledState; // Local client state sampled during the current frame, compared against the transient state to detect changes
+	DeadBand deadBand; // Dead band to suppress updates of local tracked state caused by tracking noise
+	double viewerUpdateTime; // Application time at which the local viewer states were last updated exactly
 	unsigned int followClientID; // ID of client whose navigation transformation to follow (0 if disabled)
 	unsigned int faceClientID; // ID of client whom to face in a conversation (0 if disabled)
+	double frameWorkBudget; // Wall-clock time in seconds per frame that may be spent on deferrable work such as adding remote clients; 0 disables the budget
+	double frameWorkDeadline; // Wall-clock time at which the current frame's budget for deferrable work runs out
 	
 	/* User interface: */
 	GLMotif::PopupWindow* clientDialogPopup; // Dialog window showing the state of the collaboration client
@@ -208,6 +221,15 @@ class CollaborationClient:private CollaborationProtocol
 		{
 		return *pipe;
 		}
+	MessageBufferPool& getMessageBufferPool(void) // Returns the pool of buffers for incoming protocol plug-in messages
+		{
+		return messageBufferPool;
+		}
+	const DeadBand& getDeadBand(void) const // Returns the dead band used to suppress updates of local tracked state
+		{
+		return deadBand;
+		}
+	bool haveFrameWorkTime(void) const; // Returns true if the current frame's budget for deferrable work has not run out yet; must only be called on the master node, which forwards its decisions to the slave nodes
 	virtual void connect(void); // Runs the connection initiation protocol; throws exception if fails
 	ProtocolClient* getProtocol(const char* protocolName); // Returns a pointer to a protocol client; returns 0 if protocol does not exist
 	const Threads::TripleBuffer<ClientState>& getClientState(unsigned int clientID) const // Returns the client state of the client with the given ID
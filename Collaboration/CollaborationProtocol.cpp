@@ -24,15 +24,65 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <Collaboration/CollaborationProtocol.h>
 
 #include <IO/File.h>
+#include <Collaboration/Arena.h>
+#include <Collaboration/ProtocolSchema.h>
 
 namespace Collaboration {
 
+namespace {
+
+/***********************************
+Wire schema of client state updates:
+***********************************/
+
+typedef CollaborationProtocol::ClientState CS;
+
+class NumViewersCodec // Codec transmitting the number of viewers and re-allocating the viewer state array on reception
+	{
+	/* Methods: */
+	public:
+	static size_t getSize(const CS& s)
+		{
+		return sizeof(Protocol::Card);
+		}
+	static void read(CS& s,IO::File& source)
+		{
+		s.resize(source.read<Protocol::Card>());
+		}
+	static void write(const CS& s,IO::File& sink)
+		{
+		sink.write<Protocol::Card>(s.numViewers);
+		}
+	static bool changed(const CS& sent,const CS& current)
+		{
+		return sent.numViewers!=current.numViewers;
+		}
+	static void copy(CS& dest,const CS& source)
+		{
+		dest.resize(source.numViewers);
+		}
+	};
+
+typedef Schema<SchemaField<CS,Protocol::Scalar,&CS::inchFactor,CS::ENVIRONMENT>,
+               SchemaField<CS,Protocol::Point,&CS::displayCenter,CS::ENVIRONMENT>,
+               SchemaField<CS,Protocol::Scalar,&CS::displaySize,CS::ENVIRONMENT>,
+               SchemaField<CS,Protocol::Vector,&CS::forward,CS::ENVIRONMENT>,
+               SchemaField<CS,Protocol::Vector,&CS::up,CS::ENVIRONMENT>,
+               SchemaField<CS,CollaborationProtocol::Plane,&CS::floorPlane,CS::ENVIRONMENT>,
+               SchemaField<CS,std::string,&CS::clientName,CS::CLIENTNAME>,
+               SchemaCustomField<CS,NumViewersCodec,CS::NUM_VIEWERS>,
+               SchemaArrayField<CS,Protocol::ONTransform,&CS::viewerStates,&CS::numViewers,CS::VIEWER,TransformComparison>,
+               SchemaField<CS,Protocol::OGTransform,&CS::navTransform,CS::NAVTRANSFORM> > ClientStateSchema;
+
+}
+
 /***************************************************
 Methods of class CollaborationProtocol::ClientState:
 ***************************************************/
 
-CollaborationProtocol::ClientState::ClientState(void)
-	:updateMask(NO_CHANGE),
+CollaborationProtocol::ClientState::ClientState(Arena* sArena)
+	:arena(sArena),
+	 updateMask(NO_CHANGE),
 	 inchFactor(1),
 	 displayCenter(Point::origin),
 	 displaySize(1),
@@ -46,37 +96,16 @@ CollaborationProtocol::ClientState& CollaborationProtocol::ClientState::operator
 	{
 	if(&source!=this)
 		{
-		/* Copy the physical environment state: */
+		/* Copy all state components, including the viewer state array: */
+		ClientStateSchema::copy(FULL_UPDATE,*this,source);
 		updateMask=source.updateMask;
-		inchFactor=source.inchFactor;
-		displayCenter=source.displayCenter;
-		displaySize=source.displaySize;
-		forward=source.forward;
-		up=source.up;
-		floorPlane=source.floorPlane;
-		
-		/* Copy the client name: */
-		clientName=source.clientName;
-		
-		/* Copy the array of viewer states: */
-		if(numViewers!=source.numViewers)
-			{
-			delete[] viewerStates;
-			numViewers=source.numViewers;
-			viewerStates=numViewers>0?new ONTransform[numViewers]:0;
-			}
-		for(unsigned int i=0;i<numViewers;++i)
-			viewerStates[i]=source.viewerStates[i];
-		
-		/* Copy the navigation transformation: */
-		navTransform=source.navTransform;
 		}
 	return *this;
 	}
 
 CollaborationProtocol::ClientState::~ClientState(void)
 	{
-	delete[] viewerStates;
+	Arena::deleteArray(arena,viewerStates,numViewers);
 	}
 
 bool CollaborationProtocol::ClientState::resize(unsigned int newNumViewers)
@@ -84,9 +113,9 @@ bool CollaborationProtocol::ClientState::resize(unsigned int newNumViewers)
 	if(newNumViewers!=numViewers)
 		{
 		/* Re-allocate the viewer states array: */
-		delete[] viewerStates;
+		Arena::deleteArray(arena,viewerStates,numViewers);
 		numViewers=newNumViewers;
-		viewerStates=numViewers>0?new ONTransform[numViewers]:0;
+		viewerStates=Arena::newArray<ONTransform>(arena,numViewers);
 		updateMask|=NUM_VIEWERS;
 		return true;
 		}
@@ -103,42 +132,8 @@ void CollaborationProtocol::readClientState(CollaborationProtocol::ClientState&
 	/* Read this update's update mask: */
 	unsigned int newUpdateMask=source.read<Byte>();
 	
-	if(newUpdateMask&ClientState::ENVIRONMENT)
-		{
-		/* Read the client's physical environment definition: */
-		read(clientState.inchFactor,source);
-		read(clientState.displayCenter,source);
-		read(clientState.displaySize,source);
-		read(clientState.forward,source);
-		read(clientState.up,source);
-		read(clientState.floorPlane,source);
-		}
-	
-	if(newUpdateMask&ClientState::CLIENTNAME)
-		{
-		/* Read the client's display name: */
-		read(clientState.clientName,source);
-		}
-	
-	if(newUpdateMask&ClientState::NUM_VIEWERS)
-		{
-		/* Read the new number of viewers and resize the state array: */
-		unsigned int newNumViewers=source.read<Card>();
-		clientState.resize(newNumViewers);
-		}
-	
-	if(newUpdateMask&ClientState::VIEWER)
-		{
-		/* Read the client's viewer states: */
-		for(unsigned int i=0;i<clientState.numViewers;++i)
-			read(clientState.viewerStates[i],source);
-		}
-	
-	if(newUpdateMask&ClientState::NAVTRANSFORM)
-		{
-		/* Read the navigation transformation: */
-		read(clientState.navTransform,source);
-		}
+	/* Read all state components selected by the update mask: */
+	ClientStateSchema::read(newUpdateMask,clientState,source);
 	
 	/* Update the client state's update mask: */
 	clientState.updateMask|=newUpdateMask;
@@ -149,41 +144,40 @@ void CollaborationProtocol::writeClientState(unsigned int updateMask,const Colla
 	/* Write the update mask: */
 	sink.write<Byte>(updateMask);
 	
-	if(updateMask&ClientState::ENVIRONMENT)
-		{
-		/* Write the client's physical environment definition: */
-		write(clientState.inchFactor,sink);
-		write(clientState.displayCenter,sink);
-		write(clientState.displaySize,sink);
-		write(clientState.forward,sink);
-		write(clientState.up,sink);
-		write(clientState.floorPlane,sink);
-		}
-	
-	if(updateMask&ClientState::CLIENTNAME)
-		{
-		/* Write the client's display name: */
-		write(clientState.clientName,sink);
-		}
-	
-	if(updateMask&ClientState::NUM_VIEWERS)
-		{
-		/* Write the new number of viewers: */
-		sink.write<Card>(clientState.numViewers);
-		}
-	
-	if(updateMask&ClientState::VIEWER)
-		{
-		/* Write the client's viewer states: */
-		for(unsigned int i=0;i<clientState.numViewers;++i)
-			write(clientState.viewerStates[i],sink);
-		}
+	/* Write all state components selected by the update mask: */
+	ClientStateSchema::write(updateMask,clientState,sink);
+	}
+
+size_t CollaborationProtocol::getClientStateSize(unsigned int updateMask,const CollaborationProtocol::ClientState& clientState)
+	{
+	return sizeof(Byte)+ClientStateSchema::getSize(updateMask,clientState);
+	}
+
+unsigned int CollaborationProtocol::diffClientState(const CollaborationProtocol::ClientState& sent,const CollaborationProtocol::ClientState& current,const DeadBand& deadBand,bool stale)
+	{
+	return ClientStateSchema::diff(sent,current,deadBand,stale);
+	}
+
+void CollaborationProtocol::copyClientState(unsigned int updateMask,CollaborationProtocol::ClientState& dest,const CollaborationProtocol::ClientState& source)
+	{
+	ClientStateSchema::copy(updateMask,dest,source);
+	dest.updateMask|=updateMask;
+	}
+
+void CollaborationProtocol::writeVersionReject(IO::File& sink)
+	{
+	/* Reject the connection request without negotiating any protocols: */
+	writeMessage(CONNECT_REJECT,sink);
+	sink.write<Card>(0);
 	
-	if(updateMask&ClientState::NAVTRANSFORM)
-		{
-		/* Write the navigation transformation: */
-		write(clientState.navTransform,sink);
-		}
+	/* Tell the client which protocol version the server speaks: */
+	sink.write<Card>(protocolVersion);
 	}
 
+/*********************************************
+Static elements of class CollaborationProtocol:
+*********************************************/
+
+const unsigned int CollaborationProtocol::protocolVersion=(2U<<16)+9U; // Version 2.9
+
 }
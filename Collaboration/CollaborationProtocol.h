@@ -32,6 +32,10 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 namespace IO {
 class File;
 }
+namespace Collaboration {
+class Arena;
+class DeadBand;
+}
 
 namespace Collaboration {
 
@@ -55,6 +59,9 @@ class CollaborationProtocol:public Protocol
 	
 	typedef Geometry::Plane<Scalar,3> Plane; // Data type for plane equations
 	
+	/* Elements: */
+	static const unsigned int protocolVersion; // Version of the base protocol; sent by clients right after the CONNECT_REQUEST message ID, and by servers at the end of CONNECT_REJECT messages
+	
 	struct ClientState // State of a client's environment synchronized between the server and all connected clients
 		{
 		/* Embedded classes: */
@@ -71,6 +78,7 @@ class CollaborationProtocol:public Protocol
 			};
 		
 		/* Elements: */
+		Arena* arena; // Memory arena from which the viewer state array is allocated, or null to use the heap
 		unsigned int updateMask; // Cumulative update mask of this client state
 		
 		/* Definition of client's physical environment in client's physical coordinate system: */
@@ -91,7 +99,7 @@ class CollaborationProtocol:public Protocol
 		OGTransform navTransform;
 		
 		/* Constructors and destructors: */
-		ClientState(void); // Creates empty client state structure
+		ClientState(Arena* sArena =0); // Creates empty client state structure allocating from the given memory arena
 		private:
 		ClientState(const ClientState&); // Prohibit copy constructor
 		public:
@@ -105,6 +113,10 @@ class CollaborationProtocol:public Protocol
 	/* Methods: */
 	static void readClientState(ClientState& clientState,IO::File& source); // Reads client state update from the given source
 	static void writeClientState(unsigned int updateMask,const ClientState& clientState,IO::File& sink); // Writes client state update to the given sink using the specific state update mask
+	static size_t getClientStateSize(unsigned int updateMask,const ClientState& clientState); // Returns the number of bytes written by a client state update using the specific state update mask
+	static unsigned int diffClientState(const ClientState& sent,const ClientState& current,const DeadBand& deadBand,bool stale); // Returns the update mask of all client state components whose change from the sent to the current state must be sent; viewer changes are compared against the given dead band
+	static void copyClientState(unsigned int updateMask,ClientState& dest,const ClientState& source); // Copies the client state components selected by the given update mask and adds them to the destination's update mask
+	static void writeVersionReject(IO::File& sink); // Writes a CONNECT_REJECT message without negotiated protocols, followed by the server's base protocol version, to the given sink
 	};
 
 }
@@ -0,0 +1,296 @@
+/***********************************************************************
+CollaborationRoomServer - Class to run several independent collaboration
+sessions ("rooms") in one server process, sharing one listening socket
+and a pool of threads updating the rooms.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/CollaborationRoomServer.h>
+
+#include <ctype.h>
+#include <iostream>
+#include <stdexcept>
+#include <Misc/ThrowStdErr.h>
+#include <Misc/StandardValueCoders.h>
+#include <Comm/TCPPipe.h>
+
+namespace Collaboration {
+
+/****************************************
+Methods of class CollaborationRoomServer:
+****************************************/
+
+bool CollaborationRoomServer::isValidRoomName(const std::string& roomName)
+	{
+	/* Limit room names to short sequences of letters, digits, dashes, and underscores, as they might end up in file names: */
+	if(roomName.size()>64)
+		return false;
+	for(std::string::const_iterator rnIt=roomName.begin();rnIt!=roomName.end();++rnIt)
+		if(!isalnum((unsigned char)(*rnIt))&&*rnIt!='-'&&*rnIt!='_')
+			return false;
+	
+	return true;
+	}
+
+bool CollaborationRoomServer::addClient(const std::string& roomName,Comm::NetPipePtr clientPipe)
+	{
+	/* Keep the room list locked while handing the client over, so that the room cannot be destroyed in the meantime: */
+	Threads::Mutex::Lock roomListLock(roomListMutex);
+	
+	/* Check if a room of the given name already exists: */
+	CollaborationServer* room=0;
+	for(RoomList::iterator rIt=rooms.begin();rIt!=rooms.end()&&room==0;++rIt)
+		if(rIt->server->getRoomName()==roomName)
+			room=rIt->server;
+	
+	if(room==0)
+		{
+		/* Bail out if the room limit has been reached: */
+		if(rooms.size()>=maxNumRooms)
+			return false;
+		
+		/* Create a new room with its own configuration object: */
+		#ifdef VERBOSE
+		std::cout<<"CollaborationRoomServer: Creating room \""<<roomName<<"\""<<std::endl<<std::flush;
+		#endif
+		room=new CollaborationServer(0,roomName.c_str());
+		rooms.push_back(Room(room));
+		}
+	
+	/* Hand the client over to the room's server: */
+	room->addClient(clientPipe);
+	
+	return true;
+	}
+
+void* CollaborationRoomServer::listenThreadMethod(void)
+	{
+	/* Enable immediate cancellation of this thread: */
+	Threads::Thread::setCancelState(Threads::Thread::CANCEL_ENABLE);
+	
+	while(true)
+		{
+		/* Wait for the next incoming connection: */
+		#ifdef VERBOSE
+		std::cout<<"CollaborationRoomServer: Waiting for client connection"<<std::endl<<std::flush;
+		#endif
+		Comm::NetPipePtr clientPipe=new Comm::TCPPipe(listenSocket);
+		
+		try
+			{
+			/* Read the message ID and base protocol version of the client's connection request: */
+			clientPipe->negotiateEndianness();
+			if(readMessage(*clientPipe)!=CONNECT_REQUEST)
+				Misc::throwStdErr("Protocol error in connection request from host %s",clientPipe->getPeerHostName().c_str());
+			unsigned int clientProtocolVersion=clientPipe->read<Card>();
+			if(clientProtocolVersion!=protocolVersion)
+				{
+				std::cerr<<"CollaborationRoomServer: Rejecting client from host "<<clientPipe->getPeerHostName()<<" speaking protocol version "<<(clientProtocolVersion>>16)<<'.'<<(clientProtocolVersion&0xffffU)<<" instead of "<<(protocolVersion>>16)<<'.'<<(protocolVersion&0xffffU)<<std::endl<<std::flush;
+				
+				/* Reject the connection request before reading any fields whose layout depends on the protocol version: */
+				writeVersionReject(*clientPipe);
+				clientPipe->flush();
+				continue;
+				}
+			
+			/* Read the name of the room the client wants to join: */
+			std::string roomName=read<std::string>(*clientPipe);
+			
+			/* Hand the client over to the requested room: */
+			if(!isValidRoomName(roomName)||!addClient(roomName,clientPipe))
+				{
+				std::cerr<<"CollaborationRoomServer: Rejecting client from host "<<clientPipe->getPeerHostName()<<" requesting room \""<<roomName<<"\""<<std::endl<<std::flush;
+				
+				/* Reject the connection request without negotiating any protocols: */
+				writeVersionReject(*clientPipe);
+				clientPipe->flush();
+				}
+			}
+		catch(std::runtime_error err)
+			{
+			std::cerr<<"CollaborationRoomServer: Cancelled connecting new client due to exception "<<err.what()<<std::endl<<std::flush;
+			}
+		}
+	
+	return 0;
+	}
+
+void CollaborationRoomServer::updateRoom(CollaborationServer* room)
+	{
+	try
+		{
+		room->update();
+		}
+	catch(std::runtime_error err)
+		{
+		/* Print an error message and carry on with the other rooms: */
+		std::cerr<<"CollaborationRoomServer: Caught exception "<<err.what()<<" while updating room \""<<room->getRoomName()<<"\""<<std::endl<<std::flush;
+		}
+	}
+
+CollaborationServer* CollaborationRoomServer::finishRoomUpdate(CollaborationServer* room)
+	{
+	/* Find the room in the room list: */
+	RoomList::iterator rIt;
+	for(rIt=rooms.begin();rIt!=rooms.end()&&rIt->server!=room;++rIt)
+		;
+	rIt->updating=false;
+	
+	/* Keep the room while it has clients; the room list mutex prevents new clients from joining the room until it is removed: */
+	if(!room->isIdle())
+		return 0;
+	
+	#ifdef VERBOSE
+	std::cout<<"CollaborationRoomServer: Destroying room \""<<room->getRoomName()<<"\""<<std::endl<<std::flush;
+	#endif
+	rooms.erase(rIt);
+	
+	return room;
+	}
+
+void* CollaborationRoomServer::tickThreadMethod(void)
+	{
+	Threads::Mutex::Lock roomListLock(roomListMutex);
+	
+	while(true)
+		{
+		/* Wait for the next queued room or for shutdown: */
+		while(!shutdownTickThreads&&tickQueue.empty())
+			tickQueueCond.wait(roomListMutex);
+		if(shutdownTickThreads)
+			break;
+		CollaborationServer* room=tickQueue.front();
+		tickQueue.pop_front();
+		
+		/* Update the room without holding the room list lock: */
+		roomListMutex.unlock();
+		updateRoom(room);
+		roomListMutex.lock();
+		
+		/* Destroy the room if its last clients disconnected: */
+		CollaborationServer* deadRoom=finishRoomUpdate(room);
+		if(deadRoom!=0)
+			{
+			roomListMutex.unlock();
+			delete deadRoom;
+			roomListMutex.lock();
+			}
+		}
+	
+	return 0;
+	}
+
+CollaborationRoomServer::CollaborationRoomServer(CollaborationRoomServer::Configuration* sConfiguration)
+	:configuration(sConfiguration!=0?sConfiguration:new Configuration),
+	 listenSocket(configuration->cfg.retrieveValue<int>("./listenPortId",-1),0),
+	 maxNumRooms(configuration->cfg.retrieveValue<unsigned int>("./maxNumRooms",16)),
+	 numTickThreads(configuration->cfg.retrieveValue<unsigned int>("./numTickThreads",2)),
+	 tickThreads(0),
+	 shutdownTickThreads(false)
+	{
+	/* Start the tick thread pool: */
+	if(numTickThreads>0)
+		{
+		tickThreads=new Threads::Thread[numTickThreads];
+		for(unsigned int i=0;i<numTickThreads;++i)
+			tickThreads[i].start(this,&CollaborationRoomServer::tickThreadMethod);
+		}
+	
+	/* Start connection initiating thread: */
+	listenThread.start(this,&CollaborationRoomServer::listenThreadMethod);
+	}
+
+CollaborationRoomServer::~CollaborationRoomServer(void)
+	{
+	#ifdef VERBOSE
+	std::cout<<"CollaborationRoomServer: Shutting down room server"<<std::endl<<std::flush;
+	#endif
+	
+	/* Stop connection initiating thread: */
+	listenThread.cancel();
+	listenThread.join();
+	
+	/* Shut down the tick thread pool: */
+	if(tickThreads!=0)
+		{
+		{
+		Threads::Mutex::Lock roomListLock(roomListMutex);
+		shutdownTickThreads=true;
+		tickQueueCond.broadcast();
+		}
+		for(unsigned int i=0;i<numTickThreads;++i)
+			tickThreads[i].join();
+		delete[] tickThreads;
+		}
+	
+	/* Shut down all rooms: */
+	for(RoomList::iterator rIt=rooms.begin();rIt!=rooms.end();++rIt)
+		delete rIt->server;
+	
+	/* Delete the configuration object: */
+	delete configuration;
+	}
+
+unsigned int CollaborationRoomServer::getNumRooms(void)
+	{
+	Threads::Mutex::Lock roomListLock(roomListMutex);
+	return rooms.size();
+	}
+
+void CollaborationRoomServer::update(void)
+	{
+	Threads::Mutex::Lock roomListLock(roomListMutex);
+	
+	if(numTickThreads==0)
+		{
+		/* Collect the rooms to be updated during this tick: */
+		std::vector<CollaborationServer*> tickRooms;
+		tickRooms.reserve(rooms.size());
+		for(RoomList::iterator rIt=rooms.begin();rIt!=rooms.end();++rIt)
+			tickRooms.push_back(rIt->server);
+		
+		/* Update all rooms from the calling thread, and destroy the rooms whose last clients disconnected: */
+		for(std::vector<CollaborationServer*>::iterator trIt=tickRooms.begin();trIt!=tickRooms.end();++trIt)
+			{
+			roomListMutex.unlock();
+			updateRoom(*trIt);
+			roomListMutex.lock();
+			delete finishRoomUpdate(*trIt);
+			}
+		
+		return;
+		}
+	
+	/* Queue all rooms that are done with their previous updates; rooms that are still busy skip this tick: */
+	bool queuedRooms=false;
+	for(RoomList::iterator rIt=rooms.begin();rIt!=rooms.end();++rIt)
+		if(!rIt->updating)
+			{
+			rIt->updating=true;
+			tickQueue.push_back(rIt->server);
+			queuedRooms=true;
+			}
+	
+	/* Wake up the tick threads without waiting for the rooms' updates: */
+	if(queuedRooms)
+		tickQueueCond.broadcast();
+	}
+
+}
@@ -0,0 +1,115 @@
+/***********************************************************************
+CollaborationRoomServer - Class to run several independent collaboration
+sessions ("rooms") in one server process, sharing one listening socket
+and a pool of threads updating the rooms.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Each room is served by its own collaboration server object with its own
+client list, protocol plug-ins, and plug-in state. The room server reads
+the message ID and room name of a new client's connection request,
+creates the named room on demand, and hands the client over to the
+room's server. Rooms are scheduled on the thread pool independently: a
+room that is still being updated when the next tick starts skips that
+tick instead of holding up the other rooms. Rooms are destroyed after
+their last clients disconnected.
+***********************************************************************/
+
+#ifndef COLLABORATION_COLLABORATIONROOMSERVER_INCLUDED
+#define COLLABORATION_COLLABORATIONROOMSERVER_INCLUDED
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <Threads/Thread.h>
+#include <Threads/Mutex.h>
+#include <Threads/Cond.h>
+#include <Comm/ListeningTCPSocket.h>
+#include <Collaboration/CollaborationProtocol.h>
+#include <Collaboration/CollaborationServer.h>
+
+namespace Collaboration {
+
+class CollaborationRoomServer:private CollaborationProtocol
+	{
+	/* Embedded classes: */
+	public:
+	typedef CollaborationServer::Configuration Configuration; // Room servers share the configuration of stand-alone servers
+	
+	private:
+	struct Room // Structure describing a room
+		{
+		/* Elements: */
+		public:
+		CollaborationServer* server; // Collaboration server serving the room
+		bool updating; // Flag if the room is queued for or being updated by a tick thread
+		
+		/* Constructors and destructors: */
+		Room(CollaborationServer* sServer)
+			:server(sServer),updating(false)
+			{
+			}
+		};
+	
+	typedef std::vector<Room> RoomList; // Type for lists of rooms
+	
+	/* Elements: */
+	Configuration* configuration; // Pointer to the room server's configuration object
+	Comm::ListeningTCPSocket listenSocket; // Socket receiving connection requests from clients
+	Threads::Thread listenThread; // Thread receiving connection request messages
+	unsigned int maxNumRooms; // Maximum number of rooms created on request of connecting clients
+	Threads::Mutex roomListMutex; // Mutex protecting the room list and the tick queue
+	RoomList rooms; // List of all rooms in order of creation
+	unsigned int numTickThreads; // Number of threads in the pool updating the rooms; 0 updates all rooms from the calling thread
+	Threads::Thread* tickThreads; // Array of threads updating the rooms
+	Threads::Cond tickQueueCond; // Condition variable to wake up the tick threads when rooms are queued for updates or on shutdown
+	std::deque<CollaborationServer*> tickQueue; // Queue of rooms waiting to be updated by a tick thread
+	bool shutdownTickThreads; // Flag to shut down the tick threads
+	
+	/* Private methods: */
+	static bool isValidRoomName(const std::string& roomName); // Returns true if the given room name can be used to create a room
+	bool addClient(const std::string& roomName,Comm::NetPipePtr clientPipe); // Hands the client connected via the given pipe over to the room of the given name, creating the room if it does not exist yet; returns false if the room cannot be created
+	void* listenThreadMethod(void); // Method for thread receiving connection request messages
+	static void updateRoom(CollaborationServer* room); // Updates the given room and prints an error message if the update fails
+	CollaborationServer* finishRoomUpdate(CollaborationServer* room); // Marks the given room as updated and removes it from the room list if it has no more clients; returns the room if it needs to be deleted, or 0; room list mutex must be locked
+	void* tickThreadMethod(void); // Method for threads updating rooms
+	
+	/* Constructors and destructors: */
+	public:
+	CollaborationRoomServer(Configuration* sConfiguration =0); // Creates a room server object with the given configuration
+	private:
+	CollaborationRoomServer(const CollaborationRoomServer& source); // Prohibit copy constructor
+	CollaborationRoomServer& operator=(const CollaborationRoomServer& source); // Prohibit assignment operator
+	public:
+	~CollaborationRoomServer(void);
+	
+	/* Methods: */
+	int getListenPortId(void) const // Returns the port ID the room server listens on
+		{
+		return listenSocket.getPortId();
+		}
+	unsigned int getNumRooms(void); // Returns the current number of rooms
+	void update(void); // Queues all rooms that are not still busy with a previous update for state updates on the thread pool without waiting for them, or updates all rooms from the calling thread if there is no pool
+	};
+
+}
+
+#endif
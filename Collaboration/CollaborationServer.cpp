@@ -27,12 +27,22 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <iostream>
 #include <algorithm>
 #include <Misc/ThrowStdErr.h>
+#include <Misc/Autopointer.h>
 #include <Misc/StandardValueCoders.h>
 #include <Misc/CompoundValueCoders.h>
+#include <Misc/Time.h>
 #include <Comm/TCPPipe.h>
+#include <Collaboration/CompressedPipe.h>
+#include <Collaboration/BufferedPipe.h>
 
 namespace Collaboration {
 
+/********************************************
+Static elements of class CollaborationServer:
+********************************************/
+
+const size_t CollaborationServer::minSharedClientStateSize=64;
+
 /***************************************************
 Methods of class CollaborationServer::Configuration:
 ***************************************************/
@@ -53,20 +63,29 @@ double CollaborationServer::Configuration::getTickTime(void)
 	return cfg.retrieveValue<double>("./tickTime",0.02);
 	}
 
+bool CollaborationServer::Configuration::getEnableRooms(void)
+	{
+	return cfg.retrieveValue<bool>("./enableRooms",false);
+	}
+
 /******************************************************
 Methods of class CollaborationServer::ClientConnection:
 ******************************************************/
 
 CollaborationServer::ClientConnection::ClientConnection(unsigned int sClientID,Comm::NetPipePtr sPipe)
-	:clientID(sClientID),pipe(sPipe),
+	:clientID(sClientID),spectator(false),connectRequestRead(false),pipe(sPipe),compressedPipe(0),deferredPipe(0),numDeferredUpdates(0),
 	 clientHostname(pipe->getPeerHostName()),
 	 clientPortId(pipe->getPeerPortId()),
+	 state(&arena),
 	 stateUpdateMask(ClientState::NO_CHANGE)
 	{
 	}
 
 CollaborationServer::ClientConnection::~ClientConnection(void)
 	{
+	/* Discard any server updates that were deferred for the client: */
+	delete deferredPipe;
+	
 	/* Delete the client states of all protocol plug-ins: */
 	for(ClientProtocolList::iterator pIt=protocols.begin();pIt!=protocols.end();++pIt)
 		delete pIt->protocolClientState;
@@ -96,6 +115,13 @@ bool CollaborationServer::ClientConnection::negotiateProtocols(CollaborationServ
 			/* Let the protocol plug-in process the message payload: */
 			ProtocolClientState* pcs=ps.first->receiveConnectRequest(protocolMessageLength,*pipe);
 			
+			/* Let the protocol plug-in allocate all further state for this client from the connection's arena, and tell it whether the client is a spectator: */
+			if(pcs!=0)
+				{
+				pcs->arena=&arena;
+				pcs->spectator=spectator;
+				}
+			
 			#ifdef VERBOSE
 			if(pcs!=0)
 				std::cout<<" done"<<std::endl;
@@ -128,58 +154,161 @@ bool CollaborationServer::ClientConnection::negotiateProtocols(CollaborationServ
 	return result;
 	}
 
-void CollaborationServer::ClientConnection::sendClientConnectProtocols(ClientConnection* dest,Comm::NetPipe& destPipe)
+void CollaborationServer::ClientConnection::buildProtocolTables(void)
+	{
+	/* Map each negotiated protocol's server index and message IDs to its list entry: */
+	for(ClientProtocolList::iterator cplIt=protocols.begin();cplIt!=protocols.end();++cplIt)
+		{
+		if(protocolTable.size()<=cplIt->index)
+			protocolTable.resize(cplIt->index+1,0);
+		protocolTable[cplIt->index]=&*cplIt;
+		
+		unsigned int messageIdEnd=cplIt->protocol->messageIdBase+cplIt->protocol->getNumMessages();
+		if(messageDispatchTable.size()<messageIdEnd)
+			messageDispatchTable.resize(messageIdEnd,0);
+		for(unsigned int messageId=cplIt->protocol->messageIdBase;messageId<messageIdEnd;++messageId)
+			messageDispatchTable[messageId]=&*cplIt;
+		}
+	}
+
+Comm::NetPipe& CollaborationServer::ClientConnection::getUpdatePipe(void)
+	{
+	if(deferredPipe!=0)
+		return *deferredPipe;
+	else
+		return *pipe;
+	}
+
+unsigned int CollaborationServer::ClientConnection::getNumSharedProtocols(CollaborationServer::ClientConnection* dest)
 	{
 	/* Count the number of protocol plug-ins supported by both clients: */
 	unsigned int numSharedProtocols=0;
-	const ClientProtocolList& cpl1=protocols;
-	const ClientProtocolList& cpl2=dest->protocols;
-	unsigned int i1=0;
-	unsigned int i2=0;
-	while(i1<cpl1.size()&&i2<cpl2.size())
-		{
-		if(cpl1[i1].index<cpl2[i2].index)
-			++i1; // Protocol in first list is not shared
-		else if(cpl1[i1].index>cpl2[i2].index)
-			++i2; // Protocol in second list is not shared
-		else
-			{
+	for(ClientProtocolList::iterator cplIt=protocols.begin();cplIt!=protocols.end();++cplIt)
+		if(dest->findProtocol(cplIt->index)!=0)
 			++numSharedProtocols;
-			++i1;
-			++i2;
-			}
-		}
 	
-	/* Write the number of shared protocols: */
-	destPipe.write<Card>(numSharedProtocols);
+	return numSharedProtocols;
+	}
+
+bool CollaborationServer::ClientConnection::hasSameProtocols(const CollaborationServer::ClientConnection* other) const
+	{
+	/* Compare the two clients' sorted protocol lists: */
+	if(protocols.size()!=other->protocols.size())
+		return false;
+	for(size_t i=0;i<protocols.size();++i)
+		if(protocols[i].index!=other->protocols[i].index)
+			return false;
+	
+	return true;
+	}
+
+void CollaborationServer::ClientConnection::sendClientConnectProtocols(ClientConnection* dest,Comm::NetPipe& destPipe)
+	{
+	/* Write the number of protocol plug-ins supported by both clients: */
+	destPipe.write<Card>(getNumSharedProtocols(dest));
 	
 	/* Now send the actual protocol messages: */
-	i1=0;
-	i2=0;
-	while(i1<cpl1.size()&&i2<cpl2.size())
-		{
-		if(cpl1[i1].index<cpl2[i2].index)
-			++i1; // Protocol in first list is not shared
-		else if(cpl1[i1].index>cpl2[i2].index)
-			++i2; // Protocol in second list is not shared
-		else
+	for(ClientProtocolList::iterator cplIt=protocols.begin();cplIt!=protocols.end();++cplIt)
+		{
+		ProtocolListEntry* destPle=dest->findProtocol(cplIt->index);
+		if(destPle!=0)
 			{
 			/* Write the destination client's protocol index: */
-			destPipe.write<Card>(i2);
+			destPipe.write<Card>(Card(destPle-&dest->protocols[0]));
 			
 			/* Let the protocol send its data: */
-			cpl1[i1].protocol->sendClientConnect(cpl1[i1].protocolClientState,cpl2[i2].protocolClientState,destPipe);
-			
-			++i1;
-			++i2;
+			cplIt->protocol->sendClientConnect(cplIt->protocolClientState,destPle->protocolClientState,destPipe);
 			}
 		}
 	}
 
+/***********************************************************
+Methods of class CollaborationServer::ClientConnectSnapshot:
+***********************************************************/
+
+CollaborationServer::ClientConnectSnapshot::~ClientConnectSnapshot(void)
+	{
+	/* Delete all captured protocol plug-in states: */
+	for(std::vector<ProtocolSnapshot>::iterator psIt=protocols.begin();psIt!=protocols.end();++psIt)
+		delete psIt->second;
+	delete higherLevels;
+	}
+
 /************************************
 Methods of class CollaborationServer:
 ************************************/
 
+void CollaborationServer::reportCompressionStatistics(const CollaborationServer::ClientConnection* client)
+	{
+	if(client->compressedPipe==0)
+		return;
+	
+	const CompressedPipe::Statistics& stats=client->compressedPipe->getStatistics();
+	std::cout<<"CollaborationServer: Client "<<client->clientID<<" ("<<client->state.clientName<<") at "<<client->clientHostname<<", port "<<client->clientPortId<<", compression level "<<client->compressedPipe->getCompressionLevel()<<':'<<std::endl;
+	std::cout<<"  Sent "<<stats.numRawBytesWritten<<" bytes as "<<stats.numCompressedBytesWritten<<" bytes";
+	if(stats.numRawBytesWritten>0)
+		std::cout<<" ("<<double(stats.numCompressedBytesWritten)*100.0/double(stats.numRawBytesWritten)<<"%)";
+	std::cout<<", compression CPU time "<<stats.compressionTime*1000.0<<" ms"<<std::endl;
+	std::cout<<"  Received "<<stats.numCompressedBytesRead<<" bytes as "<<stats.numRawBytesRead<<" bytes";
+	std::cout<<", decompression CPU time "<<stats.decompressionTime*1000.0<<" ms"<<std::endl;
+	}
+
+CollaborationServer::ClientConnectSnapshot* CollaborationServer::captureClientConnect(CollaborationServer::ClientConnection* source,CollaborationServer::ClientConnection* dest)
+	{
+	ClientConnectSnapshot* result=new ClientConnectSnapshot(source->clientID);
+	try
+		{
+		/* Copy the full client state: */
+		result->state=source->state;
+		
+		/* Let all protocol plug-ins shared by the two clients capture their states: */
+		for(ClientConnection::ClientProtocolList::iterator cplIt=source->protocols.begin();cplIt!=source->protocols.end();++cplIt)
+			{
+			ClientConnection::ProtocolListEntry* destPle=dest->findProtocol(cplIt->index);
+			if(destPle!=0)
+				{
+				result->protocols.push_back(ClientConnectSnapshot::ProtocolSnapshot(Card(destPle-&dest->protocols[0]),0));
+				result->protocols.back().second=cplIt->protocol->captureClientConnect(cplIt->protocolClientState,destPle->protocolClientState,*dest->pipe);
+				}
+			}
+		
+		/* Process higher-level protocols: */
+		result->higherLevels=new BufferedPipe(dest->pipe);
+		sendClientConnect(source->clientID,dest->clientID,*result->higherLevels);
+		}
+	catch(...)
+		{
+		delete result;
+		throw;
+		}
+	
+	return result;
+	}
+
+void CollaborationServer::writeClientConnect(const CollaborationServer::ClientConnectSnapshot* snapshot,Comm::NetPipe& pipe)
+	{
+	/* Send a client connect message: */
+	writeMessage(CLIENT_CONNECT,pipe);
+	pipe.write<Card>(snapshot->clientID);
+	
+	/* Send the full client state: */
+	writeClientState(ClientState::FULL_UPDATE,snapshot->state,pipe);
+	
+	/* Send the captured states of all protocol plug-ins shared by the two clients: */
+	pipe.write<Card>(snapshot->protocols.size());
+	for(std::vector<ClientConnectSnapshot::ProtocolSnapshot>::const_iterator psIt=snapshot->protocols.begin();psIt!=snapshot->protocols.end();++psIt)
+		{
+		/* Write the destination client's protocol index: */
+		pipe.write<Card>(psIt->first);
+		
+		/* Let the protocol write its captured data: */
+		psIt->second->write(pipe);
+		}
+	
+	/* Send the captured payload of higher-level protocols: */
+	snapshot->higherLevels->writeToSink(pipe);
+	}
+
 void* CollaborationServer::listenThreadMethod(void)
 	{
 	/* Enable immediate cancellation of this thread: */
@@ -192,7 +321,7 @@ void* CollaborationServer::listenThreadMethod(void)
 		#ifdef VERBOSE
 		std::cout<<"CollaborationServer: Waiting for client connection"<<std::endl<<std::flush;
 		#endif
-		Comm::NetPipePtr clientPipe=new Comm::TCPPipe(listenSocket);
+		Comm::NetPipePtr clientPipe=new Comm::TCPPipe(*listenSocket);
 		
 		/**************************************************************************
 		Connect the new client by creating a new client connection state structure:
@@ -200,18 +329,8 @@ void* CollaborationServer::listenThreadMethod(void)
 		
 		try
 			{
-			/* Create a new client connection state structure: */
 			clientPipe->negotiateEndianness();
-			ClientConnection* newClientConnection=new ClientConnection(nextClientID,clientPipe);
-			if(++nextClientID==0)
-				nextClientID=1;
-			
-			#ifdef VERBOSE
-			std::cout<<"CollaborationServer: Connecting new client from host "<<newClientConnection->clientHostname<<", port "<<newClientConnection->clientPortId<<std::endl<<std::flush;
-			#endif
-			
-			/* Start a communication thread for the new client: */
-			newClientConnection->communicationThread.start(this,&CollaborationServer::clientCommunicationThreadMethod,newClientConnection);
+			startClient(clientPipe,false);
 			}
 		catch(std::runtime_error err)
 			{
@@ -222,6 +341,28 @@ void* CollaborationServer::listenThreadMethod(void)
 	return 0;
 	}
 
+void CollaborationServer::startClient(Comm::NetPipePtr pipe,bool connectRequestRead)
+	{
+	/* Create a new client connection state structure: */
+	ClientConnection* newClientConnection=new ClientConnection(nextClientID,pipe);
+	newClientConnection->connectRequestRead=connectRequestRead;
+	if(++nextClientID==0)
+		nextClientID=1;
+	
+	#ifdef VERBOSE
+	std::cout<<"CollaborationServer: Connecting new client from host "<<newClientConnection->clientHostname<<", port "<<newClientConnection->clientPortId<<std::endl<<std::flush;
+	#endif
+	
+	/* Count the new client until its connection state structure is deleted: */
+	{
+	Threads::Mutex::Lock clientListLock(clientListMutex);
+	++numClientConnections;
+	}
+	
+	/* Start a communication thread for the new client: */
+	newClientConnection->communicationThread.start(this,&CollaborationServer::clientCommunicationThreadMethod,newClientConnection);
+	}
+
 void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::ClientConnection* client)
 	{
 	/* Enable immediate cancellation of this thread: */
@@ -234,18 +375,35 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 		};
 	
 	Threads::Mutex& pipeMutex=client->pipeMutex;
-	Comm::NetPipe& pipe=*(client->pipe);
 	unsigned int clientID=client->clientID;
 	
 	/* Run the client communication state machine until the client disconnects or there is a communication error: */
 	bool clientAdded=false; // Flag to remember whether this client was ever "officially" connected
+	Misc::Autopointer<BufferedPipe> snapshot; // Pipe collecting the connection snapshot for the new client, and then the deferred server updates it catches up on
+	unsigned int numDeferredRounds=0; // Number of rounds of deferred server updates sent to the new client
 	try
 		{
 		State state=START;
 		while(state!=FINISH)
 			{
-			/* Wait for the next message: */
-			MessageIdType message=readMessage(pipe);
+			/* Get the current pipe, which might have been replaced by a compressing pipe during connection initialization: */
+			Comm::NetPipe& pipe=*(client->pipe);
+			
+			if(client->deferredPipe!=0)
+				{
+				/* Send the server updates deferred since the last server update, one round per server update, while still reading the client's messages: */
+				if(sendDeferredUpdates(client,*snapshot,numDeferredRounds))
+					snapshot=0;
+				else
+					{
+					/* Wait for the client's next message for at most one server tick: */
+					if(!pipe.waitForData(Misc::Time(tickTime)))
+						continue;
+					}
+				}
+			
+			/* Wait for the next message, unless a room server already read the client's connection request message: */
+			MessageIdType message=client->connectRequestRead?MessageIdType(CONNECT_REQUEST):readMessage(pipe);
 			
 			/* Process the message based on the communication state: */
 			switch(state)
@@ -262,6 +420,37 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 							{
 							bool connectionOk=true;
 							
+							if(!client->connectRequestRead)
+								{
+								/* Check the client's base protocol version: */
+								unsigned int clientProtocolVersion=pipe.read<Card>();
+								if(clientProtocolVersion!=protocolVersion)
+									{
+									std::cerr<<"CollaborationServer: Rejecting client from host "<<client->clientHostname<<" speaking protocol version "<<(clientProtocolVersion>>16)<<'.'<<(clientProtocolVersion&0xffffU)<<" instead of "<<(protocolVersion>>16)<<'.'<<(protocolVersion&0xffffU)<<std::endl<<std::flush;
+									
+									{
+									Threads::Mutex::Lock pipeLock(pipeMutex);
+									writeVersionReject(pipe);
+									pipe.flush();
+									}
+									
+									state=FINISH;
+									break;
+									}
+								
+								/* Skip the name of the room the client wants to join; a stand-alone server serves all clients in the same room: */
+								read<std::string>(pipe);
+								}
+							client->connectRequestRead=false;
+							
+							/* Read the client's requested pipe compression level and limit it to the server's maximum: */
+							int compressionLevel=pipe.read<Byte>();
+							if(compressionLevel>maxCompressionLevel)
+								compressionLevel=maxCompressionLevel;
+							
+							/* Read whether the client wants to connect as a spectator: */
+							client->spectator=pipe.read<Byte>()!=0;
+							
 							/* Read the client's initial client state: */
 							readClientState(client->state,pipe);
 							
@@ -270,6 +459,7 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 							
 							/* Sort the new client's negotiated protocol list in order of ascending main list index to facilitate quick intersection tests: */
 							std::sort(client->protocols.begin(),client->protocols.end(),ClientConnection::ProtocolListEntry::comp);
+							client->buildProtocolTables();
 							
 							/* Process higher-level protocols: */
 							bool higherLevelsSawRequest=connectionOk;
@@ -283,6 +473,9 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 								Threads::Mutex::Lock pipeLock(pipeMutex);
 								writeMessage(CONNECT_REPLY,pipe);
 								
+								/* Write the granted pipe compression level: */
+								pipe.write<Byte>(compressionLevel);
+								
 								/* Write the number of negotiated protocols: */
 								pipe.write<Card>(client->protocols.size());
 								
@@ -302,37 +495,61 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 								/* Process higher-level protocols: */
 								sendConnectReply(clientID,pipe);
 								
-								/* Send client connect messages for all clients that are already connected: */
-								{
-								Threads::Mutex::Lock clientListLock(clientListMutex);
-								for(ClientList::const_iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
+								if(compressionLevel>0)
 									{
-									Threads::Mutex::Lock clientLock((*clIt)->mutex);
-									
-									/* Send a client connect message: */
-									writeMessage(CLIENT_CONNECT,pipe);
-									pipe.write<Card>((*clIt)->clientID);
+									/* Send the uncompressed reply, and compress everything from here on: */
+									pipe.flush();
+									client->compressedPipe=new CompressedPipe(client->pipe,compressionLevel);
+									client->pipe=client->compressedPipe;
+									}
+								client->pipe->flush();
+								}
+								
+								/* Capture the states of all clients that are already connected, to be marshalled after all locks have been released: */
+								ClientConnectSnapshotList connectSnapshots;
+								try
+									{
+									{
+									Threads::Mutex::Lock clientListLock(clientListMutex);
+									connectSnapshots.reserve(clientList.size());
+									for(ClientList::const_iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
+										{
+										Threads::Mutex::Lock clientLock((*clIt)->mutex);
+										connectSnapshots.push_back(captureClientConnect(*clIt,client));
+										}
 									
-									/* Send the full client state: */
-									writeClientState(ClientState::FULL_UPDATE,(*clIt)->state,pipe);
+									/* Collect server updates for the client until the snapshot has been sent: */
+									{
+									Threads::Mutex::Lock pipeLock(pipeMutex);
+									client->deferredPipe=new BufferedPipe(client->pipe);
+									}
 									
-									/* Send the intersection of protocol plug-ins negotiated with both clients to the client: */
-									(*clIt)->sendClientConnectProtocols(client,pipe);
+									/* Add client action to list: */
+									clientAdded=true;
+									actionList.push_back(ClientListAction(ClientListAction::ADD_CLIENT,clientID,client));
+									}
 									
-									/* Process higher-level protocols: */
-									sendClientConnect((*clIt)->clientID,clientID,pipe);
+									/* Marshal and send the snapshot without holding any locks, so that server updates can proceed in the meantime: */
+									snapshot=new BufferedPipe(client->pipe);
+									for(ClientConnectSnapshotList::iterator csIt=connectSnapshots.begin();csIt!=connectSnapshots.end();++csIt)
+										{
+										writeClientConnect(*csIt,*snapshot);
+										delete *csIt;
+										*csIt=0;
+										}
 									}
+								catch(...)
+									{
+									for(ClientConnectSnapshotList::iterator csIt=connectSnapshots.begin();csIt!=connectSnapshots.end();++csIt)
+										delete *csIt;
+									throw;
+									}
+								snapshot->sendData();
 								
-								/* Add client action to list: */
-								clientAdded=true;
-								actionList.push_back(ClientListAction(ClientListAction::ADD_CLIENT,clientID,client));
-								}
-								
-								pipe.flush();
-								}
+								/* The communication loop sends the server updates deferred during the transfer until the client has caught up: */
 								
 								#ifdef VERBOSE
-								std::cout<<"CollaborationServer: Connected client from host "<<client->clientHostname<<", port "<<client->clientPortId<<" as "<<client->state.clientName<<std::endl<<std::flush;
+								std::cout<<"CollaborationServer: Connected client from host "<<client->clientHostname<<", port "<<client->clientPortId<<" as "<<client->state.clientName<<(client->spectator?" (spectator)":"")<<std::endl<<std::flush;
 								#endif
 								
 								state=CONNECTED;
@@ -363,6 +580,9 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 									sendConnectReject(clientID,pipe);
 									}
 								
+								/* Tell the client which protocol version the server speaks: */
+								pipe.write<Card>(protocolVersion);
+								
 								pipe.flush();
 								}
 								
@@ -387,6 +607,14 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 						{
 						case CLIENT_UPDATE:
 							{
+							if(client->spectator)
+								{
+								/* Spectators cannot change the shared state, and must send empty client updates: */
+								if(pipe.read<Byte>()!=ClientState::NO_CHANGE)
+									Misc::throwStdErr("Protocol error, received non-empty client update from spectator");
+								break;
+								}
+							
 							{
 							/* Lock client state: */
 							Threads::Mutex::Lock clientLock(client->mutex);
@@ -442,21 +670,21 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 						
 						default:
 							{
+							/* Spectators cannot send plug-in or higher-level protocol messages: */
+							if(client->spectator)
+								Misc::throwStdErr("Protocol error, received message %d from spectator",int(message));
+							
 							{
 							Threads::Mutex::Lock clientLock(client->mutex);
 							
 							/* Find the protocol that registered itself for this message ID: */
 							if(message<messageTable.size())
 								{
-								/* Find the protocol's client state object: */
-								ProtocolServer* protocol=messageTable[message];
-								ProtocolClientState* pcs=0;
-								for(ClientConnection::ClientProtocolList::iterator pclIt=client->protocols.begin();pclIt!=client->protocols.end();++pclIt)
-									if(pclIt->protocol==protocol)
-										pcs=pclIt->protocolClientState;
+								/* Look up the negotiated protocol and its client state object: */
+								ClientConnection::ProtocolListEntry* ple=client->findMessageProtocol(message);
 								
 								/* Call on the protocol plug-in to handle the message: */
-								if(protocol==0||pcs==0||!protocol->handleMessage(pcs,message-protocol->messageIdBase,pipe))
+								if(ple==0||ple->protocolClientState==0||!ple->protocol->handleMessage(ple->protocolClientState,message-ple->protocol->messageIdBase,pipe))
 									{
 									/* Bail out: */
 									Misc::throwStdErr("Protocol error, received message %d",int(message));
@@ -512,11 +740,16 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 			/* Remove the request to add the client from the action list: */
 			actionList.erase(alIt);
 			
+			/* Print the final compression statistics of the client's connection: */
+			reportCompressionStatistics(client);
+			
 			/* Delete the client connection state structure immediately (closing the TCP pipe): */
 			delete client;
 			
 			/* Process higher-level protocols: */
 			disconnectClient(clientID);
+			
+			--numClientConnections;
 			}
 		else
 			{
@@ -526,25 +759,45 @@ void* CollaborationServer::clientCommunicationThreadMethod(CollaborationServer::
 		}
 	else
 		{
+		/* Print the final compression statistics of the client's connection: */
+		reportCompressionStatistics(client);
+		
 		/* Delete the client connection state structure immediately (closing the TCP pipe): */
 		delete client;
 		
 		/* Process higher-level protocols: */
 		disconnectClient(clientID);
+		
+		Threads::Mutex::Lock clientListLock(clientListMutex);
+		--numClientConnections;
 		}
 	
 	/* Terminate: */
 	return 0;
 	}
 
-CollaborationServer::CollaborationServer(CollaborationServer::Configuration* sConfiguration)
+CollaborationServer::CollaborationServer(CollaborationServer::Configuration* sConfiguration,const char* sRoomName)
 	:configuration(sConfiguration!=0?sConfiguration:new Configuration),
 	 protocolLoader(configuration->cfg.retrieveString("./pluginDsoNameTemplate",COLLABORATION_PLUGINDSONAMETEMPLATE)),
-	 listenSocket(configuration->cfg.retrieveValue<int>("./listenPortId",-1),0),
-	 nextClientID(1)
+	 roomName(sRoomName!=0?sRoomName:""),
+	 listenSocket(sRoomName==0?new Comm::ListeningTCPSocket(configuration->cfg.retrieveValue<int>("./listenPortId",-1),0):0),
+	 nextClientID(1),numClientConnections(0),
+	 maxCompressionLevel(configuration->cfg.retrieveValue<int>("./maxCompressionLevel",9)),
+	 compressionReportInterval(configuration->cfg.retrieveValue<double>("./compressionReportInterval",0.0)),
+	 nextCompressionReport(0.0),
+	 maxDeferredUpdateSize(configuration->cfg.retrieveValue<size_t>("./maxDeferredUpdateSize",65536)),
+	 maxDeferredUpdateBacklog(configuration->cfg.retrieveValue<size_t>("./maxDeferredUpdateBacklog",16*1024*1024)),
+	 maxDeferredUpdateRounds(configuration->cfg.retrieveValue<unsigned int>("./maxDeferredUpdateRounds",64)),
+	 tickTime(configuration->getTickTime())
 	{
 	typedef std::vector<std::string> StringList;
 	
+	/* Limit the maximum compression level to the range supported by zlib, as it is sent to clients as a single byte: */
+	if(maxCompressionLevel<0)
+		maxCompressionLevel=0;
+	if(maxCompressionLevel>9)
+		maxCompressionLevel=9;
+	
 	/* Get additional search paths from configuration file section and add them to the object loader: */
 	StringList pluginSearchPaths=configuration->cfg.retrieveValue<StringList>("./pluginSearchPaths",StringList());
 	for(StringList::const_iterator tspIt=pluginSearchPaths.begin();tspIt!=pluginSearchPaths.end();++tspIt)
@@ -557,8 +810,9 @@ CollaborationServer::CollaborationServer(CollaborationServer::Configuration* sCo
 	for(unsigned int i=0;i<MESSAGES_END;++i)
 		messageTable.push_back(0);
 	
-	/* Start connection initiating thread: */
-	listenThread.start(this,&CollaborationServer::listenThreadMethod);
+	/* Start connection initiating thread unless the server is part of a room server: */
+	if(listenSocket!=0)
+		listenThread.start(this,&CollaborationServer::listenThreadMethod);
 	}
 
 CollaborationServer::~CollaborationServer(void)
@@ -572,8 +826,12 @@ CollaborationServer::~CollaborationServer(void)
 	Threads::Mutex::Lock clientListLock(clientListMutex);
 	
 	/* Stop connection initiating thread: */
-	listenThread.cancel();
-	listenThread.join();
+	if(listenSocket!=0)
+		{
+		listenThread.cancel();
+		listenThread.join();
+		delete listenSocket;
+		}
 	
 	if(!clientList.empty())
 		{
@@ -596,6 +854,21 @@ CollaborationServer::~CollaborationServer(void)
 			delete *clIt;
 			}
 		}
+	
+	/* Disconnect all spectators: */
+	for(ClientList::iterator slIt=spectatorList.begin();slIt!=spectatorList.end();++slIt)
+		{
+		{
+		Threads::Mutex::Lock clientLock((*slIt)->mutex);
+		
+		/* Stop client communication thread: */
+		(*slIt)->communicationThread.cancel();
+		(*slIt)->communicationThread.join();
+		}
+		
+		/* Delete client connection state structure (closing TCP pipe): */
+		delete *slIt;
+		}
 	}
 	
 	/* Delete all protocol plug-ins: */
@@ -610,6 +883,17 @@ CollaborationServer::~CollaborationServer(void)
 	delete configuration;
 	}
 
+void CollaborationServer::addClient(Comm::NetPipePtr pipe)
+	{
+	startClient(pipe,true);
+	}
+
+bool CollaborationServer::isIdle(void)
+	{
+	Threads::Mutex::Lock clientListLock(clientListMutex);
+	return numClientConnections==0;
+	}
+
 void CollaborationServer::registerProtocol(ProtocolServer* newProtocol)
 	{
 	/* Simply add the protocol to the list; already-connected clients won't be able to use it: */
@@ -677,6 +961,377 @@ std::pair<ProtocolServer*,int> CollaborationServer::loadProtocol(std::string pro
 	return result;
 	}
 
+void CollaborationServer::updateProtocolClients(void)
+	{
+	/* Collect the clients that negotiated each protocol plug-in, and their protocol client states: */
+	protocolClients.clear();
+	protocolClients.resize(protocols.size());
+	for(size_t clientIndex=0;clientIndex<clientList.size();++clientIndex)
+		{
+		ClientConnection* client=clientList[clientIndex];
+		for(ClientConnection::ClientProtocolList::iterator cplIt=client->protocols.begin();cplIt!=client->protocols.end();++cplIt)
+			protocolClients[cplIt->index].push_back(ProtocolClient(clientIndex,cplIt->protocolClientState));
+		}
+	}
+
+void CollaborationServer::failClientUpdate(CollaborationServer::ClientConnection* client,const char* error)
+	{
+	/* Forcibly disconnect clients that cause pipe errors during a state update: */
+	std::cerr<<"CollaborationServer::update: Terminating client connection due to exception "<<error<<std::endl;
+	
+	#ifdef VERBOSE
+	std::cout<<"CollaborationServer::update: Disconnecting client from host "<<client->clientHostname<<", port "<<client->clientPortId<<std::endl<<std::flush;
+	#endif
+	
+	/* Record the client; its communication thread is stopped once the update has released all locks: */
+	updateDeadClients.push_back(client);
+	}
+
+void CollaborationServer::failClientUpdate(size_t clientIndex,const char* error)
+	{
+	updateClientFailed[clientIndex]=true;
+	failClientUpdate(clientList[clientIndex],error);
+	}
+
+void CollaborationServer::finishClientUpdate(CollaborationServer::ClientConnection* client)
+	{
+	/* Disconnect newly connected clients for which too many server updates piled up while their connection snapshots are sent: */
+	if(client->deferredPipe!=0&&client->deferredPipe->getDataSize()>maxDeferredUpdateBacklog)
+		Misc::throwStdErr("More than %lu bytes of server updates deferred for newly connected client",(unsigned long)maxDeferredUpdateBacklog);
+	
+	client->getUpdatePipe().flush();
+	if(client->deferredPipe!=0)
+		++client->numDeferredUpdates;
+	}
+
+bool CollaborationServer::sendDeferredUpdates(CollaborationServer::ClientConnection* client,BufferedPipe& catchUpPipe,unsigned int& numRounds)
+	{
+	{
+	Threads::Mutex::Lock pipeLock(client->pipeMutex);
+	
+	/* Wait for the next server update if none were deferred since the last round: */
+	if(client->numDeferredUpdates==0)
+		return false;
+	client->numDeferredUpdates=0;
+	
+	if(client->deferredPipe->getDataSize()<=maxDeferredUpdateSize)
+		{
+		/* Send the remaining deferred updates and switch the client over to direct server updates: */
+		client->deferredPipe->sendData();
+		delete client->deferredPipe;
+		client->deferredPipe=0;
+		return true;
+		}
+	
+	/* Disconnect clients that cannot catch up with the server updates: */
+	if(numRounds>=maxDeferredUpdateRounds)
+		Misc::throwStdErr("Client did not catch up with server updates after %u rounds",numRounds);
+	++numRounds;
+	
+	/* Take the deferred updates so they can be sent without holding the pipe lock: */
+	catchUpPipe.swapData(*client->deferredPipe);
+	}
+	
+	catchUpPipe.sendData();
+	return false;
+	}
+
+void CollaborationServer::removeClient(CollaborationServer::ClientConnection* client)
+	{
+	unsigned int clientID=client->clientID;
+	
+	/* Process plug-in protocols: */
+	{
+	Threads::Mutex::Lock clientLock(client->mutex);
+	for(ClientConnection::ClientProtocolList::iterator cplIt=client->protocols.begin();cplIt!=client->protocols.end();++cplIt)
+		cplIt->protocol->disconnectClient(cplIt->protocolClientState);
+	}
+	
+	/* Print the final compression statistics of the client's connection: */
+	reportCompressionStatistics(client);
+	
+	/* Delete client connection state structure (closing TCP pipe): */
+	delete client;
+	--numClientConnections;
+	
+	/* Process higher-level protocols: */
+	disconnectClient(clientID);
+	}
+
+void CollaborationServer::broadcastClientConnect(CollaborationServer::ClientConnection* newClient)
+	{
+	size_t numClients=clientList.size();
+	std::vector<bool>& clientFailed=updateClientFailed;
+	
+	/* Assemble the message header and the new client's full state once for each byte order used by the destination clients, and send them to all destinations of that byte order: */
+	IO::VariableMemoryFile& header=updateConnectHeader;
+	for(int swap=0;swap<2;++swap)
+		{
+		bool assembled=false;
+		for(size_t destIndex=0;destIndex<numClients;++destIndex)
+			{
+			ClientConnection* destClient=clientList[destIndex];
+			if(destClient==newClient||clientFailed[destIndex])
+				continue;
+			Comm::NetPipe& pipe=destClient->getUpdatePipe();
+			if(pipe.mustSwapOnWrite()!=(swap!=0))
+				continue;
+			
+			if(!assembled)
+				{
+				header.clear();
+				header.setSwapOnWrite(swap!=0);
+				writeMessage(CLIENT_CONNECT,header);
+				header.write<Card>(newClient->clientID);
+				writeClientState(ClientState::FULL_UPDATE,newClient->state,header);
+				assembled=true;
+				}
+			
+			try
+				{
+				header.writeToSink(pipe);
+				
+				/* Write the number of protocol plug-ins negotiated with both clients: */
+				pipe.write<Card>(newClient->getNumSharedProtocols(destClient));
+				}
+			catch(std::runtime_error err)
+				{
+				failClientUpdate(destIndex,err.what());
+				}
+			}
+		}
+	header.clear();
+	
+	/* Let each of the new client's protocol plug-ins send its payload to all clients sharing the protocol in one batch: */
+	std::vector<ProtocolServer::UpdateDestination>& destinations=updateDestinations;
+	std::vector<size_t>& destinationIndices=updateDestinationIndices;
+	for(ClientConnection::ClientProtocolList::iterator cplIt=newClient->protocols.begin();cplIt!=newClient->protocols.end();++cplIt)
+		{
+		destinations.clear();
+		destinationIndices.clear();
+		const ProtocolClientList& pcl=protocolClients[cplIt->index];
+		for(ProtocolClientList::const_iterator pcIt=pcl.begin();pcIt!=pcl.end();++pcIt)
+			{
+			ClientConnection* destClient=clientList[pcIt->first];
+			if(destClient==newClient||clientFailed[pcIt->first])
+				continue;
+			Comm::NetPipe& pipe=destClient->getUpdatePipe();
+			
+			try
+				{
+				/* Write the destination client's protocol index: */
+				pipe.write<Card>(Card(destClient->findProtocol(cplIt->index)-&destClient->protocols[0]));
+				
+				destinations.push_back(ProtocolServer::UpdateDestination(pcIt->second,&pipe));
+				destinationIndices.push_back(pcIt->first);
+				}
+			catch(std::runtime_error err)
+				{
+				failClientUpdate(pcIt->first,err.what());
+				}
+			}
+		if(destinations.empty())
+			continue;
+		
+		cplIt->protocol->sendClientConnect(cplIt->protocolClientState,&destinations[0],destinations.size());
+		
+		/* Disconnect all destination clients whose pipes failed: */
+		for(size_t i=0;i<destinations.size();++i)
+			if(destinations[i].failed)
+				failClientUpdate(destinationIndices[i],destinations[i].error.c_str());
+		}
+	
+	/* Process higher-level protocols: */
+	for(size_t destIndex=0;destIndex<numClients;++destIndex)
+		{
+		ClientConnection* destClient=clientList[destIndex];
+		if(destClient!=newClient&&!clientFailed[destIndex])
+			{
+			try
+				{
+				sendClientConnect(newClient->clientID,destClient->clientID,destClient->getUpdatePipe());
+				}
+			catch(std::runtime_error err)
+				{
+				failClientUpdate(destIndex,err.what());
+				}
+			}
+		}
+	}
+
+void CollaborationServer::sendClientState(size_t sourceIndex)
+	{
+	size_t numClients=clientList.size();
+	std::vector<bool>& clientFailed=updateClientFailed;
+	ClientConnection* sourceClient=clientList[sourceIndex];
+	const ClientState& state=sourceClient->state;
+	
+	if(getClientStateSize(state.updateMask,state)<minSharedClientStateSize)
+		{
+		/* Write the small state update to each destination client directly: */
+		for(size_t destIndex=0;destIndex<numClients;++destIndex)
+			if(destIndex!=sourceIndex&&!clientFailed[destIndex])
+				{
+				Comm::NetPipe& pipe=clientList[destIndex]->getUpdatePipe();
+				try
+					{
+					pipe.write<Card>(sourceClient->clientID);
+					writeClientState(state.updateMask,state,pipe);
+					}
+				catch(std::runtime_error err)
+					{
+					failClientUpdate(destIndex,err.what());
+					}
+				}
+		
+		return;
+		}
+	
+	/* Assemble the large state update once for each byte order used by the destination clients, and send it to all destinations of that byte order: */
+	IO::VariableMemoryFile& buffer=updateClientStateBuffer;
+	for(int swap=0;swap<2;++swap)
+		{
+		bool assembled=false;
+		for(size_t destIndex=0;destIndex<numClients;++destIndex)
+			{
+			if(destIndex==sourceIndex||clientFailed[destIndex])
+				continue;
+			Comm::NetPipe& pipe=clientList[destIndex]->getUpdatePipe();
+			if(pipe.mustSwapOnWrite()!=(swap!=0))
+				continue;
+			
+			if(!assembled)
+				{
+				buffer.clear();
+				buffer.setSwapOnWrite(swap!=0);
+				buffer.write<Card>(sourceClient->clientID);
+				writeClientState(state.updateMask,state,buffer);
+				assembled=true;
+				}
+			
+			try
+				{
+				buffer.writeToSink(pipe);
+				}
+			catch(std::runtime_error err)
+				{
+				failClientUpdate(destIndex,err.what());
+				}
+			}
+		}
+	buffer.clear();
+	}
+
+void CollaborationServer::sendSpectatorUpdates(void)
+	{
+	/*********************************************************************
+	Spectators that negotiated the same protocol plug-ins and use the same
+	byte order receive identical update streams. Each group's stream is
+	assembled once, using the protocol states of the group's first
+	spectator as destination states, and then copied to all spectators in
+	the group. Spectators using any protocol plug-in that keeps state
+	about individual destination clients get a group of their own.
+	*********************************************************************/
+	
+	/* Sort all spectators into groups: */
+	std::vector<SpectatorGroup>& groups=updateSpectatorGroups;
+	groups.clear();
+	for(size_t spectatorIndex=0;spectatorIndex<spectatorList.size();++spectatorIndex)
+		{
+		ClientConnection* spectator=spectatorList[spectatorIndex];
+		
+		/* Check if the spectator can share an update stream with other spectators: */
+		bool canShare=true;
+		for(ClientConnection::ClientProtocolList::iterator cplIt=spectator->protocols.begin();canShare&&cplIt!=spectator->protocols.end();++cplIt)
+			canShare=cplIt->protocol->canShareSpectatorUpdates();
+		
+		bool swap=spectator->getUpdatePipe().mustSwapOnWrite();
+		std::vector<SpectatorGroup>::iterator gIt=groups.end();
+		if(canShare)
+			for(gIt=groups.begin();gIt!=groups.end();++gIt)
+				if(gIt->representative->getUpdatePipe().mustSwapOnWrite()==swap&&gIt->representative->hasSameProtocols(spectator))
+					break;
+		if(gIt==groups.end())
+			{
+			groups.push_back(SpectatorGroup(spectator));
+			gIt=groups.end()-1;
+			}
+		gIt->members.push_back(spectatorIndex);
+		}
+	
+	std::vector<ClientConnection*>& connectedClients=updateConnectedClients;
+	std::vector<unsigned int>& disconnectedClientIDs=updateDisconnectedClientIDs;
+	for(std::vector<SpectatorGroup>::iterator gIt=groups.begin();gIt!=groups.end();++gIt)
+		{
+		ClientConnection* representative=gIt->representative;
+		BufferedPipe stream(representative->pipe);
+		
+		/* Send client connect messages for all added clients: */
+		for(std::vector<ClientConnection*>::iterator ccIt=connectedClients.begin();ccIt!=connectedClients.end();++ccIt)
+			{
+			ClientConnection* newClient=*ccIt;
+			writeMessage(CLIENT_CONNECT,stream);
+			stream.write<Card>(newClient->clientID);
+			writeClientState(ClientState::FULL_UPDATE,newClient->state,stream);
+			newClient->sendClientConnectProtocols(representative,stream);
+			sendClientConnect(newClient->clientID,representative->clientID,stream);
+			}
+		
+		/* Send client disconnect messages for all removed clients: */
+		for(std::vector<unsigned int>::iterator dcIt=disconnectedClientIDs.begin();dcIt!=disconnectedClientIDs.end();++dcIt)
+			{
+			writeMessage(CLIENT_DISCONNECT,stream);
+			stream.write<Card>(*dcIt);
+			}
+		
+		/* Process plug-in and higher-level protocols: */
+		for(ClientConnection::ClientProtocolList::iterator cplIt=representative->protocols.begin();cplIt!=representative->protocols.end();++cplIt)
+			cplIt->protocol->beforeServerUpdate(cplIt->protocolClientState,stream);
+		beforeServerUpdate(representative->clientID,stream);
+		
+		/* Send the server update packet header, which includes all clients: */
+		writeMessage(SERVER_UPDATE,stream);
+		stream.write<Card>(clientList.size());
+		for(ClientConnection::ClientProtocolList::iterator cplIt=representative->protocols.begin();cplIt!=representative->protocols.end();++cplIt)
+			cplIt->protocol->sendServerUpdate(cplIt->protocolClientState,stream);
+		sendServerUpdate(representative->clientID,stream);
+		
+		/* Send the states of all clients: */
+		for(ClientList::iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
+			{
+			ClientConnection* sourceClient=*clIt;
+			stream.write<Card>(sourceClient->clientID);
+			writeClientState(sourceClient->state.updateMask,sourceClient->state,stream);
+			
+			/* Process plug-in protocols shared by the source client and the group: */
+			for(ClientConnection::ClientProtocolList::iterator cplIt=sourceClient->protocols.begin();cplIt!=sourceClient->protocols.end();++cplIt)
+				{
+				ClientConnection::ProtocolListEntry* destPle=representative->findProtocol(cplIt->index);
+				if(destPle!=0)
+					cplIt->protocol->sendServerUpdate(cplIt->protocolClientState,destPle->protocolClientState,stream);
+				}
+			
+			/* Process higher-level protocols: */
+			sendServerUpdate(sourceClient->clientID,representative->clientID,stream);
+			}
+		
+		/* Copy the assembled stream to all spectators in the group: */
+		for(std::vector<size_t>::iterator mIt=gIt->members.begin();mIt!=gIt->members.end();++mIt)
+			{
+			ClientConnection* spectator=spectatorList[*mIt];
+			try
+				{
+				stream.writeToSink(spectator->getUpdatePipe());
+				finishClientUpdate(spectator);
+				}
+			catch(std::runtime_error err)
+				{
+				failClientUpdate(spectator,err.what());
+				}
+			}
+		}
+	}
+
 void CollaborationServer::update(void)
 	{
 	{
@@ -691,15 +1346,36 @@ void CollaborationServer::update(void)
 	/* Lock client list: */
 	Threads::Mutex::Lock clientListLock(clientListMutex);
 	
-	/* Process all actions from the client action list: */
+	/*********************************************************************
+	Process all actions from the client action list in bulk: added clients
+	are appended to the client list first, and then all removed clients
+	are taken out of the list in a single pass. Clients that connected
+	and disconnected since the last update are never announced to any
+	other clients.
+	*********************************************************************/
+	
+	ClientIDSet& addedClients=updateAddedClients;
+	addedClients.clear();
+	ClientIDSet& removedClients=updateRemovedClients;
+	removedClients.clear();
+	std::vector<ClientConnection*>& connectedClients=updateConnectedClients;
+	connectedClients.clear();
+	std::vector<unsigned int>& disconnectedClientIDs=updateDisconnectedClientIDs;
+	disconnectedClientIDs.clear();
 	for(ActionList::const_iterator alIt=actionList.begin();alIt!=actionList.end();++alIt)
 		{
 		switch(alIt->action)
 			{
 			case ClientListAction::ADD_CLIENT:
 				{
-				/* Add the client state to the list: */
-				clientList.push_back(alIt->client);
+				/* Add the client state to the appropriate list: */
+				if(alIt->client->spectator)
+					spectatorList.push_back(alIt->client);
+				else
+					{
+					clientList.push_back(alIt->client);
+					addedClients[alIt->clientID]=true;
+					}
 				
 				/* Process plug-in protocols: */
 				{
@@ -714,34 +1390,54 @@ void CollaborationServer::update(void)
 				}
 			
 			case ClientListAction::REMOVE_CLIENT:
-				{
-				/* Find the client connection state structure in the list: */
-				ClientList::iterator clIt;
-				for(clIt=clientList.begin();clIt!=clientList.end()&&(*clIt)->clientID!=alIt->clientID;++clIt)
-					;
-				if(clIt!=clientList.end())
-					{
-					/* Process plug-in protocols: */
-					{
-					Threads::Mutex::Lock clientLock(alIt->client->mutex);
-					for(ClientConnection::ClientProtocolList::iterator cplIt=(*clIt)->protocols.begin();cplIt!=(*clIt)->protocols.end();++cplIt)
-						cplIt->protocol->disconnectClient(cplIt->protocolClientState);
-					}
-					
-					/* Delete client connection state structure (closing TCP pipe): */
-					delete *clIt;
-					
-					/* Remove the client from the list: */
-					clientList.erase(clIt);
-					
-					/* Process higher-level protocols: */
-					disconnectClient(alIt->clientID);
-					}
+				/* Mark the client for removal; a client might be marked more than once: */
+				removedClients[alIt->clientID]=true;
 				break;
+			}
+		}
+	
+	if(removedClients.getNumEntries()>0)
+		{
+		/* Remove all marked clients from the client list in a single pass: */
+		ClientList::iterator keepIt=clientList.begin();
+		for(ClientList::iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
+			{
+			ClientConnection* client=*clIt;
+			unsigned int clientID=client->clientID;
+			if(removedClients.isEntry(clientID))
+				{
+				removeClient(client);
+				
+				/* Announce the client's disconnection unless its connection was never announced: */
+				if(!addedClients.isEntry(clientID))
+					disconnectedClientIDs.push_back(clientID);
 				}
+			else
+				*(keepIt++)=client;
 			}
+		clientList.erase(keepIt,clientList.end());
+		
+		/* Remove all marked spectators from the spectator list in a single pass: */
+		keepIt=spectatorList.begin();
+		for(ClientList::iterator slIt=spectatorList.begin();slIt!=spectatorList.end();++slIt)
+			{
+			if(removedClients.isEntry((*slIt)->clientID))
+				removeClient(*slIt);
+			else
+				*(keepIt++)=*slIt;
+			}
+		spectatorList.erase(keepIt,spectatorList.end());
 		}
 	
+	/* Collect the added clients whose connections need to be announced: */
+	for(ActionList::const_iterator alIt=actionList.begin();alIt!=actionList.end();++alIt)
+		if(alIt->action==ClientListAction::ADD_CLIENT&&!removedClients.isEntry(alIt->clientID)&&!alIt->client->spectator)
+			connectedClients.push_back(alIt->client);
+	
+	/* Update the lists of clients sharing each protocol plug-in if the client list changed: */
+	if(!actionList.empty())
+		updateProtocolClients();
+	
 	/* Lock the connection states of all clients: */
 	for(ClientList::iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
 		{
@@ -755,65 +1451,59 @@ void CollaborationServer::update(void)
 			cplIt->protocol->beforeServerUpdate(cplIt->protocolClientState);
 		}
 	
-	/* Create a temporary action list to cleanly disconnect all clients that bomb out during the update step: */
-	std::vector<ClientConnection*> deadClientList;
+	/* Lock the connection states of all spectators, whose plug-in states are processed like those of regular clients: */
+	for(ClientList::iterator slIt=spectatorList.begin();slIt!=spectatorList.end();++slIt)
+		{
+		ClientConnection* spectator=*slIt;
+		spectator->mutex.lock();
+		for(ClientConnection::ClientProtocolList::iterator cplIt=spectator->protocols.begin();cplIt!=spectator->protocols.end();++cplIt)
+			cplIt->protocol->beforeServerUpdate(cplIt->protocolClientState);
+		}
+	
+	/* Reset the action list to cleanly disconnect all clients that bomb out during the update step: */
+	std::vector<ClientConnection*>& deadClientList=updateDeadClients;
+	deadClientList.clear();
+	
+	/*********************************************************************
+	Send state updates to all connected clients. The update messages are
+	assembled in source-major order, i.e., the state of each source
+	client is written to all destination clients before moving on to the
+	next source client, such that each protocol plug-in handles all
+	destinations of a source client in a single batched call. The
+	sequence of data written to each destination client's pipe is the
+	same as if its update message were written in one go.
+	*********************************************************************/
+	
+	size_t numClients=clientList.size();
+	std::vector<bool>& clientFailed=updateClientFailed;
+	clientFailed.assign(numClients,false);
 	
-	/* Send state updates to all connected clients: */
+	/* Lock the communication pipes of all clients and spectators: */
 	for(ClientList::iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
+		(*clIt)->pipeMutex.lock();
+	for(ClientList::iterator slIt=spectatorList.begin();slIt!=spectatorList.end();++slIt)
+		(*slIt)->pipeMutex.lock();
+	
+	/* Send client connect messages for all added clients to all other clients: */
+	for(std::vector<ClientConnection*>::iterator ccIt=connectedClients.begin();ccIt!=connectedClients.end();++ccIt)
+		broadcastClientConnect(*ccIt);
+	
+	/* Send the update message headers to all connected clients: */
+	for(size_t destIndex=0;destIndex<numClients;++destIndex)
 		{
-		ClientConnection* destClient=*clIt;
-		Comm::NetPipe& pipe=*(destClient->pipe);
+		if(clientFailed[destIndex])
+			continue;
+		ClientConnection* destClient=clientList[destIndex];
+		Comm::NetPipe& pipe=destClient->getUpdatePipe();
 		
 		try
 			{
-			{
-			Threads::Mutex::Lock pipeLock(destClient->pipeMutex);
-			
-			/* Check the client state action list for any actions relevant for this client: */
-			for(ActionList::const_iterator alIt=actionList.begin();alIt!=actionList.end();++alIt)
-				if(alIt->clientID!=destClient->clientID)
-					{
-					switch(alIt->action)
-						{
-						case ClientListAction::ADD_CLIENT:
-							{
-							/* Find the added client's state: */
-							ClientConnection* newClient=0;
-							for(ClientList::iterator cl2It=clientList.begin();cl2It!=clientList.end();++cl2It)
-								if((*cl2It)->clientID==alIt->clientID)
-									{
-									newClient=*cl2It;
-									break;
-									}
-							
-							if(newClient!=0)
-								{
-								/* Send a client connect message: */
-								writeMessage(CLIENT_CONNECT,pipe);
-								pipe.write<Card>(newClient->clientID);
-								
-								/* Send the full state of the client: */
-								writeClientState(ClientState::FULL_UPDATE,newClient->state,pipe);
-								
-								/* Send the intersection of protocol plug-ins negotiated with both clients to the client: */
-								newClient->sendClientConnectProtocols(destClient,pipe);
-								
-								/* Process higher-level protocols: */
-								sendClientConnect(newClient->clientID,destClient->clientID,pipe);
-								}
-							break;
-							}
-						
-						case ClientListAction::REMOVE_CLIENT:
-							{
-							/* Send a client disconnect message: */
-							writeMessage(CLIENT_DISCONNECT,pipe);
-							pipe.write<Card>(alIt->clientID);
-							
-							break;
-							}
-						}
-					}
+			/* Send client disconnect messages for all removed clients: */
+			for(std::vector<unsigned int>::iterator dcIt=disconnectedClientIDs.begin();dcIt!=disconnectedClientIDs.end();++dcIt)
+				{
+				writeMessage(CLIENT_DISCONNECT,pipe);
+				pipe.write<Card>(*dcIt);
+				}
 			
 			/* Process plug-in protocols for the client: */
 			for(ClientConnection::ClientProtocolList::iterator cplIt=destClient->protocols.begin();cplIt!=destClient->protocols.end();++cplIt)
@@ -824,7 +1514,7 @@ void CollaborationServer::update(void)
 			
 			/* Send the server update packet header: */
 			writeMessage(SERVER_UPDATE,pipe);
-			pipe.write<Card>(clientList.size()-1);
+			pipe.write<Card>(numClients-1);
 			
 			/* Process plug-in protocols for the client: */
 			for(ClientConnection::ClientProtocolList::iterator cplIt=destClient->protocols.begin();cplIt!=destClient->protocols.end();++cplIt)
@@ -832,60 +1522,84 @@ void CollaborationServer::update(void)
 			
 			/* Process higher-level protocols: */
 			sendServerUpdate(destClient->clientID,pipe);
-			
-			/* Send the states of all other clients: */
-			for(ClientList::iterator cl2It=clientList.begin();cl2It!=clientList.end();++cl2It)
-				if(cl2It!=clIt)
-					{
-					ClientConnection* sourceClient=*cl2It;
-					
-					/* Send the server update packet: */
-					pipe.write<Card>(sourceClient->clientID);
-					writeClientState(sourceClient->state.updateMask,sourceClient->state,pipe);
-					
-					/* Process plug-in protocols shared by the two clients: */
-					ClientConnection::ClientProtocolList::iterator cpl1It=sourceClient->protocols.begin();
-					ClientConnection::ClientProtocolList::iterator cpl2It=destClient->protocols.begin();
-					while(cpl1It!=sourceClient->protocols.end()&&cpl2It!=destClient->protocols.end())
-						{
-						if(cpl1It->index<cpl2It->index)
-							++cpl1It;
-						else if(cpl1It->index>cpl2It->index)
-							++cpl2It;
-						else
-							{
-							/* Send the shared protocol's payload: */
-							cpl1It->protocol->sendServerUpdate(cpl1It->protocolClientState,cpl2It->protocolClientState,pipe);
-							++cpl1It;
-							++cpl2It;
-							}
-						}
-					
-					/* Process higher-level protocols: */
-					sendServerUpdate(sourceClient->clientID,destClient->clientID,pipe);
-					}
-			
-			/* Finish the message: */
-			pipe.flush();
-			}
 			}
 		catch(std::runtime_error err)
 			{
-			/* Forcibly disconnect clients that cause pipe errors during a state update: */
-			std::cerr<<"CollaborationServer::update: Terminating client connection due to exception "<<err.what()<<std::endl;
-			
-			#ifdef VERBOSE
-			std::cout<<"CollaborationServer::update: Disconnecting client from host "<<destClient->clientHostname<<", port "<<destClient->clientPortId<<std::endl<<std::flush;
-			#endif
+			failClientUpdate(destIndex,err.what());
+			}
+		}
+	
+	/* Send the states of all clients to all other clients: */
+	std::vector<ProtocolServer::UpdateDestination>& destinations=updateDestinations;
+	std::vector<size_t>& destinationIndices=updateDestinationIndices;
+	for(size_t sourceIndex=0;sourceIndex<numClients;++sourceIndex)
+		{
+		ClientConnection* sourceClient=clientList[sourceIndex];
+		
+		/* Send the source client's state to all other clients: */
+		sendClientState(sourceIndex);
+		
+		/* Let each of the source client's protocol plug-ins send its payload to all clients sharing the protocol in one batch: */
+		for(ClientConnection::ClientProtocolList::iterator cplIt=sourceClient->protocols.begin();cplIt!=sourceClient->protocols.end();++cplIt)
+			{
+			destinations.clear();
+			destinationIndices.clear();
+			const ProtocolClientList& pcl=protocolClients[cplIt->index];
+			for(ProtocolClientList::const_iterator pcIt=pcl.begin();pcIt!=pcl.end();++pcIt)
+				if(pcIt->first!=sourceIndex&&!clientFailed[pcIt->first])
+					{
+					destinations.push_back(ProtocolServer::UpdateDestination(pcIt->second,&clientList[pcIt->first]->getUpdatePipe()));
+					destinationIndices.push_back(pcIt->first);
+					}
+			if(destinations.empty())
+				continue;
 			
-			/* Stop client communication thread: */
-			destClient->communicationThread.cancel();
-			destClient->communicationThread.join();
+			cplIt->protocol->sendServerUpdate(cplIt->protocolClientState,&destinations[0],destinations.size());
 			
-			/* Properly disconnect the client on the next update: */
-			deadClientList.push_back(destClient);
+			/* Disconnect all destination clients whose pipes failed: */
+			for(size_t i=0;i<destinations.size();++i)
+				if(destinations[i].failed)
+					failClientUpdate(destinationIndices[i],destinations[i].error.c_str());
+			}
+		
+		/* Process higher-level protocols: */
+		for(size_t destIndex=0;destIndex<numClients;++destIndex)
+			if(destIndex!=sourceIndex&&!clientFailed[destIndex])
+				{
+				try
+					{
+					sendServerUpdate(sourceClient->clientID,clientList[destIndex]->clientID,clientList[destIndex]->getUpdatePipe());
+					}
+				catch(std::runtime_error err)
+					{
+					failClientUpdate(destIndex,err.what());
+					}
+				}
+		}
+	
+	/* Send the update messages to all spectators: */
+	if(!spectatorList.empty())
+		sendSpectatorUpdates();
+	
+	/* Finish the update messages and unlock the communication pipes of all clients: */
+	for(size_t destIndex=0;destIndex<numClients;++destIndex)
+		{
+		ClientConnection* destClient=clientList[destIndex];
+		if(!clientFailed[destIndex])
+			{
+			try
+				{
+				finishClientUpdate(destClient);
+				}
+			catch(std::runtime_error err)
+				{
+				failClientUpdate(destIndex,err.what());
+				}
 			}
+		destClient->pipeMutex.unlock();
 		}
+	for(ClientList::iterator slIt=spectatorList.begin();slIt!=spectatorList.end();++slIt)
+		(*slIt)->pipeMutex.unlock();
 	
 	/* Process plug-in protocols: */
 	for(ClientList::iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
@@ -899,6 +1613,13 @@ void CollaborationServer::update(void)
 		/* Unlock the client state: */
 		client->mutex.unlock();
 		}
+	for(ClientList::iterator slIt=spectatorList.begin();slIt!=spectatorList.end();++slIt)
+		{
+		ClientConnection* spectator=*slIt;
+		for(ClientConnection::ClientProtocolList::iterator cplIt=spectator->protocols.begin();cplIt!=spectator->protocols.end();++cplIt)
+			cplIt->protocol->afterServerUpdate(cplIt->protocolClientState);
+		spectator->mutex.unlock();
+		}
 	
 	/* Clear the client state list action list: */
 	actionList.clear();
@@ -919,6 +1640,36 @@ void CollaborationServer::update(void)
 	for(ProtocolList::iterator plIt=protocols.begin();plIt!=protocols.end();++plIt)
 		(*plIt)->afterServerUpdate();
 	}
+	
+	/*********************************************************************
+	Stop the communication threads of all clients that failed during the
+	update. This must not happen while any client's pipe or state mutex,
+	or the client or protocol list mutex, is locked, because a
+	communication thread blocked on one of those mutexes cannot be
+	cancelled. The dead clients are deleted during the next update.
+	*********************************************************************/
+	
+	for(std::vector<ClientConnection*>::const_iterator dclIt=updateDeadClients.begin();dclIt!=updateDeadClients.end();++dclIt)
+		{
+		(*dclIt)->communicationThread.cancel();
+		(*dclIt)->communicationThread.join();
+		}
+	
+	/* Periodically report the compression statistics of all connected clients: */
+	if(compressionReportInterval>0.0)
+		{
+		Misc::Time nowTime=Misc::Time::now();
+		double now=double(nowTime.tv_sec)+double(nowTime.tv_nsec)/1.0e9;
+		if(now>=nextCompressionReport)
+			{
+			Threads::Mutex::Lock clientListLock(clientListMutex);
+			for(ClientList::iterator clIt=clientList.begin();clIt!=clientList.end();++clIt)
+				reportCompressionStatistics(*clIt);
+			for(ClientList::iterator slIt=spectatorList.begin();slIt!=spectatorList.end();++slIt)
+				reportCompressionStatistics(*slIt);
+			nextCompressionReport=now+compressionReportInterval;
+			}
+		}
 	}
 
 bool CollaborationServer::receiveConnectRequest(unsigned int clientID,Comm::NetPipe& pipe)
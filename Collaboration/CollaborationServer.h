@@ -34,10 +34,20 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <Threads/Mutex.h>
 #include <Comm/ListeningTCPSocket.h>
 #include <Comm/NetPipe.h>
+#include <IO/VariableMemoryFile.h>
 #include <Vrui/Geometry.h>
+#include <Collaboration/Arena.h>
+#include <Collaboration/FlatHashTable.h>
 #include <Collaboration/ProtocolServer.h>
 #include <Collaboration/CollaborationProtocol.h>
 
+/* Forward declarations: */
+namespace Collaboration {
+class CompressedPipe;
+class BufferedPipe;
+class CollaborationRoomServer;
+}
+
 namespace Collaboration {
 
 class CollaborationServer:private CollaborationProtocol
@@ -47,6 +57,7 @@ class CollaborationServer:private CollaborationProtocol
 	class Configuration // Class to configure a collaboration server
 		{
 		friend class CollaborationServer;
+		friend class CollaborationRoomServer;
 		
 		/* Elements: */
 		private:
@@ -60,6 +71,7 @@ class CollaborationServer:private CollaborationProtocol
 		/* Methods: */
 		void setListenPortId(int newListenPortId); // Overrides the default server listening port ID
 		double getTickTime(void); // Returns server loop's tick time in seconds
+		bool getEnableRooms(void); // Returns true if the server runs several independent rooms
 		};
 	
 	private:
@@ -98,12 +110,20 @@ class CollaborationServer:private CollaborationProtocol
 		public:
 		Threads::Mutex mutex; // Mutex protecting the client connection state structure
 		unsigned int clientID; // Server-wide unique client ID
+		bool spectator; // Flag if the client is a passive spectator, which receives the session's updates but is never announced to other clients
+		bool connectRequestRead; // Flag if the message ID and room name of the client's connection request were already read by a room server
 		Threads::Mutex pipeMutex; // Mutex protecting the client communication pipe
 		Comm::NetPipePtr pipe; // Communication pipe connecting to the client
+		CompressedPipe* compressedPipe; // Pointer to the compressing pipe wrapping the client's TCP pipe, or 0 if the client did not request compression
+		BufferedPipe* deferredPipe; // Pipe collecting server updates for the client while its connection snapshot is being sent, or 0 if server updates are sent directly
+		unsigned int numDeferredUpdates; // Number of server updates deferred for the client since its last round of sending deferred server updates
 		std::string clientHostname; // Hostname of connected client
 		int clientPortId; // Port ID of connected client
 		ClientProtocolList protocols; // List of protocol plug-ins negotiated with this client sorted in order of ascending index
+		std::vector<ProtocolListEntry*> protocolTable; // Table mapping server protocol indices to entries in the negotiated protocol list, or null for protocols not negotiated with this client
+		std::vector<ProtocolListEntry*> messageDispatchTable; // Table mapping message IDs to the entries of the negotiated protocols handling them
 		Threads::Thread communicationThread; // Thread receiving messages from the connected client
+		Arena arena; // Memory arena from which the client's state and all its protocol plug-in states are allocated; released as a whole when the client disconnects
 		ClientState state; // Transient client state
 		unsigned int stateUpdateMask; // Update mask for the transient client state
 		
@@ -113,6 +133,18 @@ class CollaborationServer:private CollaborationProtocol
 		
 		/* Methods: */
 		bool negotiateProtocols(CollaborationServer& server); // Finds the common subset of protocol plug-ins registered on the client and server; returns false if any protocol rejects the client
+		void buildProtocolTables(void); // Builds the protocol and message dispatch tables after the negotiated protocol list has been sorted
+		ProtocolListEntry* findProtocol(unsigned int index) // Returns the negotiated protocol list entry for the given server protocol index, or null
+			{
+			return index<protocolTable.size()?protocolTable[index]:0;
+			}
+		ProtocolListEntry* findMessageProtocol(unsigned int messageId) // Returns the negotiated protocol list entry handling the given message ID, or null
+			{
+			return messageId<messageDispatchTable.size()?messageDispatchTable[messageId]:0;
+			}
+		Comm::NetPipe& getUpdatePipe(void); // Returns the pipe to which server updates for the client are written; pipe mutex must be locked
+		unsigned int getNumSharedProtocols(ClientConnection* dest); // Returns the number of protocol plug-ins negotiated with both this client and the given client
+		bool hasSameProtocols(const ClientConnection* other) const; // Returns true if this client and the given client negotiated the same protocol plug-ins
 		void sendClientConnectProtocols(ClientConnection* dest,Comm::NetPipe& destPipe); // Lets all protocol plug-ins shared by the two clients write their CLIENT_CONNECT message payloads
 		};
 	
@@ -141,34 +173,117 @@ class CollaborationServer:private CollaborationProtocol
 	
 	typedef std::vector<ClientListAction> ActionList; // Type for lists of client list actions
 	
+	struct ClientConnectSnapshot // Structure holding the state of a connected client, captured under the client's lock for a newly connecting client
+		{
+		/* Embedded classes: */
+		public:
+		typedef std::pair<unsigned int,ProtocolServer::ConnectSnapshot*> ProtocolSnapshot; // Type for the new client's index of a shared protocol plug-in and the plug-in's captured state
+		
+		/* Elements: */
+		unsigned int clientID; // ID of the connected client
+		ClientState state; // Copy of the connected client's state
+		std::vector<ProtocolSnapshot> protocols; // Captured states of all protocol plug-ins shared by the two clients
+		BufferedPipe* higherLevels; // Client connect payload of higher-level protocols, or 0 if not yet captured
+		
+		/* Constructors and destructors: */
+		ClientConnectSnapshot(unsigned int sClientID)
+			:clientID(sClientID),higherLevels(0)
+			{
+			}
+		~ClientConnectSnapshot(void);
+		};
+	
+	typedef std::vector<ClientConnectSnapshot*> ClientConnectSnapshotList; // Type for lists of captured client states
+	typedef std::pair<size_t,ProtocolClientState*> ProtocolClient; // Type for a client's index in the client list and its state for one protocol plug-in
+	typedef std::vector<ProtocolClient> ProtocolClientList; // Type for lists of clients that negotiated the same protocol plug-in
+	typedef FlatHashTable<unsigned int,bool> ClientIDSet; // Type for sets of client IDs
+	
+	struct SpectatorGroup // Structure for groups of spectators that receive identical server update streams
+		{
+		/* Elements: */
+		public:
+		ClientConnection* representative; // Spectator whose protocol states are used to assemble the group's server update stream
+		std::vector<size_t> members; // Indices of the group's spectators in the spectator list
+		
+		/* Constructors and destructors: */
+		SpectatorGroup(ClientConnection* sRepresentative)
+			:representative(sRepresentative)
+			{
+			}
+		};
+	
 	/* Elements: */
 	private:
+	static const size_t minSharedClientStateSize; // Size of client state updates in bytes from which they are assembled once for all destination clients instead of written to each destination
 	Configuration* configuration; // Pointer to the server's configuration object
 	ProtocolServerLoader protocolLoader; // Object loader to dynamically load protocol plug-ins requested by clients
-	Comm::ListeningTCPSocket listenSocket; // Socket receiving connection requests from clients
+	std::string roomName; // Name of the room served by the server if it is part of a room server; empty for stand-alone servers
+	Comm::ListeningTCPSocket* listenSocket; // Socket receiving connection requests from clients, or 0 if the server is part of a room server
 	Threads::Thread listenThread; // Thread receiving connection request messages
 	Threads::Mutex protocolListMutex; // Mutex protecting the protocol list
 	ProtocolList protocols; // List of protocols currently registered with the server
 	std::vector<ProtocolServer*> messageTable; // Table mapping from message IDs to the protocol engines handling them
 	Threads::Mutex clientListMutex; // Mutex protecting the client state list
 	ClientList clientList; // The list containing the states of all currently connected clients
+	ClientList spectatorList; // The list containing the states of all currently connected spectators
 	ActionList actionList; // List of recent client state list actions
 	unsigned int nextClientID; // Unique identification numbers assigned to clients in order of connection
+	unsigned int numClientConnections; // Number of existing client connection state structures, including clients that are still connecting or waiting for removal
+	std::vector<ProtocolClientList> protocolClients; // Lists of clients that negotiated each protocol plug-in, indexed by protocol index; rebuilt whenever the client list changes
+	int maxCompressionLevel; // Highest compression level the server grants to clients requesting pipe compression; 0 disables compression
+	double compressionReportInterval; // Time interval between reports of per-client compression statistics in seconds; zero disables periodic reports
+	double nextCompressionReport; // Wall-clock time in seconds at which to print the next compression statistics report
+	size_t maxDeferredUpdateSize; // Amount of deferred server updates below which a newly connected client is switched over to direct server updates
+	size_t maxDeferredUpdateBacklog; // Amount of deferred server updates above which a newly connected client is disconnected
+	unsigned int maxDeferredUpdateRounds; // Maximum number of rounds of sending deferred server updates before a newly connected client is disconnected
+	double tickTime; // Interval between server updates in seconds; newly connected clients catching up on deferred server updates wait at most this long for messages
+	
+	/* Scratch lists used during server updates; retained between updates to avoid per-update allocations: */
+	std::vector<bool> updateClientFailed; // Flags for clients whose pipes failed during the current update
+	std::vector<ProtocolServer::UpdateDestination> updateDestinations; // Destinations of a batched plug-in server update
+	std::vector<size_t> updateDestinationIndices; // Client list indices of the destinations of a batched plug-in server update
+	std::vector<ClientConnection*> updateDeadClients; // Clients that failed during the current update
+	ClientIDSet updateAddedClients; // IDs of clients added to the client list during the current update
+	ClientIDSet updateRemovedClients; // IDs of clients removed from the client list during the current update
+	std::vector<ClientConnection*> updateConnectedClients; // Added clients whose connections are announced to all other clients during the current update
+	std::vector<unsigned int> updateDisconnectedClientIDs; // IDs of removed clients whose disconnections are announced to all remaining clients during the current update
+	IO::VariableMemoryFile updateConnectHeader; // Buffer to assemble the header and full client state of a CLIENT_CONNECT message once for all destination clients
+	IO::VariableMemoryFile updateClientStateBuffer; // Buffer to assemble a large client state update once for all destination clients
+	std::vector<SpectatorGroup> updateSpectatorGroups; // Groups of spectators sharing a server update stream
 	
 	/* Private methods: */
 	void* listenThreadMethod(void); // Method for thread receiving connection request messages
+	void startClient(Comm::NetPipePtr pipe,bool connectRequestRead); // Creates a connection state structure for a new client connected via the given pipe and starts its communication thread
+	static void reportCompressionStatistics(const ClientConnection* client); // Prints the compression statistics of the given client connection
 	void* clientCommunicationThreadMethod(ClientConnection* client); // Method for thread receiving messages from connected clients
+	void updateProtocolClients(void); // Rebuilds the lists of clients that negotiated each protocol plug-in
+	void failClientUpdate(ClientConnection* client,const char* error); // Records a client or spectator that failed during a state update for disconnection after the update
+	void failClientUpdate(size_t clientIndex,const char* error); // Ditto for the client of the given client list index, and excludes it from the rest of the update
+	void finishClientUpdate(ClientConnection* client); // Flushes the server update written to the given client or spectator; throws an exception if the client fell too far behind while connecting
+	bool sendDeferredUpdates(ClientConnection* client,BufferedPipe& catchUpPipe,unsigned int& numRounds); // Sends one round of the server updates deferred for the given newly connected client since the last server update via the given pipe; returns true if the client was switched over to direct server updates
+	void removeClient(ClientConnection* client); // Disconnects the given client from all protocols and deletes it during a state update
+	void broadcastClientConnect(ClientConnection* newClient); // Sends CLIENT_CONNECT messages for the given newly added client to all other clients during a state update
+	ClientConnectSnapshot* captureClientConnect(ClientConnection* source,ClientConnection* dest); // Captures the state of the given connected client for the given connecting client; source client's mutex must be locked
+	void writeClientConnect(const ClientConnectSnapshot* snapshot,Comm::NetPipe& pipe); // Writes a CLIENT_CONNECT message for the given captured client state to the given pipe
+	void sendClientState(size_t sourceIndex); // Sends the state update of the client of the given client list index to all other clients during a state update
+	void sendSpectatorUpdates(void); // Assembles the server update stream once for each group of spectators and sends it to all spectators in the group during a state update
 	
 	/* Constructors and destructors: */
 	public:
-	CollaborationServer(Configuration* sConfiguration =0); // Creates a server object with the given configuration
+	CollaborationServer(Configuration* sConfiguration =0,const char* sRoomName =0); // Creates a server object with the given configuration; creates a room of a room server that does not listen for connections itself if a room name is given
 	virtual ~CollaborationServer(void);
 	
 	/* Methods: */
-	int getListenPortId(void) const // Returns the port ID the collaboration server listens on
+	int getListenPortId(void) const // Returns the port ID the collaboration server listens on, or -1 if the server is part of a room server
 		{
-		return listenSocket.getPortId();
+		return listenSocket!=0?listenSocket->getPortId():-1;
 		};
+	const std::string& getRoomName(void) const // Returns the name of the room served by the server; empty for stand-alone servers
+		{
+		return roomName;
+		}
+	void addClient(Comm::NetPipePtr pipe); // Adds a client connected via the given pipe, whose connection request message ID and room name were already read by a room server
+	bool isIdle(void); // Returns true if the server has no clients, including clients that are still connecting or waiting for removal
 	virtual void registerProtocol(ProtocolServer* newProtocol); // Registers a new protocol plug-in with the server; server inherits objects
 	virtual std::pair<ProtocolServer*,int> loadProtocol(std::string protocolName); // Returns a protocol server plug-in for the given protocol, or 0
 	virtual void update(void); // Signals the server to send state updates to all connected clients
@@ -0,0 +1,248 @@
+/***********************************************************************
+CompressedPipe - Class for network pipes that transparently compress
+all data sent through an underlying network pipe using a persistent
+zlib stream.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/CompressedPipe.h>
+
+#include <time.h>
+#include <stdexcept>
+#include <Misc/ThrowStdErr.h>
+#include <Misc/Time.h>
+
+namespace Collaboration {
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+inline double getThreadCpuTime(void) // Returns the CPU time consumed by the calling thread in seconds
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+	return double(ts.tv_sec)+double(ts.tv_nsec)/1.0e9;
+	}
+
+}
+
+/*******************************
+Methods of class CompressedPipe:
+*******************************/
+
+size_t CompressedPipe::readData(IO::File::Byte* buffer,size_t bufferSize)
+	{
+	/* Decompress into the given buffer until at least one byte of uncompressed data has been produced: */
+	inflater.next_out=reinterpret_cast<Bytef*>(buffer);
+	inflater.avail_out=bufferSize;
+	while(inflater.avail_out==bufferSize)
+		{
+		if(inflater.avail_in==0)
+			{
+			/* Read the next chunk of compressed data from the underlying pipe: */
+			size_t readSize=pipe->readUpTo(inflateBuffer,compressedBufferSize);
+			if(readSize==0)
+				{
+				/* Signal end-of-file: */
+				return 0;
+				}
+			statistics.numCompressedBytesRead+=readSize;
+			inflater.next_in=reinterpret_cast<Bytef*>(inflateBuffer);
+			inflater.avail_in=readSize;
+			}
+		
+		/* Decompress as much as possible: */
+		double startTime=getThreadCpuTime();
+		int result=inflate(&inflater,Z_SYNC_FLUSH);
+		statistics.decompressionTime+=getThreadCpuTime()-startTime;
+		if(result!=Z_OK&&result!=Z_BUF_ERROR)
+			Misc::throwStdErr("CompressedPipe::readData: Error %d while decompressing incoming data",result);
+		}
+	
+	/* Remember if the decompression stream filled the read buffer and might have more output: */
+	inflatePending=inflater.avail_out==0;
+	
+	size_t readSize=bufferSize-inflater.avail_out;
+	statistics.numRawBytesRead+=readSize;
+	return readSize;
+	}
+
+void CompressedPipe::writeData(const IO::File::Byte* buffer,size_t bufferSize)
+	{
+	/*********************************************************************
+	The write buffer is handed down either when it is full or when the
+	protocol flushes the pipe at the end of a message. Using a sync flush
+	in both cases guarantees that the receiver can decode every complete
+	message as soon as it arrives, while the compression dictionary
+	carries over from one message to the next.
+	*********************************************************************/
+	
+	statistics.numRawBytesWritten+=bufferSize;
+	deflater.next_in=const_cast<Bytef*>(reinterpret_cast<const Bytef*>(buffer));
+	deflater.avail_in=bufferSize;
+	do
+		{
+		/* Compress into the intermediate buffer: */
+		deflater.next_out=reinterpret_cast<Bytef*>(deflateBuffer);
+		deflater.avail_out=compressedBufferSize;
+		double startTime=getThreadCpuTime();
+		int result=deflate(&deflater,Z_SYNC_FLUSH);
+		statistics.compressionTime+=getThreadCpuTime()-startTime;
+		if(result!=Z_OK&&result!=Z_BUF_ERROR)
+			Misc::throwStdErr("CompressedPipe::writeData: Error %d while compressing outgoing data",result);
+		
+		/* Send the compressed data to the underlying pipe: */
+		size_t compressedSize=compressedBufferSize-deflater.avail_out;
+		pipe->writeRaw(deflateBuffer,compressedSize);
+		statistics.numCompressedBytesWritten+=compressedSize;
+		}
+	while(deflater.avail_out==0);
+	
+	/* Send the compressed data on its way: */
+	pipe->flush();
+	}
+
+CompressedPipe::CompressedPipe(Comm::NetPipePtr sPipe,int sCompressionLevel)
+	:Comm::NetPipe(ReadWrite),
+	 pipe(sPipe),
+	 compressionLevel(sCompressionLevel),
+	 inflatePending(false),
+	 compressedBufferSize(16384),
+	 deflateBuffer(0),inflateBuffer(0)
+	{
+	/* Initialize the compression and decompression streams: */
+	deflater.zalloc=Z_NULL;
+	deflater.zfree=Z_NULL;
+	deflater.opaque=Z_NULL;
+	if(deflateInit(&deflater,compressionLevel)!=Z_OK)
+		Misc::throwStdErr("CompressedPipe::CompressedPipe: Unable to initialize compression stream");
+	inflater.zalloc=Z_NULL;
+	inflater.zfree=Z_NULL;
+	inflater.opaque=Z_NULL;
+	inflater.next_in=Z_NULL;
+	inflater.avail_in=0;
+	if(inflateInit(&inflater)!=Z_OK)
+		{
+		deflateEnd(&deflater);
+		Misc::throwStdErr("CompressedPipe::CompressedPipe: Unable to initialize decompression stream");
+		}
+	
+	/* Allocate the intermediate buffers: */
+	deflateBuffer=new Byte[compressedBufferSize];
+	inflateBuffer=new Byte[compressedBufferSize];
+	
+	/* Inherit the underlying pipe's endianness settings; the underlying pipe only sees raw data: */
+	setSwapOnRead(pipe->mustSwapOnRead());
+	setSwapOnWrite(pipe->mustSwapOnWrite());
+	}
+
+CompressedPipe::~CompressedPipe(void)
+	{
+	/* Send any pending data: */
+	try
+		{
+		flush();
+		}
+	catch(std::runtime_error err)
+		{
+		/* Ignore the error; the connection is going away anyway */
+		}
+	
+	/* Release the compression and decompression streams: */
+	deflateEnd(&deflater);
+	inflateEnd(&inflater);
+	delete[] deflateBuffer;
+	delete[] inflateBuffer;
+	}
+
+int CompressedPipe::getFd(void) const
+	{
+	return pipe->getFd();
+	}
+
+bool CompressedPipe::waitForData(void) const
+	{
+	/* Check for data that has already been decompressed into the read buffer: */
+	if(getUnreadDataSize()>0||inflatePending)
+		return true;
+	
+	/* Check for compressed data that has been received but not yet decompressed: */
+	if(inflater.avail_in>0)
+		return true;
+	
+	return pipe->waitForData();
+	}
+
+bool CompressedPipe::waitForData(const Misc::Time& timeout) const
+	{
+	/* Check for data that has already been decompressed into the read buffer: */
+	if(getUnreadDataSize()>0||inflatePending)
+		return true;
+	
+	/* Check for compressed data that has been received but not yet decompressed: */
+	if(inflater.avail_in>0)
+		return true;
+	
+	return pipe->waitForData(timeout);
+	}
+
+void CompressedPipe::shutdown(bool read,bool write)
+	{
+	/* Send any pending data before shutting down the write side: */
+	if(write)
+		flush();
+	
+	pipe->shutdown(read,write);
+	}
+
+int CompressedPipe::getPortId(void) const
+	{
+	return pipe->getPortId();
+	}
+
+std::string CompressedPipe::getAddress(void) const
+	{
+	return pipe->getAddress();
+	}
+
+std::string CompressedPipe::getHostName(void) const
+	{
+	return pipe->getHostName();
+	}
+
+int CompressedPipe::getPeerPortId(void) const
+	{
+	return pipe->getPeerPortId();
+	}
+
+std::string CompressedPipe::getPeerAddress(void) const
+	{
+	return pipe->getPeerAddress();
+	}
+
+std::string CompressedPipe::getPeerHostName(void) const
+	{
+	return pipe->getPeerHostName();
+	}
+
+}
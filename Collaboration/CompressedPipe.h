@@ -0,0 +1,114 @@
+/***********************************************************************
+CompressedPipe - Class for network pipes that transparently compress
+all data sent through an underlying network pipe using a persistent
+zlib stream.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#ifndef COLLABORATION_COMPRESSEDPIPE_INCLUDED
+#define COLLABORATION_COMPRESSEDPIPE_INCLUDED
+
+#include <stddef.h>
+#include <zlib.h>
+#include <string>
+#include <Comm/NetPipe.h>
+
+namespace Collaboration {
+
+class CompressedPipe:public Comm::NetPipe
+	{
+	/* Embedded classes: */
+	public:
+	struct Statistics // Structure to accumulate compression statistics
+		{
+		/* Elements: */
+		public:
+		size_t numRawBytesWritten; // Number of uncompressed bytes written to the pipe
+		size_t numCompressedBytesWritten; // Number of compressed bytes sent to the underlying pipe
+		size_t numCompressedBytesRead; // Number of compressed bytes received from the underlying pipe
+		size_t numRawBytesRead; // Number of uncompressed bytes read from the pipe
+		double compressionTime; // Total CPU time spent compressing outgoing data in seconds
+		double decompressionTime; // Total CPU time spent decompressing incoming data in seconds
+		
+		/* Constructors and destructors: */
+		Statistics(void)
+			:numRawBytesWritten(0),numCompressedBytesWritten(0),
+			 numCompressedBytesRead(0),numRawBytesRead(0),
+			 compressionTime(0.0),decompressionTime(0.0)
+			{
+			}
+		};
+	
+	/* Elements: */
+	private:
+	Comm::NetPipePtr pipe; // The underlying network pipe
+	int compressionLevel; // zlib compression level for outgoing data
+	z_stream deflater; // Compression stream for outgoing data; retains its dictionary for the lifetime of the pipe
+	z_stream inflater; // Decompression stream for incoming data; retains its dictionary for the lifetime of the pipe
+	bool inflatePending; // Flag if the decompression stream might hold decompressed data that did not fit into the read buffer
+	size_t compressedBufferSize; // Size of the intermediate buffers for compressed data
+	Byte* deflateBuffer; // Buffer receiving compressed outgoing data
+	Byte* inflateBuffer; // Buffer holding compressed incoming data
+	Statistics statistics; // Accumulated compression statistics
+	
+	/* Protected methods from IO::File: */
+	protected:
+	virtual size_t readData(Byte* buffer,size_t bufferSize);
+	virtual void writeData(const Byte* buffer,size_t bufferSize);
+	
+	/* Constructors and destructors: */
+	public:
+	CompressedPipe(Comm::NetPipePtr sPipe,int sCompressionLevel); // Creates a compressed pipe on top of the given network pipe, which must have negotiated endianness already
+	private:
+	CompressedPipe(const CompressedPipe& source); // Prohibit copy constructor
+	CompressedPipe& operator=(const CompressedPipe& source); // Prohibit assignment operator
+	public:
+	virtual ~CompressedPipe(void);
+	
+	/* Methods from IO::File: */
+	virtual int getFd(void) const;
+	
+	/* Methods from Comm::Pipe: */
+	virtual bool waitForData(void) const;
+	virtual bool waitForData(const Misc::Time& timeout) const;
+	virtual void shutdown(bool read,bool write);
+	
+	/* Methods from Comm::NetPipe: */
+	virtual int getPortId(void) const;
+	virtual std::string getAddress(void) const;
+	virtual std::string getHostName(void) const;
+	virtual int getPeerPortId(void) const;
+	virtual std::string getPeerAddress(void) const;
+	virtual std::string getPeerHostName(void) const;
+	
+	/* New methods: */
+	int getCompressionLevel(void) const // Returns the pipe's compression level
+		{
+		return compressionLevel;
+		}
+	const Statistics& getStatistics(void) const // Returns the pipe's accumulated compression statistics
+		{
+		return statistics;
+		}
+	};
+
+}
+
+#endif
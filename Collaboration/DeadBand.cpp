@@ -0,0 +1,77 @@
+/***********************************************************************
+DeadBand - Class to decide whether changes to tracked positions,
+orientations, and valuator values are large enough to be sent to the
+collaboration server.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/DeadBand.h>
+
+#include <Misc/ConfigurationFile.h>
+#include <Misc/StandardValueCoders.h>
+#include <Math/Math.h>
+
+namespace Collaboration {
+
+/*************************
+Methods of class DeadBand:
+*************************/
+
+void DeadBand::updateDerivedTolerances(void)
+	{
+	positionTolerance2=positionTolerance*positionTolerance;
+	linearVelocityTolerance2=linearVelocityTolerance*linearVelocityTolerance;
+	angularVelocityTolerance2=angularVelocityTolerance*angularVelocityTolerance;
+	directionCosTolerance=Math::cos(angleTolerance);
+	rotationCosTolerance=Math::cos(angleTolerance*Scalar(0.5));
+	}
+
+DeadBand::DeadBand(void)
+	:positionTolerance(0),angleTolerance(0),
+	 linearVelocityTolerance(0),angularVelocityTolerance(0),
+	 valueTolerance(0),
+	 maxStaleness(0.0)
+	{
+	updateDerivedTolerances();
+	}
+
+DeadBand::DeadBand(DeadBand::Scalar sPositionTolerance,DeadBand::Scalar sAngleTolerance,DeadBand::Scalar sLinearVelocityTolerance,DeadBand::Scalar sAngularVelocityTolerance,DeadBand::Scalar sValueTolerance,double sMaxStaleness)
+	:positionTolerance(sPositionTolerance),angleTolerance(sAngleTolerance),
+	 linearVelocityTolerance(sLinearVelocityTolerance),angularVelocityTolerance(sAngularVelocityTolerance),
+	 valueTolerance(sValueTolerance),
+	 maxStaleness(sMaxStaleness)
+	{
+	updateDerivedTolerances();
+	}
+
+void DeadBand::configure(const Misc::ConfigurationFileSection& configFileSection,DeadBand::Scalar inchFactor)
+	{
+	/* Read the tolerances, using the current settings as defaults: */
+	positionTolerance=configFileSection.retrieveValue<Scalar>("./deadBandPositionTolerance",positionTolerance/inchFactor)*inchFactor;
+	angleTolerance=Math::rad(configFileSection.retrieveValue<Scalar>("./deadBandAngleTolerance",Math::deg(angleTolerance)));
+	linearVelocityTolerance=configFileSection.retrieveValue<Scalar>("./deadBandLinearVelocityTolerance",linearVelocityTolerance/inchFactor)*inchFactor;
+	angularVelocityTolerance=Math::rad(configFileSection.retrieveValue<Scalar>("./deadBandAngularVelocityTolerance",Math::deg(angularVelocityTolerance)));
+	valueTolerance=configFileSection.retrieveValue<Scalar>("./deadBandValueTolerance",valueTolerance);
+	maxStaleness=configFileSection.retrieveValue<double>("./deadBandMaxStaleness",maxStaleness);
+	
+	updateDerivedTolerances();
+	}
+
+}
@@ -0,0 +1,150 @@
+/***********************************************************************
+DeadBand - Class to decide whether changes to tracked positions,
+orientations, and valuator values are large enough to be sent to the
+collaboration server.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+A dead band suppresses state updates caused by tracking noise. A change
+is only reported if it exceeds the respective tolerance, or if the last
+update is older than the maximum staleness interval, in which case any
+change at all is reported so that receivers eventually see the exact
+state. All tolerances of zero report every change.
+***********************************************************************/
+
+#ifndef COLLABORATION_DEADBAND_INCLUDED
+#define COLLABORATION_DEADBAND_INCLUDED
+
+#include <Collaboration/Protocol.h>
+
+/* Forward declarations: */
+namespace Misc {
+class ConfigurationFileSection;
+}
+
+namespace Collaboration {
+
+class DeadBand
+	{
+	/* Embedded classes: */
+	public:
+	typedef Protocol::Scalar Scalar;
+	typedef Protocol::Vector Vector;
+	typedef Protocol::ONTransform ONTransform;
+	
+	/* Elements: */
+	private:
+	Scalar positionTolerance; // Largest imperceptible change in position in physical coordinate units
+	Scalar angleTolerance; // Largest imperceptible change in orientation or direction in radians
+	Scalar linearVelocityTolerance; // Largest imperceptible change in linear velocity in physical coordinate units per second
+	Scalar angularVelocityTolerance; // Largest imperceptible change in angular velocity in radians per second
+	Scalar valueTolerance; // Largest imperceptible change in valuator values
+	double maxStaleness; // Longest time in seconds for which imperceptible changes are withheld
+	Scalar positionTolerance2; // Squared position tolerance
+	Scalar linearVelocityTolerance2; // Squared linear velocity tolerance
+	Scalar angularVelocityTolerance2; // Squared angular velocity tolerance
+	Scalar directionCosTolerance; // Cosine of the angle tolerance, to compare direction vectors
+	Scalar rotationCosTolerance; // Cosine of half the angle tolerance, to compare rotation quaternions
+	
+	/* Private methods: */
+	void updateDerivedTolerances(void); // Updates the derived tolerances after the tolerances changed
+	static Scalar sqrDist(const Vector& v1,const Vector& v2) // Returns the squared distance between two vectors
+		{
+		Scalar result(0);
+		for(int i=0;i<3;++i)
+			result+=(v1[i]-v2[i])*(v1[i]-v2[i]);
+		return result;
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	DeadBand(void); // Creates a dead band reporting every change
+	DeadBand(Scalar sPositionTolerance,Scalar sAngleTolerance,Scalar sLinearVelocityTolerance,Scalar sAngularVelocityTolerance,Scalar sValueTolerance,double sMaxStaleness); // Creates a dead band with the given tolerances; angle tolerances are in radians
+	
+	/* Methods: */
+	void configure(const Misc::ConfigurationFileSection& configFileSection,Scalar inchFactor); // Overrides the current tolerances from the given configuration file section; position tolerances are given in inches and converted using the given number of physical coordinate units per inch, and angle tolerances are given in degrees
+	Scalar getPositionTolerance(void) const // Returns the position tolerance
+		{
+		return positionTolerance;
+		}
+	Scalar getAngleTolerance(void) const // Returns the angle tolerance in radians
+		{
+		return angleTolerance;
+		}
+	Scalar getLinearVelocityTolerance(void) const // Returns the linear velocity tolerance
+		{
+		return linearVelocityTolerance;
+		}
+	Scalar getAngularVelocityTolerance(void) const // Returns the angular velocity tolerance in radians per second
+		{
+		return angularVelocityTolerance;
+		}
+	Scalar getValueTolerance(void) const // Returns the valuator value tolerance
+		{
+		return valueTolerance;
+		}
+	double getMaxStaleness(void) const // Returns the maximum staleness interval in seconds
+		{
+		return maxStaleness;
+		}
+	bool isStale(double lastUpdateTime,double time) const // Returns true if an update sent at the first time is stale at the second time
+		{
+		return time-lastUpdateTime>=maxStaleness;
+		}
+	bool changedPosition(const Vector& sent,const Vector& current,bool stale) const // Returns true if a change in position must be sent
+		{
+		return sent!=current&&(stale||sqrDist(sent,current)>positionTolerance2);
+		}
+	bool changedLinearVelocity(const Vector& sent,const Vector& current,bool stale) const // Returns true if a change in linear velocity must be sent
+		{
+		return sent!=current&&(stale||sqrDist(sent,current)>linearVelocityTolerance2);
+		}
+	bool changedDirection(const Vector& sent,const Vector& current,bool stale) const // Returns true if a change in direction must be sent
+		{
+		if(sent==current)
+			return false;
+		if(stale)
+			return true;
+		Scalar dot=sent*current;
+		return dot<=Scalar(0)||dot*dot<directionCosTolerance*directionCosTolerance*Geometry::sqr(sent)*Geometry::sqr(current);
+		}
+	bool changedAngularVelocity(const Vector& sent,const Vector& current,bool stale) const // Returns true if a change in angular velocity in radians per second must be sent
+		{
+		return sent!=current&&(stale||sqrDist(sent,current)>angularVelocityTolerance2);
+		}
+	bool changed(const ONTransform& sent,const ONTransform& current,bool stale) const // Returns true if a change in position or orientation must be sent
+		{
+		if(sent==current)
+			return false;
+		if(stale||sqrDist(sent.getTranslation(),current.getTranslation())>positionTolerance2)
+			return true;
+		
+		/* Compare the orientations by the angle between their quaternions: */
+		const Scalar* q1=sent.getRotation().getQuaternion();
+		const Scalar* q2=current.getRotation().getQuaternion();
+		Scalar dot=q1[0]*q2[0]+q1[1]*q2[1]+q1[2]*q2[2]+q1[3]*q2[3];
+		return (dot>=Scalar(0)?dot:-dot)<rotationCosTolerance;
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,359 @@
+/***********************************************************************
+FlatHashTable - Class for hash tables mapping small keys such as IDs or
+pointers to values, storing all entries contiguously for fast
+iteration, and finding them via an open-addressing index.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+FlatHashTable implements the subset of the Misc::HashTable interface
+used by the collaboration infrastructure. Entries are kept in a dense
+array in no particular order; removing an entry moves the last entry
+into its place, which invalidates iterators pointing at the last entry
+and entry references. Iterating over a table touches only the dense
+entry array.
+***********************************************************************/
+
+#ifndef COLLABORATION_FLATHASHTABLE_INCLUDED
+#define COLLABORATION_FLATHASHTABLE_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+#include <Misc/ThrowStdErr.h>
+
+namespace Collaboration {
+
+template <class KeyParam>
+class FlatHashTableHash // Default hash function class for integral keys
+	{
+	/* Methods: */
+	public:
+	static unsigned int hash(const KeyParam& key)
+		{
+		return (unsigned int)(key);
+		}
+	};
+
+template <class PointeeParam>
+class FlatHashTableHash<PointeeParam*> // Hash function class for pointer keys
+	{
+	/* Methods: */
+	public:
+	static unsigned int hash(PointeeParam* key)
+		{
+		/* Drop the always-zero alignment bits and fold the upper half of 64-bit pointers: */
+		size_t bits=reinterpret_cast<size_t>(key)>>4;
+		return (unsigned int)(bits^((bits>>16)>>16));
+		}
+	};
+
+template <class KeyParam,class ValueParam,class HashParam =FlatHashTableHash<KeyParam> >
+class FlatHashTable
+	{
+	/* Embedded classes: */
+	public:
+	typedef KeyParam Source; // Type of keys
+	typedef ValueParam Dest; // Type of values
+	typedef HashParam Hash; // Hash function class
+	
+	class Entry // Class for key/value pairs
+		{
+		friend class FlatHashTable;
+		
+		/* Elements: */
+		private:
+		Source source; // Entry's key
+		Dest dest; // Entry's value
+		
+		/* Constructors and destructors: */
+		public:
+		Entry(void)
+			{
+			}
+		Entry(const Source& sSource,const Dest& sDest)
+			:source(sSource),dest(sDest)
+			{
+			}
+		
+		/* Methods: */
+		const Source& getSource(void) const
+			{
+			return source;
+			}
+		const Dest& getDest(void) const
+			{
+			return dest;
+			}
+		Dest& getDest(void)
+			{
+			return dest;
+			}
+		};
+	
+	private:
+	typedef std::vector<Entry> EntryList; // Type for dense entry arrays
+	
+	public:
+	class ConstIterator;
+	
+	class Iterator // Class to iterate through and modify table entries
+		{
+		friend class FlatHashTable;
+		friend class ConstIterator;
+		
+		/* Elements: */
+		private:
+		FlatHashTable* table; // Table being iterated
+		size_t index; // Index of current entry in the table's entry array
+		
+		/* Constructors and destructors: */
+		Iterator(FlatHashTable* sTable,size_t sIndex)
+			:table(sTable),index(sIndex)
+			{
+			}
+		public:
+		Iterator(void)
+			:table(0),index(0)
+			{
+			}
+		
+		/* Methods: */
+		bool isFinished(void) const // Returns true if the iterator is past the last entry
+			{
+			return table==0||index>=table->entries.size();
+			}
+		Entry& operator*(void) const
+			{
+			return table->entries[index];
+			}
+		Entry* operator->(void) const
+			{
+			return &table->entries[index];
+			}
+		Iterator& operator++(void)
+			{
+			++index;
+			return *this;
+			}
+		};
+	
+	class ConstIterator // Class to iterate through table entries
+		{
+		friend class FlatHashTable;
+		
+		/* Elements: */
+		private:
+		const FlatHashTable* table; // Table being iterated
+		size_t index; // Index of current entry in the table's entry array
+		
+		/* Constructors and destructors: */
+		ConstIterator(const FlatHashTable* sTable,size_t sIndex)
+			:table(sTable),index(sIndex)
+			{
+			}
+		public:
+		ConstIterator(void)
+			:table(0),index(0)
+			{
+			}
+		ConstIterator(const Iterator& source)
+			:table(source.table),index(source.index)
+			{
+			}
+		
+		/* Methods: */
+		bool isFinished(void) const // Returns true if the iterator is past the last entry
+			{
+			return table==0||index>=table->entries.size();
+			}
+		const Entry& operator*(void) const
+			{
+			return table->entries[index];
+			}
+		const Entry* operator->(void) const
+			{
+			return &table->entries[index];
+			}
+		ConstIterator& operator++(void)
+			{
+			++index;
+			return *this;
+			}
+		};
+	
+	/* Elements: */
+	private:
+	static const unsigned int emptySlot=~0U; // Index value marking unused slots
+	EntryList entries; // Dense array of all entries
+	std::vector<unsigned int> slots; // Open-addressing index mapping hash values to indices in the entry array; size is a power of two
+	unsigned int slotShift; // Number of bits to shift multiplied hash values to get slot indices
+	
+	/* Private methods: */
+	size_t getHomeSlot(const Source& source) const // Returns the preferred slot of the given key
+		{
+		/* Use Fibonacci hashing to spread consecutive IDs across the slot array: */
+		return size_t((Hash::hash(source)*2654435769U)>>slotShift);
+		}
+	size_t findSlot(const Source& source) const // Returns the slot holding the given key, or the empty slot where it would be inserted
+		{
+		size_t slotMask=slots.size()-1;
+		size_t slot=getHomeSlot(source);
+		while(slots[slot]!=emptySlot&&!(entries[slots[slot]].source==source))
+			slot=(slot+1)&slotMask;
+		return slot;
+		}
+	void rehash(size_t newNumSlots) // Rebuilds the slot array with the given power-of-two size
+		{
+		slots.assign(newNumSlots,emptySlot);
+		slotShift=32;
+		for(size_t s=newNumSlots;s>1;s>>=1)
+			--slotShift;
+		for(size_t i=0;i<entries.size();++i)
+			slots[findSlot(entries[i].source)]=(unsigned int)(i);
+		}
+	size_t insert(const Source& source,const Dest& dest) // Adds a new entry known not to be in the table; returns its index
+		{
+		/* Keep the slot array at most half full: */
+		if((entries.size()+1)*2>slots.size())
+			rehash(slots.size()*2);
+		
+		size_t index=entries.size();
+		entries.push_back(Entry(source,dest));
+		slots[findSlot(source)]=(unsigned int)(index);
+		return index;
+		}
+	void removeSlot(size_t slot) // Removes the entry referenced by the given slot
+		{
+		size_t slotMask=slots.size()-1;
+		size_t index=slots[slot];
+		
+		/* Close the gap in the slot array by shifting back displaced slots of the same probe sequence: */
+		size_t gap=slot;
+		for(size_t next=(gap+1)&slotMask;slots[next]!=emptySlot;next=(next+1)&slotMask)
+			{
+			size_t home=getHomeSlot(entries[slots[next]].source);
+			if(((next-home)&slotMask)>=((next-gap)&slotMask))
+				{
+				slots[gap]=slots[next];
+				gap=next;
+				}
+			}
+		slots[gap]=emptySlot;
+		
+		/* Move the last entry into the removed entry's place: */
+		size_t last=entries.size()-1;
+		if(index!=last)
+			{
+			slots[findSlot(entries[last].source)]=(unsigned int)(index);
+			entries[index]=entries[last];
+			}
+		entries.pop_back();
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	FlatHashTable(size_t sInitialSize =16) // Creates an empty table with room for the given number of entries
+		{
+		size_t numSlots=16;
+		while(numSlots<sInitialSize*2)
+			numSlots<<=1;
+		entries.reserve(numSlots/2);
+		rehash(numSlots);
+		}
+	
+	/* Methods: */
+	size_t getNumEntries(void) const // Returns the number of entries in the table
+		{
+		return entries.size();
+		}
+	void clear(void) // Removes all entries from the table
+		{
+		entries.clear();
+		slots.assign(slots.size(),emptySlot);
+		}
+	bool isEntry(const Source& source) const // Returns true if the table contains the given key
+		{
+		return slots[findSlot(source)]!=emptySlot;
+		}
+	void setEntry(const Entry& newEntry) // Sets the value of the given key, adding a new entry if the key is not in the table
+		{
+		(*this)[newEntry.source]=newEntry.dest;
+		}
+	Dest& operator[](const Source& source) // Returns the value of the given key, adding a default-constructed value if the key is not in the table
+		{
+		unsigned int index=slots[findSlot(source)];
+		if(index==emptySlot)
+			index=(unsigned int)(insert(source,Dest()));
+		return entries[index].dest;
+		}
+	Entry& getEntry(const Source& source) // Returns the entry of the given key; throws exception if the key is not in the table
+		{
+		unsigned int index=slots[findSlot(source)];
+		if(index==emptySlot)
+			Misc::throwStdErr("FlatHashTable::getEntry: Entry not found");
+		return entries[index];
+		}
+	const Entry& getEntry(const Source& source) const // Ditto
+		{
+		unsigned int index=slots[findSlot(source)];
+		if(index==emptySlot)
+			Misc::throwStdErr("FlatHashTable::getEntry: Entry not found");
+		return entries[index];
+		}
+	Iterator findEntry(const Source& source) // Returns an iterator to the entry of the given key, or a finished iterator
+		{
+		unsigned int index=slots[findSlot(source)];
+		return Iterator(this,index!=emptySlot?size_t(index):entries.size());
+		}
+	ConstIterator findEntry(const Source& source) const // Ditto
+		{
+		unsigned int index=slots[findSlot(source)];
+		return ConstIterator(this,index!=emptySlot?size_t(index):entries.size());
+		}
+	void removeEntry(const Source& source) // Removes the entry of the given key if it is in the table
+		{
+		size_t slot=findSlot(source);
+		if(slots[slot]!=emptySlot)
+			removeSlot(slot);
+		}
+	void removeEntry(const Iterator& it) // Removes the entry referenced by the given unfinished iterator
+		{
+		removeSlot(findSlot(entries[it.index].source));
+		}
+	Iterator begin(void) // Returns an iterator to the first entry
+		{
+		return Iterator(this,0);
+		}
+	ConstIterator begin(void) const // Ditto
+		{
+		return ConstIterator(this,0);
+		}
+	};
+
+/*********************************************
+Static elements of class template FlatHashTable:
+*********************************************/
+
+template <class KeyParam,class ValueParam,class HashParam>
+const unsigned int FlatHashTable<KeyParam,ValueParam,HashParam>::emptySlot;
+
+}
+
+#endif
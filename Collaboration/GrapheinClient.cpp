@@ -24,13 +24,15 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <Collaboration/GrapheinClient.h>
 
 #include <iostream>
+#include <algorithm>
 #include <Misc/ThrowStdErr.h>
-#include <IO/FixedMemoryFile.h>
 #include <Comm/NetPipe.h>
 #include <GL/gl.h>
 #include <GL/GLColorTemplates.h>
 #include <GL/GLGeometryWrappers.h>
 #include <GL/GLTransformationWrappers.h>
+#include <GL/GLContextData.h>
+#include <GL/Extensions/GLARBVertexBufferObject.h>
 #include <GLMotif/StyleSheet.h>
 #include <GLMotif/WidgetManager.h>
 #include <GLMotif/PopupWindow.h>
@@ -40,30 +42,228 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <GLMotif/TextField.h>
 #include <Vrui/Vrui.h>
 #include <Vrui/InputDevice.h>
+#include <Collaboration/CollaborationClient.h>
 
 namespace Collaboration {
 
+/********************************************************
+Methods of class GrapheinClient::CurveRenderer::DataItem:
+********************************************************/
+
+GrapheinClient::CurveRenderer::DataItem::DataItem(void)
+	:vertexBufferId(0),vertexBufferCapacity(0),
+	 version(0)
+	{
+	/* Create a vertex buffer object if the extension is supported; otherwise, render from client memory: */
+	if(GLARBVertexBufferObject::isSupported())
+		{
+		GLARBVertexBufferObject::initExtension();
+		glGenBuffersARB(1,&vertexBufferId);
+		}
+	}
+
+GrapheinClient::CurveRenderer::DataItem::~DataItem(void)
+	{
+	if(vertexBufferId!=0)
+		glDeleteBuffersARB(1,&vertexBufferId);
+	}
+
+/**********************************************
+Methods of class GrapheinClient::CurveRenderer:
+**********************************************/
+
+GrapheinClient::CurveRenderer::CurveRenderer(const GrapheinProtocol::CurveSet& sCurves)
+	:curves(sCurves),
+	 index(curves)
+	{
+	}
+
+void GrapheinClient::CurveRenderer::initContext(GLContextData& contextData) const
+	{
+	/* Create a data item and store it in the context: */
+	DataItem* dataItem=new DataItem;
+	contextData.addDataItem(this,dataItem);
+	}
+
+void GrapheinClient::CurveRenderer::glRenderAction(GLContextData& contextData) const
+	{
+	if(curves.getNumCurves()==0)
+		return;
+	
+	/* Get the context data item: */
+	DataItem* dataItem=contextData.retrieveDataItem<DataItem>(this);
+	
+	glPushAttrib(GL_ENABLE_BIT|GL_LINE_BIT);
+	glDisable(GL_LIGHTING);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	
+	const Point* vertexPointer=curves.getVertexBuffer();
+	if(dataItem->vertexBufferId!=0)
+		{
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB,dataItem->vertexBufferId);
+		
+		if(dataItem->version!=curves.getVersion())
+			{
+			size_t numVertices=curves.getVertexBufferSize();
+			if(dataItem->vertexBufferCapacity<numVertices)
+				{
+				/* Re-allocate the vertex buffer object with room to grow, and upload the entire vertex buffer: */
+				size_t newCapacity=dataItem->vertexBufferCapacity*2;
+				if(newCapacity<numVertices)
+					newCapacity=numVertices;
+				glBufferDataARB(GL_ARRAY_BUFFER_ARB,newCapacity*sizeof(Point),0,GL_DYNAMIC_DRAW_ARB);
+				glBufferSubDataARB(GL_ARRAY_BUFFER_ARB,0,numVertices*sizeof(Point),curves.getVertexBuffer());
+				dataItem->vertexBufferCapacity=newCapacity;
+				}
+			else
+				{
+				/* Upload only the vertices that changed since the last upload: */
+				size_t firstVertex=curves.getFirstChangedVertex(dataItem->version);
+				if(firstVertex<numVertices)
+					glBufferSubDataARB(GL_ARRAY_BUFFER_ARB,firstVertex*sizeof(Point),(numVertices-firstVertex)*sizeof(Point),curves.getVertexBuffer()+firstVertex);
+				}
+			}
+		
+		/* Render from the vertex buffer object: */
+		vertexPointer=0;
+		}
+	
+	if(dataItem->version!=curves.getVersion())
+		{
+		/* Rebuild the list of draw calls, sorted by curve appearance to minimize state changes: */
+		dataItem->drawCalls.clear();
+		for(CurveSet::ConstIterator cIt=curves.begin();!cIt.isFinished();++cIt)
+			dataItem->drawCalls.push_back(DrawCall(cIt->getDest()));
+		std::sort(dataItem->drawCalls.begin(),dataItem->drawCalls.end());
+		
+		dataItem->version=curves.getVersion();
+		}
+	
+	const std::vector<DrawCall>* drawCalls=&dataItem->drawCalls;
+	if(index.isCurrent())
+		{
+		/* Calculate the current combined projection and modelview matrix: */
+		GLdouble projection[16],modelview[16];
+		glGetDoublev(GL_PROJECTION_MATRIX,projection);
+		glGetDoublev(GL_MODELVIEW_MATRIX,modelview);
+		double pmv[16];
+		for(int i=0;i<4;++i)
+			for(int j=0;j<4;++j)
+				{
+				pmv[i*4+j]=0.0;
+				for(int k=0;k<4;++k)
+					pmv[i*4+j]+=projection[k*4+j]*modelview[i*4+k];
+				}
+		
+		/* Cull the curves against the view frustum: */
+		dataItem->visibleCurveIds.clear();
+		index.cull(GrapheinCurveIndex::Frustum(pmv),dataItem->visibleCurveIds);
+		if(dataItem->visibleCurveIds.size()<dataItem->drawCalls.size())
+			{
+			/* Render only the visible curves: */
+			dataItem->visibleDrawCalls.clear();
+			for(std::vector<unsigned int>::iterator vcIt=dataItem->visibleCurveIds.begin();vcIt!=dataItem->visibleCurveIds.end();++vcIt)
+				dataItem->visibleDrawCalls.push_back(DrawCall(*curves.findCurve(*vcIt)));
+			std::sort(dataItem->visibleDrawCalls.begin(),dataItem->visibleDrawCalls.end());
+			drawCalls=&dataItem->visibleDrawCalls;
+			}
+		}
+	
+	/* Render the curves in batches of the same appearance: */
+	glVertexPointer(3,GL_FLOAT,0,vertexPointer);
+	std::vector<DrawCall>::const_iterator dcIt=drawCalls->begin();
+	while(dcIt!=drawCalls->end())
+		{
+		glLineWidth(dcIt->lineWidth);
+		glColor(dcIt->color);
+		std::vector<DrawCall>::const_iterator batchIt=dcIt;
+		for(;dcIt!=drawCalls->end()&&!(*batchIt<*dcIt);++dcIt)
+			glDrawArrays(GL_LINE_STRIP,dcIt->firstVertex,dcIt->numVertices);
+		}
+	
+	if(dataItem->vertexBufferId!=0)
+		glBindBufferARB(GL_ARRAY_BUFFER_ARB,0);
+	
+	glPopClientAttrib();
+	glPopAttrib();
+	}
+
 /**************************************************
 Methods of class GrapheinClient::RemoteClientState:
 **************************************************/
 
-GrapheinClient::RemoteClientState::RemoteClientState(void)
-	:curves(17)
+GrapheinClient::RemoteClientState::RemoteClientState(MessageBufferPool& sMessageBufferPool)
+	:curves(17),renderer(curves),
+	 messageBufferPool(sMessageBufferPool)
 	{
 	}
 
 GrapheinClient::RemoteClientState::~RemoteClientState(void)
 	{
-	/* Delete all curves in the hash table: */
-	for(CurveMap::Iterator cIt=curves.begin();!cIt.isFinished();++cIt)
-		delete cIt->getDest();
-	
 	/* Delete any leftover message buffers: */
 	{
 	Threads::Mutex::Lock messageBufferLock(messageBufferMutex);
 	for(std::vector<IncomingMessage*>::iterator mIt=messages.begin();mIt!=messages.end();++mIt)
-		delete *mIt;
+		messageBufferPool.release(*mIt);
+	}
 	}
+
+void GrapheinClient::RemoteClientState::queueMessage(GrapheinClient::IncomingMessage* msg)
+	{
+	/* Find the last delete-all message in the buffer: */
+	IO::File::Offset startPos=0;
+	bool deletesAll=false;
+	try
+		{
+		while(!msg->eom())
+			{
+			IO::File::Offset messagePos=msg->getReadPos();
+			switch(GrapheinProtocol::readMessage(*msg))
+				{
+				case ADD_CURVE:
+					msg->skip<Card>(1);
+					Curve::skip(*msg);
+					break;
+				
+				case APPEND_POINTS:
+					msg->skip<Card>(2);
+					skipVertexRun(*msg);
+					break;
+				
+				case DELETE_CURVE:
+					msg->skip<Card>(1);
+					break;
+				
+				case DELETE_ALL_CURVES:
+					startPos=messagePos;
+					deletesAll=true;
+					break;
+				}
+			}
+		}
+	catch(...)
+		{
+		/* Return the buffer to the pool and re-throw the exception: */
+		messageBufferPool.release(msg);
+		throw;
+		}
+	
+	/* Start processing the buffer at the last delete-all message, which supersedes everything before it: */
+	msg->setReadPosAbs(startPos);
+	
+	Threads::Mutex::Lock messageBufferLock(messageBufferMutex);
+	
+	/* Drop all queued buffers if the new buffer deletes all curves: */
+	if(deletesAll)
+		{
+		for(std::vector<IncomingMessage*>::iterator mIt=messages.begin();mIt!=messages.end();++mIt)
+			messageBufferPool.release(*mIt);
+		messages.clear();
+		}
+	
+	/* Store the new buffer in the message list: */
+	messages.push_back(msg);
 	}
 
 void GrapheinClient::RemoteClientState::processMessages(void)
@@ -74,8 +274,8 @@ void GrapheinClient::RemoteClientState::processMessages(void)
 	for(std::vector<IncomingMessage*>::iterator mIt=messages.begin();mIt!=messages.end();++mIt)
 		{
 		/* Process all messages in this buffer: */
-		IO::File& msg=**mIt;
-		while(!msg.eof())
+		IncomingMessage& msg=**mIt;
+		while(!msg.eom())
 			{
 			/* Read the next message: */
 			MessageIdType message=GrapheinProtocol::readMessage(msg);
@@ -86,43 +286,35 @@ void GrapheinClient::RemoteClientState::processMessages(void)
 					unsigned int newCurveId=msg.read<Card>();
 					
 					/* Check if a curve of the given ID already exists: */
-					if(curves.isEntry(newCurveId))
+					if(curves.isCurve(newCurveId))
 						{
 						/* Skip the curve definition: */
-						Curve dummy;
-						dummy.read(msg);
+						Curve::skip(msg);
 						}
 					else
 						{
-						/* Create a new curve and add it to the curve map: */
-						Curve* newCurve=new Curve;
-						curves.setEntry(CurveMap::Entry(newCurveId,newCurve));
-						newCurve->read(msg);
+						/* Read the new curve into the curve set: */
+						curves.readCurve(newCurveId,msg);
 						}
 					
 					break;
 					}
 				
-				case APPEND_POINT:
+				case APPEND_POINTS:
 					{
-					/* Read the curve ID and index of the new vertex: */
+					/* Read the curve ID and index of the first vertex in the run: */
 					unsigned int curveId=msg.read<Card>();
-					unsigned int vertexIndex=msg.read<Card>();
-					
-					/* Read the vertex: */
-					Point newVertex=GrapheinProtocol::read<Point>(msg);
+					unsigned int firstIndex=msg.read<Card>();
 					
 					/* Get a handle on the curve: */
-					CurveMap::Iterator cIt=curves.findEntry(curveId);
-					if(!cIt.isFinished())
+					const Curve* curve=curves.findCurve(curveId);
+					if(curve!=0&&firstIndex>0&&firstIndex<=curve->numVertices)
 						{
-						/* Check that the curve doesn't already contains the vertex: */
-						if(vertexIndex>=cIt->getDest()->vertices.size())
-							{
-							/* Append the vertex: */
-							cIt->getDest()->vertices.push_back(newVertex);
-							}
+						/* Store the run's vertices, replacing any the curve already contains: */
+						curves.readVertexRun(curveId,firstIndex,msg);
 						}
+					else
+						skipVertexRun(msg);
 					break;
 					}
 				
@@ -131,14 +323,8 @@ void GrapheinClient::RemoteClientState::processMessages(void)
 					/* Read the curve ID: */
 					unsigned int curveId=msg.read<Card>();
 					
-					/* Get a handle on the curve: */
-					CurveMap::Iterator cIt=curves.findEntry(curveId);
-					if(!cIt.isFinished())
-						{
-						/* Delete the curve: */
-						delete cIt->getDest();
-						curves.removeEntry(cIt);
-						}
+					/* Delete the curve: */
+					curves.deleteCurve(curveId);
 					
 					break;
 					}
@@ -146,39 +332,27 @@ void GrapheinClient::RemoteClientState::processMessages(void)
 				case DELETE_ALL_CURVES:
 					{
 					/* Delete all curves: */
-					for(CurveMap::Iterator cIt=curves.begin();!cIt.isFinished();++cIt)
-						delete cIt->getDest();
 					curves.clear();
 					break;
 					}
 				}
 			}
 		
-		/* Destroy the just-read message buffer: */
-		delete *mIt;
+		/* Return the just-read message buffer to the pool: */
+		messageBufferPool.release(*mIt);
 		}
 	
 	/* Clear the message buffer list: */
 	messages.clear();
+	
+	/* Update the spatial index of the curves: */
+	renderer.update();
 	}
 
 void GrapheinClient::RemoteClientState::glRenderAction(GLContextData& contextData) const
 	{
-	glPushAttrib(GL_ENABLE_BIT|GL_LINE_BIT);
-	glDisable(GL_LIGHTING);
-	
 	/* Render all curves: */
-	for(CurveMap::ConstIterator cIt=curves.begin();!cIt.isFinished();++cIt)
-		{
-		glLineWidth(cIt->getDest()->lineWidth);
-		glColor(cIt->getDest()->color);
-		glBegin(GL_LINE_STRIP);
-		for(std::vector<Point>::const_iterator vIt=cIt->getDest()->vertices.begin();vIt!=cIt->getDest()->vertices.end();++vIt)
-			glVertex(*vIt);
-		glEnd();
-		}
-	
-	glPopAttrib();
+	renderer.glRenderAction(contextData);
 	}
 
 /*****************************************************
@@ -259,6 +433,12 @@ GrapheinClient::GrapheinTool::GrapheinTool(const Vrui::ToolFactory* factory,cons
 	GLMotif::NewButton* deleteCurvesButton=new GLMotif::NewButton("DeleteCurvesButton",controlDialog,"Delete All Curves");
 	deleteCurvesButton->getSelectCallbacks().add(this,&GrapheinTool::deleteCurvesCallback);
 	
+	/* Add a button to clear all curves archived on the server: */
+	new GLMotif::Blind("Blind2",controlDialog);
+	
+	GLMotif::NewButton* deleteArchivedCurvesButton=new GLMotif::NewButton("DeleteArchivedCurvesButton",controlDialog,"Delete Archived Curves");
+	deleteArchivedCurvesButton->getSelectCallbacks().add(this,&GrapheinTool::deleteArchivedCurvesCallback);
+	
 	controlDialog->manageChild();
 	
 	/* Pop up the control dialog: */
@@ -284,41 +464,32 @@ void GrapheinClient::GrapheinTool::buttonCallback(int,Vrui::InputDevice::ButtonC
 		/* Start a new curve: */
 		currentCurveId=client->nextLocalCurveId;
 		++client->nextLocalCurveId;
-		Curve* newCurve=new Curve;
-		newCurve->lineWidth=newLineWidth;
-		newCurve->color=newColor;
+		client->localCurves.addCurve(currentCurveId,newLineWidth,newColor);
 		const Vrui::NavTransform& invNav=Vrui::getInverseNavigationTransformation();
 		lastPoint=invNav.transform(getButtonDevicePosition(0));
-		newCurve->vertices.push_back(lastPoint);
-		client->localCurves.setEntry(CurveMap::Entry(currentCurveId,newCurve));
+		client->localCurves.appendVertex(currentCurveId,lastPoint);
 		
 		/* Send a curve creation message: */
 		{
 		Threads::Mutex::Lock messageLock(client->messageMutex);
 		writeMessage(ADD_CURVE,client->message);
 		client->message.write<Card>(currentCurveId);
-		newCurve->write(client->message);
+		client->localCurves.writeCurve(*client->localCurves.findCurve(currentCurveId),client->message);
 		}
 		}
 	else
 		{
-		/* Retrieve the current curve: */
-		CurveMap::Iterator cIt=client->localCurves.findEntry(currentCurveId);
-		if(!cIt.isFinished())
+		/* Check if the current curve still exists: */
+		if(client->localCurves.isCurve(currentCurveId))
 			{
 			if(currentPoint!=lastPoint)
 				{
 				/* Add the final dragging point to the curve: */
-				cIt->getDest()->vertices.push_back(currentPoint);
-				
-				/* Send a vertex appending message: */
-				{
-				Threads::Mutex::Lock messageLock(client->messageMutex);
-				writeMessage(APPEND_POINT,client->message);
-				client->message.write<Card>(currentCurveId);
-				write(currentPoint,client->message);
-				}
+				client->appendVertex(currentCurveId,currentPoint);
 				}
+			
+			/* Let the server simplify the finished curve: */
+			client->finishCurve(currentCurveId);
 			}
 		
 		/* Deactivate the tool: */
@@ -340,19 +511,10 @@ void GrapheinClient::GrapheinTool::frame(void)
 		/* Check if the dragging point is far enough away from the most recent curve vertex: */
 		if(Geometry::sqrDist(currentPoint,lastPoint)>=Math::sqr(Vrui::getUiSize()*invNav.getScaling()))
 			{
-			CurveMap::Iterator cIt=client->localCurves.findEntry(currentCurveId);
-			if(!cIt.isFinished())
+			if(client->localCurves.isCurve(currentCurveId))
 				{
 				/* Add the dragging point to the curve: */
-				cIt->getDest()->vertices.push_back(currentPoint);
-				
-				/* Send a vertex appending message: */
-				{
-				Threads::Mutex::Lock messageLock(client->messageMutex);
-				writeMessage(APPEND_POINT,client->message);
-				client->message.write<Card>(currentCurveId);
-				write(currentPoint,client->message);
-				}
+				client->appendVertex(currentCurveId,currentPoint);
 				}
 			
 			/* Remember the last added point: */
@@ -369,18 +531,18 @@ void GrapheinClient::GrapheinTool::display(GLContextData& contextData) const
 	if(active)
 		{
 		/* Retrieve the current curve: */
-		CurveMap::Iterator cIt=client->localCurves.findEntry(currentCurveId);
-		if(!cIt.isFinished())
+		const Curve* curve=client->localCurves.findCurve(currentCurveId);
+		if(curve!=0)
 			{
 			/* Render the last segment of the current curve: */
 			glPushAttrib(GL_ENABLE_BIT|GL_LINE_BIT);
 			glDisable(GL_LIGHTING);
-			glLineWidth(cIt->getDest()->lineWidth);
+			glLineWidth(curve->lineWidth);
 			
 			glPushMatrix();
 			glMultMatrix(Vrui::getNavigationTransformation());
 			
-			glColor(cIt->getDest()->color);
+			glColor(curve->color);
 			glBegin(GL_LINES);
 			glVertex(lastPoint);
 			glVertex(currentPoint);
@@ -414,9 +576,8 @@ void GrapheinClient::GrapheinTool::deleteCurvesCallback(Misc::CallbackData* cbDa
 		return;
 	
 	/* Delete all local curves: */
-	for(CurveMap::Iterator cIt=client->localCurves.begin();!cIt.isFinished();++cIt)
-		delete cIt->getDest();
 	client->localCurves.clear();
+	client->appendedCurves.clear();
 	
 	/* Send a curve deletion message: */
 	{
@@ -428,12 +589,23 @@ void GrapheinClient::GrapheinTool::deleteCurvesCallback(Misc::CallbackData* cbDa
 	active=false;
 	}
 
+void GrapheinClient::GrapheinTool::deleteArchivedCurvesCallback(Misc::CallbackData* cbData)
+	{
+	if(client==0)
+		return;
+	
+	/* Ask the server to delete all archived curves: */
+	Threads::Mutex::Lock messageLock(client->messageMutex);
+	writeMessage(DELETE_ARCHIVED_CURVES,client->message);
+	}
+
 /*******************************
 Methods of class GrapheinClient:
 *******************************/
 
 GrapheinClient::GrapheinClient(void)
-	:nextLocalCurveId(0),localCurves(17)
+	:nextLocalCurveId(0),localCurves(17),localRenderer(localCurves),appendedCurves(17),
+	 archive(0)
 	{
 	/* Register the Graphein tool class: */
 	GrapheinToolFactory* grapheinToolFactory=new GrapheinToolFactory("GrapheinTool","Shared Curve Editor",Vrui::getToolManager()->loadClass("UtilityTool"),*Vrui::getToolManager());
@@ -444,9 +616,8 @@ GrapheinClient::GrapheinClient(void)
 
 GrapheinClient::~GrapheinClient(void)
 	{
-	/* Delete all local curves: */
-	for(CurveMap::Iterator cIt=localCurves.begin();!cIt.isFinished();++cIt)
-		delete cIt->getDest();
+	/* Delete the archived curves: */
+	delete archive;
 	
 	/* Uninstall tool manager callbacks: */
 	Vrui::getToolManager()->getToolCreationCallbacks().remove(this,&GrapheinClient::toolCreationCallback);
@@ -469,6 +640,9 @@ void GrapheinClient::initialize(CollaborationClient* sClient,Misc::Configuration
 	{
 	/* Call the base class method: */
 	ProtocolClient::initialize(sClient,configFileSection);
+	
+	/* Create the state object for archived curves: */
+	archive=new RemoteClientState(client->getMessageBufferPool());
 	}
 
 void GrapheinClient::sendConnectRequest(Comm::NetPipe& pipe)
@@ -485,6 +659,9 @@ void GrapheinClient::receiveConnectReply(Comm::NetPipe& pipe)
 	/* Set the message buffer's endianness swapping behavior to that of the pipe: */
 	message.setSwapOnWrite(pipe.mustSwapOnWrite());
 	
+	/* Receive the curves archived on the server: */
+	receiveServerUpdate(pipe);
+	
 	/* Register callbacks with the tool manager: */
 	Vrui::getToolManager()->getToolCreationCallbacks().add(this,&GrapheinClient::toolCreationCallback);
 	}
@@ -498,7 +675,7 @@ void GrapheinClient::receiveDisconnectReply(Comm::NetPipe& pipe)
 ProtocolClient::RemoteClientState* GrapheinClient::receiveClientConnect(Comm::NetPipe& pipe)
 	{
 	/* Create a new remote client state object: */
-	RemoteClientState* newClientState=new RemoteClientState;
+	RemoteClientState* newClientState=new RemoteClientState(client->getMessageBufferPool());
 	
 	/* Read the number of existing curves in this message: */
 	unsigned int numCurves=pipe.read<Card>();
@@ -509,17 +686,28 @@ ProtocolClient::RemoteClientState* GrapheinClient::receiveClientConnect(Comm::Ne
 		/* Read the new curve's ID: */
 		unsigned int newCurveId=pipe.read<Card>();
 		
-		/* Create the new curve and add it to the new client's curve set: */
-		Curve* newCurve=new Curve;
-		newClientState->curves.setEntry(CurveMap::Entry(newCurveId,newCurve));
-		
-		/* Read the curve's state: */
-		newCurve->read(pipe);
+		/* Read the new curve's state into the new client's curve set: */
+		newClientState->curves.readCurve(newCurveId,pipe);
 		}
 	
 	return newClientState;
 	}
 
+bool GrapheinClient::receiveServerUpdate(Comm::NetPipe& pipe)
+	{
+	/* Read the size of the following archive update message: */
+	unsigned int messageSize=pipe.read<Card>();
+	
+	if(messageSize>0)
+		{
+		/* Read the message into a pooled buffer and queue it with the archived curves: */
+		IncomingMessage* msg=archive->messageBufferPool.acquire(pipe,messageSize);
+		archive->queueMessage(msg);
+		}
+	
+	return messageSize!=0;
+	}
+
 bool GrapheinClient::receiveServerUpdate(ProtocolClient::RemoteClientState* rcs,Comm::NetPipe& pipe)
 	{
 	/* Get a handle on the remote client state object: */
@@ -530,16 +718,14 @@ bool GrapheinClient::receiveServerUpdate(ProtocolClient::RemoteClientState* rcs,
 	/* Read the size of the following message: */
 	unsigned int messageSize=pipe.read<Card>();
 	
-	/* Read the entire message into a new read buffer that has the same endianness as the pipe's read end: */
-	IncomingMessage* msg=new IncomingMessage(messageSize);
-	msg->setSwapOnRead(pipe.mustSwapOnRead());
-	pipe.readRaw(msg->getMemory(),messageSize);
-	
-	/* Store the new buffer in the client's message list: */
-	{
-	Threads::Mutex::Lock messageBufferLock(myRcs->messageBufferMutex);
-	myRcs->messages.push_back(msg);
-	}
+	if(messageSize>0)
+		{
+		/* Read the entire message into a pooled read buffer that has the same endianness as the pipe's read end: */
+		IncomingMessage* msg=myRcs->messageBufferPool.acquire(pipe,messageSize);
+		
+		/* Queue the new buffer, dropping any queued buffers it supersedes: */
+		myRcs->queueMessage(msg);
+		}
 	
 	return messageSize!=0;
 	}
@@ -557,6 +743,24 @@ void GrapheinClient::sendClientUpdate(Comm::NetPipe& pipe)
 	writeMessage(UPDATE_END,pipe);
 	}
 
+void GrapheinClient::frame(void)
+	{
+	/* Process queued archive update messages: */
+	archive->processMessages();
+	
+	if(appendedCurves.getNumEntries()!=0)
+		{
+		/* Send the vertices appended to each local curve during the last frame as a single run: */
+		Threads::Mutex::Lock messageLock(messageMutex);
+		for(AppendMap::Iterator aIt=appendedCurves.begin();!aIt.isFinished();++aIt)
+			writeVertexRun(aIt->getSource(),aIt->getDest());
+		appendedCurves.clear();
+		}
+	
+	/* Update the spatial index of the local curves: */
+	localRenderer.update();
+	}
+
 void GrapheinClient::frame(ProtocolClient::RemoteClientState* rcs)
 	{
 	/* Get a handle on the remote client state object: */
@@ -570,21 +774,11 @@ void GrapheinClient::frame(ProtocolClient::RemoteClientState* rcs)
 
 void GrapheinClient::glRenderAction(GLContextData& contextData) const
 	{
-	glPushAttrib(GL_ENABLE_BIT|GL_LINE_BIT);
-	glDisable(GL_LIGHTING);
-	
-	/* Render all curves: */
-	for(CurveMap::ConstIterator cIt=localCurves.begin();!cIt.isFinished();++cIt)
-		{
-		glLineWidth(cIt->getDest()->lineWidth);
-		glColor(cIt->getDest()->color);
-		glBegin(GL_LINE_STRIP);
-		for(std::vector<Point>::const_iterator vIt=cIt->getDest()->vertices.begin();vIt!=cIt->getDest()->vertices.end();++vIt)
-			glVertex(*vIt);
-		glEnd();
-		}
+	/* Render the archived curves: */
+	archive->glRenderAction(contextData);
 	
-	glPopAttrib();
+	/* Render all local curves: */
+	localRenderer.glRenderAction(contextData);
 	}
 
 void GrapheinClient::glRenderAction(const ProtocolClient::RemoteClientState* rcs,GLContextData& contextData) const
@@ -598,6 +792,48 @@ void GrapheinClient::glRenderAction(const ProtocolClient::RemoteClientState* rcs
 	myRcs->glRenderAction(contextData);
 	}
 
+void GrapheinClient::writeVertexRun(unsigned int curveId,unsigned int firstIndex)
+	{
+	if(localCurves.isCurve(curveId))
+		{
+		writeMessage(APPEND_POINTS,message);
+		message.write<Card>(curveId);
+		localCurves.writeVertexRun(curveId,firstIndex,message);
+		}
+	}
+
+void GrapheinClient::appendVertex(unsigned int curveId,const GrapheinClient::Point& vertex)
+	{
+	/* Stop growing curves that reached the maximum length accepted by the server and other clients: */
+	size_t numVertices=localCurves.findCurve(curveId)->numVertices;
+	if(numVertices>=maxNumCurveVertices)
+		return;
+	
+	/* Remember the first new vertex unless the curve already has vertices waiting to be sent: */
+	if(!appendedCurves.isEntry(curveId))
+		appendedCurves[curveId]=numVertices;
+	
+	/* Append the vertex to the curve: */
+	localCurves.appendVertex(curveId,vertex);
+	}
+
+void GrapheinClient::finishCurve(unsigned int curveId)
+	{
+	Threads::Mutex::Lock messageLock(messageMutex);
+	
+	/* Send the curve's pending vertices first, so that the server sees the complete curve: */
+	AppendMap::Iterator aIt=appendedCurves.findEntry(curveId);
+	if(!aIt.isFinished())
+		{
+		writeVertexRun(curveId,aIt->getDest());
+		appendedCurves.removeEntry(aIt);
+		}
+	
+	/* Send a curve completion message: */
+	writeMessage(FINISH_CURVE,message);
+	message.write<Card>(curveId);
+	}
+
 void GrapheinClient::toolCreationCallback(Vrui::ToolManager::ToolCreationCallbackData* cbData)
 	{
 	/* Check if the new tool is a Graphein tool: */
@@ -27,6 +27,8 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <vector>
 #include <IO/VariableMemoryFile.h>
 #include <Threads/Mutex.h>
+#include <GL/gl.h>
+#include <GL/GLObject.h>
 #include <GLMotif/NewButton.h>
 #include <GLMotif/Slider.h>
 #include <Vrui/UtilityTool.h>
@@ -34,11 +36,10 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <Vrui/ToolManager.h>
 #include <Collaboration/ProtocolClient.h>
 #include <Collaboration/GrapheinProtocol.h>
+#include <Collaboration/GrapheinCurveIndex.h>
+#include <Collaboration/MessageBufferPool.h>
 
 /* Forward declarations: */
-namespace IO {
-class FixedMemoryFile;
-}
 class GLContextData;
 namespace GLMotif {
 class PopupWindow;
@@ -52,22 +53,96 @@ class GrapheinClient:public ProtocolClient,private GrapheinProtocol
 	{
 	/* Embedded classes: */
 	private:
-	typedef IO::FixedMemoryFile IncomingMessage; // Type for buffers storing incoming messages
+	typedef MessageBufferPool::Buffer IncomingMessage; // Type for pooled buffers storing incoming messages
 	typedef IO::VariableMemoryFile OutgoingMessage; // Type for buffers storing outgoing messages
 	
+	class CurveRenderer:public GLObject // Class to render the visible curves of a curve set from per-context vertex buffer objects
+		{
+		/* Embedded classes: */
+		private:
+		struct DrawCall // Structure describing how to draw a single curve
+			{
+			/* Elements: */
+			public:
+			GLfloat lineWidth; // The curve's line width
+			Curve::Color color; // The curve's color
+			GLint firstVertex; // Index of the curve's first vertex in the vertex buffer
+			GLsizei numVertices; // Number of the curve's vertices
+			
+			/* Constructors and destructors: */
+			DrawCall(const Curve& curve)
+				:lineWidth(curve.lineWidth),color(curve.color),
+				 firstVertex(GLint(curve.firstVertex)),numVertices(GLsizei(curve.numVertices))
+				{
+				}
+			
+			/* Methods: */
+			bool operator<(const DrawCall& other) const // Orders draw calls by line width and color
+				{
+				if(lineWidth!=other.lineWidth)
+					return lineWidth<other.lineWidth;
+				for(int i=0;i<3;++i)
+					if(color.getRgba()[i]!=other.color.getRgba()[i])
+						return color.getRgba()[i]<other.color.getRgba()[i];
+				return false;
+				}
+			};
+		
+		struct DataItem:public GLObject::DataItem
+			{
+			/* Elements: */
+			public:
+			GLuint vertexBufferId; // ID of vertex buffer object holding the curve set's vertex buffer, or 0 if vertex buffer objects are not supported
+			size_t vertexBufferCapacity; // Number of vertices for which the vertex buffer object has room
+			unsigned int version; // Version number of the curve set when it was last uploaded
+			std::vector<DrawCall> drawCalls; // List of draw calls for all curves, sorted by appearance
+			std::vector<unsigned int> visibleCurveIds; // List of IDs of curves inside the current view frustum
+			std::vector<DrawCall> visibleDrawCalls; // List of draw calls for visible curves, sorted by appearance
+			
+			/* Constructors and destructors: */
+			DataItem(void);
+			virtual ~DataItem(void);
+			};
+		
+		/* Elements: */
+		const CurveSet& curves; // The rendered curve set
+		GrapheinCurveIndex index; // Spatial index of the rendered curve set
+		
+		/* Constructors and destructors: */
+		public:
+		CurveRenderer(const CurveSet& sCurves);
+		
+		/* Methods from GLObject: */
+		virtual void initContext(GLContextData& contextData) const;
+		
+		/* New methods: */
+		const GrapheinCurveIndex& getIndex(void) const // Returns the spatial index of the rendered curve set
+			{
+			return index;
+			}
+		void update(void) // Updates the spatial index after changes to the curve set; must be called from the main thread
+			{
+			index.update();
+			}
+		void glRenderAction(GLContextData& contextData) const; // Renders the curve set, uploading vertices changed since the last call
+		};
+	
 	class RemoteClientState:public ProtocolClient::RemoteClientState
 		{
 		/* Elements: */
 		public:
-		CurveMap curves; // Set of curves owned by the remote client
+		CurveSet curves; // Set of curves owned by the remote client
+		CurveRenderer renderer; // Renderer for the remote client's curves
+		MessageBufferPool& messageBufferPool; // Pool from which incoming message buffers are drawn and to which they are returned
 		Threads::Mutex messageBufferMutex; // Mutex serializing access to the message buffer list
 		std::vector<IncomingMessage*> messages; // List of buffers retaining server update messages between frame calls
 		
 		/* Constructors and destructors: */
-		RemoteClientState(void);
+		RemoteClientState(MessageBufferPool& sMessageBufferPool);
 		virtual ~RemoteClientState(void);
 		
 		/* Methods: */
+		void queueMessage(IncomingMessage* msg); // Queues the given server update message, dropping all queued messages superseded by a delete-all message; called from communication thread
 		void processMessages(void); // Reads and processes all queued server update messages
 		void glRenderAction(GLContextData& contextData) const; // Displays the remote client's state
 		};
@@ -113,6 +188,7 @@ class GrapheinClient:public ProtocolClient,private GrapheinProtocol
 		void lineWidthSliderCallback(GLMotif::Slider::ValueChangedCallbackData* cbData);
 		void colorButtonSelectCallback(GLMotif::NewButton::SelectCallbackData* cbData);
 		void deleteCurvesCallback(Misc::CallbackData* cbData);
+		void deleteArchivedCurvesCallback(Misc::CallbackData* cbData);
 		};
 	
 	friend class GrapheinTool;
@@ -120,9 +196,12 @@ class GrapheinClient:public ProtocolClient,private GrapheinProtocol
 	/* Elements: */
 	private:
 	unsigned int nextLocalCurveId; // ID number for the next created curve
-	CurveMap localCurves; // Set of curves owned by the client
+	CurveSet localCurves; // Set of curves owned by the client
+	CurveRenderer localRenderer; // Renderer for the client's curves
 	Threads::Mutex messageMutex; // Mutex protecting the client update message buffer
 	OutgoingMessage message; // Buffer to assemble client update messages as devices are created / destroyed
+	AppendMap appendedCurves; // Set of local curves to which vertices were appended since the last frame
+	RemoteClientState* archive; // State object holding the curves archived on the server, which are not owned by any connected client
 	
 	/* Constructors and destructors: */
 	public:
@@ -137,13 +216,22 @@ class GrapheinClient:public ProtocolClient,private GrapheinProtocol
 	virtual void receiveConnectReply(Comm::NetPipe& pipe);
 	virtual void receiveDisconnectReply(Comm::NetPipe& pipe);
 	virtual ProtocolClient::RemoteClientState* receiveClientConnect(Comm::NetPipe& pipe);
+	virtual bool receiveServerUpdate(Comm::NetPipe& pipe);
 	virtual bool receiveServerUpdate(ProtocolClient::RemoteClientState* rcs,Comm::NetPipe& pipe);
 	virtual void sendClientUpdate(Comm::NetPipe& pipe);
+	virtual void frame(void);
 	virtual void frame(ProtocolClient::RemoteClientState* rcs);
 	virtual void glRenderAction(GLContextData& contextData) const;
 	virtual void glRenderAction(const ProtocolClient::RemoteClientState* rcs,GLContextData& contextData) const;
 	
+	/* Private methods: */
+	private:
+	void writeVertexRun(unsigned int curveId,unsigned int firstIndex); // Writes the vertices appended to a local curve starting at the given index to the client update message; message mutex must be locked
+	
 	/* New methods: */
+	public:
+	void appendVertex(unsigned int curveId,const Point& vertex); // Appends a vertex to a local curve and schedules it to be sent to the server
+	void finishCurve(unsigned int curveId); // Sends all pending vertices of a local curve to the server and tells the server that the curve is complete
 	void toolCreationCallback(Vrui::ToolManager::ToolCreationCallbackData* cbData);
 	};
 
@@ -0,0 +1,295 @@
+/***********************************************************************
+GrapheinCurveIndex - Class for bounding volume hierarchies over the
+curves of a Graphein curve set, to cull curves against view frusta and
+to pick curves close to a point.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/GrapheinCurveIndex.h>
+
+#include <algorithm>
+#include <Geometry/Point.h>
+#include <Geometry/Vector.h>
+
+namespace Collaboration {
+
+namespace {
+
+/****************
+Helper functions:
+****************/
+
+const unsigned int maxLeafSize=4; // Maximum number of curves in a leaf node
+
+inline GrapheinCurveIndex::Scalar sqrDist(const GrapheinCurveIndex::Point& point,const GrapheinCurveIndex::Box& box) // Returns the squared distance from the given point to the given box
+	{
+	GrapheinCurveIndex::Scalar result(0);
+	for(int i=0;i<3;++i)
+		{
+		if(point[i]<box.min[i])
+			result+=(box.min[i]-point[i])*(box.min[i]-point[i]);
+		else if(point[i]>box.max[i])
+			result+=(point[i]-box.max[i])*(point[i]-box.max[i]);
+		}
+	return result;
+	}
+
+}
+
+/********************************************
+Methods of class GrapheinCurveIndex::Frustum:
+********************************************/
+
+GrapheinCurveIndex::Frustum::Frustum(const double matrix[16])
+	{
+	/* Extract the left/right, bottom/top, and near/far plane pairs from the matrix's rows: */
+	for(int i=0;i<3;++i)
+		for(int j=0;j<4;++j)
+			{
+			planes[2*i+0][j]=matrix[j*4+3]+matrix[j*4+i];
+			planes[2*i+1][j]=matrix[j*4+3]-matrix[j*4+i];
+			}
+	}
+
+bool GrapheinCurveIndex::Frustum::doesBoxIntersect(const GrapheinCurveIndex::Box& box) const
+	{
+	for(int i=0;i<6;++i)
+		{
+		/* Check the box corner farthest along the plane's normal: */
+		double d=planes[i][3];
+		for(int j=0;j<3;++j)
+			d+=planes[i][j]*double(planes[i][j]>=0.0?box.max[j]:box.min[j]);
+		if(d<0.0)
+			return false;
+		}
+	
+	return true;
+	}
+
+/***********************************
+Methods of class GrapheinCurveIndex:
+***********************************/
+
+void GrapheinCurveIndex::build(unsigned int nodeIndex,unsigned int first,unsigned int numCurves,std::vector<GrapheinCurveIndex::Point>& centers)
+	{
+	if(numCurves>maxLeafSize)
+		{
+		/* Find the longest axis of the bounding box of the curves' centers: */
+		Box centerBox=Box::empty;
+		for(unsigned int i=first;i<first+numCurves;++i)
+			centerBox.addPoint(centers[i]);
+		int axis=0;
+		for(int i=1;i<3;++i)
+			if(centerBox.max[axis]-centerBox.min[axis]<centerBox.max[i]-centerBox.min[i])
+				axis=i;
+		
+		/* Partition the curves at the middle of that axis: */
+		Scalar split=(centerBox.min[axis]+centerBox.max[axis])*Scalar(0.5);
+		unsigned int left=first;
+		unsigned int right=first+numCurves;
+		while(left<right)
+			{
+			if(centers[left][axis]<split)
+				++left;
+			else
+				{
+				--right;
+				std::swap(centers[left],centers[right]);
+				std::swap(curveIds[left],curveIds[right]);
+				}
+			}
+		unsigned int numLeftCurves=left-first;
+		
+		/* Split the curves in half if all centers fell on one side: */
+		if(numLeftCurves==0||numLeftCurves==numCurves)
+			numLeftCurves=numCurves/2;
+		
+		/* Create the node's children: */
+		unsigned int childIndex=nodes.size();
+		nodes[nodeIndex].first=childIndex;
+		nodes[nodeIndex].numCurves=0;
+		nodes.resize(childIndex+2);
+		build(childIndex,first,numLeftCurves,centers);
+		build(childIndex+1,first+numLeftCurves,numCurves-numLeftCurves,centers);
+		}
+	else
+		{
+		/* Make the node a leaf: */
+		nodes[nodeIndex].first=first;
+		nodes[nodeIndex].numCurves=numCurves;
+		}
+	}
+
+const GrapheinCurveIndex::Box& GrapheinCurveIndex::refit(unsigned int nodeIndex)
+	{
+	Node& node=nodes[nodeIndex];
+	if(node.numCurves!=0)
+		{
+		/* Combine the bounding boxes of the leaf's curves: */
+		node.bounds=Box::empty;
+		for(unsigned int i=node.first;i<node.first+node.numCurves;++i)
+			node.bounds.addBox(curves.findCurve(curveIds[i])->bounds);
+		}
+	else
+		{
+		/* Combine the bounding boxes of the node's children: */
+		node.bounds=refit(node.first);
+		node.bounds.addBox(refit(node.first+1));
+		}
+	
+	return node.bounds;
+	}
+
+GrapheinCurveIndex::GrapheinCurveIndex(const GrapheinProtocol::CurveSet& sCurves)
+	:curves(sCurves),
+	 version(curves.getVersion()-1),structureVersion(curves.getStructureVersion()-1)
+	{
+	/* Build the initial hierarchy: */
+	update();
+	}
+
+void GrapheinCurveIndex::update(void)
+	{
+	if(version==curves.getVersion())
+		return;
+	
+	if(structureVersion!=curves.getStructureVersion())
+		{
+		/* Collect the IDs and bounding box centers of all curves: */
+		curveIds.clear();
+		std::vector<Point> centers;
+		centers.reserve(curves.getNumCurves());
+		for(CurveSet::ConstIterator cIt=curves.begin();!cIt.isFinished();++cIt)
+			{
+			curveIds.push_back(cIt->getSource());
+			centers.push_back(Geometry::mid(cIt->getDest().bounds.min,cIt->getDest().bounds.max));
+			}
+		
+		/* Rebuild the hierarchy: */
+		nodes.clear();
+		if(!curveIds.empty())
+			{
+			nodes.resize(1);
+			build(0,0,curveIds.size(),centers);
+			}
+		
+		structureVersion=curves.getStructureVersion();
+		}
+	
+	/* Update the bounding boxes of all nodes: */
+	if(!nodes.empty())
+		refit(0);
+	
+	version=curves.getVersion();
+	}
+
+void GrapheinCurveIndex::cull(const GrapheinCurveIndex::Frustum& frustum,std::vector<unsigned int>& visibleCurveIds) const
+	{
+	if(nodes.empty())
+		return;
+	
+	/* Traverse the hierarchy and skip all subtrees whose bounding boxes are outside the frustum: */
+	std::vector<unsigned int> stack;
+	stack.push_back(0);
+	while(!stack.empty())
+		{
+		const Node& node=nodes[stack.back()];
+		stack.pop_back();
+		if(frustum.doesBoxIntersect(node.bounds))
+			{
+			if(node.numCurves!=0)
+				{
+				/* Check the leaf's curves individually: */
+				for(unsigned int i=node.first;i<node.first+node.numCurves;++i)
+					if(frustum.doesBoxIntersect(curves.findCurve(curveIds[i])->bounds))
+						visibleCurveIds.push_back(curveIds[i]);
+				}
+			else
+				{
+				stack.push_back(node.first+1);
+				stack.push_back(node.first);
+				}
+			}
+		}
+	}
+
+bool GrapheinCurveIndex::pick(const GrapheinCurveIndex::Point& point,GrapheinCurveIndex::Scalar maxDist,unsigned int& curveId) const
+	{
+	bool result=false;
+	Scalar bestDist2=maxDist*maxDist;
+	
+	/* Traverse the hierarchy and skip all subtrees whose bounding boxes are farther away than the closest curve found so far: */
+	std::vector<unsigned int> stack;
+	if(!nodes.empty())
+		stack.push_back(0);
+	while(!stack.empty())
+		{
+		const Node& node=nodes[stack.back()];
+		stack.pop_back();
+		if(sqrDist(point,node.bounds)<bestDist2)
+			{
+			if(node.numCurves!=0)
+				{
+				for(unsigned int i=node.first;i<node.first+node.numCurves;++i)
+					{
+					const GrapheinProtocol::Curve& curve=*curves.findCurve(curveIds[i]);
+					if(curve.numVertices==0||sqrDist(point,curve.bounds)>=bestDist2)
+						continue;
+					
+					/* Calculate the distance from the point to the curve's vertices and segments: */
+					const Point* v=curves.getVertices(curve);
+					Scalar dist2=Geometry::sqrDist(point,v[0]);
+					for(size_t j=1;j<curve.numVertices;++j)
+						{
+						GrapheinProtocol::Vector segment=v[j]-v[j-1];
+						GrapheinProtocol::Vector pv=point-v[j-1];
+						Scalar t=pv*segment;
+						Scalar segmentLength2=Geometry::sqr(segment);
+						Scalar d2;
+						if(t<=Scalar(0))
+							d2=Geometry::sqr(pv);
+						else if(t>=segmentLength2)
+							d2=Geometry::sqrDist(point,v[j]);
+						else
+							d2=Geometry::sqr(pv)-t*t/segmentLength2;
+						if(dist2>d2)
+							dist2=d2;
+						}
+					
+					if(bestDist2>dist2)
+						{
+						bestDist2=dist2;
+						curveId=curveIds[i];
+						result=true;
+						}
+					}
+				}
+			else
+				{
+				stack.push_back(node.first+1);
+				stack.push_back(node.first);
+				}
+			}
+		}
+	
+	return result;
+	}
+
+}
@@ -0,0 +1,100 @@
+/***********************************************************************
+GrapheinCurveIndex - Class for bounding volume hierarchies over the
+curves of a Graphein curve set, to cull curves against view frusta and
+to pick curves close to a point.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+An index is rebuilt from scratch whenever curves are added to or removed
+from its curve set, and only refitted bottom-up when the set's curves
+change otherwise, i.e., when vertices are appended to curves.
+***********************************************************************/
+
+#ifndef COLLABORATION_GRAPHEINCURVEINDEX_INCLUDED
+#define COLLABORATION_GRAPHEINCURVEINDEX_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+#include <Collaboration/GrapheinProtocol.h>
+
+namespace Collaboration {
+
+class GrapheinCurveIndex
+	{
+	/* Embedded classes: */
+	public:
+	typedef GrapheinProtocol::Scalar Scalar;
+	typedef GrapheinProtocol::Point Point;
+	typedef GrapheinProtocol::Box Box;
+	typedef GrapheinProtocol::CurveSet CurveSet;
+	
+	class Frustum // Class for view frusta defined by six bounding planes
+		{
+		/* Elements: */
+		private:
+		double planes[6][4]; // Plane equations a*x+b*y+c*z+d>=0 for the inside of the frustum
+		
+		/* Constructors and destructors: */
+		public:
+		Frustum(const double matrix[16]); // Extracts the frustum of the given column-major projection-modelview matrix
+		
+		/* Methods: */
+		bool doesBoxIntersect(const Box& box) const; // Returns false if the given box is entirely outside the frustum
+		};
+	
+	private:
+	struct Node // Structure for nodes of the hierarchy
+		{
+		/* Elements: */
+		public:
+		Box bounds; // Bounding box of all curves below the node
+		unsigned int first; // Index of the node's first child in the node array for interior nodes, or of the first curve in the curve ID array for leaf nodes
+		unsigned int numCurves; // Number of curves in a leaf node, or zero for interior nodes
+		};
+	
+	/* Elements: */
+	const CurveSet& curves; // The indexed curve set
+	unsigned int version; // Version number of the curve set when the index was last updated
+	unsigned int structureVersion; // Structure version number of the curve set when the index was last built
+	std::vector<unsigned int> curveIds; // Array of IDs of all indexed curves, in leaf order
+	std::vector<Node> nodes; // Array of hierarchy nodes; root is the first node
+	
+	/* Private methods: */
+	void build(unsigned int nodeIndex,unsigned int first,unsigned int numCurves,std::vector<Point>& centers); // Recursively builds the hierarchy below the given node for the given range of curves
+	const Box& refit(unsigned int nodeIndex); // Recursively updates the bounding boxes of the given node and all nodes below it
+	
+	/* Constructors and destructors: */
+	public:
+	GrapheinCurveIndex(const CurveSet& sCurves); // Creates an index for the given curve set
+	
+	/* Methods: */
+	bool isCurrent(void) const // Returns true if the index reflects the current state of its curve set
+		{
+		return version==curves.getVersion();
+		}
+	void update(void); // Updates the index to the current state of its curve set
+	void cull(const Frustum& frustum,std::vector<unsigned int>& visibleCurveIds) const; // Appends the IDs of all curves that might intersect the given frustum to the given list
+	bool pick(const Point& point,Scalar maxDist,unsigned int& curveId) const; // Returns true and the ID of the curve closest to the given point if that curve is closer than the given distance
+	};
+
+}
+
+#endif
@@ -23,45 +23,419 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <Collaboration/GrapheinProtocol.h>
 
+#include <algorithm>
+#include <Misc/SizedTypes.h>
+#include <Misc/ThrowStdErr.h>
+#include <Math/Math.h>
+#include <Geometry/Point.h>
+#include <Geometry/Vector.h>
 #include <IO/File.h>
+#include <Collaboration/ProtocolSchema.h>
 
 namespace Collaboration {
 
+namespace {
+
+/**********************
+Wire schema of curves:
+**********************/
+
+typedef GrapheinProtocol::Curve C;
+
+class ColorEncoding // Transmits curve colors as three bytes
+	{
+	/* Embedded classes: */
+	public:
+	typedef C::Color Value;
+	
+	/* Methods: */
+	static size_t getSize(const Value& value)
+		{
+		return 3*sizeof(Misc::UInt8);
+		}
+	static void read(Value& value,IO::File& source)
+		{
+		Misc::UInt8 rgb[3];
+		source.read(rgb,3);
+		value=Value(rgb);
+		}
+	static void write(const Value& value,IO::File& sink)
+		{
+		for(int i=0;i<3;++i)
+			sink.write<Misc::UInt8>(value.getRgba()[i]);
+		}
+	};
+
+const unsigned int CURVE=0x1U; // Curve appearances are always transmitted completely
+
+typedef Schema<SchemaField<C,GLfloat,&C::lineWidth,CURVE,CastEncoding<GLfloat,Misc::Float32> >,
+               SchemaField<C,C::Color,&C::color,CURVE,ColorEncoding> > CurveSchema;
+
+const size_t minUnusedVertices=4096; // Number of unused vertices below which a curve set's vertex buffer is never compacted
+const size_t maxNumChanges=16; // Number of changes a curve set remembers individually
+
+inline GrapheinProtocol::Scalar sqrSegmentDist(const GrapheinProtocol::Point& p,const GrapheinProtocol::Point& s0,const GrapheinProtocol::Point& s1) // Returns the squared distance from a point to a line segment
+	{
+	GrapheinProtocol::Vector d=s1-s0;
+	GrapheinProtocol::Vector ps0=p-s0;
+	GrapheinProtocol::Scalar t=ps0*d;
+	if(t<=GrapheinProtocol::Scalar(0))
+		return Geometry::sqr(ps0);
+	GrapheinProtocol::Scalar d2=Geometry::sqr(d);
+	if(t>=d2)
+		return Geometry::sqrDist(p,s1);
+	return Geometry::sqr(ps0)-t*t/d2;
+	}
+
+}
+
 /****************************************
 Methods of class GrapheinProtocol::Curve:
 ****************************************/
 
-void GrapheinProtocol::Curve::read(IO::File& source)
+void GrapheinProtocol::Curve::skip(IO::File& source)
 	{
-	/* Read the curve's cosmetic line width: */
-	lineWidth=GLfloat(source.read<Misc::Float32>());
-	
-	/* Read the curve's color: */
-	Misc::UInt8 rgb[3];
-	source.read(rgb,3);
-	color=Color(rgb);
+	/* Skip the curve's line width and color: */
+	source.skip<Misc::Float32>(1);
+	source.skip<Misc::UInt8>(3);
 	
-	/* Read the curve's vertex array: */
-	vertices.clear();
+	/* Skip the curve's vertex array: */
 	unsigned int numVertices=source.read<Card>();
-	vertices.reserve(numVertices);
-	for(unsigned int i=0;i<numVertices;++i)
-		vertices.push_back(GrapheinProtocol::read<Point>(source));
+	source.skip<Scalar>(numVertices*3);
+	}
+
+/*******************************************
+Methods of class GrapheinProtocol::CurveSet:
+*******************************************/
+
+void GrapheinProtocol::CurveSet::logChange(size_t firstVertex)
+	{
+	++version;
+	if(!changes.empty()&&changes.back().firstVertex<=firstVertex)
+		{
+		/* Extend the most recent change, which already covers this one: */
+		changes.back().version=version;
+		}
+	else
+		{
+		/* Merge the two oldest changes if the list is full: */
+		if(changes.size()==maxNumChanges)
+			{
+			changes[1].firstVertex=std::min(changes[0].firstVertex,changes[1].firstVertex);
+			changes.erase(changes.begin());
+			}
+		
+		/* Record the new change: */
+		Change change;
+		change.version=version;
+		change.firstVertex=firstVertex;
+		changes.push_back(change);
+		}
+	}
+
+void GrapheinProtocol::CurveSet::releaseVertices(const GrapheinProtocol::Curve& curve)
+	{
+	if(curve.firstVertex+curve.numVertices==vertices.size())
+		{
+		/* Shrink the vertex buffer if the curve is at its end: */
+		vertices.resize(curve.firstVertex);
+		}
+	else
+		numUnusedVertices+=curve.numVertices;
+	}
+
+void GrapheinProtocol::CurveSet::compactVertices(void)
+	{
+	/* Copy the vertices of all curves into a new buffer, in the order in which the curves are stored: */
+	std::vector<Point> newVertices;
+	newVertices.reserve(vertices.size()-numUnusedVertices);
+	for(CurveMap::Iterator cIt=curves.begin();!cIt.isFinished();++cIt)
+		{
+		Curve& curve=cIt->getDest();
+		size_t newFirstVertex=newVertices.size();
+		newVertices.insert(newVertices.end(),vertices.begin()+curve.firstVertex,vertices.begin()+(curve.firstVertex+curve.numVertices));
+		curve.firstVertex=newFirstVertex;
+		}
+	std::swap(vertices,newVertices);
+	numUnusedVertices=0;
+	logChange(0);
+	}
+
+GrapheinProtocol::CurveSet::CurveSet(size_t initialNumCurves)
+	:curves(initialNumCurves),
+	 numUnusedVertices(0),
+	 version(0),structureVersion(0)
+	{
+	}
+
+size_t GrapheinProtocol::CurveSet::getFirstChangedVertex(unsigned int sinceVersion) const
+	{
+	/* Find the lowest changed vertex index of all changes since the given version: */
+	size_t result=vertices.size();
+	for(std::vector<Change>::const_reverse_iterator cIt=changes.rbegin();cIt!=changes.rend()&&cIt->version>sinceVersion;++cIt)
+		if(result>cIt->firstVertex)
+			result=cIt->firstVertex;
+	
+	return result;
+	}
+
+void GrapheinProtocol::CurveSet::addCurve(unsigned int curveId,GLfloat lineWidth,const GrapheinProtocol::Curve::Color& color)
+	{
+	/* Release the vertices of an existing curve of the same ID: */
+	CurveMap::Iterator cIt=curves.findEntry(curveId);
+	if(!cIt.isFinished())
+		releaseVertices(cIt->getDest());
+	
+	/* Add an empty curve at the end of the vertex buffer: */
+	Curve& curve=curves[curveId];
+	curve.lineWidth=lineWidth;
+	curve.color=color;
+	curve.firstVertex=vertices.size();
+	curve.numVertices=0;
+	curve.bounds=Box::empty;
+	logChange(vertices.size());
+	++structureVersion;
+	}
+
+GrapheinProtocol::Point* GrapheinProtocol::CurveSet::resizeCurve(unsigned int curveId,size_t newNumVertices)
+	{
+	Curve& curve=curves.getEntry(curveId).getDest();
+	size_t firstChangedVertex=curve.firstVertex+std::min(curve.numVertices,newNumVertices);
+	if(curve.firstVertex+curve.numVertices!=vertices.size()&&newNumVertices>curve.numVertices)
+		{
+		/* Compact the vertex buffer first if it contains too many unused vertices: */
+		if(numUnusedVertices>=minUnusedVertices&&numUnusedVertices*2>=vertices.size())
+			compactVertices();
+		
+		if(curve.firstVertex+curve.numVertices!=vertices.size())
+			{
+			/* Move the curve's vertices to the end of the vertex buffer so that it can grow in place: */
+			size_t newFirstVertex=vertices.size();
+			vertices.reserve(newFirstVertex+newNumVertices);
+			for(size_t i=0;i<curve.numVertices;++i)
+				vertices.push_back(vertices[curve.firstVertex+i]);
+			numUnusedVertices+=curve.numVertices;
+			curve.firstVertex=newFirstVertex;
+			}
+		firstChangedVertex=curve.firstVertex;
+		}
+	
+	if(curve.firstVertex+curve.numVertices==vertices.size())
+		{
+		/* Grow or shrink the curve at the end of the vertex buffer: */
+		vertices.resize(curve.firstVertex+newNumVertices);
+		}
+	else
+		{
+		/* Shrink the curve in place: */
+		numUnusedVertices+=curve.numVertices-newNumVertices;
+		}
+	curve.numVertices=newNumVertices;
+	logChange(firstChangedVertex);
+	
+	return getVertexBuffer()==0?0:&vertices[0]+curve.firstVertex;
+	}
+
+void GrapheinProtocol::CurveSet::deleteCurve(unsigned int curveId)
+	{
+	CurveMap::Iterator cIt=curves.findEntry(curveId);
+	if(!cIt.isFinished())
+		{
+		releaseVertices(cIt->getDest());
+		curves.removeEntry(cIt);
+		
+		/* Release the vertex buffer's memory when the last curve is gone: */
+		if(curves.getNumEntries()==0)
+			clear();
+		else
+			{
+			logChange(vertices.size());
+			++structureVersion;
+			}
+		}
+	}
+
+void GrapheinProtocol::CurveSet::clear(void)
+	{
+	curves.clear();
+	std::vector<Point>().swap(vertices);
+	numUnusedVertices=0;
+	
+	/* Forget all previous changes, which are superseded by this one: */
+	changes.clear();
+	logChange(0);
+	++structureVersion;
+	}
+
+void GrapheinProtocol::CurveSet::readCurve(unsigned int curveId,IO::File& source)
+	{
+	/* Read the curve's line width and color: */
+	Curve header;
+	CurveSchema::read(CURVE,header,source);
+	
+	/* Read the curve's vertex array directly into the vertex buffer: */
+	size_t numVertices=source.read<Card>();
+	if(numVertices>maxNumCurveVertices)
+		Misc::throwStdErr("GrapheinProtocol::CurveSet::readCurve: Curve %u has %u vertices; maximum is %u",curveId,(unsigned int)numVertices,(unsigned int)maxNumCurveVertices);
+	addCurve(curveId,header.lineWidth,header.color);
+	if(numVertices>0)
+		{
+		Point* curveVertices=resizeCurve(curveId,numVertices);
+		readArray(curveVertices,numVertices,source);
+		
+		/* Calculate the curve's bounding box: */
+		Box& bounds=curves.getEntry(curveId).getDest().bounds;
+		for(size_t i=0;i<numVertices;++i)
+			bounds.addPoint(curveVertices[i]);
+		}
+	}
+
+void GrapheinProtocol::CurveSet::writeCurve(const GrapheinProtocol::Curve& curve,IO::File& sink) const
+	{
+	/* Write the curve's line width and color: */
+	CurveSchema::write(CURVE,curve,sink);
+	
+	/* Write the curve's vertex array directly from the vertex buffer: */
+	sink.write<Card>(Card(curve.numVertices));
+	if(curve.numVertices>0)
+		writeArray(getVertices(curve),curve.numVertices,sink);
+	}
+
+void GrapheinProtocol::CurveSet::copyCurve(unsigned int curveId,const GrapheinProtocol::CurveSet& source,const GrapheinProtocol::Curve& sourceCurve)
+	{
+	addCurve(curveId,sourceCurve.lineWidth,sourceCurve.color);
+	if(sourceCurve.numVertices>0)
+		{
+		Point* curveVertices=resizeCurve(curveId,sourceCurve.numVertices);
+		const Point* sourceVertices=source.getVertices(sourceCurve);
+		for(size_t i=0;i<sourceCurve.numVertices;++i)
+			curveVertices[i]=sourceVertices[i];
+		curves.getEntry(curveId).getDest().bounds=sourceCurve.bounds;
+		}
+	}
+
+size_t GrapheinProtocol::CurveSet::simplifyCurve(unsigned int curveId,GrapheinProtocol::Scalar tolerance)
+	{
+	Curve& curve=curves.getEntry(curveId).getDest();
+	if(curve.numVertices<3)
+		return curve.numVertices;
+	Point* v=&vertices[0]+curve.firstVertex;
+	
+	/* Mark the vertices to keep by recursively splitting the curve at its vertex farthest from the approximating segment: */
+	std::vector<bool> keep(curve.numVertices,false);
+	keep[0]=true;
+	keep[curve.numVertices-1]=true;
+	Scalar tolerance2=tolerance*tolerance;
+	std::vector<std::pair<size_t,size_t> > spans;
+	spans.push_back(std::pair<size_t,size_t>(0,curve.numVertices-1));
+	while(!spans.empty())
+		{
+		std::pair<size_t,size_t> span=spans.back();
+		spans.pop_back();
+		
+		/* Find the span's vertex farthest from the segment connecting its end points: */
+		Scalar maxDist2(0);
+		size_t maxIndex=span.first;
+		for(size_t i=span.first+1;i<span.second;++i)
+			{
+			Scalar dist2=sqrSegmentDist(v[i],v[span.first],v[span.second]);
+			if(maxDist2<dist2)
+				{
+				maxDist2=dist2;
+				maxIndex=i;
+				}
+			}
+		
+		/* Keep the farthest vertex and split the span if the vertex is outside the tolerance: */
+		if(maxDist2>tolerance2)
+			{
+			keep[maxIndex]=true;
+			spans.push_back(std::pair<size_t,size_t>(span.first,maxIndex));
+			spans.push_back(std::pair<size_t,size_t>(maxIndex,span.second));
+			}
+		}
+	
+	/* Move the kept vertices to the front of the curve, drop the rest, and shrink the curve's bounding box to the kept vertices: */
+	size_t numKeptVertices=0;
+	curve.bounds=Box::empty;
+	for(size_t i=0;i<curve.numVertices;++i)
+		if(keep[i])
+			{
+			v[numKeptVertices]=v[i];
+			curve.bounds.addPoint(v[numKeptVertices]);
+			++numKeptVertices;
+			}
+	logChange(curve.firstVertex);
+	resizeCurve(curveId,numKeptVertices);
+	
+	return numKeptVertices;
 	}
 
-void GrapheinProtocol::Curve::write(IO::File& sink) const
+void GrapheinProtocol::CurveSet::writeVertexRun(unsigned int curveId,size_t firstIndex,IO::File& sink)
 	{
-	/* Write the curve's cosmetic line width: */
-	sink.write<Misc::Float32>(Misc::Float32(lineWidth));
+	/* Get the curve's vertices: */
+	Curve& curve=curves.getEntry(curveId).getDest();
+	Point* v=&vertices[0]+curve.firstVertex;
+	logChange(curve.firstVertex+firstIndex);
+	
+	/* Write the number of vertices in the run: */
+	size_t numVertices=curve.numVertices-firstIndex;
+	writeVarCard(Card(numVertices),sink);
+	
+	/* Find the largest delta component between consecutive vertices to calculate the run's quantization step: */
+	Scalar maxDelta(0);
+	for(size_t i=firstIndex;i<curve.numVertices;++i)
+		for(int j=0;j<3;++j)
+			{
+			Scalar delta=Math::abs(v[i][j]-v[i-1][j]);
+			if(maxDelta<delta)
+				maxDelta=delta;
+			}
+	Scalar step=maxDelta>Scalar(0)?maxDelta/Scalar(32766):Scalar(1);
+	sink.write<Scalar>(step);
 	
-	/* Write the curve's color: */
-	for(int i=0;i<3;++i)
-		sink.write<Misc::UInt8>(color.getRgba()[i]);
+	/* Write each vertex as a quantized delta to the reconstructed previous vertex, and store the reconstruction to avoid drift: */
+	for(size_t i=firstIndex;i<curve.numVertices;++i)
+		for(int j=0;j<3;++j)
+			{
+			Scalar q=Math::floor((v[i][j]-v[i-1][j])/step+Scalar(0.5));
+			if(q<Scalar(-32767))
+				q=Scalar(-32767);
+			else if(q>Scalar(32767))
+				q=Scalar(32767);
+			sink.write<Misc::SInt16>(Misc::SInt16(q));
+			v[i][j]=v[i-1][j]+q*step;
+			}
 	
-	/* Write the curve's vertex array: */
-	sink.write<Card>(Card(vertices.size()));
-	for(std::vector<Point>::const_iterator vIt=vertices.begin();vIt!=vertices.end();++vIt)
-		GrapheinProtocol::write<Point>(*vIt,sink);
+	/* Extend the curve's bounding box by the quantized vertices: */
+	for(size_t i=firstIndex;i<curve.numVertices;++i)
+		curve.bounds.addPoint(v[i]);
+	}
+
+void GrapheinProtocol::CurveSet::readVertexRun(unsigned int curveId,size_t firstIndex,IO::File& source)
+	{
+	/* Read the number of vertices in the run and its quantization step: */
+	size_t numVertices=readVarCard(source);
+	if(numVertices>maxNumCurveVertices||firstIndex+numVertices>maxNumCurveVertices)
+		Misc::throwStdErr("GrapheinProtocol::CurveSet::readVertexRun: Run of %u vertices would grow curve %u beyond the maximum of %u vertices",(unsigned int)numVertices,curveId,(unsigned int)maxNumCurveVertices);
+	Scalar step=source.read<Scalar>();
+	
+	/* Make room for the run's vertices: */
+	Point* v;
+	Curve& curve=curves.getEntry(curveId).getDest();
+	if(curve.numVertices<firstIndex+numVertices)
+		v=resizeCurve(curveId,firstIndex+numVertices);
+	else
+		v=&vertices[0]+curve.firstVertex;
+	logChange(curve.firstVertex+firstIndex);
+	
+	/* Reconstruct the vertices from their quantized deltas and extend the curve's bounding box: */
+	for(size_t i=firstIndex;i<firstIndex+numVertices;++i)
+		{
+		for(int j=0;j<3;++j)
+			v[i][j]=v[i-1][j]+Scalar(source.read<Misc::SInt16>())*step;
+		curve.bounds.addPoint(v[i]);
+		}
 	}
 
 /*****************************************
@@ -69,6 +443,19 @@ Static elements of class GrapheinProtocol:
 *****************************************/
 
 const char* GrapheinProtocol::protocolName="Graphein";
-const unsigned int GrapheinProtocol::protocolVersion=(2U<<16)+0U; // Version 2.0
+const unsigned int GrapheinProtocol::protocolVersion=(3U<<16)+2U; // Version 3.2
+const size_t GrapheinProtocol::maxNumCurveVertices=1024*1024;
+
+/*********************************
+Methods of class GrapheinProtocol:
+*********************************/
+
+void GrapheinProtocol::skipVertexRun(IO::File& source)
+	{
+	/* Skip the number of vertices, the quantization step, and the quantized deltas: */
+	size_t numVertices=readVarCard(source);
+	source.skip<Scalar>(1);
+	source.skip<Misc::SInt16>(numVertices*3);
+	}
 
 }
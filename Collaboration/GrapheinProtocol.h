@@ -24,11 +24,13 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #ifndef COLLABORATION_GRAPHEINPROTOCOL_INCLUDED
 #define COLLABORATION_GRAPHEINPROTOCOL_INCLUDED
 
+#include <stddef.h>
 #include <string>
 #include <vector>
-#include <Misc/HashTable.h>
 #include <GL/gl.h>
 #include <GL/GLColor.h>
+#include <Geometry/Box.h>
+#include <Collaboration/FlatHashTable.h>
 #include <Collaboration/Protocol.h>
 
 namespace Collaboration {
@@ -40,14 +42,18 @@ class GrapheinProtocol:public Protocol
 	enum MessageId // Enumerated type for Graphein protocol messages
 		{
 		ADD_CURVE=0,
-		APPEND_POINT,
+		APPEND_POINTS,
+		FINISH_CURVE,
 		DELETE_CURVE,
 		DELETE_ALL_CURVES,
+		DELETE_ARCHIVED_CURVES,
 		UPDATE_END,
 		MESSAGES_END
 		};
 	
-	struct Curve // Structure to represent single-stroke curves
+	typedef Geometry::Box<Scalar,3> Box; // Type for axis-aligned bounding boxes
+	
+	struct Curve // Structure describing a single-stroke curve stored in a curve set
 		{
 		/* Embedded classes: */
 		public:
@@ -56,18 +62,121 @@ class GrapheinProtocol:public Protocol
 		/* Elements: */
 		GLfloat lineWidth; // The curve's cosmetic line width
 		Color color; // The curve's color
-		std::vector<Point> vertices; // The curve's vertices
+		size_t firstVertex; // Index of the curve's first vertex in the curve set's vertex buffer
+		size_t numVertices; // Number of the curve's vertices
+		Box bounds; // Bounding box of the curve's vertices; may be larger than necessary
+		
+		/* Constructors and destructors: */
+		Curve(void)
+			:lineWidth(1.0f),color(0,0,0),firstVertex(0),numVertices(0),
+			 bounds(Box::empty)
+			{
+			}
+		
+		/* Methods: */
+		static void skip(IO::File& source); // Skips a curve transmitted on the given source
+		};
+	
+	class CurveSet // Class for sets of curves owned by the same client, storing the vertices of all curves in a single contiguous buffer
+		{
+		/* Embedded classes: */
+		public:
+		typedef FlatHashTable<unsigned int,Curve> CurveMap; // Hash table mapping curve IDs to curves, storing all curves contiguously
+		typedef CurveMap::ConstIterator ConstIterator; // Type to iterate through the curves of a set
+		
+		private:
+		struct Change // Structure recording a change to the set
+			{
+			/* Elements: */
+			public:
+			unsigned int version; // Version number of the set after the change
+			size_t firstVertex; // Index of the first vertex in the buffer that was changed
+			};
+		
+		/* Elements: */
+		CurveMap curves; // Map of the set's curves
+		std::vector<Point> vertices; // Buffer holding the vertices of all curves
+		size_t numUnusedVertices; // Number of vertices in the buffer that no longer belong to any curve
+		unsigned int version; // Version number of the set, incremented on every change
+		unsigned int structureVersion; // Version number of the set's structure, incremented whenever curves are added or removed
+		std::vector<Change> changes; // Short list of the most recent changes, oldest first
+		
+		/* Private methods: */
+		void logChange(size_t firstVertex); // Increments the set's version number and records that vertices starting at the given index changed
+		void releaseVertices(const Curve& curve); // Marks the vertices of the given curve as unused
+		void compactVertices(void); // Moves all curves' vertices to the front of the buffer, in curve order
+		
+		/* Constructors and destructors: */
+		public:
+		CurveSet(size_t initialNumCurves =17); // Creates an empty curve set
 		
 		/* Methods: */
-		void read(IO::File& source); // Reads a curve from the given source
-		void write(IO::File& sink) const; // Writes a curve to the given sink
+		size_t getNumCurves(void) const // Returns the number of curves in the set
+			{
+			return curves.getNumEntries();
+			}
+		bool isCurve(unsigned int curveId) const // Returns true if the set contains a curve of the given ID
+			{
+			return curves.isEntry(curveId);
+			}
+		const Curve* findCurve(unsigned int curveId) const // Returns the curve of the given ID, or null; pointer is invalidated by any change to the set
+			{
+			ConstIterator cIt=curves.findEntry(curveId);
+			return cIt.isFinished()?0:&cIt->getDest();
+			}
+		ConstIterator begin(void) const // Returns an iterator to the first curve in the set
+			{
+			return curves.begin();
+			}
+		const Point* getVertexBuffer(void) const // Returns the vertex buffer; pointer is invalidated by any change to the set
+			{
+			return vertices.empty()?0:&vertices[0];
+			}
+		size_t getVertexBufferSize(void) const // Returns the number of vertices in the vertex buffer, including unused ones
+			{
+			return vertices.size();
+			}
+		const Point* getVertices(const Curve& curve) const // Returns the given curve's vertices; pointer is invalidated by any change to the set
+			{
+			return getVertexBuffer()+curve.firstVertex;
+			}
+		unsigned int getVersion(void) const // Returns the set's current version number
+			{
+			return version;
+			}
+		size_t getFirstChangedVertex(unsigned int sinceVersion) const; // Returns a lower bound on the index of the first buffer vertex that changed since the given version; returns the buffer size if no vertices changed
+		unsigned int getStructureVersion(void) const // Returns the version number of the set's structure
+			{
+			return structureVersion;
+			}
+		void addCurve(unsigned int curveId,GLfloat lineWidth,const Curve::Color& color); // Adds an empty curve of the given ID and appearance, replacing any existing curve of the same ID
+		Point* resizeCurve(unsigned int curveId,size_t newNumVertices); // Changes the number of vertices of the given curve, moving the curve to the end of the vertex buffer if it needs to grow; returns the curve's vertices; only changes to vertices beyond the curve's previous size are tracked, and the curve's bounding box is not updated
+		void appendVertex(unsigned int curveId,const Point& vertex) // Appends a vertex to the given curve
+			{
+			Curve& curve=curves.getEntry(curveId).getDest();
+			Point* curveVertices=resizeCurve(curveId,curve.numVertices+1);
+			curveVertices[curve.numVertices-1]=vertex;
+			curve.bounds.addPoint(vertex);
+			}
+		void deleteCurve(unsigned int curveId); // Deletes the curve of the given ID if it exists
+		void clear(void); // Deletes all curves
+		void readCurve(unsigned int curveId,IO::File& source); // Reads a curve from the given source and stores it under the given ID, replacing any existing curve of the same ID
+		void writeCurve(const Curve& curve,IO::File& sink) const; // Writes the given curve of this set to the given sink
+		void copyCurve(unsigned int curveId,const CurveSet& source,const Curve& sourceCurve); // Copies the given curve of the given source set into this set under the given ID, replacing any existing curve of the same ID
+		size_t simplifyCurve(unsigned int curveId,Scalar tolerance); // Removes vertices from the given curve that deviate less than the given distance from a Douglas-Peucker approximation of the curve and shrinks its bounding box to the remaining vertices; returns the new number of vertices
+		void writeVertexRun(unsigned int curveId,size_t firstIndex,IO::File& sink); // Writes the given curve's vertices starting at the given non-zero index as quantized deltas to the given sink, and replaces them with their quantized values
+		void readVertexRun(unsigned int curveId,size_t firstIndex,IO::File& source); // Reads a run of vertices from the given source and stores them in the given curve starting at the given non-zero index, replacing or appending vertices
 		};
 	
-	typedef Misc::HashTable<unsigned int,Curve*> CurveMap; // Hash table to map curve IDs to curve objects
+	typedef FlatHashTable<unsigned int,unsigned int> AppendMap; // Hash table mapping IDs of curves with appended vertices to the index of the first vertex not yet sent
 	
 	/* Elements: */
 	static const char* protocolName; // Network name of Graphein protocol
 	static const unsigned int protocolVersion; // Specific version of protocol implementation
+	static const size_t maxNumCurveVertices; // Maximum number of vertices in a curve; longer curves read from a source are rejected before any memory is allocated for them
+	
+	/* Methods: */
+	static void skipVertexRun(IO::File& source); // Skips a run of vertices transmitted on the given source
 	};
 
 }
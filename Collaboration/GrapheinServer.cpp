@@ -23,8 +23,15 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <Collaboration/GrapheinServer.h>
 
+#include <iostream>
+#include <stdexcept>
 #include <Misc/ThrowStdErr.h>
+#include <Misc/StandardValueCoders.h>
+#include <Misc/ConfigurationFile.h>
+#include <Geometry/Point.h>
 #include <Comm/NetPipe.h>
+#include <Collaboration/CollaborationServer.h>
+#include <Collaboration/GrapheinStore.h>
 
 namespace Collaboration {
 
@@ -33,27 +40,53 @@ Methods of class GrapheinServer::ClientState:
 ********************************************/
 
 GrapheinServer::ClientState::ClientState(void)
-	:curves(17)
+	:curves(17),appendedCurves(17),storeKeys(17)
 	{
 	}
 
 GrapheinServer::ClientState::~ClientState(void)
 	{
-	/* Delete all curves in the curve map: */
-	for(CurveMap::Iterator cIt=curves.begin();!cIt.isFinished();++cIt)
-		delete cIt->getDest();
+	}
+
+/**********************************************
+Methods of class GrapheinServer::CurveSnapshot:
+**********************************************/
+
+void GrapheinServer::CurveSnapshot::write(Comm::NetPipe& pipe)
+	{
+	writeCurves(curves,pipe);
 	}
 
 /*******************************
 Methods of class GrapheinServer:
 *******************************/
 
+void GrapheinServer::writeCurves(const GrapheinProtocol::CurveSet& curves,IO::File& sink)
+	{
+	unsigned int numCurves=curves.getNumCurves();
+	sink.write<Card>(numCurves);
+	for(CurveSet::ConstIterator cIt=curves.begin();!cIt.isFinished();++cIt)
+		{
+		/* Write the curve's ID: */
+		sink.write<Card>(cIt->getSource());
+		
+		/* Write the curve itself: */
+		curves.writeCurve(cIt->getDest(),sink);
+		}
+	}
+
 GrapheinServer::GrapheinServer(void)
+	:simplificationTolerance(0),
+	 store(0)
 	{
+	/* Keep archive update messages in both byte orders, as clients of either byte order can be connected at the same time: */
+	for(int swap=0;swap<2;++swap)
+		archiveUpdates[swap].setSwapOnWrite(swap!=0);
 	}
 
 GrapheinServer::~GrapheinServer(void)
 	{
+	delete store;
 	}
 
 const char* GrapheinServer::getName(void) const
@@ -66,6 +99,43 @@ unsigned int GrapheinServer::getNumMessages(void) const
 	return MESSAGES_END;
 	}
 
+bool GrapheinServer::canShareSpectatorUpdates(void) const
+	{
+	/* Server updates only depend on the source clients' accumulated curve messages and the shared archive updates: */
+	return true;
+	}
+
+void GrapheinServer::initialize(CollaborationServer* sServer,Misc::ConfigurationFileSection& configFileSection)
+	{
+	/* Call the base class method: */
+	ProtocolServer::initialize(sServer,configFileSection);
+	
+	/* Read the curve simplification tolerance: */
+	simplificationTolerance=configFileSection.retrieveValue<Scalar>("./simplificationTolerance",Scalar(0.15));
+	
+	/* Open the annotation store if a log file is configured: */
+	std::string storeFileName=configFileSection.retrieveString("./storeFileName","");
+	if(!storeFileName.empty())
+		{
+		/* Give each room of a room server its own annotation store: */
+		if(!server->getRoomName().empty())
+			{
+			storeFileName.push_back('.');
+			storeFileName.append(server->getRoomName());
+			}
+		
+		try
+			{
+			store=new GrapheinStore(storeFileName,configFileSection.retrieveValue<double>("./storeCompactionRatio",2.0));
+			}
+		catch(std::runtime_error err)
+			{
+			/* Print an error message and carry on without persistent curves: */
+			std::cerr<<"GrapheinServer::initialize: Caught exception "<<err.what()<<" while opening annotation store "<<storeFileName<<std::endl;
+			}
+		}
+	}
+
 ProtocolServer::ClientState* GrapheinServer::receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe)
 	{
 	/* Check the protocol message length: */
@@ -91,13 +161,8 @@ ProtocolServer::ClientState* GrapheinServer::receiveConnectRequest(unsigned int
 		return 0;
 	}
 
-void GrapheinServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe)
+void GrapheinServer::receiveClientUpdate(GrapheinServer::ClientState* cs,Comm::NetPipe& pipe)
 	{
-	/* Get a handle on the Graphein state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("GrapheinServer::receiveClientUpdate: Client state object has mismatching type");
-	
 	/* Receive a list of curve action messages from the client: */
 	MessageIdType message;
 	while((message=readMessage(pipe))!=UPDATE_END)
@@ -108,39 +173,85 @@ void GrapheinServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::N
 				/* Read the new curve's ID: */
 				unsigned int newCurveId=pipe.read<Card>();
 				
-				/* Create a new curve object and add it to the client's curve map: */
-				Curve* newCurve=new Curve;
-				myCs->curves.setEntry(CurveMap::Entry(newCurveId,newCurve));
+				/* Forget the client's previous curve of the same ID, which is replaced by the new curve: */
+				cs->appendedCurves.removeEntry(newCurveId);
+				StoreKeyMap::Iterator skIt=cs->storeKeys.findEntry(newCurveId);
+				if(!skIt.isFinished())
+					{
+					store->deleteCurve(skIt->getDest());
+					cs->storeKeys.removeEntry(skIt);
+					}
+				
+				/* Read the new curve's state from the pipe into the client's curve set: */
+				cs->curves.readCurve(newCurveId,pipe);
+				const Curve& newCurve=*cs->curves.findCurve(newCurveId);
 				
-				/* Read the new curve's state from the pipe: */
-				newCurve->read(pipe);
+				/* Add the new curve to the annotation store: */
+				if(store!=0)
+					cs->storeKeys[newCurveId]=store->addCurve(cs->curves,newCurve);
 				
 				/* Append a curve creation message to the client's outgoing buffer: */
-				writeMessage(ADD_CURVE,myCs->messageBuffer);
-				myCs->messageBuffer.write<Card>(newCurveId);
-				newCurve->write(myCs->messageBuffer);
+				writeMessage(ADD_CURVE,cs->messageBuffer);
+				cs->messageBuffer.write<Card>(newCurveId);
+				cs->curves.writeCurve(newCurve,cs->messageBuffer);
 				
 				break;
 				}
 			
-			case APPEND_POINT:
+			case APPEND_POINTS:
 				{
 				/* Read the affected curve's ID: */
 				unsigned int curveId=pipe.read<Card>();
 				
-				/* Read the new vertex position: */
-				Point newVertex=read<Point>(pipe);
+				/* Append the run of new vertices to the curve: */
+				const Curve* curve=cs->curves.findCurve(curveId);
+				if(curve==0||curve->numVertices==0)
+					Misc::throwStdErr("GrapheinServer::receiveClientUpdate: Protocol error; received vertex run for missing or empty curve %u",curveId);
+				unsigned int firstIndex=curve->numVertices;
+				cs->curves.readVertexRun(curveId,firstIndex,pipe);
 				
-				/* Append the new vertex to the curve: */
-				Curve* curve=myCs->curves.getEntry(curveId).getDest();
-				unsigned int vertexIndex=curve->vertices.size();
-				curve->vertices.push_back(newVertex);
+				/* Remember the first new vertex unless the curve already has vertices waiting to be forwarded: */
+				if(!cs->appendedCurves.isEntry(curveId))
+					cs->appendedCurves[curveId]=firstIndex;
+				
+				break;
+				}
+			
+			case FINISH_CURVE:
+				{
+				/* Read the affected curve's ID: */
+				unsigned int curveId=pipe.read<Card>();
 				
-				/* Append a vertex addition message to the client's outgoing buffer: */
-				writeMessage(APPEND_POINT,myCs->messageBuffer);
-				myCs->messageBuffer.write<Card>(curveId);
-				myCs->messageBuffer.write<Card>(vertexIndex);
-				write(newVertex,myCs->messageBuffer);
+				/* Check if the curve is worth simplifying: */
+				const Curve* curve=cs->curves.findCurve(curveId);
+				if(curve!=0&&curve->numVertices>2&&simplificationTolerance>Scalar(0))
+					{
+					/* Log any vertices appended since the last server update in the annotation store, which only simplifies curves when it archives them: */
+					AppendMap::Iterator aIt=cs->appendedCurves.findEntry(curveId);
+					if(!aIt.isFinished())
+						{
+						if(store!=0)
+							store->appendVertices(cs->storeKeys.getEntry(curveId).getDest(),cs->curves,*curve,aIt->getDest());
+						cs->appendedCurves.removeEntry(aIt);
+						}
+					
+					/* Calculate the simplification tolerance in navigational space from the curve's average vertex spacing: */
+					const Point* v=cs->curves.getVertices(*curve);
+					Scalar length(0);
+					for(size_t i=1;i<curve->numVertices;++i)
+						length+=Geometry::dist(v[i-1],v[i]);
+					Scalar tolerance=simplificationTolerance*length/Scalar(curve->numVertices-1);
+					
+					/* Simplify the curve: */
+					cs->curves.simplifyCurve(curveId,tolerance);
+					
+					/* Replace the curve on all other clients with its simplified version: */
+					writeMessage(DELETE_CURVE,cs->messageBuffer);
+					cs->messageBuffer.write<Card>(curveId);
+					writeMessage(ADD_CURVE,cs->messageBuffer);
+					cs->messageBuffer.write<Card>(curveId);
+					cs->curves.writeCurve(*cs->curves.findCurve(curveId),cs->messageBuffer);
+					}
 				
 				break;
 				}
@@ -150,90 +261,202 @@ void GrapheinServer::receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::N
 				/* Read the affected curve's ID: */
 				unsigned int curveId=pipe.read<Card>();
 				
-				/* Erase the curve from the client's curve map: */
-				CurveMap::Iterator cIt=myCs->curves.findEntry(curveId);
-				if(!cIt.isFinished())
+				/* Delete the curve from the client's curve set: */
+				cs->curves.deleteCurve(curveId);
+				cs->appendedCurves.removeEntry(curveId);
+				
+				/* Delete the curve from the annotation store: */
+				StoreKeyMap::Iterator skIt=cs->storeKeys.findEntry(curveId);
+				if(!skIt.isFinished())
 					{
-					/* Delete the curve: */
-					delete cIt->getDest();
-					myCs->curves.removeEntry(cIt);
+					store->deleteCurve(skIt->getDest());
+					cs->storeKeys.removeEntry(skIt);
 					}
 				
 				/* Append a curve destruction message to the client's outgoing buffer: */
-				writeMessage(DELETE_CURVE,myCs->messageBuffer);
-				myCs->messageBuffer.write<Card>(curveId);
+				writeMessage(DELETE_CURVE,cs->messageBuffer);
+				cs->messageBuffer.write<Card>(curveId);
 				
 				break;
 				}
 			
 			case DELETE_ALL_CURVES:
 				{
-				/* Delete all curves in the client's curve map: */
-				for(CurveMap::Iterator cIt=myCs->curves.begin();!cIt.isFinished();++cIt)
-					delete cIt->getDest();
-				myCs->curves.clear();
+				/* Delete all curves in the client's curve set: */
+				cs->curves.clear();
+				cs->appendedCurves.clear();
+				
+				/* Delete all curves from the annotation store: */
+				for(StoreKeyMap::Iterator skIt=cs->storeKeys.begin();!skIt.isFinished();++skIt)
+					store->deleteCurve(skIt->getDest());
+				cs->storeKeys.clear();
 				
 				/* Append a curve set destruction message to the client's outgoing buffer: */
-				writeMessage(DELETE_ALL_CURVES,myCs->messageBuffer);
+				writeMessage(DELETE_ALL_CURVES,cs->messageBuffer);
 				
 				break;
 				}
 			
+			case DELETE_ARCHIVED_CURVES:
+				if(store!=0)
+					{
+					/* Delete all archived curves from the annotation store: */
+					store->deleteArchivedCurves();
+					
+					/* Tell all clients to delete their archived curves: */
+					Threads::Mutex::Lock archiveUpdateLock(archiveUpdateMutex);
+					for(int swap=0;swap<2;++swap)
+						writeMessage(DELETE_ALL_CURVES,archiveUpdates[swap]);
+					}
+				
+				break;
+			
 			default:
 				Misc::throwStdErr("GrapheinServer::receiveClientUpdate: received unknown message %u",message);
 			}
 	}
 
-void GrapheinServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+void GrapheinServer::sendClientConnect(GrapheinServer::ClientState* sourceCs,GrapheinServer::ClientState* destCs,Comm::NetPipe& pipe)
 	{
-	/* Get handles on the Graphein state objects: */
-	ClientState* mySourceCs=dynamic_cast<ClientState*>(sourceCs);
-	ClientState* myDestCs=dynamic_cast<ClientState*>(destCs);
-	if(mySourceCs==0||myDestCs==0)
-		Misc::throwStdErr("GrapheinServer::sendClientConnect: Client state object has mismatching type");
-	
 	/* Send all curves currently owned by the source client to the destination client: */
-	unsigned int numCurves=mySourceCs->curves.getNumEntries();
-	pipe.write<Card>(numCurves);
-	for(CurveMap::Iterator cIt=mySourceCs->curves.begin();!cIt.isFinished();++cIt)
+	writeCurves(sourceCs->curves,pipe);
+	}
+
+void GrapheinServer::beforeServerUpdate(GrapheinServer::ClientState* cs)
+	{
+	/* Forward all vertices appended to each curve since the last update as a single run: */
+	for(AppendMap::Iterator aIt=cs->appendedCurves.begin();!aIt.isFinished();++aIt)
 		{
-		/* Send the curve's ID: */
-		pipe.write<Card>(cIt->getSource());
-		
-		/* Send the curve itself: */
-		cIt->getDest()->write(pipe);
+		if(cs->curves.isCurve(aIt->getSource()))
+			{
+			writeMessage(APPEND_POINTS,cs->messageBuffer);
+			cs->messageBuffer.write<Card>(aIt->getSource());
+			cs->messageBuffer.write<Card>(aIt->getDest());
+			cs->curves.writeVertexRun(aIt->getSource(),aIt->getDest(),cs->messageBuffer);
+			
+			/* Log the forwarded vertices in the annotation store: */
+			if(store!=0)
+				store->appendVertices(cs->storeKeys.getEntry(aIt->getSource()).getDest(),cs->curves,*cs->curves.findCurve(aIt->getSource()),aIt->getDest());
+			}
 		}
+	cs->appendedCurves.clear();
 	}
 
-void GrapheinServer::sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+void GrapheinServer::sendServerUpdate(GrapheinServer::ClientState* sourceCs,GrapheinServer::ClientState* destCs,Comm::NetPipe& pipe)
 	{
-	/* Get handles on the Graphein state objects: */
-	ClientState* mySourceCs=dynamic_cast<ClientState*>(sourceCs);
-	ClientState* myDestCs=dynamic_cast<ClientState*>(destCs);
-	if(mySourceCs==0||myDestCs==0)
-		Misc::throwStdErr("GrapheinServer::sendServerUpdate: Client state object has mismatching type");
-	
 	/*********************************************************************
 	Send the source client's accumulated state tracking messages to the
 	destination client:
 	*********************************************************************/
 	
 	/* Send the total size of the message first: */
-	pipe.write<Card>(mySourceCs->messageBuffer.getDataSize());
+	pipe.write<Card>(sourceCs->messageBuffer.getDataSize());
 	
 	/* Write the message itself: */
-	mySourceCs->messageBuffer.writeToSink(pipe);
+	sourceCs->messageBuffer.writeToSink(pipe);
 	}
 
-void GrapheinServer::afterServerUpdate(ProtocolServer::ClientState* cs)
+void GrapheinServer::afterServerUpdate(GrapheinServer::ClientState* cs)
 	{
-	/* Get a handle on the Graphein state object: */
-	ClientState* myCs=dynamic_cast<ClientState*>(cs);
-	if(myCs==0)
-		Misc::throwStdErr("GrapheinServer::afterServerUpdate: Mismatching client state object type");
-	
 	/* Clear the client's message buffer: */
-	myCs->messageBuffer.clear();
+	cs->messageBuffer.clear();
+	}
+
+void GrapheinServer::sendConnectReply(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe)
+	{
+	/* Send all archived curves to the new client: */
+	if(store!=0)
+		store->writeArchive(pipe);
+	else
+		pipe.write<Card>(0);
+	}
+
+void GrapheinServer::disconnectClient(ProtocolServer::ClientState* cs)
+	{
+	/* Spectators never own any curves: */
+	if(store==0||cs->isSpectator())
+		return;
+	
+	/* Archive all curves owned by the disconnected client, and tell all remaining clients about them: */
+	ClientState* myCs=cast<ClientState>(cs);
+	Threads::Mutex::Lock archiveUpdateLock(archiveUpdateMutex);
+	for(StoreKeyMap::Iterator skIt=myCs->storeKeys.begin();!skIt.isFinished();++skIt)
+		{
+		const Curve& curve=*myCs->curves.findCurve(skIt->getSource());
+		store->archiveCurve(skIt->getDest(),myCs->curves,curve);
+		for(int swap=0;swap<2;++swap)
+			{
+			writeMessage(ADD_CURVE,archiveUpdates[swap]);
+			archiveUpdates[swap].write<Card>(skIt->getDest());
+			myCs->curves.writeCurve(curve,archiveUpdates[swap]);
+			}
+		}
+	myCs->storeKeys.clear();
+	}
+
+void GrapheinServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::UpdateDestination* destinations,unsigned int numDestinations)
+	{
+	ClientState* mySourceCs=cast<ClientState>(sourceCs);
+	
+	/* Assemble the source client's curves once for each byte order used by the destination clients, and send them to all destinations of that byte order: */
+	for(int swap=0;swap<2;++swap)
+		{
+		bool assembled=false;
+		for(UpdateDestination* dIt=destinations;dIt!=destinations+numDestinations;++dIt)
+			if(dIt->pipe->mustSwapOnWrite()==(swap!=0))
+				{
+				if(!assembled)
+					{
+					connectMessageBuffer.clear();
+					connectMessageBuffer.setSwapOnWrite(swap!=0);
+					writeCurves(mySourceCs->curves,connectMessageBuffer);
+					assembled=true;
+					}
+				
+				try
+					{
+					connectMessageBuffer.writeToSink(*dIt->pipe);
+					}
+				catch(std::runtime_error err)
+					{
+					/* Flag the destination as failed and carry on with the others: */
+					dIt->failed=true;
+					dIt->error=err.what();
+					}
+				}
+		}
+	
+	/* Reset the buffer for the next connecting client: */
+	connectMessageBuffer.clear();
+	}
+
+ProtocolServer::ConnectSnapshot* GrapheinServer::captureClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+	{
+	/* Copy the source client's curve set, which stores all curves and vertices contiguously, and marshal the curves later: */
+	return new CurveSnapshot(cast<ClientState>(sourceCs)->curves);
+	}
+
+void GrapheinServer::sendServerUpdate(ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+	{
+	/* Send the accumulated archive update messages in the destination client's byte order: */
+	Threads::Mutex::Lock archiveUpdateLock(archiveUpdateMutex);
+	MessageBuffer& archiveUpdate=archiveUpdates[pipe.mustSwapOnWrite()?1:0];
+	pipe.write<Card>(archiveUpdate.getDataSize());
+	archiveUpdate.writeToSink(pipe);
+	}
+
+void GrapheinServer::afterServerUpdate(void)
+	{
+	/* Clear the archive update buffers: */
+	{
+	Threads::Mutex::Lock archiveUpdateLock(archiveUpdateMutex);
+	for(int swap=0;swap<2;++swap)
+		archiveUpdates[swap].clear();
+	}
+	
+	/* Let the annotation store compact its log file in the background if it grew too much: */
+	if(store!=0)
+		store->compact();
 	}
 
 }
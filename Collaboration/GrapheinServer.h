@@ -25,17 +25,26 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #define COLLABORATION_GRAPHEINSERVER_INCLUDED
 
 #include <vector>
+#include <Threads/Mutex.h>
 #include <IO/VariableMemoryFile.h>
-#include <Collaboration/ProtocolServer.h>
+#include <Collaboration/ProtocolServerT.h>
 #include <Collaboration/GrapheinProtocol.h>
 
+/* Forward declarations: */
+namespace Collaboration {
+class GrapheinStore;
+}
+
 namespace Collaboration {
 
-class GrapheinServer:public ProtocolServer,private GrapheinProtocol
+class GrapheinServer:public ProtocolServerT<GrapheinServer>,private GrapheinProtocol
 	{
+	friend class ProtocolServerT<GrapheinServer>;
+	
 	/* Embedded classes: */
 	private:
 	typedef IO::VariableMemoryFile MessageBuffer; // Buffer to hold outgoing messages from a client between two updates
+	typedef FlatHashTable<unsigned int,unsigned int> StoreKeyMap; // Hash table mapping client curve IDs to curve keys in the annotation store
 	
 	class ClientState:public ProtocolServer::ClientState
 		{
@@ -43,7 +52,9 @@ class GrapheinServer:public ProtocolServer,private GrapheinProtocol
 		
 		/* Elements: */
 		private:
-		CurveMap curves; // The set of curves currently owned by the client
+		CurveSet curves; // The set of curves currently owned by the client
+		AppendMap appendedCurves; // The set of curves to which the client appended vertices since the last server update
+		StoreKeyMap storeKeys; // Keys of the client's curves in the annotation store
 		MessageBuffer messageBuffer; // Buffer for outgoing messages from this client
 		
 		/* Constructors and destructors: */
@@ -51,6 +62,33 @@ class GrapheinServer:public ProtocolServer,private GrapheinProtocol
 		virtual ~ClientState(void);
 		};
 	
+	class CurveSnapshot:public ProtocolServer::ConnectSnapshot // Class for snapshots of a client's curves, captured for a newly connecting client
+		{
+		/* Elements: */
+		private:
+		CurveSet curves; // Copy of the client's curve set
+		
+		/* Constructors and destructors: */
+		public:
+		CurveSnapshot(const CurveSet& sCurves) // Captures the given curve set
+			:curves(sCurves)
+			{
+			}
+		
+		/* Methods from ProtocolServer::ConnectSnapshot: */
+		virtual void write(Comm::NetPipe& pipe);
+		};
+	
+	/* Elements: */
+	Scalar simplificationTolerance; // Tolerance for simplifying finished curves, relative to the curve's average vertex spacing; curves are not simplified if zero
+	GrapheinStore* store; // Persistent store of all curves, or null if curves are not persistent
+	Threads::Mutex archiveUpdateMutex; // Mutex protecting the archive update buffers
+	MessageBuffer archiveUpdates[2]; // Buffers for messages about curves archived or deleted from the store since the last server update, in native and swapped byte order
+	MessageBuffer connectMessageBuffer; // Buffer to assemble a connecting client's curves once for all destination clients
+	
+	/* Private methods: */
+	static void writeCurves(const CurveSet& curves,IO::File& sink); // Writes all curves in the given curve set to the given sink
+	
 	/* Constructors and destructors: */
 	public:
 	GrapheinServer(void); // Creates a Graphein server object
@@ -59,11 +97,22 @@ class GrapheinServer:public ProtocolServer,private GrapheinProtocol
 	/* Methods from ProtocolServer: */
 	virtual const char* getName(void) const;
 	virtual unsigned int getNumMessages(void) const;
+	virtual bool canShareSpectatorUpdates(void) const;
+	virtual void initialize(CollaborationServer* sServer,Misc::ConfigurationFileSection& configFileSection);
 	virtual ProtocolServer::ClientState* receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe);
-	virtual void receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe);
-	virtual void sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
-	virtual void sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
-	virtual void afterServerUpdate(ProtocolServer::ClientState* cs);
+	virtual void sendConnectReply(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe);
+	virtual void disconnectClient(ProtocolServer::ClientState* cs);
+	virtual void sendClientConnect(ProtocolServer::ClientState* sourceCs,UpdateDestination* destinations,unsigned int numDestinations);
+	virtual ProtocolServer::ConnectSnapshot* captureClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
+	virtual void sendServerUpdate(ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe);
+	virtual void afterServerUpdate(void);
+	
+	/* Statically dispatched hooks from ProtocolServerT: */
+	void receiveClientUpdate(ClientState* cs,Comm::NetPipe& pipe);
+	void sendClientConnect(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe);
+	void beforeServerUpdate(ClientState* cs);
+	void sendServerUpdate(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe);
+	void afterServerUpdate(ClientState* cs);
 	};
 
 }
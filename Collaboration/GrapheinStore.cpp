@@ -0,0 +1,686 @@
+/***********************************************************************
+GrapheinStore - Class for persistent server-side stores of Graphein
+curves, backed by an append-only log file that is memory-mapped to
+serve archived curves to joining clients, and compacted periodically.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/GrapheinStore.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <iostream>
+#include <stdexcept>
+#include <Misc/SizedTypes.h>
+#include <Misc/Endianness.h>
+#include <Misc/ThrowStdErr.h>
+#include <IO/File.h>
+
+namespace Collaboration {
+
+namespace {
+
+/***************
+Log file format:
+***************/
+
+const GrapheinProtocol::Card logMagic=0x47524C47U; // Magic number at the beginning of a log file
+const GrapheinProtocol::Card logVersion=1U; // Version of the log file format
+const size_t logHeaderSize=2*sizeof(GrapheinProtocol::Card); // Size of the log file header
+const size_t recordHeaderSize=2*sizeof(GrapheinProtocol::Card); // Size of a record's type and payload size
+const size_t minCompactionSize=1024*1024; // Log size below which the log is never compacted
+
+enum RecordType // Enumerated type for log records
+	{
+	ADD_RECORD=0, // Adds a live curve: key, curve
+	APPEND_RECORD, // Appends vertices to a curve: key, index of first vertex, number of vertices, vertices
+	DELETE_RECORD, // Deletes a live curve: key
+	ARCHIVE_RECORD, // Archives a curve: ADD_CURVE protocol message containing key and curve
+	DELETE_ARCHIVE_RECORD // Deletes all archived curves: empty
+	};
+
+/**************************************************
+Helper class to read from a memory-mapped log file:
+**************************************************/
+
+class MappedLogReader:public IO::File
+	{
+	/* Elements: */
+	private:
+	const Byte* data; // Pointer to the unread part of the mapped log
+	size_t dataSize; // Size of the unread part of the mapped log
+	
+	/* Protected methods from IO::File: */
+	protected:
+	virtual size_t readData(Byte* buffer,size_t bufferSize)
+		{
+		/* Copy as much of the remaining mapped data as fits into the buffer: */
+		size_t readSize=bufferSize<dataSize?bufferSize:dataSize;
+		memcpy(buffer,data,readSize);
+		data+=readSize;
+		dataSize-=readSize;
+		return readSize;
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	MappedLogReader(const char* sData,size_t sDataSize)
+		:IO::File(ReadOnly),
+		 data(reinterpret_cast<const Byte*>(sData)),dataSize(sDataSize)
+		{
+		}
+	};
+
+/******************************************************
+Helper class to temporarily map a log file into memory:
+******************************************************/
+
+class LogMapping
+	{
+	/* Elements: */
+	private:
+	void* data; // Pointer to the mapped log file, or null
+	size_t dataSize; // Size of the mapping
+	
+	/* Constructors and destructors: */
+	public:
+	LogMapping(void)
+		:data(0),dataSize(0)
+		{
+		}
+	private:
+	LogMapping(const LogMapping& source); // Prohibit copy constructor
+	LogMapping& operator=(const LogMapping& source); // Prohibit assignment operator
+	public:
+	~LogMapping(void)
+		{
+		/* Remove the mapping, which stays valid even if the log file was replaced in the meantime: */
+		if(data!=0)
+			munmap(data,dataSize);
+		}
+	
+	/* Methods: */
+	void map(int fd,size_t sDataSize,const std::string& fileName) // Maps the first given number of bytes of the given log file
+		{
+		void* mapping=mmap(0,sDataSize,PROT_READ,MAP_SHARED,fd,0);
+		if(mapping==MAP_FAILED)
+			Misc::throwStdErr("GrapheinStore: Unable to map log file %s due to error %s",fileName.c_str(),strerror(errno));
+		data=mapping;
+		dataSize=sDataSize;
+		}
+	const char* getData(void) const // Returns the mapped log file
+		{
+		return static_cast<const char*>(data);
+		}
+	};
+
+}
+
+/*******************************************
+Declaration of class GrapheinStore::LogFile:
+*******************************************/
+
+class GrapheinStore::LogFile:public IO::File
+	{
+	/* Elements: */
+	private:
+	int fd; // File descriptor of the log file, positioned at its end
+	
+	/* Protected methods from IO::File: */
+	protected:
+	virtual void writeData(const Byte* buffer,size_t bufferSize)
+		{
+		while(bufferSize>0)
+			{
+			ssize_t writeResult=::write(fd,buffer,bufferSize);
+			if(writeResult>0)
+				{
+				buffer+=writeResult;
+				bufferSize-=size_t(writeResult);
+				}
+			else if(writeResult<0&&errno!=EINTR)
+				Misc::throwStdErr("GrapheinStore::LogFile::writeData: Error %s while writing to log file",strerror(errno));
+			}
+		}
+	
+	/* Constructors and destructors: */
+	public:
+	LogFile(int sFd)
+		:IO::File(WriteOnly),
+		 fd(sFd)
+		{
+		}
+	virtual ~LogFile(void)
+		{
+		/* Write any buffered data before the file is destroyed: */
+		flush();
+		}
+	
+	/* Methods from IO::File: */
+	virtual int getFd(void) const
+		{
+		return fd;
+		}
+	};
+
+/******************************
+Methods of class GrapheinStore:
+******************************/
+
+void GrapheinStore::writeRecord(unsigned int recordType)
+	{
+	/* Write the record's header and payload and push them to the log file: */
+	size_t payloadSize=record.getDataSize();
+	logFile->write<Card>(recordType);
+	logFile->write<Card>(payloadSize);
+	record.writeToSink(*logFile);
+	logFile->flush();
+	record.clear();
+	
+	logSize+=recordHeaderSize+payloadSize;
+	}
+
+void GrapheinStore::mapLog(void)
+	{
+	if(logSize==0)
+		return;
+	
+	void* mapping=mmap(0,logSize,PROT_READ,MAP_SHARED,logFd,0);
+	if(mapping==MAP_FAILED)
+		Misc::throwStdErr("GrapheinStore::mapLog: Unable to map log file %s due to error %s",fileName.c_str(),strerror(errno));
+	mappedLog=static_cast<const char*>(mapping);
+	mappedLogSize=logSize;
+	}
+
+void GrapheinStore::unmapLog(void)
+	{
+	if(mappedLog!=0)
+		munmap(const_cast<char*>(mappedLog),mappedLogSize);
+	mappedLog=0;
+	mappedLogSize=0;
+	}
+
+void GrapheinStore::replayLog(void)
+	{
+	if(mappedLogSize<logHeaderSize)
+		return;
+	
+	/* Check the log file's header, and read it with the endianness of the host that wrote it: */
+	MappedLogReader reader(mappedLog,mappedLogSize);
+	Card magic=reader.read<Card>();
+	if(magic!=logMagic)
+		{
+		reader.setSwapOnRead(true);
+		Misc::swapEndianness(magic);
+		if(magic!=logMagic)
+			Misc::throwStdErr("GrapheinStore::replayLog: File %s is not a Graphein log file",fileName.c_str());
+		}
+	Card version=reader.read<Card>();
+	if(version!=logVersion)
+		Misc::throwStdErr("GrapheinStore::replayLog: Log file %s has unsupported version %u",fileName.c_str(),version);
+	
+	/* Apply all complete records; a truncated last record was cut short by a server crash and is ignored: */
+	size_t offset=logHeaderSize;
+	while(offset+recordHeaderSize<=mappedLogSize)
+		{
+		unsigned int recordType=reader.read<Card>();
+		size_t payloadSize=reader.read<Card>();
+		offset+=recordHeaderSize;
+		if(offset+payloadSize>mappedLogSize)
+			break;
+		offset+=payloadSize;
+		
+		switch(recordType)
+			{
+			case ADD_RECORD:
+			case ARCHIVE_RECORD:
+				{
+				if(recordType==ARCHIVE_RECORD)
+					readMessage(reader);
+				
+				/* Read the curve and replace any previous curve of the same key: */
+				unsigned int key=reader.read<Card>();
+				curves.readCurve(key,reader);
+				if(nextKey<=key)
+					nextKey=key+1;
+				
+				/* Track which curves are archived at this point in the log: */
+				if(recordType==ARCHIVE_RECORD)
+					archivedCurves[key];
+				else
+					archivedCurves.removeEntry(key);
+				break;
+				}
+			
+			case APPEND_RECORD:
+				{
+				/* Read the vertices and store them in the curve: */
+				unsigned int key=reader.read<Card>();
+				size_t firstIndex=reader.read<Card>();
+				size_t numVertices=reader.read<Card>();
+				
+				/* Reject records that would grow the curve beyond the maximum length before allocating any memory: */
+				if(numVertices>maxNumCurveVertices||firstIndex+numVertices>maxNumCurveVertices)
+					{
+					std::cerr<<"GrapheinStore: Ignoring run of "<<numVertices<<" vertices that would grow curve "<<key<<" beyond the maximum of "<<maxNumCurveVertices<<" vertices in log file "<<fileName<<std::endl;
+					if(payloadSize>sizeof(Card)*3)
+						reader.skip<Misc::UInt8>(payloadSize-sizeof(Card)*3);
+					break;
+					}
+				
+				const Curve* curve=curves.findCurve(key);
+				if(curve!=0&&firstIndex<=curve->numVertices)
+					readArray(curves.resizeCurve(key,firstIndex+numVertices)+firstIndex,numVertices,reader);
+				else
+					reader.skip<Scalar>(numVertices*3);
+				break;
+				}
+			
+			case DELETE_RECORD:
+				{
+				/* Delete the curve: */
+				unsigned int key=reader.read<Card>();
+				curves.deleteCurve(key);
+				archivedCurves.removeEntry(key);
+				break;
+				}
+			
+			case DELETE_ARCHIVE_RECORD:
+				{
+				/* Delete all curves that were archived at the time: */
+				for(ArchiveMap::Iterator aIt=archivedCurves.begin();!aIt.isFinished();++aIt)
+					curves.deleteCurve(aIt->getSource());
+				archivedCurves.clear();
+				break;
+				}
+			
+			default:
+				reader.skip<Misc::UInt8>(payloadSize);
+			}
+		}
+	
+	/* Archive all curves found in the log; their messages are located during compaction: */
+	for(CurveSet::ConstIterator cIt=curves.begin();!cIt.isFinished();++cIt)
+		archivedCurves[cIt->getSource()];
+	}
+
+void GrapheinStore::compactLog(void)
+	{
+	/*********************************************************************
+	Compact the log in three steps: take a snapshot of all curves while
+	the store is locked, write the snapshot to a new log file without
+	holding the lock, and then append all records logged since the
+	snapshot to the new log file and switch over to it while the store
+	is locked again.
+	*********************************************************************/
+	
+	/* Take a snapshot of all curves and remember where the current log file ends: */
+	CurveSet snapshotCurves(101);
+	ArchiveMap snapshotArchivedCurves(101);
+	size_t snapshotLogSize;
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	for(CurveSet::ConstIterator cIt=curves.begin();!cIt.isFinished();++cIt)
+		snapshotCurves.copyCurve(cIt->getSource(),curves,cIt->getDest());
+	snapshotArchivedCurves=archivedCurves;
+	snapshotLogSize=logSize;
+	}
+	
+	/* Create a new log file next to the current one: */
+	std::string newFileName=fileName+".new";
+	int newLogFd=open(newFileName.c_str(),O_RDWR|O_CREAT|O_TRUNC,0644);
+	if(newLogFd<0)
+		Misc::throwStdErr("GrapheinStore::compactLog: Unable to create log file %s due to error %s",newFileName.c_str(),strerror(errno));
+	LogFile* newLogFile=0;
+	size_t newLogSize=0;
+	ArchiveMap newArchivedCurves(snapshotArchivedCurves.getNumEntries());
+	try
+		{
+		/* Write the log file header: */
+		newLogFile=new LogFile(newLogFd);
+		newLogFile->write<Card>(logMagic);
+		newLogFile->write<Card>(logVersion);
+		newLogSize=logHeaderSize;
+		
+		/* Write every curve of the snapshot as a single record: */
+		IO::VariableMemoryFile snapshotRecord;
+		for(CurveSet::ConstIterator cIt=snapshotCurves.begin();!cIt.isFinished();++cIt)
+			{
+			bool archived=snapshotArchivedCurves.isEntry(cIt->getSource());
+			if(archived)
+				writeMessage(ADD_CURVE,snapshotRecord);
+			snapshotRecord.write<Card>(cIt->getSource());
+			snapshotCurves.writeCurve(cIt->getDest(),snapshotRecord);
+			size_t payloadSize=snapshotRecord.getDataSize();
+			newLogFile->write<Card>(archived?ARCHIVE_RECORD:ADD_RECORD);
+			newLogFile->write<Card>(payloadSize);
+			snapshotRecord.writeToSink(*newLogFile);
+			snapshotRecord.clear();
+			
+			/* Remember where an archived curve's protocol message ended up: */
+			if(archived)
+				newArchivedCurves[cIt->getSource()]=ArchivedCurve(newLogSize+recordHeaderSize,payloadSize);
+			newLogSize+=recordHeaderSize+payloadSize;
+			}
+		newLogFile->flush();
+		
+		/* Make sure the snapshot is on disk before the new log file replaces the current one: */
+		if(fsync(newLogFd)<0)
+			Misc::throwStdErr("GrapheinStore::compactLog: Unable to write log file %s due to error %s",newFileName.c_str(),strerror(errno));
+		}
+	catch(...)
+		{
+		/* Discard the new log file and keep using the current one: */
+		delete newLogFile;
+		close(newLogFd);
+		unlink(newFileName.c_str());
+		throw;
+		}
+	
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	try
+		{
+		/* Copy all records logged since the snapshot verbatim to the end of the new log file: */
+		if(logSize>snapshotLogSize)
+			{
+			LogMapping mapping;
+			mapping.map(logFd,logSize,fileName);
+			newLogFile->writeRaw(mapping.getData()+snapshotLogSize,logSize-snapshotLogSize);
+			newLogFile->flush();
+			}
+		
+		/* Replace the current log file: */
+		if(rename(newFileName.c_str(),fileName.c_str())<0)
+			Misc::throwStdErr("GrapheinStore::compactLog: Unable to replace log file %s due to error %s",fileName.c_str(),strerror(errno));
+		}
+	catch(...)
+		{
+		/* Discard the new log file and keep using the current one: */
+		delete newLogFile;
+		close(newLogFd);
+		unlink(newFileName.c_str());
+		throw;
+		}
+	
+	/* Locate the messages of all currently archived curves in the new log file; curves archived since the snapshot moved with the copied records: */
+	ArchiveMap movedArchivedCurves(archivedCurves.getNumEntries());
+	for(ArchiveMap::Iterator aIt=archivedCurves.begin();!aIt.isFinished();++aIt)
+		{
+		ArchiveMap::Iterator naIt=newArchivedCurves.findEntry(aIt->getSource());
+		if(!naIt.isFinished())
+			movedArchivedCurves[aIt->getSource()]=naIt->getDest();
+		else
+			movedArchivedCurves[aIt->getSource()]=ArchivedCurve(aIt->getDest().offset-snapshotLogSize+newLogSize,aIt->getDest().size);
+		}
+	newLogSize+=logSize-snapshotLogSize;
+	
+	/* Switch to the new log file: */
+	unmapLog();
+	delete logFile;
+	if(logFd>=0)
+		close(logFd);
+	logFd=newLogFd;
+	logFile=newLogFile;
+	logSize=newLogSize;
+	compactedLogSize=logSize;
+	archivedCurves=movedArchivedCurves;
+	}
+
+void* GrapheinStore::compactionThreadMethod(void)
+	{
+	storeMutex.lock();
+	
+	while(true)
+		{
+		/* Wait for the next compaction request or for shutdown: */
+		while(!compactionRequested&&!shutdownCompaction)
+			compactionCond.wait(storeMutex);
+		if(shutdownCompaction)
+			break;
+		
+		/* Compact the log without holding the store lock, which compactLog locks as needed: */
+		storeMutex.unlock();
+		try
+			{
+			compactLog();
+			}
+		catch(std::runtime_error err)
+			{
+			/* Print an error message and carry on with the uncompacted log file: */
+			std::cerr<<"GrapheinStore: Caught exception "<<err.what()<<" while compacting log file "<<fileName<<std::endl;
+			
+			/* Don't try again until the log grew enough once more: */
+			Threads::Mutex::Lock storeLock(storeMutex);
+			compactedLogSize=logSize;
+			}
+		storeMutex.lock();
+		compactionRequested=false;
+		}
+	
+	storeMutex.unlock();
+	
+	return 0;
+	}
+
+GrapheinStore::GrapheinStore(const std::string& sFileName,double sCompactionRatio)
+	:fileName(sFileName),compactionRatio(sCompactionRatio),
+	 logFd(-1),logFile(0),logSize(0),compactedLogSize(0),
+	 mappedLog(0),mappedLogSize(0),
+	 curves(101),archivedCurves(101),
+	 nextKey(0),
+	 compactionRequested(false),shutdownCompaction(false)
+	{
+	/* Open the log file if it exists: */
+	logFd=open(fileName.c_str(),O_RDONLY);
+	if(logFd<0&&errno!=ENOENT)
+		Misc::throwStdErr("GrapheinStore::GrapheinStore: Unable to open log file %s due to error %s",fileName.c_str(),strerror(errno));
+	
+	try
+		{
+		if(logFd>=0)
+			{
+			/* Map the existing log file and replay it: */
+			off_t fileSize=lseek(logFd,0,SEEK_END);
+			if(fileSize<0)
+				Misc::throwStdErr("GrapheinStore::GrapheinStore: Unable to read log file %s due to error %s",fileName.c_str(),strerror(errno));
+			logSize=size_t(fileSize);
+			mapLog();
+			replayLog();
+			}
+		
+		/* Write all recovered curves to a fresh log file, which also creates the log file if it did not exist: */
+		compactLog();
+		}
+	catch(...)
+		{
+		/* Clean up and re-throw the exception: */
+		unmapLog();
+		if(logFd>=0)
+			close(logFd);
+		throw;
+		}
+	
+	/* Start the background compaction thread: */
+	compactionThread.start(this,&GrapheinStore::compactionThreadMethod);
+	}
+
+GrapheinStore::~GrapheinStore(void)
+	{
+	/* Shut down the compaction thread, which finishes any compaction in progress: */
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	shutdownCompaction=true;
+	compactionCond.signal();
+	}
+	compactionThread.join();
+	
+	/* Close the log file: */
+	unmapLog();
+	delete logFile;
+	close(logFd);
+	}
+
+unsigned int GrapheinStore::addCurve(const GrapheinProtocol::CurveSet& curveSet,const GrapheinProtocol::Curve& curve)
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	/* Add a copy of the curve under a new key: */
+	unsigned int key=nextKey;
+	++nextKey;
+	curves.copyCurve(key,curveSet,curve);
+	
+	/* Log the new curve: */
+	record.write<Card>(key);
+	curveSet.writeCurve(curve,record);
+	writeRecord(ADD_RECORD);
+	
+	return key;
+	}
+
+void GrapheinStore::appendVertices(unsigned int key,const GrapheinProtocol::CurveSet& curveSet,const GrapheinProtocol::Curve& curve,size_t firstIndex)
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	/* Update the stored copy of the curve: */
+	const Curve* storedCurve=curves.findCurve(key);
+	if(storedCurve==0||firstIndex>storedCurve->numVertices||firstIndex>curve.numVertices)
+		return;
+	size_t numVertices=curve.numVertices-firstIndex;
+	const Point* vertices=curveSet.getVertices(curve)+firstIndex;
+	Point* storedVertices=curves.resizeCurve(key,curve.numVertices)+firstIndex;
+	for(size_t i=0;i<numVertices;++i)
+		storedVertices[i]=vertices[i];
+	
+	/* Log the appended vertices: */
+	record.write<Card>(key);
+	record.write<Card>(firstIndex);
+	record.write<Card>(numVertices);
+	writeArray(vertices,numVertices,record);
+	writeRecord(APPEND_RECORD);
+	}
+
+void GrapheinStore::deleteCurve(unsigned int key)
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	if(!curves.isCurve(key))
+		return;
+	
+	/* Delete the curve and log its deletion: */
+	curves.deleteCurve(key);
+	record.write<Card>(key);
+	writeRecord(DELETE_RECORD);
+	}
+
+void GrapheinStore::archiveCurve(unsigned int key,const GrapheinProtocol::CurveSet& curveSet,const GrapheinProtocol::Curve& curve)
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	/* Replace the stored copy of the curve with its final state: */
+	curves.copyCurve(key,curveSet,curve);
+	
+	/* Log the curve's protocol message and remember where it is in the log file: */
+	writeMessage(ADD_CURVE,record);
+	record.write<Card>(key);
+	curveSet.writeCurve(curve,record);
+	archivedCurves[key]=ArchivedCurve(logSize+recordHeaderSize,record.getDataSize());
+	writeRecord(ARCHIVE_RECORD);
+	}
+
+void GrapheinStore::deleteArchivedCurves(void)
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	if(archivedCurves.getNumEntries()==0)
+		return;
+	
+	/* Delete all archived curves and log their deletion: */
+	for(ArchiveMap::Iterator aIt=archivedCurves.begin();!aIt.isFinished();++aIt)
+		curves.deleteCurve(aIt->getSource());
+	archivedCurves.clear();
+	writeRecord(DELETE_ARCHIVE_RECORD);
+	}
+
+void GrapheinStore::writeArchive(IO::File& sink)
+	{
+	/*********************************************************************
+	Collect the archived curves' protocol messages while the store is
+	locked, and send them after it is unlocked, so that a slow joining
+	client does not stall all other users of the store.
+	*********************************************************************/
+	
+	size_t archiveSize=0;
+	LogMapping mapping;
+	std::vector<ArchivedCurve> messages;
+	IO::VariableMemoryFile swappedMessages;
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	/* Calculate the total size of all archived curves' protocol messages: */
+	for(ArchiveMap::Iterator aIt=archivedCurves.begin();!aIt.isFinished();++aIt)
+		archiveSize+=aIt->getDest().size;
+	
+	if(!sink.mustSwapOnWrite())
+		{
+		/* Map the log file and copy the locations of the messages in it: */
+		if(archiveSize!=0)
+			mapping.map(logFd,logSize,fileName);
+		messages.reserve(archivedCurves.getNumEntries());
+		for(ArchiveMap::Iterator aIt=archivedCurves.begin();!aIt.isFinished();++aIt)
+			messages.push_back(aIt->getDest());
+		}
+	else
+		{
+		/* Re-marshal the messages with the sink's endianness: */
+		swappedMessages.setSwapOnWrite(true);
+		for(ArchiveMap::Iterator aIt=archivedCurves.begin();!aIt.isFinished();++aIt)
+			{
+			writeMessage(ADD_CURVE,swappedMessages);
+			swappedMessages.write<Card>(aIt->getSource());
+			curves.writeCurve(*curves.findCurve(aIt->getSource()),swappedMessages);
+			}
+		}
+	}
+	
+	/* Write the total size of all messages, followed by the messages straight from the mapped log file or the re-marshaled messages: */
+	sink.write<Card>(archiveSize);
+	for(std::vector<ArchivedCurve>::iterator mIt=messages.begin();mIt!=messages.end();++mIt)
+		sink.writeRaw(mapping.getData()+mIt->offset,mIt->size);
+	swappedMessages.writeToSink(sink);
+	}
+
+void GrapheinStore::compact(void)
+	{
+	Threads::Mutex::Lock storeLock(storeMutex);
+	
+	/* Wake up the compaction thread if the log grew enough since the last compaction: */
+	if(!compactionRequested&&logSize>=minCompactionSize&&double(logSize)>=double(compactedLogSize)*compactionRatio)
+		{
+		compactionRequested=true;
+		compactionCond.signal();
+		}
+	}
+
+}
@@ -0,0 +1,123 @@
+/***********************************************************************
+GrapheinStore - Class for persistent server-side stores of Graphein
+curves, backed by an append-only log file that is memory-mapped to
+serve archived curves to joining clients, and compacted periodically.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+The store logs every change to every curve under a store-wide curve key.
+Curves whose authors disconnected are archived: their final state is
+written to the log as a complete ADD_CURVE protocol message, which is
+sent verbatim from the mapped log to joining clients. All curves found
+in the log when a store is opened are archived, and the log is compacted
+right away. Later compactions run on a background thread, which only
+locks the store briefly. A store's methods are thread-safe.
+***********************************************************************/
+
+#ifndef COLLABORATION_GRAPHEINSTORE_INCLUDED
+#define COLLABORATION_GRAPHEINSTORE_INCLUDED
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <Threads/Mutex.h>
+#include <Threads/Cond.h>
+#include <Threads/Thread.h>
+#include <IO/VariableMemoryFile.h>
+#include <Collaboration/GrapheinProtocol.h>
+
+namespace Collaboration {
+
+class GrapheinStore:private GrapheinProtocol
+	{
+	/* Embedded classes: */
+	private:
+	class LogFile; // Class to append records to the log file
+	
+	struct ArchivedCurve // Structure describing the location of an archived curve's protocol message in the log file
+		{
+		/* Elements: */
+		public:
+		size_t offset; // Offset of the message in the log file
+		size_t size; // Size of the message in bytes
+		
+		/* Constructors and destructors: */
+		ArchivedCurve(void)
+			:offset(0),size(0)
+			{
+			}
+		ArchivedCurve(size_t sOffset,size_t sSize)
+			:offset(sOffset),size(sSize)
+			{
+			}
+		};
+	
+	typedef FlatHashTable<unsigned int,ArchivedCurve> ArchiveMap; // Hash table mapping keys of archived curves to their protocol messages
+	
+	/* Elements: */
+	std::string fileName; // Name of the log file
+	double compactionRatio; // Log size relative to the size after the last compaction at which the log is compacted again
+	Threads::Mutex storeMutex; // Mutex serializing access to the store
+	int logFd; // File descriptor of the log file
+	LogFile* logFile; // File appending records to the log file
+	size_t logSize; // Current size of the log file
+	size_t compactedLogSize; // Size of the log file after the last compaction
+	const char* mappedLog; // Read-only memory mapping of the log file while it is replayed
+	size_t mappedLogSize; // Size of the memory mapping
+	IO::VariableMemoryFile record; // Buffer to assemble log records
+	CurveSet curves; // Set of all curves in the store, live and archived
+	ArchiveMap archivedCurves; // Map of archived curves
+	unsigned int nextKey; // Key for the next curve added to the store
+	Threads::Cond compactionCond; // Condition variable to wake up the compaction thread; protected by the store mutex
+	bool compactionRequested; // Flag if the log file needs to be compacted
+	bool shutdownCompaction; // Flag to shut down the compaction thread
+	Threads::Thread compactionThread; // Thread compacting the log file in the background
+	
+	/* Private methods: */
+	void writeRecord(unsigned int recordType); // Appends the record assembled in the record buffer to the log file and clears the buffer
+	void mapLog(void); // Maps the current contents of the log file into memory
+	void unmapLog(void); // Removes the log file's memory mapping
+	void replayLog(void); // Reads the mapped log file and archives all curves found in it
+	void compactLog(void); // Writes all curves to a new log file and replaces the current log file with it; locks the store only while taking a snapshot and while switching log files
+	void* compactionThreadMethod(void); // Method for the thread compacting the log file in the background
+	
+	/* Constructors and destructors: */
+	public:
+	GrapheinStore(const std::string& sFileName,double sCompactionRatio); // Opens or creates a store backed by the log file of the given name
+	private:
+	GrapheinStore(const GrapheinStore& source); // Prohibit copy constructor
+	GrapheinStore& operator=(const GrapheinStore& source); // Prohibit assignment operator
+	public:
+	~GrapheinStore(void);
+	
+	/* Methods: */
+	unsigned int addCurve(const CurveSet& curveSet,const Curve& curve); // Adds a copy of the given curve of the given set to the store as a new live curve; returns the curve's key
+	void appendVertices(unsigned int key,const CurveSet& curveSet,const Curve& curve,size_t firstIndex); // Replaces the vertices of the curve of the given key, starting at the given index, with those of the given curve of the given set
+	void deleteCurve(unsigned int key); // Deletes the live curve of the given key from the store
+	void archiveCurve(unsigned int key,const CurveSet& curveSet,const Curve& curve); // Archives the live curve of the given key with the final state of the given curve of the given set
+	void deleteArchivedCurves(void); // Deletes all archived curves from the store
+	void writeArchive(IO::File& sink); // Writes the total size and the protocol messages of all archived curves to the given sink; does not lock the store while writing
+	void compact(void); // Asks the background compaction thread to compact the log file if it grew enough since the last compaction
+	};
+
+}
+
+#endif
@@ -0,0 +1,186 @@
+/***********************************************************************
+MessageBufferPool - Class to recycle fixed-size memory buffers holding
+protocol messages received from a collaboration server, to avoid heap
+allocations during steady-state operation.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#include <Collaboration/MessageBufferPool.h>
+
+#include <Misc/ThrowStdErr.h>
+
+namespace Collaboration {
+
+/******************************************
+Methods of class MessageBufferPool::Buffer:
+******************************************/
+
+size_t MessageBufferPool::Buffer::readData(IO::File::Byte* buffer,size_t bufferSize)
+	{
+	/* The read buffer is the memory block itself; hand over the rest of the stored message once, and signal end-of-file afterwards: */
+	if(dataRead)
+		return 0;
+	dataRead=true;
+	return dataSize-readStart;
+	}
+
+MessageBufferPool::Buffer::Buffer(unsigned int sSizeClass,size_t sCapacity)
+	:sizeClass(sSizeClass),
+	 memory(new Byte[sCapacity]),dataSize(0),
+	 readStart(0),dataRead(false)
+	{
+	/* Read directly from the memory block instead of the file's own read buffer; reads must never bypass the read buffer: */
+	canReadThrough=false;
+	setReadBuffer(sCapacity,memory,true);
+	}
+
+MessageBufferPool::Buffer::~Buffer(void)
+	{
+	/* Detach the read buffer from the memory block before deleting it: */
+	setReadBuffer(0,0,false);
+	delete[] memory;
+	}
+
+void MessageBufferPool::Buffer::setReadPosAbs(IO::File::Offset newReadPos)
+	{
+	if(newReadPos<0||size_t(newReadPos)>dataSize)
+		Misc::throwStdErr("MessageBufferPool::Buffer::setReadPosAbs: Read position outside of stored message");
+	
+	/* Point the read buffer at the rest of the stored message, so that reading past the message's end fails: */
+	readStart=size_t(newReadPos);
+	setReadBuffer(dataSize-readStart,memory+readStart,false);
+	dataRead=false;
+	}
+
+void MessageBufferPool::Buffer::readMessage(IO::File& source)
+	{
+	/* Read the message directly into the buffer's memory and rewind the buffer: */
+	source.readRaw(memory,dataSize);
+	setReadPosAbs(0);
+	}
+
+/**********************************
+Methods of class MessageBufferPool:
+**********************************/
+
+MessageBufferPool::MessageBufferPool(size_t sMaxPooledBuffers)
+	:maxPooledBuffers(sMaxPooledBuffers)
+	{
+	/* Reserve the free lists up-front so that releasing buffers never allocates: */
+	for(unsigned int sizeClass=0;sizeClass<numSizeClasses;++sizeClass)
+		freeBuffers[sizeClass].reserve(maxPooledBuffers);
+	}
+
+MessageBufferPool::~MessageBufferPool(void)
+	{
+	/* Delete all free buffers: */
+	for(unsigned int sizeClass=0;sizeClass<numSizeClasses;++sizeClass)
+		for(BufferList::iterator bIt=freeBuffers[sizeClass].begin();bIt!=freeBuffers[sizeClass].end();++bIt)
+			delete *bIt;
+	}
+
+MessageBufferPool::Buffer* MessageBufferPool::acquire(size_t messageSize)
+	{
+	/* Find the smallest size class that can hold the message: */
+	unsigned int sizeClass=0;
+	size_t capacity=minBufferSize;
+	while(capacity<messageSize)
+		{
+		++sizeClass;
+		capacity<<=1;
+		}
+	
+	Buffer* result=0;
+	{
+	Threads::Mutex::Lock poolLock(poolMutex);
+	++statistics.numAcquired;
+	
+	/* Take a buffer from the size class's free list if there is one: */
+	if(sizeClass<numSizeClasses&&!freeBuffers[sizeClass].empty())
+		{
+		result=freeBuffers[sizeClass].back();
+		freeBuffers[sizeClass].pop_back();
+		--statistics.numPooled;
+		statistics.numPooledBytes-=capacity;
+		}
+	else
+		++statistics.numAllocated;
+	}
+	
+	/* Allocate a new buffer outside the lock if the free list was empty: */
+	if(result==0)
+		result=new Buffer(sizeClass,capacity);
+	result->dataSize=messageSize;
+	result->setReadPosAbs(0);
+	
+	return result;
+	}
+
+MessageBufferPool::Buffer* MessageBufferPool::acquire(IO::File& source,size_t messageSize)
+	{
+	/* Get a buffer and read the message into it with the same endianness as the source: */
+	Buffer* result=acquire(messageSize);
+	result->setSwapOnRead(source.mustSwapOnRead());
+	try
+		{
+		result->readMessage(source);
+		}
+	catch(...)
+		{
+		/* Return the buffer to the pool and re-throw the exception: */
+		release(result);
+		throw;
+		}
+	
+	return result;
+	}
+
+void MessageBufferPool::release(MessageBufferPool::Buffer* buffer)
+	{
+	if(buffer==0)
+		return;
+	
+	{
+	Threads::Mutex::Lock poolLock(poolMutex);
+	++statistics.numReleased;
+	
+	/* Put the buffer back into its size class's free list if there is room: */
+	if(buffer->sizeClass<numSizeClasses&&freeBuffers[buffer->sizeClass].size()<maxPooledBuffers)
+		{
+		freeBuffers[buffer->sizeClass].push_back(buffer);
+		++statistics.numPooled;
+		statistics.numPooledBytes+=minBufferSize<<buffer->sizeClass;
+		return;
+		}
+	
+	++statistics.numDiscarded;
+	}
+	
+	/* Delete the buffer outside the lock: */
+	delete buffer;
+	}
+
+MessageBufferPool::Statistics MessageBufferPool::getStatistics(void)
+	{
+	Threads::Mutex::Lock poolLock(poolMutex);
+	return statistics;
+	}
+
+}
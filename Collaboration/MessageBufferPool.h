@@ -0,0 +1,126 @@
+/***********************************************************************
+MessageBufferPool - Class to recycle fixed-size memory buffers holding
+protocol messages received from a collaboration server, to avoid heap
+allocations during steady-state operation.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+#ifndef COLLABORATION_MESSAGEBUFFERPOOL_INCLUDED
+#define COLLABORATION_MESSAGEBUFFERPOOL_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+#include <Threads/Mutex.h>
+#include <IO/File.h>
+
+namespace Collaboration {
+
+class MessageBufferPool
+	{
+	/* Embedded classes: */
+	public:
+	class Buffer:public IO::File // Class for memory buffers holding a single message; the buffer's capacity is rounded up to its size class, but only the stored message can be read
+		{
+		friend class MessageBufferPool;
+		
+		/* Elements: */
+		private:
+		unsigned int sizeClass; // Index of the buffer's size class in the pool
+		Byte* memory; // The buffer's memory block
+		size_t dataSize; // Size of the message currently stored in the buffer
+		size_t readStart; // Offset in the memory block at which the file's read buffer starts
+		bool dataRead; // Flag if the data following the read buffer's start has been handed to the file
+		
+		/* Protected methods from IO::File: */
+		protected:
+		virtual size_t readData(Byte* buffer,size_t bufferSize);
+		
+		/* Constructors and destructors: */
+		private:
+		Buffer(unsigned int sSizeClass,size_t sCapacity);
+		public:
+		virtual ~Buffer(void);
+		
+		/* Methods: */
+		size_t getDataSize(void) const // Returns the size of the message stored in the buffer
+			{
+			return dataSize;
+			}
+		Offset getReadPos(void) const // Returns the current read position in the stored message
+			{
+			return Offset(dataRead?dataSize-getUnreadDataSize():readStart);
+			}
+		void setReadPosAbs(Offset newReadPos); // Sets the read position in the stored message
+		bool eom(void) const // Returns true if the entire stored message has been read
+			{
+			return size_t(getReadPos())>=dataSize;
+			}
+		void readMessage(IO::File& source); // Reads a message of the buffer's data size from the given source and rewinds the buffer
+		};
+	
+	struct Statistics // Structure to report pool usage
+		{
+		/* Elements: */
+		public:
+		size_t numAcquired; // Number of buffers handed out by the pool
+		size_t numAllocated; // Number of buffers that had to be allocated from the heap
+		size_t numReleased; // Number of buffers returned to the pool
+		size_t numDiscarded; // Number of returned buffers that were deleted because their size class was full or too large
+		size_t numPooled; // Number of buffers currently held in the pool's free lists
+		size_t numPooledBytes; // Total capacity of all buffers currently held in the pool's free lists
+		
+		/* Constructors and destructors: */
+		Statistics(void)
+			:numAcquired(0),numAllocated(0),numReleased(0),numDiscarded(0),
+			 numPooled(0),numPooledBytes(0)
+			{
+			}
+		};
+	
+	private:
+	typedef std::vector<Buffer*> BufferList; // Type for lists of free buffers
+	
+	/* Elements: */
+	static const size_t minBufferSize=256; // Capacity of buffers in the smallest size class
+	static const unsigned int numSizeClasses=16; // Number of pooled size classes; larger messages are allocated and freed directly
+	Threads::Mutex poolMutex; // Mutex serializing access to the pool, which is shared between the communication and main threads
+	size_t maxPooledBuffers; // Maximum number of free buffers retained per size class
+	BufferList freeBuffers[numSizeClasses]; // Lists of free buffers for each size class
+	Statistics statistics; // Current pool statistics
+	
+	/* Constructors and destructors: */
+	public:
+	MessageBufferPool(size_t sMaxPooledBuffers =64); // Creates an empty pool retaining at most the given number of free buffers per size class
+	private:
+	MessageBufferPool(const MessageBufferPool& source); // Prohibit copy constructor
+	MessageBufferPool& operator=(const MessageBufferPool& source); // Prohibit assignment operator
+	public:
+	~MessageBufferPool(void); // Destroys the pool and all free buffers; all acquired buffers must have been released
+	
+	/* Methods: */
+	Buffer* acquire(size_t messageSize); // Returns a rewound buffer able to hold a message of the given size
+	Buffer* acquire(IO::File& source,size_t messageSize); // Returns a buffer containing a message of the given size read from the given source, with the source's endianness
+	void release(Buffer* buffer); // Returns a buffer to the pool
+	Statistics getStatistics(void); // Returns the current pool statistics
+	};
+
+}
+
+#endif
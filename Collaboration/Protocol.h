@@ -24,6 +24,7 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #ifndef COLLABORATION_PROTOCOL_INCLUDED
 #define COLLABORATION_PROTOCOL_INCLUDED
 
+#include <stddef.h>
 #include <Misc/SizedTypes.h>
 #include <Misc/StandardMarshallers.h>
 #include <IO/File.h>
@@ -36,6 +37,53 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 namespace Collaboration {
 
+template <class ValueParam>
+struct ScalarArrayLayout; // Traits class describing value types that are stored in memory as a packed array of scalar components; undefined for other types
+
+template <>
+struct ScalarArrayLayout<Misc::Float32>
+	{
+	/* Embedded classes: */
+	public:
+	typedef Misc::Float32 Component; // Type of the value's components
+	
+	/* Elements: */
+	static const size_t numComponents=1; // Number of components per value
+	};
+
+template <>
+struct ScalarArrayLayout<Geometry::Point<Misc::Float32,3> >
+	{
+	/* Embedded classes: */
+	public:
+	typedef Misc::Float32 Component;
+	
+	/* Elements: */
+	static const size_t numComponents=3; // Point components
+	};
+
+template <>
+struct ScalarArrayLayout<Geometry::Vector<Misc::Float32,3> >
+	{
+	/* Embedded classes: */
+	public:
+	typedef Misc::Float32 Component;
+	
+	/* Elements: */
+	static const size_t numComponents=3; // Vector components
+	};
+
+template <>
+struct ScalarArrayLayout<Geometry::OrthonormalTransformation<Misc::Float32,3> >
+	{
+	/* Embedded classes: */
+	public:
+	typedef Misc::Float32 Component;
+	
+	/* Elements: */
+	static const size_t numComponents=3+4; // Translation vector followed by rotation quaternion, same as the marshaller's order
+	};
+
 class Protocol
 	{
 	/* Embedded classes: */
@@ -59,6 +107,39 @@ class Protocol
 		{
 		sink.write<MessageIdType>(messageId);
 		}
+	static size_t getVarCardSize(Card value) // Returns the number of bytes used by the variable-length encoding of the given cardinal number
+		{
+		size_t result=1;
+		while(value>=0x80U)
+			{
+			value>>=7;
+			++result;
+			}
+		return result;
+		}
+	static Card readVarCard(IO::File& source) // Reads a cardinal number in variable-length encoding, seven bits per byte, from the given source
+		{
+		Card result=0;
+		int shift=0;
+		Byte b;
+		do
+			{
+			b=source.read<Byte>();
+			result|=Card(b&0x7fU)<<shift;
+			shift+=7;
+			}
+		while((b&0x80U)!=0x0U&&shift<35);
+		return result;
+		}
+	static void writeVarCard(Card value,IO::File& sink) // Writes a cardinal number in variable-length encoding to the given sink
+		{
+		while(value>=0x80U)
+			{
+			sink.write<Byte>(Byte(value&0x7fU)|0x80U);
+			value>>=7;
+			}
+		sink.write<Byte>(Byte(value));
+		}
 	template <class ValueParam>
 	static ValueParam read(IO::File& source) // Reads a value from the given source
 		{
@@ -74,6 +155,46 @@ class Protocol
 		{
 		Misc::Marshaller<ValueParam>::write(value,sink);
 		}
+	template <class ValueParam>
+	static void readArray(ValueParam* values,size_t numValues,IO::File& source) // Reads an array of values with a packed scalar layout directly into the given storage
+		{
+		typedef ScalarArrayLayout<ValueParam> Layout;
+		
+		/* Refuse to compile if the value type contains anything but its packed components: */
+		typedef char LayoutCheck[sizeof(ValueParam)==Layout::numComponents*sizeof(typename Layout::Component)?1:-1];
+		(void)sizeof(LayoutCheck);
+		
+		if(source.mustSwapOnRead())
+			{
+			/* Read the array as components and let the source swap them: */
+			source.read(reinterpret_cast<typename Layout::Component*>(values),numValues*Layout::numComponents);
+			}
+		else
+			{
+			/* Copy the entire array in one go: */
+			source.readRaw(values,numValues*sizeof(ValueParam));
+			}
+		}
+	template <class ValueParam>
+	static void writeArray(const ValueParam* values,size_t numValues,IO::File& sink) // Writes an array of values with a packed scalar layout directly from the given storage
+		{
+		typedef ScalarArrayLayout<ValueParam> Layout;
+		
+		/* Refuse to compile if the value type contains anything but its packed components: */
+		typedef char LayoutCheck[sizeof(ValueParam)==Layout::numComponents*sizeof(typename Layout::Component)?1:-1];
+		(void)sizeof(LayoutCheck);
+		
+		if(sink.mustSwapOnWrite())
+			{
+			/* Write the array as components and let the sink swap them: */
+			sink.write(reinterpret_cast<const typename Layout::Component*>(values),numValues*Layout::numComponents);
+			}
+		else
+			{
+			/* Copy the entire array in one go: */
+			sink.writeRaw(values,numValues*sizeof(ValueParam));
+			}
+		}
 	};
 
 }
@@ -0,0 +1,392 @@
+/***********************************************************************
+ProtocolSchema - Templates to declare the fields of protocol state
+structures, their update mask groups, their wire encodings, and their
+change tolerances once, and generate matching encoders, decoders, size
+computations, change detection, and copy operations from the
+declaration.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+A schema is a list of up to 16 field descriptors, each of which binds a
+member of a state structure to an update mask group and a wire
+encoding. Fields are encoded in declaration order, and only if their
+group's bit is set in the update mask, e.g.:
+
+typedef Schema<SchemaField<State,Scalar,&State::size,State::SIZE>,
+               SchemaField<State,Point,&State::center,State::CENTER> > StateSchema;
+
+StateSchema::write(mask,state,sink) then writes the size and/or center
+depending on mask, StateSchema::read(mask,state,source) reads them back,
+StateSchema::getSize(mask,state) returns the number of bytes written,
+and StateSchema::copy(mask,dest,source) copies them between structures.
+StateSchema::diff(sent,current,deadBand,stale) returns the mask of all
+groups containing at least one field whose change must be sent.
+
+Encodings are classes with static getSize, read, and write methods.
+Changing the wire precision of a field, e.g., to quantize it, only
+requires replacing its encoding. Comparisons are classes with a static
+changed method deciding whether a change must be sent; fields compare
+exactly by default, and tracked fields can compare against the
+tolerances of a dead band instead.
+***********************************************************************/
+
+#ifndef COLLABORATION_PROTOCOLSCHEMA_INCLUDED
+#define COLLABORATION_PROTOCOLSCHEMA_INCLUDED
+
+#include <stddef.h>
+#include <Misc/StandardMarshallers.h>
+#include <IO/File.h>
+#include <Collaboration/Protocol.h>
+#include <Collaboration/DeadBand.h>
+
+namespace Collaboration {
+
+/*****************************
+Wire encodings for field values:
+*****************************/
+
+template <class ValueParam>
+class NativeEncoding // Transmits values using their standard marshallers
+	{
+	/* Embedded classes: */
+	public:
+	typedef ValueParam Value; // In-memory type of encoded values
+	
+	/* Methods: */
+	static size_t getSize(const Value& value)
+		{
+		return Misc::Marshaller<Value>::getSize(value);
+		}
+	static void read(Value& value,IO::File& source)
+		{
+		value=Misc::Marshaller<Value>::read(source);
+		}
+	static void write(const Value& value,IO::File& sink)
+		{
+		Misc::Marshaller<Value>::write(value,sink);
+		}
+	};
+
+template <class ValueParam,class WireParam>
+class CastEncoding // Transmits scalar values after conversion to a different wire type
+	{
+	/* Embedded classes: */
+	public:
+	typedef ValueParam Value; // In-memory type of encoded values
+	typedef WireParam Wire; // Type of values on the wire
+	
+	/* Methods: */
+	static size_t getSize(const Value& value)
+		{
+		return sizeof(Wire);
+		}
+	static void read(Value& value,IO::File& source)
+		{
+		value=Value(source.read<Wire>());
+		}
+	static void write(const Value& value,IO::File& sink)
+		{
+		sink.write<Wire>(Wire(value));
+		}
+	};
+
+/***************************
+Comparisons of field values:
+***************************/
+
+template <class ValueParam>
+class ExactComparison // Reports every change in a value
+	{
+	/* Embedded classes: */
+	public:
+	typedef ValueParam Value; // Type of compared values
+	
+	/* Methods: */
+	static bool changed(const Value& sent,const Value& current,const DeadBand& deadBand,bool stale) // Returns true if the change from the sent to the current value must be sent
+		{
+		return sent!=current;
+		}
+	};
+
+class TransformComparison // Reports changes in position or orientation exceeding the tolerances of a dead band
+	{
+	/* Embedded classes: */
+	public:
+	typedef Protocol::ONTransform Value;
+	
+	/* Methods: */
+	static bool changed(const Value& sent,const Value& current,const DeadBand& deadBand,bool stale)
+		{
+		return deadBand.changed(sent,current,stale);
+		}
+	};
+
+/*****************
+Field descriptors:
+*****************/
+
+template <class StructParam,class ValueParam,ValueParam StructParam::* memberParam,unsigned int groupParam,class EncodingParam =NativeEncoding<ValueParam>,class ComparisonParam =ExactComparison<ValueParam> >
+class SchemaField // Field descriptor for a single value
+	{
+	/* Embedded classes: */
+	public:
+	typedef StructParam Struct; // Type of state structure containing the field
+	
+	/* Methods: */
+	static size_t getSize(unsigned int mask,const Struct& s)
+		{
+		return (mask&groupParam)?EncodingParam::getSize(s.*memberParam):0;
+		}
+	static void read(unsigned int mask,Struct& s,IO::File& source)
+		{
+		if(mask&groupParam)
+			EncodingParam::read(s.*memberParam,source);
+		}
+	static void write(unsigned int mask,const Struct& s,IO::File& sink)
+		{
+		if(mask&groupParam)
+			EncodingParam::write(s.*memberParam,sink);
+		}
+	static unsigned int diff(const Struct& sent,const Struct& current,const DeadBand& deadBand,bool stale)
+		{
+		return ComparisonParam::changed(sent.*memberParam,current.*memberParam,deadBand,stale)?groupParam:0U;
+		}
+	static void copy(unsigned int mask,Struct& dest,const Struct& source)
+		{
+		if(mask&groupParam)
+			dest.*memberParam=source.*memberParam;
+		}
+	};
+
+template <class StructParam,class ElementParam,ElementParam* StructParam::* arrayParam,unsigned int StructParam::* sizeParam,unsigned int groupParam,class ComparisonParam =ExactComparison<ElementParam> >
+class SchemaArrayField // Field descriptor for a pre-allocated array of packed values whose size is stored in another field
+	{
+	/* Embedded classes: */
+	public:
+	typedef StructParam Struct;
+	
+	/* Methods: */
+	static size_t getSize(unsigned int mask,const Struct& s)
+		{
+		return (mask&groupParam)?size_t(s.*sizeParam)*sizeof(ElementParam):0;
+		}
+	static void read(unsigned int mask,Struct& s,IO::File& source)
+		{
+		if(mask&groupParam)
+			Protocol::readArray(s.*arrayParam,s.*sizeParam,source);
+		}
+	static void write(unsigned int mask,const Struct& s,IO::File& sink)
+		{
+		if(mask&groupParam)
+			Protocol::writeArray(s.*arrayParam,s.*sizeParam,sink);
+		}
+	static unsigned int diff(const Struct& sent,const Struct& current,const DeadBand& deadBand,bool stale)
+		{
+		if(sent.*sizeParam!=current.*sizeParam)
+			return groupParam;
+		const ElementParam* a1=sent.*arrayParam;
+		const ElementParam* a2=current.*arrayParam;
+		for(unsigned int i=0;i<sent.*sizeParam;++i)
+			if(ComparisonParam::changed(a1[i],a2[i],deadBand,stale))
+				return groupParam;
+		return 0U;
+		}
+	static void copy(unsigned int mask,Struct& dest,const Struct& source)
+		{
+		if(mask&groupParam)
+			{
+			ElementParam* d=dest.*arrayParam;
+			const ElementParam* s=source.*arrayParam;
+			for(unsigned int i=0;i<dest.*sizeParam;++i)
+				d[i]=s[i];
+			}
+		}
+	};
+
+template <class StructParam,Protocol::Byte* StructParam::* arrayParam,unsigned int StructParam::* numBitsParam,unsigned int groupParam>
+class SchemaBitArrayField // Field descriptor for a pre-allocated array of bits whose size in bits is stored in another field
+	{
+	/* Embedded classes: */
+	public:
+	typedef StructParam Struct;
+	
+	/* Private methods: */
+	private:
+	static size_t getNumBytes(const Struct& s)
+		{
+		return (size_t(s.*numBitsParam)+7)/8;
+		}
+	
+	/* Methods: */
+	public:
+	static size_t getSize(unsigned int mask,const Struct& s)
+		{
+		return (mask&groupParam)?getNumBytes(s):0;
+		}
+	static void read(unsigned int mask,Struct& s,IO::File& source)
+		{
+		if(mask&groupParam)
+			source.read(s.*arrayParam,getNumBytes(s));
+		}
+	static void write(unsigned int mask,const Struct& s,IO::File& sink)
+		{
+		if(mask&groupParam)
+			sink.write(s.*arrayParam,getNumBytes(s));
+		}
+	static unsigned int diff(const Struct& sent,const Struct& current,const DeadBand& deadBand,bool stale)
+		{
+		if(sent.*numBitsParam!=current.*numBitsParam)
+			return groupParam;
+		size_t numBytes=getNumBytes(sent);
+		const Protocol::Byte* a1=sent.*arrayParam;
+		const Protocol::Byte* a2=current.*arrayParam;
+		for(size_t i=0;i<numBytes;++i)
+			if(a1[i]!=a2[i])
+				return groupParam;
+		return 0U;
+		}
+	static void copy(unsigned int mask,Struct& dest,const Struct& source)
+		{
+		if(mask&groupParam)
+			{
+			size_t numBytes=getNumBytes(dest);
+			for(size_t i=0;i<numBytes;++i)
+				(dest.*arrayParam)[i]=(source.*arrayParam)[i];
+			}
+		}
+	};
+
+template <class StructParam,class CodecParam,unsigned int groupParam>
+class SchemaCustomField // Field descriptor delegating to a codec class whose static getSize, read, write, changed, and copy methods operate on the entire state structure
+	{
+	/* Embedded classes: */
+	public:
+	typedef StructParam Struct;
+	
+	/* Methods: */
+	static size_t getSize(unsigned int mask,const Struct& s)
+		{
+		return (mask&groupParam)?CodecParam::getSize(s):0;
+		}
+	static void read(unsigned int mask,Struct& s,IO::File& source)
+		{
+		if(mask&groupParam)
+			CodecParam::read(s,source);
+		}
+	static void write(unsigned int mask,const Struct& s,IO::File& sink)
+		{
+		if(mask&groupParam)
+			CodecParam::write(s,sink);
+		}
+	static unsigned int diff(const Struct& sent,const Struct& current,const DeadBand& deadBand,bool stale)
+		{
+		return CodecParam::changed(sent,current)?groupParam:0U;
+		}
+	static void copy(unsigned int mask,Struct& dest,const Struct& source)
+		{
+		if(mask&groupParam)
+			CodecParam::copy(dest,source);
+		}
+	};
+
+/*******
+Schemas:
+*******/
+
+class SchemaEnd // Placeholder for unused field slots in a schema
+	{
+	};
+
+template <class F0,class F1 =SchemaEnd,class F2 =SchemaEnd,class F3 =SchemaEnd,
+          class F4 =SchemaEnd,class F5 =SchemaEnd,class F6 =SchemaEnd,class F7 =SchemaEnd,
+          class F8 =SchemaEnd,class F9 =SchemaEnd,class F10 =SchemaEnd,class F11 =SchemaEnd,
+          class F12 =SchemaEnd,class F13 =SchemaEnd,class F14 =SchemaEnd,class F15 =SchemaEnd>
+class Schema // Class for lists of field descriptors
+	{
+	/* Embedded classes: */
+	private:
+	typedef Schema<F1,F2,F3,F4,F5,F6,F7,F8,F9,F10,F11,F12,F13,F14,F15> Tail; // Schema containing all but the first field
+	
+	/* Methods: */
+	public:
+	template <class StructParam>
+	static size_t getSize(unsigned int mask,const StructParam& s) // Returns the number of bytes written for the given update mask
+		{
+		return F0::getSize(mask,s)+Tail::getSize(mask,s);
+		}
+	template <class StructParam>
+	static void read(unsigned int mask,StructParam& s,IO::File& source) // Reads all fields selected by the given update mask
+		{
+		F0::read(mask,s,source);
+		Tail::read(mask,s,source);
+		}
+	template <class StructParam>
+	static void write(unsigned int mask,const StructParam& s,IO::File& sink) // Writes all fields selected by the given update mask
+		{
+		F0::write(mask,s,sink);
+		Tail::write(mask,s,sink);
+		}
+	template <class StructParam>
+	static unsigned int diff(const StructParam& sent,const StructParam& current,const DeadBand& deadBand,bool stale) // Returns the update mask of all groups containing fields whose change from the sent to the current structure must be sent
+		{
+		return F0::diff(sent,current,deadBand,stale)|Tail::diff(sent,current,deadBand,stale);
+		}
+	template <class StructParam>
+	static void copy(unsigned int mask,StructParam& dest,const StructParam& source) // Copies all fields selected by the given update mask
+		{
+		F0::copy(mask,dest,source);
+		Tail::copy(mask,dest,source);
+		}
+	};
+
+template <>
+class Schema<SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,
+             SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd,SchemaEnd> // Empty schema terminating the field list
+	{
+	/* Methods: */
+	public:
+	template <class StructParam>
+	static size_t getSize(unsigned int mask,const StructParam& s)
+		{
+		return 0;
+		}
+	template <class StructParam>
+	static void read(unsigned int mask,StructParam& s,IO::File& source)
+		{
+		}
+	template <class StructParam>
+	static void write(unsigned int mask,const StructParam& s,IO::File& sink)
+		{
+		}
+	template <class StructParam>
+	static unsigned int diff(const StructParam& sent,const StructParam& current,const DeadBand& deadBand,bool stale)
+		{
+		return 0U;
+		}
+	template <class StructParam>
+	static void copy(unsigned int mask,StructParam& dest,const StructParam& source)
+		{
+		}
+	};
+
+}
+
+#endif
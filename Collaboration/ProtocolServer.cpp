@@ -25,13 +25,60 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 
 #include <Collaboration/ProtocolServer.h>
 
+#include <stdexcept>
+#include <Misc/Autopointer.h>
+#include <Collaboration/BufferedPipe.h>
+
 namespace Collaboration {
 
+namespace {
+
+/**************
+Helper classes:
+**************/
+
+class MarshalledConnectSnapshot:public ProtocolServer::ConnectSnapshot // Class for snapshots holding a client connect payload that was marshalled while the source client was locked
+	{
+	/* Elements: */
+	private:
+	Misc::Autopointer<BufferedPipe> payload; // Pipe collecting the marshalled payload
+	
+	/* Constructors and destructors: */
+	public:
+	MarshalledConnectSnapshot(Comm::NetPipe& pipe) // Creates an empty snapshot to be written to the given pipe
+		:payload(new BufferedPipe(&pipe))
+		{
+		}
+	
+	/* Methods from ProtocolServer::ConnectSnapshot: */
+	virtual void write(Comm::NetPipe& pipe)
+		{
+		payload->writeToSink(pipe);
+		}
+	
+	/* New methods: */
+	BufferedPipe& getPayload(void) // Returns the pipe collecting the marshalled payload
+		{
+		return *payload;
+		}
+	};
+
+}
+
+/************************************************
+Methods of class ProtocolServer::ConnectSnapshot:
+************************************************/
+
+ProtocolServer::ConnectSnapshot::~ConnectSnapshot(void)
+	{
+	}
+
 /********************************************
 Methods of class ProtocolServer::ClientState:
 ********************************************/
 
 ProtocolServer::ClientState::ClientState(void)
+	:arena(0),spectator(false)
 	{
 	}
 
@@ -64,6 +111,12 @@ void ProtocolServer::initialize(CollaborationServer* sServer,Misc::Configuration
 	server=sServer;
 	}
 
+bool ProtocolServer::canShareSpectatorUpdates(void) const
+	{
+	/* Default is to assume that the protocol keeps state about individual destination clients: */
+	return false;
+	}
+
 ProtocolServer::ClientState* ProtocolServer::receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe)
 	{
 	/* Reject the connection: */
@@ -94,6 +147,41 @@ void ProtocolServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,Pro
 	{
 	}
 
+void ProtocolServer::sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::UpdateDestination* destinations,unsigned int numDestinations)
+	{
+	/* Send the source client's connection message to each destination client individually: */
+	for(UpdateDestination* dIt=destinations;dIt!=destinations+numDestinations;++dIt)
+		{
+		try
+			{
+			sendClientConnect(sourceCs,dIt->destCs,*dIt->pipe);
+			}
+		catch(std::runtime_error err)
+			{
+			/* Flag the destination as failed and carry on with the others: */
+			dIt->failed=true;
+			dIt->error=err.what();
+			}
+		}
+	}
+
+ProtocolServer::ConnectSnapshot* ProtocolServer::captureClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+	{
+	/* Marshal the source client's connection message payload into a buffer while the source client is locked: */
+	MarshalledConnectSnapshot* result=new MarshalledConnectSnapshot(pipe);
+	try
+		{
+		sendClientConnect(sourceCs,destCs,result->getPayload());
+		}
+	catch(...)
+		{
+		delete result;
+		throw;
+		}
+	
+	return result;
+	}
+
 void ProtocolServer::sendServerUpdate(ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
 	{
 	}
@@ -102,6 +190,24 @@ void ProtocolServer::sendServerUpdate(ProtocolServer::ClientState* sourceCs,Prot
 	{
 	}
 
+void ProtocolServer::sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::UpdateDestination* destinations,unsigned int numDestinations)
+	{
+	/* Send the source client's state update to each destination client individually: */
+	for(UpdateDestination* dIt=destinations;dIt!=destinations+numDestinations;++dIt)
+		{
+		try
+			{
+			sendServerUpdate(sourceCs,dIt->destCs,*dIt->pipe);
+			}
+		catch(std::runtime_error err)
+			{
+			/* Flag the destination as failed and carry on with the others: */
+			dIt->failed=true;
+			dIt->error=err.what();
+			}
+		}
+	}
+
 bool ProtocolServer::handleMessage(ProtocolServer::ClientState* cs,unsigned int messageId,Comm::NetPipe& pipe)
 	{
 	/* Default is to reject all messages: */
@@ -26,6 +26,8 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #ifndef COLLABORATION_PROTOCOLSERVER_INCLUDED
 #define COLLABORATION_PROTOCOLSERVER_INCLUDED
 
+#include <string>
+
 /* Forward declarations: */
 namespace Misc {
 class ConfigurationFileSection;
@@ -38,6 +40,7 @@ namespace Comm {
 class NetPipe;
 }
 namespace Collaboration {
+class Arena;
 class CollaborationServer;
 }
 
@@ -48,13 +51,57 @@ class ProtocolServer
 	friend class CollaborationServer;
 	
 	/* Embedded classes: */
+	public:
+	class ConnectSnapshot // Base class for snapshots of a client's protocol state, captured for a newly connecting client and written to it after all locks have been released
+		{
+		/* Constructors and destructors: */
+		public:
+		virtual ~ConnectSnapshot(void);
+		
+		/* Methods: */
+		virtual void write(Comm::NetPipe& pipe) =0; // Writes the captured state to the given pipe as the protocol's client connect payload
+		};
+	
 	protected:
 	class ClientState // Class representing server-side state of a connected client
 		{
+		friend class CollaborationServer;
+		
+		/* Elements: */
+		private:
+		Arena* arena; // Memory arena of the client's connection; set by the server right after the state is created
+		bool spectator; // Flag if the client is a passive spectator, whose client updates never reach the protocol plug-in; set by the server right after the state is created
+		
 		/* Constructors and destructors: */
 		public:
 		ClientState(void);
 		virtual ~ClientState(void);
+		
+		/* Methods: */
+		Arena& getArena(void) const // Returns the memory arena from which all of the client's protocol state is allocated
+			{
+			return *arena;
+			}
+		bool isSpectator(void) const // Returns true if the client is a passive spectator
+			{
+			return spectator;
+			}
+		};
+	
+	struct UpdateDestination // Structure describing one destination client of a batched server update
+		{
+		/* Elements: */
+		public:
+		ClientState* destCs; // Protocol-specific state of the destination client
+		Comm::NetPipe* pipe; // Communication pipe to the destination client
+		bool failed; // Flag set by the protocol if sending to the destination client failed
+		std::string error; // Description of the error that caused the destination to fail
+		
+		/* Constructors and destructors: */
+		UpdateDestination(ClientState* sDestCs,Comm::NetPipe* sPipe)
+			:destCs(sDestCs),pipe(sPipe),failed(false)
+			{
+			}
 		};
 	
 	/* Elements: */
@@ -75,11 +122,23 @@ class ProtocolServer
 	virtual const char* getName(void) const =0; // Returns the protocol's (hopefully unique) name
 	virtual unsigned int getNumMessages(void) const; // Returns the number of protocol messages used by this protocol
 	virtual void initialize(CollaborationServer* sServer,Misc::ConfigurationFileSection& configFileSection); // Called when the protocol server is registered with a collaboration server
+	virtual bool canShareSpectatorUpdates(void) const; // Returns true if spectators sharing the protocol can receive one common server update stream; default is false
 	
 	/***********************************
 	Server protocol engine hook methods:
 	***********************************/
 	
+	/*********************************************************************
+	The server assembles the server update stream for a group of
+	spectators that negotiated the same protocols only once, calling the
+	per-destination hooks with the protocol states of the group's first
+	member, and copies the stream to all other members. Protocols that
+	tailor their payloads to, or keep state about, individual destination
+	clients, such as the components last sent to each destination, must
+	return false from canShareSpectatorUpdates, which makes the server
+	assemble a separate stream for each spectator using the protocol.
+	*********************************************************************/
+	
 	/* Hooks to add payloads to lower-level protocol messages: */
 	virtual ClientState* receiveConnectRequest(unsigned int protocolMessageLength,Comm::NetPipe& pipe); // Hook called when the server receives a client's connection request; serrver rejects the request if the method returns 0
 	virtual void sendConnectReply(ClientState* cs,Comm::NetPipe& pipe); // Hook called when the server replies to a client's connection request
@@ -88,8 +147,11 @@ class ProtocolServer
 	virtual void sendDisconnectReply(ClientState* cs,Comm::NetPipe& pipe); // Hook called when the server sends a disconnect reply to a client
 	virtual void receiveClientUpdate(ClientState* cs,Comm::NetPipe& pipe); // Hook called when the server receives a client's state update packet
 	virtual void sendClientConnect(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe); // Hook called when the server sends a connection message for client sourceClient to client destClient
+	virtual void sendClientConnect(ClientState* sourceCs,UpdateDestination* destinations,unsigned int numDestinations); // Hook called when the server sends connection messages for newly connected client sourceClient to all destination clients sharing the protocol; must not throw, but flag failed destinations instead
+	virtual ConnectSnapshot* captureClientConnect(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe); // Hook called while the server holds client sourceClient's lock to capture the payload of its connection message for newly connecting client destClient, which is written to the given pipe after all locks have been released; the snapshot must not refer to the source client's state; default marshals the payload via sendClientConnect
 	virtual void sendServerUpdate(ClientState* destCs,Comm::NetPipe& pipe); // Hook called when the server sends a state update to a client
 	virtual void sendServerUpdate(ClientState* sourceCs,ClientState* destCs,Comm::NetPipe& pipe); // Hook called when the server sends a state update for client sourceClient to client destClient
+	virtual void sendServerUpdate(ClientState* sourceCs,UpdateDestination* destinations,unsigned int numDestinations); // Hook called when the server sends a state update for client sourceClient to all destination clients sharing the protocol; must not throw, but flag failed destinations instead
 	
 	/* Hooks to insert processing into the lower-level protocol state machine: */
 	virtual bool handleMessage(ClientState* cs,unsigned int messageId,Comm::NetPipe& pipe); // Hook called when server receives unknown message from client; returns false to signal protocol error
@@ -0,0 +1,160 @@
+/***********************************************************************
+ProtocolServerT - Base class template for protocol plug-ins that
+dispatches the per-client and per-client-pair server hooks statically
+to typed methods of the derived protocol plug-in class.
+Copyright (c) 2018 Oliver Kreylos
+
+This file is part of the Vrui remote collaboration infrastructure.
+
+The Vrui remote collaboration infrastructure is free software; you can
+redistribute it and/or modify it under the terms of the GNU General
+Public License as published by the Free Software Foundation; either
+version 2 of the License, or (at your option) any later version.
+
+The Vrui remote collaboration infrastructure is distributed in the hope
+that it will be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Vrui remote collaboration infrastructure; if not, write to the
+Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+02111-1307 USA
+***********************************************************************/
+
+/***********************************************************************
+Usage: A protocol plug-in derives from ProtocolServerT<Plugin>, where
+Plugin::ClientState is its client state class derived from
+ProtocolServer::ClientState, and declares ProtocolServerT<Plugin> a
+friend. It then implements any of the statically dispatched hooks
+below as non-virtual methods taking Plugin::ClientState pointers;
+hooks it does not implement default to no-ops. All other hooks, and the
+per-destination overloads of sendServerUpdate and beforeServerUpdate,
+remain regular virtual methods. The batched overloads of
+sendClientConnect and sendServerUpdate can be overridden to encode a
+source client's payload once for all destinations.
+
+The collaboration server only ever passes client state objects to a
+protocol plug-in that were created by the same plug-in's
+receiveConnectRequest method, i.e., the type of a client state object is
+established once, when it is created. All typed hooks are hence reached
+via static casts, without run-time type checks.
+***********************************************************************/
+
+#ifndef COLLABORATION_PROTOCOLSERVERT_INCLUDED
+#define COLLABORATION_PROTOCOLSERVERT_INCLUDED
+
+#include <stdexcept>
+#include <Collaboration/ProtocolServer.h>
+
+namespace Collaboration {
+
+template <class DerivedParam>
+class ProtocolServerT:public ProtocolServer
+	{
+	/* Embedded classes: */
+	public:
+	typedef DerivedParam Derived; // Type of the derived protocol plug-in class
+	
+	/* Protected methods: */
+	protected:
+	Derived* derived(void) // Returns the derived protocol plug-in object
+		{
+		return static_cast<Derived*>(this);
+		}
+	template <class ClientStateParam>
+	static ClientStateParam* cast(ProtocolServer::ClientState* cs) // Converts a generic client state into the derived plug-in's client state
+		{
+		return static_cast<ClientStateParam*>(cs);
+		}
+	
+	/* Default implementations of the statically dispatched hooks: */
+	template <class ClientStateParam>
+	void receiveClientUpdate(ClientStateParam* cs,Comm::NetPipe& pipe)
+		{
+		}
+	template <class ClientStateParam>
+	void sendClientConnect(ClientStateParam* sourceCs,ClientStateParam* destCs,Comm::NetPipe& pipe)
+		{
+		}
+	template <class ClientStateParam>
+	void sendServerUpdate(ClientStateParam* sourceCs,ClientStateParam* destCs,Comm::NetPipe& pipe)
+		{
+		}
+	template <class ClientStateParam>
+	void beforeServerUpdate(ClientStateParam* cs)
+		{
+		}
+	template <class ClientStateParam>
+	void afterServerUpdate(ClientStateParam* cs)
+		{
+		}
+	
+	/* Methods from ProtocolServer: */
+	public:
+	using ProtocolServer::sendServerUpdate;
+	using ProtocolServer::beforeServerUpdate;
+	using ProtocolServer::afterServerUpdate;
+	virtual void receiveClientUpdate(ProtocolServer::ClientState* cs,Comm::NetPipe& pipe)
+		{
+		derived()->receiveClientUpdate(cast<typename Derived::ClientState>(cs),pipe);
+		}
+	virtual void sendClientConnect(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+		{
+		derived()->sendClientConnect(cast<typename Derived::ClientState>(sourceCs),cast<typename Derived::ClientState>(destCs),pipe);
+		}
+	virtual void sendClientConnect(ProtocolServer::ClientState* sourceCs,UpdateDestination* destinations,unsigned int numDestinations)
+		{
+		/* Send the source client's connection message to all destination clients without going through the virtual per-pair hook: */
+		Derived* d=derived();
+		typename Derived::ClientState* mySourceCs=cast<typename Derived::ClientState>(sourceCs);
+		for(UpdateDestination* dIt=destinations;dIt!=destinations+numDestinations;++dIt)
+			{
+			try
+				{
+				d->sendClientConnect(mySourceCs,cast<typename Derived::ClientState>(dIt->destCs),*dIt->pipe);
+				}
+			catch(std::runtime_error err)
+				{
+				/* Flag the destination as failed and carry on with the others: */
+				dIt->failed=true;
+				dIt->error=err.what();
+				}
+			}
+		}
+	virtual void sendServerUpdate(ProtocolServer::ClientState* sourceCs,ProtocolServer::ClientState* destCs,Comm::NetPipe& pipe)
+		{
+		derived()->sendServerUpdate(cast<typename Derived::ClientState>(sourceCs),cast<typename Derived::ClientState>(destCs),pipe);
+		}
+	virtual void sendServerUpdate(ProtocolServer::ClientState* sourceCs,UpdateDestination* destinations,unsigned int numDestinations)
+		{
+		/* Send the source client's state update to all destination clients without going through the virtual per-pair hook: */
+		Derived* d=derived();
+		typename Derived::ClientState* mySourceCs=cast<typename Derived::ClientState>(sourceCs);
+		for(UpdateDestination* dIt=destinations;dIt!=destinations+numDestinations;++dIt)
+			{
+			try
+				{
+				d->sendServerUpdate(mySourceCs,cast<typename Derived::ClientState>(dIt->destCs),*dIt->pipe);
+				}
+			catch(std::runtime_error err)
+				{
+				/* Flag the destination as failed and carry on with the others: */
+				dIt->failed=true;
+				dIt->error=err.what();
+				}
+			}
+		}
+	virtual void beforeServerUpdate(ProtocolServer::ClientState* cs)
+		{
+		derived()->beforeServerUpdate(cast<typename Derived::ClientState>(cs));
+		}
+	virtual void afterServerUpdate(ProtocolServer::ClientState* cs)
+		{
+		derived()->afterServerUpdate(cast<typename Derived::ClientState>(cs));
+		}
+	};
+
+}
+
+#endif
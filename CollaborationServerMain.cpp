@@ -28,6 +28,7 @@ Free Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
 #include <Misc/Time.h>
 
 #include <Collaboration/CollaborationServer.h>
+#include <Collaboration/CollaborationRoomServer.h>
 
 volatile bool runServerLoop=true;
 
@@ -36,6 +37,34 @@ void termSignalHandler(int)
 	runServerLoop=false;
 	}
 
+template <class ServerParam>
+void runServer(ServerParam& server,const Misc::Time& tickTime)
+	{
+	/* Reroute SIG_INT signals to cleanly shut down multiplexer: */
+	struct sigaction sigIntAction;
+	memset(&sigIntAction,0,sizeof(struct sigaction));
+	sigIntAction.sa_handler=termSignalHandler;
+	if(sigaction(SIGINT,&sigIntAction,0)!=0)
+		std::cerr<<"CollaborationServerMain: Cannot intercept SIG_INT signals. Server won't shut down cleanly."<<std::endl;
+	
+	/* Run the server loop at the specified time interval: */
+	Misc::Time nextTick=Misc::Time::now();
+	int i=0;
+	while(runServerLoop)
+		{
+		/* Sleep for the tick time: */
+		nextTick+=tickTime;
+		Misc::Time sleepTime=nextTick-Misc::Time::now();
+		if(sleepTime.tv_sec>=0)
+			Misc::sleep(sleepTime);
+		
+		/* Update the server state: */
+		server.update();
+		std::cout<<'\r'<<char('0'+i%10)<<std::flush;
+		++i;
+		}
+	}
+
 int main(int argc,char* argv[])
 	{
 	try
@@ -45,6 +74,7 @@ int main(int argc,char* argv[])
 		
 		/* Parse the command line: */
 		Misc::Time tickTime(cfg->getTickTime()); // Server update time interval in seconds
+		bool enableRooms=cfg->getEnableRooms(); // Flag whether to run several independent rooms
 		for(int i=1;i<argc;++i)
 			{
 			if(argv[i][0]=='-')
@@ -68,6 +98,8 @@ int main(int argc,char* argv[])
 					else
 						std::cerr<<"CollaborationServerMain: ignored dangling -tick option"<<std::endl;
 					}
+				else if(strcasecmp(argv[i]+1,"rooms")==0)
+					enableRooms=true;
 				}
 			}
 		
@@ -78,33 +110,23 @@ int main(int argc,char* argv[])
 		sigPipeAction.sa_flags=0x0;
 		sigaction(SIGPIPE,&sigPipeAction,0);
 		
-		/* Create the collaboration server object: */
-		Collaboration::CollaborationServer server(cfg.getTarget());
-		cfg.releaseTarget();
-		std::cout<<"CollaborationServerMain: Started server on port "<<server.getListenPortId()<<std::endl;
-		
-		/* Reroute SIG_INT signals to cleanly shut down multiplexer: */
-		struct sigaction sigIntAction;
-		memset(&sigIntAction,0,sizeof(struct sigaction));
-		sigIntAction.sa_handler=termSignalHandler;
-		if(sigaction(SIGINT,&sigIntAction,0)!=0)
-			std::cerr<<"CollaborationServerMain: Cannot intercept SIG_INT signals. Server won't shut down cleanly."<<std::endl;
-		
-		/* Run the server loop at the specified time interval: */
-		Misc::Time nextTick=Misc::Time::now();
-		int i=0;
-		while(runServerLoop)
+		if(enableRooms)
+			{
+			/* Create the collaboration room server object: */
+			Collaboration::CollaborationRoomServer server(cfg.getTarget());
+			cfg.releaseTarget();
+			std::cout<<"CollaborationServerMain: Started room server on port "<<server.getListenPortId()<<std::endl;
+			
+			runServer(server,tickTime);
+			}
+		else
 			{
-			/* Sleep for the tick time: */
-			nextTick+=tickTime;
-			Misc::Time sleepTime=nextTick-Misc::Time::now();
-			if(sleepTime.tv_sec>=0)
-				Misc::sleep(sleepTime);
+			/* Create the collaboration server object: */
+			Collaboration::CollaborationServer server(cfg.getTarget());
+			cfg.releaseTarget();
+			std::cout<<"CollaborationServerMain: Started server on port "<<server.getListenPortId()<<std::endl;
 			
-			/* Update the server state: */
-			server.update();
-			std::cout<<'\r'<<char('0'+i%10)<<std::flush;
-			++i;
+			runServer(server,tickTime);
 			}
 		}
 	catch(std::runtime_error err)